@@ -0,0 +1,1087 @@
+/***************************************************************************
+*
+*   Copyright(c) Jeff V. Merkey 1997-2022.  All rights reserved.
+*   Open CWorthy Look Alike Terminal Library.
+*
+*   CWBENCH interaction benchmark.  Drives menus, portals, error
+*   portals and forms through scripted key sequences and reports the
+*   per key latency and throughput, so builds can be compared without
+*   a human at the keyboard.
+*
+*   scenarios
+*      page    - page through a 1024 line portal with get_portal_resp
+*      error   - open and close error portals
+*      menu    - scroll a 128 item menu with activate_menu
+*      form    - type into a form with input_portal_fields
+*      refresh - page a portal while a provider rewrites it every tick
+*      saver   - let the screensaver run and wake it with a key
+*      notify  - flood the notification queue from worker threads
+*
+*   "cwbench all" is also the training workload for "make pgo".
+*
+*   "cwbench startup" launches cwbench count times and reports the
+*   time from exec until each one has drawn its first portal.
+*
+*   "cwbench wire" runs cwbench under a pseudo terminal it owns and
+*   counts every byte written to it, per interaction and per kind of
+*   escape sequence, for color, text, mono and unicode mode.  The
+*   counts do not depend on the speed of the machine, so they can be
+*   used as a regression gate for rendering changes.
+*
+****************************************************************************/
+
+#include "cworthy.h"
+#include <sys/wait.h>
+#include <poll.h>
+#include <pty.h>
+
+#define PAGE_LINES    1024
+#define MENU_ITEMS    128
+#define FORM_FIELDS   10
+#define FIELD_LEN     40
+#define REFRESH_LINES 64
+#define NOTIFY_THREADS 4
+#define STARTUP_RUNS  20
+#define WIRE_COUNT    16
+#define WIRE_ROWS     25
+#define WIRE_COLS     80
+
+typedef struct _SCENARIO
+{
+   const char *name;
+   ULONG (*run)(ULONG count);
+   const char *script;          // %lu is replaced with count
+   ULONG count;
+   int selected;
+   ULONG keys;
+   LONGLONG elapsed_ns;
+   CWLATENCY latency;
+   CWSTATS stats;
+} SCENARIO;
+
+ULONG run_page(ULONG count);
+ULONG run_error(ULONG count);
+ULONG run_menu(ULONG count);
+ULONG run_form(ULONG count);
+ULONG run_refresh(ULONG count);
+ULONG run_saver(ULONG count);
+ULONG run_notify(ULONG count);
+
+SCENARIO scenarios[] =
+{
+   { "page", run_page,
+     "repeat %lu\nkey DOWN 1023\nkey UP 1023\n"
+     "key PGDN 64\nkey PGUP 64\nend\nkey q\n", 2 },
+   { "error", run_error,
+     "key ENTER %lu\n", 1000 },
+   { "menu", run_menu,
+     "repeat %lu\nkey DOWN 127\nkey UP 127\nend\nkey q\n", 8 },
+   { "form", run_form,
+     "repeat %lu\ntext the quick brown fox\nkey BKSP 19\nkey DOWN\nend\n"
+     "key F5\n", 50 },
+   { "refresh", run_refresh,
+     "delay 1\nrepeat %lu\nkey DOWN 63\nkey UP 63\nend\nkey q\n", 4 },
+   { "saver", run_saver,
+     "repeat %lu\nsleep 2500\nkey SPACE\nend\n", 1 },
+   { "notify", run_notify,
+     "sleep 2000\nkey q\n", 1000 },
+   { NULL }
+};
+
+// wire benchmark.  The child marks the end of every frame from a
+// flush hook and waits until the parent has drained the terminal, so
+// each byte is charged to the interaction which wrote it.
+
+#define WIRE_SETUP    0
+#define WIRE_OPEN     1
+#define WIRE_PAGE     2
+#define WIRE_MOVE     3
+#define WIRE_STATS    4
+#define WIRE_CLOSE    5
+#define WIRE_SAVER    6
+#define WIRE_PHASES   7
+
+#define WIRE_FRAME    1
+#define WIRE_DONE     2
+
+#define WIRE_TEXT     0         // printable characters and UTF-8
+#define WIRE_CTRL     1         // CR, LF, BS and other C0 controls
+#define WIRE_CURSOR   2         // cursor positioning
+#define WIRE_SGR      3         // color and video attributes
+#define WIRE_EDIT     4         // erase, insert and delete
+#define WIRE_SCROLL   5         // scroll regions and index
+#define WIRE_CHARSET  6         // line drawing character set
+#define WIRE_OTHER    7
+#define WIRE_CLASSES  8
+
+typedef struct _WIRE_MSG
+{
+   int type;
+   int phase;
+   ULONG count;
+} WIRE_MSG;
+
+typedef struct _WIRE_PHASE
+{
+   ULONG interactions;
+   ULONG frames;
+   ULONG bytes;
+   ULONG bytes_max;
+   ULONG classes[WIRE_CLASSES];
+} WIRE_PHASE;
+
+typedef struct _WIRE_PARSER
+{
+   int state;
+   ULONG len;
+   ULONG classes[WIRE_CLASSES];
+} WIRE_PARSER;
+
+const char *wire_phase_names[WIRE_PHASES] =
+{
+   "setup", "open", "page", "move", "stats", "close", "saver"
+};
+
+const char *wire_mode_names[] = { "color", "text", "mono", "unicode", NULL };
+
+const char *script_path = NULL;
+ULONG delay = 0;
+int startup = 0;
+int wire = 0, wire_modes = 0, wire_fd = -1;
+int wire_phase = WIRE_SETUP, wire_next = -1;
+LONGLONG *startup_ns, *startup_init_ns;
+ULONG startup_runs = STARTUP_RUNS;
+ULONG notify_count;
+LONGLONG notify_post_ns;
+
+ULONG run_page(ULONG count)
+{
+   ULONG portal, i;
+   char buf[128];
+
+   portal = make_portal(get_console_screen(), "Page Benchmark", 0, 1, 0,
+			get_screen_lines() - 2, get_screen_cols() - 1,
+			PAGE_LINES, BORDER_SINGLE,
+			YELLOW | BGBLUE, YELLOW | BGBLUE,
+			BRITEWHITE | BGBLUE, BRITEWHITE | BGBLUE,
+			NULL, 0, NULL, TRUE);
+   if (!portal)
+      return -1;
+
+   for (i=0; i < PAGE_LINES; i++)
+   {
+      snprintf(buf, sizeof(buf), "line %04lu  the quick brown fox jumps "
+	       "over the lazy dog", i);
+      write_portal(portal, buf, i, 2, BRITEWHITE | BGBLUE);
+   }
+
+   activate_static_portal(portal);
+   update_static_portal(portal);
+   get_portal_resp(portal);
+   deactivate_static_portal(portal);
+   free_portal(portal);
+   return 0;
+}
+
+ULONG run_error(ULONG count)
+{
+   ULONG i;
+   char buf[64];
+
+   for (i=0; i < count; i++)
+   {
+      snprintf(buf, sizeof(buf), "  Error portal %lu of %lu  ", i + 1, count);
+      error_portal(buf, (get_screen_lines() - 5) / 2);
+   }
+   return 0;
+}
+
+ULONG run_menu(ULONG count)
+{
+   ULONG menu, i;
+   char buf[64];
+
+   menu = make_menu(get_console_screen(), "Menu Benchmark", 2,
+		    (get_screen_cols() - 30) / 2, 16, BORDER_DOUBLE,
+		    YELLOW | BGBLUE, YELLOW | BGBLUE,
+		    BRITEWHITE | BGBLUE, BRITEWHITE | BGBLUE,
+		    0, 0, 0, TRUE, MENU_ITEMS);
+   if (!menu)
+      return -1;
+
+   for (i=0; i < MENU_ITEMS; i++)
+   {
+      snprintf(buf, sizeof(buf), "Menu item %lu", i);
+      add_item_to_menu(menu, buf, i);
+   }
+
+   activate_menu(menu);
+   free_menu(menu);
+   return 0;
+}
+
+ULONG run_form(ULONG count)
+{
+   BYTE prompt[FORM_FIELDS][32], buffer[FORM_FIELDS][FIELD_LEN + 1];
+   ULONG portal, i;
+
+   portal = make_portal(get_console_screen(), "Form Benchmark", 0, 2, 4,
+			FORM_FIELDS + 6, get_screen_cols() - 5,
+			FORM_FIELDS + 2, BORDER_SINGLE,
+			YELLOW | BGBLUE, YELLOW | BGBLUE,
+			BRITEWHITE | BGBLUE, BRITEWHITE | BGBLUE,
+			NULL, 0, NULL, FALSE);
+   if (!portal)
+      return -1;
+
+   for (i=0; i < FORM_FIELDS; i++)
+   {
+      snprintf((char *)prompt[i], sizeof(prompt[i]), "Field %02lu:", i);
+      buffer[i][0] = '\0';
+      add_field_to_portal(portal, i + 1, 2, BRITEWHITE | BGBLUE, prompt[i],
+			  strlen((const char *)prompt[i]), buffer[i], FIELD_LEN,
+			  NULL, 0, 0, NULL, FIELD_ENTRY, NULL, NULL);
+   }
+
+   activate_static_portal(portal);
+   input_portal_fields(portal);
+   deactivate_static_portal(portal);
+   free_portal(portal);
+   return 0;
+}
+
+ULONG refresh_lines(ULONG portal, void *context)
+{
+   ULONG *tick = (ULONG *)context, i;
+   char buf[128];
+
+   (*tick)++;
+   for (i=0; i < REFRESH_LINES; i++)
+   {
+      snprintf(buf, sizeof(buf), "cpu %02lu  %12lu packets  %5.1f%% busy",
+	       i, *tick * (i + 1) * 977, ((*tick * 7 + i * 13) % 1000) / 10.0);
+      write_portal(portal, buf, i, 2, BRITEWHITE | BGBLUE);
+   }
+   return 0;
+}
+
+ULONG run_refresh(ULONG count)
+{
+   ULONG portal, tick = 0;
+
+   portal = make_portal(get_console_screen(), "Refresh Benchmark", 0, 1, 0,
+			get_screen_lines() - 2, get_screen_cols() - 1,
+			REFRESH_LINES, BORDER_SINGLE,
+			YELLOW | BGBLUE, YELLOW | BGBLUE,
+			BRITEWHITE | BGBLUE, BRITEWHITE | BGBLUE,
+			NULL, 0, NULL, TRUE);
+   if (!portal)
+      return -1;
+
+   refresh_lines(portal, &tick);
+   activate_static_portal(portal);
+   update_static_portal(portal);
+   register_portal_refresh(portal, 10, refresh_lines, &tick);
+   get_portal_resp(portal);
+   unregister_portal_refresh(portal);
+   deactivate_static_portal(portal);
+   free_portal(portal);
+   return 0;
+}
+
+ULONG run_saver(ULONG count)
+{
+   ULONG i, interval;
+
+   interval = set_screensaver_interval(0);
+   for (i=0; i < count; i++)
+      get_key();
+   set_screensaver_interval(interval);
+   return 0;
+}
+
+// each thread posts count link events, nearly all of them the same
+// one, while the UI thread waits in get_key and shows them
+
+void *notify_thread(void *arg)
+{
+   LONGLONG start, total = 0;
+   ULONG i;
+
+   for (i=0; i < notify_count; i++)
+   {
+      start = get_ns();
+      post_notification((i % 100) ? "eth0 link down" : "eth0 link flapping",
+			error_attribute);
+      total += get_ns() - start;
+   }
+   __sync_fetch_and_add(&notify_post_ns, total);
+   return NULL;
+}
+
+ULONG run_notify(ULONG count)
+{
+   pthread_t threads[NOTIFY_THREADS];
+   ULONG i;
+
+   notify_count = count;
+   notify_post_ns = 0;
+   for (i=0; i < NOTIFY_THREADS; i++)
+      pthread_create(&threads[i], NULL, notify_thread, NULL);
+   for (i=0; i < NOTIFY_THREADS; i++)
+      pthread_join(threads[i], NULL);
+
+   while (get_key() != 'q')
+      ;
+   return 0;
+}
+
+// child side of the startup benchmark, draw a portal and pass the
+// times init_cworthy started and the first frame was out back to
+// the parent
+
+int startup_child(int fd)
+{
+   LONGLONG t[2];
+   ULONG portal, i;
+   char buf[64];
+
+   t[0] = get_ns();
+   if (init_cworthy())
+      return 1;
+
+   portal = make_portal(get_console_screen(), "Startup Benchmark", 0, 1, 0,
+			get_screen_lines() - 2, get_screen_cols() - 1,
+			64, BORDER_SINGLE,
+			YELLOW | BGBLUE, YELLOW | BGBLUE,
+			BRITEWHITE | BGBLUE, BRITEWHITE | BGBLUE,
+			NULL, 0, NULL, TRUE);
+   if (portal)
+   {
+      for (i=0; i < 64; i++)
+      {
+	 snprintf(buf, sizeof(buf), "line %04lu", i);
+	 write_portal(portal, buf, i, 2, BRITEWHITE | BGBLUE);
+      }
+      activate_static_portal(portal);
+      update_static_portal(portal);
+   }
+   refresh_screen();
+   t[1] = get_ns();
+
+   if (portal)
+   {
+      deactivate_static_portal(portal);
+      free_portal(portal);
+   }
+   release_cworthy();
+   if (write(fd, t, sizeof(t)) != sizeof(t))
+      return 1;
+   return 0;
+}
+
+int compare_ns(const void *a, const void *b)
+{
+   LONGLONG x = *(const LONGLONG *)a, y = *(const LONGLONG *)b;
+
+   return (x > y) - (x < y);
+}
+
+int run_startup(void)
+{
+   char arg[32];
+   LONGLONG start, t[2];
+   int fd[2], status;
+   ULONG i;
+   pid_t pid;
+
+   startup_ns = (LONGLONG *)calloc(startup_runs, sizeof(LONGLONG));
+   startup_init_ns = (LONGLONG *)calloc(startup_runs, sizeof(LONGLONG));
+   if (!startup_ns || !startup_init_ns)
+      return -1;
+
+   for (i=0; i < startup_runs; i++)
+   {
+      if (pipe(fd))
+	 return -1;
+      snprintf(arg, sizeof(arg), "startup-child=%d", fd[1]);
+
+      start = get_ns();
+      pid = fork();
+      if (pid < 0)
+	 return -1;
+      if (!pid)
+      {
+	 close(fd[0]);
+	 execl("/proc/self/exe", "cwbench", arg, (char *)NULL);
+	 _exit(127);
+      }
+
+      close(fd[1]);
+      if (read(fd[0], t, sizeof(t)) != sizeof(t))
+      {
+	 close(fd[0]);
+	 waitpid(pid, &status, 0);
+	 return -1;
+      }
+      close(fd[0]);
+      waitpid(pid, &status, 0);
+
+      startup_ns[i] = t[1] - start;
+      startup_init_ns[i] = t[1] - t[0];
+   }
+
+   qsort(startup_ns, startup_runs, sizeof(LONGLONG), compare_ns);
+   qsort(startup_init_ns, startup_runs, sizeof(LONGLONG), compare_ns);
+   return 0;
+}
+
+// child side of the wire benchmark
+
+int wire_send(int type, int phase, ULONG count)
+{
+   WIRE_MSG msg;
+   char ack;
+
+   msg.type = type;
+   msg.phase = phase;
+   msg.count = count;
+   if (write(wire_fd, &msg, sizeof(msg)) != sizeof(msg))
+      return -1;
+   if (read(wire_fd, &ack, 1) != 1)
+      return -1;
+   return 0;
+}
+
+void wire_flush(NWSCREEN *screen, void *context)
+{
+   wire_send(WIRE_FRAME, wire_phase, 0);
+   if (wire_next >= 0)
+   {
+      wire_phase = wire_next;
+      wire_next = -1;
+   }
+}
+
+// run a key script against get_portal_resp.  The frame with the
+// initial bar is charged to setup, the frames after each key to phase.
+
+void wire_keys(ULONG portal, int phase, const char *script)
+{
+   wire_phase = WIRE_SETUP;
+   wire_next = phase;
+   if (start_key_script_text(script))
+      return;
+   get_portal_resp(portal);
+   wait_key_script();
+   wire_phase = WIRE_SETUP;
+}
+
+ULONG wire_portal(ULONG lines)
+{
+   ULONG portal, i;
+   char buf[128];
+
+   portal = make_portal(get_console_screen(), "Wire Benchmark", 0, 1, 0,
+			get_screen_lines() - 2, get_screen_cols() - 1,
+			lines, BORDER_SINGLE,
+			YELLOW | BGBLUE, YELLOW | BGBLUE,
+			BRITEWHITE | BGBLUE, BRITEWHITE | BGBLUE,
+			NULL, 0, NULL, TRUE);
+   if (!portal)
+      return 0;
+
+   for (i=0; i < lines; i++)
+   {
+      snprintf(buf, sizeof(buf), "line %04lu  the quick brown fox jumps "
+	       "over the lazy dog", i);
+      write_portal(portal, buf, i, 2, BRITEWHITE | BGBLUE);
+   }
+   activate_static_portal(portal);
+   update_static_portal(portal);
+   return portal;
+}
+
+int wire_child(int fd, ULONG count)
+{
+   ULONG portal, tick = 0, interval, i;
+   char script[256];
+
+   wire_fd = fd;
+   if (init_cworthy())
+      return 1;
+   set_screensaver_interval(0x7FFFFFFF);
+   clear_screen(get_console_screen());
+   register_flush_hook(wire_flush, NULL);
+   refresh_screen();
+
+   for (i=0; i < count; i++)
+   {
+      wire_phase = WIRE_OPEN;
+      portal = wire_portal(REFRESH_LINES);
+      refresh_screen();
+      wire_phase = WIRE_CLOSE;
+      deactivate_static_portal(portal);
+      free_portal(portal);
+      refresh_screen();
+   }
+   wire_send(WIRE_DONE, WIRE_OPEN, count);
+   wire_send(WIRE_DONE, WIRE_CLOSE, count);
+
+   wire_phase = WIRE_SETUP;
+   portal = wire_portal(PAGE_LINES);
+   snprintf(script, sizeof(script), "key PGDN %lu\nkey PGUP %lu\nkey q\n",
+	    count, count);
+   wire_keys(portal, WIRE_PAGE, script);
+   wire_send(WIRE_DONE, WIRE_PAGE, count * 2);
+
+   snprintf(script, sizeof(script), "repeat %lu\nkey DOWN 8\nkey UP 8\nend\n"
+	    "key q\n", count);
+   wire_keys(portal, WIRE_MOVE, script);
+   wire_send(WIRE_DONE, WIRE_MOVE, count * 16);
+   deactivate_static_portal(portal);
+   free_portal(portal);
+
+   // what a stats portal rewritten once a second sends each time
+   portal = wire_portal(REFRESH_LINES);
+   refresh_screen();
+   wire_phase = WIRE_STATS;
+   for (i=0; i < count; i++)
+   {
+      refresh_lines(portal, &tick);
+      update_static_portal(portal);
+      refresh_screen();
+   }
+   wire_send(WIRE_DONE, WIRE_STATS, count);
+   wire_phase = WIRE_SETUP;
+   deactivate_static_portal(portal);
+   free_portal(portal);
+   refresh_screen();
+
+   // screensaver frames, one interaction per frame
+   wire_phase = WIRE_SAVER;
+   interval = set_screensaver_interval(0);
+   if (!start_key_script_text("sleep 2000\nkey SPACE\n"))
+   {
+      get_key();
+      wait_key_script();
+   }
+   set_screensaver_interval(interval);
+   wire_phase = WIRE_SETUP;
+   refresh_screen();
+   wire_send(WIRE_DONE, WIRE_SAVER, 0);
+
+   unregister_flush_hook(wire_flush, NULL);
+   release_cworthy();
+   return 0;
+}
+
+// parent side, sort the bytes from the terminal into classes.  An
+// escape sequence is charged to its class when its final byte is seen.
+
+void wire_parse(WIRE_PARSER *p, const BYTE *buf, ULONG len)
+{
+   ULONG i, cls;
+   BYTE c;
+
+   for (i=0; i < len; i++)
+   {
+      c = buf[i];
+      switch (p->state)
+      {
+	 case 0:
+	    if (c == 0x1B)
+	    {
+	       p->state = 1;
+	       p->len = 1;
+	    }
+	    else if (c == 0x0E || c == 0x0F)
+	       p->classes[WIRE_CHARSET]++;
+	    else if (c < 0x20 || c == 0x7F)
+	       p->classes[WIRE_CTRL]++;
+	    else
+	       p->classes[WIRE_TEXT]++;
+	    break;
+
+	 // after ESC
+	 case 1:
+	    p->len++;
+	    if (c == '[')
+	       p->state = 2;
+	    else if (c == ']' || c == 'P')
+	       p->state = 3;
+	    else if (c == '(' || c == ')' || c == '*' || c == '+')
+	       p->state = 4;
+	    else
+	    {
+	       if (c == '7' || c == '8')
+		  cls = WIRE_CURSOR;
+	       else if (c == 'D' || c == 'M' || c == 'E')
+		  cls = WIRE_SCROLL;
+	       else
+		  cls = WIRE_OTHER;
+	       p->classes[cls] += p->len;
+	       p->state = 0;
+	    }
+	    break;
+
+	 // CSI parameters up to the final byte
+	 case 2:
+	    p->len++;
+	    if (c < 0x40 || c > 0x7E)
+	       break;
+	    switch (c)
+	    {
+	       case 'H': case 'f': case 'A': case 'B': case 'C': case 'D':
+	       case 'E': case 'F': case 'G': case 'd': case '`':
+		  cls = WIRE_CURSOR;
+		  break;
+	       case 'm':
+		  cls = WIRE_SGR;
+		  break;
+	       case 'K': case 'J': case 'X': case 'P': case '@':
+	       case 'L': case 'M':
+		  cls = WIRE_EDIT;
+		  break;
+	       case 'r': case 'S': case 'T':
+		  cls = WIRE_SCROLL;
+		  break;
+	       default:
+		  cls = WIRE_OTHER;
+		  break;
+	    }
+	    p->classes[cls] += p->len;
+	    p->state = 0;
+	    break;
+
+	 // OSC and DCS strings end with BEL or ST
+	 case 3:
+	    p->len++;
+	    if (c == 0x07 || c == '\\')
+	    {
+	       p->classes[WIRE_OTHER] += p->len;
+	       p->state = 0;
+	    }
+	    break;
+
+	 // character set designation
+	 case 4:
+	    p->len++;
+	    p->classes[WIRE_CHARSET] += p->len;
+	    p->state = 0;
+	    break;
+      }
+   }
+}
+
+// charge everything parsed since the last frame to phase
+
+void wire_charge(WIRE_PARSER *p, WIRE_PHASE *ph)
+{
+   ULONG i, bytes = 0;
+
+   for (i=0; i < WIRE_CLASSES; i++)
+   {
+      ph->classes[i] += p->classes[i];
+      bytes += p->classes[i];
+      p->classes[i] = 0;
+   }
+   ph->bytes += bytes;
+   if (bytes > ph->bytes_max)
+      ph->bytes_max = bytes;
+   ph->frames++;
+}
+
+int wire_drain(int master, WIRE_PARSER *p)
+{
+   BYTE buf[4096];
+   ssize_t n;
+
+   while ((n = read(master, buf, sizeof(buf))) > 0)
+      wire_parse(p, buf, n);
+   return (n < 0 && errno != EAGAIN) ? -1 : 0;
+}
+
+int run_wire(int mode, ULONG count, WIRE_PHASE *phase)
+{
+   struct winsize ws;
+   struct pollfd pfd[2];
+   WIRE_PARSER parser;
+   WIRE_MSG msg;
+   char arg[32], carg[32];
+   int sv[2], master, status, open = 1;
+   pid_t pid;
+
+   memset(&parser, 0, sizeof(parser));
+   memset(phase, 0, WIRE_PHASES * sizeof(WIRE_PHASE));
+   memset(&ws, 0, sizeof(ws));
+   ws.ws_row = WIRE_ROWS;
+   ws.ws_col = WIRE_COLS;
+
+   if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+      return -1;
+   snprintf(arg, sizeof(arg), "wire-child=%d", sv[1]);
+   snprintf(carg, sizeof(carg), "count=%lu", count);
+
+   pid = forkpty(&master, NULL, NULL, &ws);
+   if (pid < 0)
+   {
+      close(sv[0]);
+      close(sv[1]);
+      return -1;
+   }
+   if (!pid)
+   {
+      close(sv[0]);
+      // the counts should not depend on the locale of the caller
+      if (!strcmp(wire_mode_names[mode], "unicode"))
+	 setenv("LC_ALL", "C.UTF-8", 1);
+      if (!getenv("TERM"))
+	 setenv("TERM", "xterm-256color", 1);
+      execl("/proc/self/exe", "cwbench", arg, carg, wire_mode_names[mode],
+	    (char *)NULL);
+      _exit(127);
+   }
+   close(sv[1]);
+   fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+   pfd[0].fd = master;
+   pfd[0].events = POLLIN;
+   pfd[1].fd = sv[0];
+   pfd[1].events = POLLIN;
+   while (open)
+   {
+      if (poll(pfd, 2, -1) < 0)
+      {
+	 if (errno == EINTR)
+	    continue;
+	 break;
+      }
+      if ((pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) &&
+	  wire_drain(master, &parser))
+	 pfd[0].fd = -1;
+
+      if (pfd[1].revents & (POLLIN | POLLHUP | POLLERR))
+      {
+	 if (read(sv[0], &msg, sizeof(msg)) != sizeof(msg))
+	    break;
+
+	 // the frame is in the terminal before the message is sent
+	 wire_drain(master, &parser);
+	 if (msg.phase >= 0 && msg.phase < WIRE_PHASES)
+	 {
+	    if (msg.type == WIRE_FRAME)
+	       wire_charge(&parser, &phase[msg.phase]);
+	    else if (msg.type == WIRE_DONE)
+	       phase[msg.phase].interactions = msg.count;
+	 }
+	 if (write(sv[0], "", 1) != 1)
+	    open = 0;
+      }
+   }
+
+   // whatever release_cworthy wrote on the way out
+   wire_drain(master, &parser);
+   wire_charge(&parser, &phase[WIRE_SETUP]);
+   close(sv[0]);
+   close(master);
+   waitpid(pid, &status, 0);
+   return (WIFEXITED(status) && !WEXITSTATUS(status)) ? 0 : -1;
+}
+
+void print_wire(int mode, WIRE_PHASE *phase)
+{
+   ULONG i, n;
+   WIRE_PHASE *ph;
+
+   printf("%-7s %-7s %5s %6s %8s %7s %6s  %s\n", "wire", wire_mode_names[mode],
+	  "inter", "frames", "bytes", "/inter", "max",
+	  "text ctrl cursor sgr edit scroll charset other");
+   for (i=WIRE_OPEN; i < WIRE_PHASES; i++)
+   {
+      ph = &phase[i];
+      // the screensaver has no interactions, its frames are counted
+      n = ph->interactions ? ph->interactions : ph->frames;
+      printf("        %-7s %5lu %6lu %8lu %7lu %6lu  %lu %lu %lu %lu %lu %lu "
+	     "%lu %lu\n", wire_phase_names[i], n, ph->frames, ph->bytes,
+	     n ? ph->bytes / n : 0, ph->bytes_max,
+	     ph->classes[WIRE_TEXT], ph->classes[WIRE_CTRL],
+	     ph->classes[WIRE_CURSOR], ph->classes[WIRE_SGR],
+	     ph->classes[WIRE_EDIT], ph->classes[WIRE_SCROLL],
+	     ph->classes[WIRE_CHARSET], ph->classes[WIRE_OTHER]);
+   }
+}
+
+int run_scenario(SCENARIO *s)
+{
+   char script[1024];
+   CWSTATS before;
+   LONGLONG start;
+   ULONG ccode;
+
+   if (script_path)
+      ccode = start_key_script(script_path);
+   else
+   {
+      snprintf(script, sizeof(script), "delay %lu\n", delay);
+      snprintf(&script[strlen(script)], sizeof(script) - strlen(script),
+	       s->script, s->count);
+      ccode = start_key_script_text(script);
+   }
+   if (ccode)
+      return -1;
+
+   reset_key_latency();
+   get_cworthy_stats(&before);
+   start = get_ns();
+
+   (s->run)(s->count);
+
+   s->elapsed_ns = get_ns() - start;
+   s->keys = stop_key_script();
+   get_key_latency(&s->latency);
+   get_cworthy_stats(&s->stats);
+   s->stats.cells_written -= before.cells_written;
+   s->stats.cells_emitted -= before.cells_emitted;
+   s->stats.tty_bytes -= before.tty_bytes;
+   s->stats.refreshes -= before.refreshes;
+   s->stats.notes_posted -= before.notes_posted;
+   s->stats.notes_coalesced -= before.notes_coalesced;
+   s->stats.notes_dropped -= before.notes_dropped;
+
+   // discard keys the scenario did not consume
+   while (key_queue_pending())
+      get_key();
+   return 0;
+}
+
+void print_ns(const char *label, LONGLONG ns)
+{
+   if (ns >= 10000000LL)
+      printf("  %s %.1fms", label, ns / 1000000.0);
+   else
+      printf("  %s %lldus", label, ns / 1000);
+}
+
+void print_results(SCENARIO *s)
+{
+   double secs = s->elapsed_ns / 1000000000.0;
+
+   printf("%-7s %7lu keys %8.3f s %8.0f keys/s", s->name, s->keys, secs,
+	  secs > 0 ? s->latency.count / secs : 0.0);
+   if (s->latency.count)
+   {
+      print_ns("avg", s->latency.total_ns / s->latency.count);
+      print_ns("p50", key_latency_percentile(&s->latency, 50));
+      print_ns("p99", key_latency_percentile(&s->latency, 99));
+      print_ns("max", s->latency.max_ns);
+   }
+   printf("\n        %lld cells written  %lld emitted  %lld tty bytes"
+	  "  %lld refreshes\n", s->stats.cells_written,
+	  s->stats.cells_emitted, s->stats.tty_bytes, s->stats.refreshes);
+   if (s->stats.notes_posted)
+      printf("        %lld notifications  %lld coalesced  %lld dropped"
+	     "  %lldns per post\n", s->stats.notes_posted,
+	     s->stats.notes_coalesced, s->stats.notes_dropped,
+	     notify_post_ns / s->stats.notes_posted);
+}
+
+void print_startup(void)
+{
+   LONGLONG total = 0, init_total = 0;
+   ULONG i;
+
+   for (i=0; i < startup_runs; i++)
+   {
+      total += startup_ns[i];
+      init_total += startup_init_ns[i];
+   }
+
+   printf("%-7s %7lu runs ", "startup", startup_runs);
+   print_ns("avg", total / startup_runs);
+   print_ns("p50", startup_ns[(startup_runs - 1) / 2]);
+   print_ns("p99", startup_ns[(startup_runs * 99 - 1) / 100]);
+   print_ns("max", startup_ns[startup_runs - 1]);
+   printf("\n        first frame after exec, of which init and draw");
+   print_ns("avg", init_total / startup_runs);
+   print_ns("p50", startup_init_ns[(startup_runs - 1) / 2]);
+   printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    WIRE_PHASE phase[WIRE_PHASES];
+    int i, j, any = 0;
+    ULONG count = 0;
+
+    if (argc == 2 && !strncmp(argv[1], "startup-child=", 14))
+       return startup_child(atoi(&argv[1][14]));
+
+    if (argc == 4 && !strncmp(argv[1], "wire-child=", 11))
+    {
+       if (!strcmp(argv[3], "text"))
+	  set_text_mode(1);
+       else if (!strcmp(argv[3], "mono"))
+	  set_mono_mode(1);
+       else if (!strcmp(argv[3], "unicode"))
+	  set_unicode_mode(1);
+       return wire_child(atoi(&argv[1][11]), atol(&argv[2][6]));
+    }
+
+    for (i=1; i < argc; i++)
+    {
+       if (!strcasecmp(argv[i], "-h") || !strcasecmp(argv[i], "-help"))
+       {
+          printf("USAGE:  cwbench (page|error|menu|form|refresh|saver|all|"
+		 "startup|wire) "
+		 "(count=<n>|delay=<ms>|script=<file>|text|mono|"
+		 "unicode)\n");
+          printf("        page           - page through a %d line portal\n",
+		 PAGE_LINES);
+          printf("        error          - open and close error portals\n");
+          printf("        menu           - scroll a %d item menu\n",
+		 MENU_ITEMS);
+          printf("        form           - type into a %d field form\n",
+		 FORM_FIELDS);
+          printf("        refresh        - page a portal refreshed every "
+		 "10ms\n");
+          printf("        saver          - run the screensaver\n");
+          printf("        all            - run every scenario (default)\n");
+          printf("        startup        - time %d launches to the first "
+		 "frame\n", STARTUP_RUNS);
+          printf("        wire           - count the bytes sent to the "
+		 "terminal per interaction\n");
+          printf("        count=<n>      - scenario repeat count\n");
+          printf("        delay=<ms>     - delay between keys\n");
+          printf("        script=<file>  - drive the scenario from a key "
+		 "script\n");
+          printf("        text           - disable box line drawing\n");
+          printf("        mono           - disable color mode\n");
+          printf("        unicode        - enable unicode mode\n");
+          printf("        with wire, text, mono and unicode pick the "
+		 "modes measured,\n        all four by default\n");
+          exit(0);
+       }
+       else if (!strncasecmp(argv[i], "count=", 6))
+          count = atol(&argv[i][6]);
+       else if (!strncasecmp(argv[i], "delay=", 6))
+          delay = atol(&argv[i][6]);
+       else if (!strncasecmp(argv[i], "script=", 7))
+          script_path = &argv[i][7];
+       else if (!strcasecmp(argv[i], "text"))
+       {
+          set_text_mode(1);
+          wire_modes |= 1 << 1;
+       }
+       else if (!strcasecmp(argv[i], "mono"))
+       {
+          set_mono_mode(1);
+          wire_modes |= 1 << 2;
+       }
+       else if (!strcasecmp(argv[i], "unicode"))
+       {
+          set_unicode_mode(1);
+          wire_modes |= 1 << 3;
+       }
+       else if (!strcasecmp(argv[i], "startup"))
+          startup = 1;
+       else if (!strcasecmp(argv[i], "wire"))
+          wire = 1;
+       else if (!strcasecmp(argv[i], "all"))
+       {
+          for (j=0; scenarios[j].name; j++)
+             scenarios[j].selected = 1;
+          any = 1;
+       }
+       else
+       {
+          for (j=0; scenarios[j].name; j++)
+          {
+             if (!strcasecmp(argv[i], scenarios[j].name))
+             {
+                scenarios[j].selected = 1;
+                any = 1;
+                break;
+             }
+          }
+          if (!scenarios[j].name)
+          {
+             printf("cwbench:  unknown option %s\n", argv[i]);
+             return 1;
+          }
+       }
+    }
+
+    for (j=0; scenarios[j].name; j++)
+    {
+       if (!any && !startup && !wire)
+          scenarios[j].selected = 1;
+       if (count)
+          scenarios[j].count = count;
+    }
+
+    // each wire run owns a terminal of its own, the results go to
+    // stdout once its child is done
+    if (wire)
+    {
+       for (j=0; wire_mode_names[j]; j++)
+       {
+          if (wire_modes && !(wire_modes & (1 << j)))
+             continue;
+          if (run_wire(j, count ? count : WIRE_COUNT, phase))
+          {
+             printf("cwbench:  could not run the wire benchmark\n");
+             return 1;
+          }
+          print_wire(j, phase);
+       }
+       if (!any && !startup)
+          return 0;
+    }
+
+    // the startup runs own the terminal while they run, so they go
+    // before this process initializes the screen
+    if (startup)
+    {
+       if (count)
+          startup_runs = count;
+       if (run_startup())
+       {
+          printf("cwbench:  could not run the startup benchmark\n");
+          return 1;
+       }
+       if (!any)
+       {
+          print_startup();
+          return 0;
+       }
+    }
+
+    if (init_cworthy())
+       return 1;
+
+    set_screensaver_interval(0x7FFFFFFF);
+    set_stats_tty_bytes(1);
+    clear_screen(get_console_screen());
+
+    for (j=0; scenarios[j].name; j++)
+    {
+       if (!scenarios[j].selected)
+          continue;
+       if (run_scenario(&scenarios[j]))
+       {
+          release_cworthy();
+          printf("cwbench:  could not start the key script\n");
+          return 1;
+       }
+    }
+
+    release_cworthy();
+
+    if (startup)
+       print_startup();
+    for (j=0; scenarios[j].name; j++)
+       if (scenarios[j].selected)
+          print_results(&scenarios[j]);
+    return 0;
+}
@@ -0,0 +1,429 @@
+/***************************************************************************
+*
+*   Copyright(c) Jeff V. Merkey 1997-2022.  All rights reserved.
+*
+*   Licensed under the Lesser GNU Public License (LGPL) v2.1.
+*
+*   Permission to use, copy, modify, distribute, and sell this software and its
+*   documentation for any purpose is hereby granted without fee, provided that
+*   the above copyright notice appear in all copies and that both that
+*   copyright notice and this permission notice appear in supporting
+*   documentation.  No representations are made about the suitability of
+*   this software for any purpose.  It is provided "as is" without express or
+*   implied warranty.
+*
+*   Color pair cache for extended attributes.  Pairs 1 - 64 hold the PC
+*   attribute table built by init_cworthy, the rest of the terminal's
+*   COLOR_PAIRS are handed out on demand to the (fg, bg) combinations
+*   the application actually draws.  Lookups are a hash probe plus a
+*   move to the front of an LRU list, and when every pair is taken the
+*   least recently used one is redefined.  A cell still on the screen
+*   with an evicted pair changes color, so the cache only thrashes if
+*   more distinct color pairs are visible than the terminal supports.
+*
+*   The cache is not locked, it is only used with vidmem_mutex held.
+*
+**************************************************************************/
+
+#include "cworthy.h"
+
+#define PAIR_BASE       65       // first pair not used by the PC table
+#define MAX_ENTRIES     4096     // cap on the cache size
+
+typedef struct _PAIR_ENTRY
+{
+   ULONG key;          // extended attribute, 0 if the entry is free
+   int pair;           // ncurses pair, 0 if only the fallback is cached
+   int hnext;          // hash chain
+   int prev;           // LRU list, most recent first
+   int next;
+   BYTE fallback;      // nearest PC attribute
+} PAIR_ENTRY;
+
+typedef struct _PAIR_CACHE
+{
+   PAIR_ENTRY *entry;
+   int *bucket;
+   ULONG mask;
+   int size;           // entries allocated
+   int used;
+   int head;
+   int tail;
+   int last;           // entry of the previous lookup
+   int pairs;          // pairs available for extended colors
+} PAIR_CACHE;
+
+static PAIR_CACHE cache = { NULL, NULL, 0, 0, 0, -1, -1, -1, 0 };
+
+// xterm default palette for the first 16 colors, in ncurses order
+// (black, red, green, yellow, blue, magenta, cyan, white)
+
+static const BYTE ansi_rgb[16][3] =
+{
+   {   0,   0,   0 }, { 205,   0,   0 }, {   0, 205,   0 }, { 205, 205,   0 },
+   {   0,   0, 238 }, { 205,   0, 205 }, {   0, 205, 205 }, { 229, 229, 229 },
+   { 127, 127, 127 }, { 255,   0,   0 }, {   0, 255,   0 }, { 255, 255,   0 },
+   {  92,  92, 255 }, { 255,   0, 255 }, {   0, 255, 255 }, { 255, 255, 255 }
+};
+
+// PC color number to ncurses color number
+static const BYTE pc_to_ansi[16] =
+{
+   0, 4, 2, 6, 1, 5, 3, 7, 8, 12, 10, 14, 9, 13, 11, 15
+};
+
+static const BYTE cube_level[6] = { 0, 95, 135, 175, 215, 255 };
+
+static void color_rgb(ULONG color, ULONG *r, ULONG *g, ULONG *b)
+{
+   ULONG i;
+
+   if (color & CW_RGB)
+   {
+      *r = (color >> 16) & 0xFF;
+      *g = (color >> 8) & 0xFF;
+      *b = color & 0xFF;
+      return;
+   }
+
+   i = color & 0xFF;
+   if (i < 16)
+   {
+      *r = ansi_rgb[i][0];
+      *g = ansi_rgb[i][1];
+      *b = ansi_rgb[i][2];
+   }
+   else if (i < 232)
+   {
+      i -= 16;
+      *r = cube_level[i / 36];
+      *g = cube_level[(i / 6) % 6];
+      *b = cube_level[i % 6];
+   }
+   else
+      *r = *g = *b = 8 + (i - 232) * 10;
+}
+
+static ULONG distance(ULONG r1, ULONG g1, ULONG b1,
+		      ULONG r2, ULONG g2, ULONG b2)
+{
+   long dr = (long)r1 - (long)r2;
+   long dg = (long)g1 - (long)g2;
+   long db = (long)b1 - (long)b2;
+
+   // weighted for the eye's sensitivity to green
+   return (ULONG)(dr * dr * 3 + dg * dg * 4 + db * db * 2);
+}
+
+// nearest of the first count palette colors
+
+static ULONG nearest_ansi(ULONG r, ULONG g, ULONG b, ULONG count)
+{
+   ULONG i, d, best = 0, best_d = (ULONG)-1;
+
+   for (i=0; i < count; i++)
+   {
+      d = distance(r, g, b, ansi_rgb[i][0], ansi_rgb[i][1], ansi_rgb[i][2]);
+      if (d < best_d)
+      {
+	 best_d = d;
+	 best = i;
+      }
+   }
+   return best;
+}
+
+static ULONG cube_index(ULONG v)
+{
+   if (v < 48)
+      return 0;
+   if (v < 115)
+      return 1;
+   return (v - 35) / 40;
+}
+
+static ULONG nearest_256(ULONG r, ULONG g, ULONG b)
+{
+   ULONG ri = cube_index(r), gi = cube_index(g), bi = cube_index(b);
+   ULONG gray, gi_gray, cube_d, gray_d;
+
+   cube_d = distance(r, g, b, cube_level[ri], cube_level[gi],
+		     cube_level[bi]);
+
+   gray = (r + g + b) / 3;
+   gi_gray = gray < 8 ? 0 : (gray > 238 ? 23 : (gray - 3) / 10);
+   gray_d = distance(r, g, b, 8 + gi_gray * 10, 8 + gi_gray * 10,
+		     8 + gi_gray * 10);
+
+   if (gray_d < cube_d)
+      return 232 + gi_gray;
+   return 16 + ri * 36 + gi * 6 + bi;
+}
+
+// the color number to give ncurses for an extended color
+
+static int terminal_color(ULONG color)
+{
+   ULONG r, g, b;
+
+   if (color & CW_RGB)
+   {
+      // direct color terminals take the RGB value as the color number
+      if (COLORS >= 0x1000000)
+	 return (int)(color & 0xFFFFFF);
+      color_rgb(color, &r, &g, &b);
+      if (COLORS >= 256)
+	 return (int)nearest_256(r, g, b);
+   }
+   else
+   {
+      color_rgb(color, &r, &g, &b);
+      if (COLORS >= 0x1000000)
+	 return (int)((r << 16) | (g << 8) | b);
+      if ((int)(color & 0xFF) < COLORS)
+	 return (int)(color & 0xFF);
+   }
+   return (int)nearest_ansi(r, g, b, COLORS >= 16 ? 16 : 8);
+}
+
+static BYTE pc_color(ULONG color, ULONG count)
+{
+   ULONG r, g, b, i, d, best = 0, best_d = (ULONG)-1;
+
+   color_rgb(color, &r, &g, &b);
+   for (i=0; i < count; i++)
+   {
+      d = distance(r, g, b, ansi_rgb[pc_to_ansi[i]][0],
+		   ansi_rgb[pc_to_ansi[i]][1], ansi_rgb[pc_to_ansi[i]][2]);
+      if (d < best_d)
+      {
+	 best_d = d;
+	 best = i;
+      }
+   }
+   return (BYTE)best;
+}
+
+static inline ULONG hash_key(ULONG key)
+{
+   unsigned long long h = key;
+
+   h ^= h >> 29;
+   h *= 0xBF58476D1CE4E5B9ULL;
+   h ^= h >> 32;
+   return (ULONG)h & cache.mask;
+}
+
+static int alloc_cache(void)
+{
+   ULONG buckets;
+   int i;
+
+   cache.pairs = 0;
+   if (has_color && COLOR_PAIRS > PAIR_BASE)
+      cache.pairs = COLOR_PAIRS - PAIR_BASE;
+   if (cache.pairs > MAX_ENTRIES)
+      cache.pairs = MAX_ENTRIES;
+   // without free pairs only the nearest PC attribute is cached
+   cache.size = cache.pairs ? cache.pairs : MAX_ENTRIES;
+
+   for (buckets=16; buckets < (ULONG)cache.size * 2; buckets <<= 1)
+      ;
+
+   cache.entry = (PAIR_ENTRY *)calloc(cache.size, sizeof(PAIR_ENTRY));
+   cache.bucket = (int *)malloc(buckets * sizeof(int));
+   if (!cache.entry || !cache.bucket)
+   {
+      release_color_cache();
+      return -1;
+   }
+   for (i=0; i < (int)buckets; i++)
+      cache.bucket[i] = -1;
+   cache.mask = buckets - 1;
+   cache.used = 0;
+   cache.head = cache.tail = cache.last = -1;
+   return 0;
+}
+
+static void lru_unlink(int i)
+{
+   PAIR_ENTRY *e = &cache.entry[i];
+
+   if (e->prev >= 0)
+      cache.entry[e->prev].next = e->next;
+   else
+      cache.head = e->next;
+   if (e->next >= 0)
+      cache.entry[e->next].prev = e->prev;
+   else
+      cache.tail = e->prev;
+}
+
+static void lru_push(int i)
+{
+   PAIR_ENTRY *e = &cache.entry[i];
+
+   e->prev = -1;
+   e->next = cache.head;
+   if (cache.head >= 0)
+      cache.entry[cache.head].prev = i;
+   cache.head = i;
+   if (cache.tail < 0)
+      cache.tail = i;
+}
+
+static void hash_remove(int i)
+{
+   int *p = &cache.bucket[hash_key(cache.entry[i].key)];
+
+   while (*p >= 0)
+   {
+      if (*p == i)
+      {
+	 *p = cache.entry[i].hnext;
+	 return;
+      }
+      p = &cache.entry[*p].hnext;
+   }
+}
+
+// take a free entry, or the least recently used one
+
+static int claim_entry(void)
+{
+   int i;
+
+   if (cache.used < cache.size)
+   {
+      i = cache.used++;
+      cache.entry[i].pair = cache.pairs ? PAIR_BASE + i : 0;
+      if (cache.pairs)
+	 cw_stats.color_pairs++;
+      return i;
+   }
+
+   i = cache.tail;
+   lru_unlink(i);
+   hash_remove(i);
+   if (cache.pairs)
+      cw_stats.color_evictions++;
+   return i;
+}
+
+static PAIR_ENTRY *lookup(ULONG attr)
+{
+   ULONG key = (ULONG)(attr & (CW_XATTR | CW_COLOR_MASK |
+			       ((unsigned long long)CW_COLOR_MASK << 32)));
+   PAIR_ENTRY *e;
+   ULONG h;
+   int i;
+
+   if (cache.last >= 0 && cache.entry[cache.last].key == key)
+      return &cache.entry[cache.last];
+
+   if (!cache.entry && alloc_cache())
+      return NULL;
+
+   h = hash_key(key);
+   for (i=cache.bucket[h]; i >= 0; i=cache.entry[i].hnext)
+   {
+      if (cache.entry[i].key == key)
+      {
+	 if (cache.head != i)
+	 {
+	    lru_unlink(i);
+	    lru_push(i);
+	 }
+	 cache.last = i;
+	 return &cache.entry[i];
+      }
+   }
+
+   cw_stats.color_misses++;
+   i = claim_entry();
+   e = &cache.entry[i];
+   e->key = key;
+   e->fallback = xattr_pc_attr(key);
+   if (e->pair)
+   {
+#ifdef NCURSES_EXT_COLORS
+      init_extended_pair(e->pair, terminal_color(XATTR_FG(key)),
+			 terminal_color(XATTR_BG(key)));
+#else
+      init_pair(e->pair, terminal_color(XATTR_FG(key)),
+		terminal_color(XATTR_BG(key)));
+#endif
+   }
+   e->hnext = cache.bucket[h];
+   cache.bucket[h] = i;
+   lru_push(i);
+   cache.last = i;
+   return e;
+}
+
+// nearest PC attribute of an extended attribute, for attribute arrays
+// and terminals without extended colors.  This does not use the cache
+// and can be called without any lock held.
+
+BYTE xattr_pc_attr(ULONG attr)
+{
+   if (!(attr & CW_XATTR))
+      return (BYTE)attr;
+   return (BYTE)(pc_color(XATTR_FG(attr), 16) |
+		 (pc_color(XATTR_BG(attr), 8) << 4));
+}
+
+// the same from the cache, for cells stored in the screen map
+
+BYTE xattr_fallback(ULONG attr)
+{
+   PAIR_ENTRY *e;
+
+   if (!(attr & CW_XATTR))
+      return (BYTE)attr;
+   e = lookup(attr);
+   if (!e)
+      return xattr_pc_attr(attr);
+   return e->fallback;
+}
+
+void set_xattr_color(ULONG attr)
+{
+   PAIR_ENTRY *e;
+   int pair;
+
+   e = lookup(attr);
+   if (!e || !e->pair)
+   {
+      attrset(get_color_pair(xattr_fallback(attr)));
+      return;
+   }
+
+   pair = e->pair;
+#ifdef NCURSES_EXT_COLORS
+   attr_set(A_NORMAL, (short)pair, &pair);
+#else
+   attr_set(A_NORMAL, (short)pair, NULL);
+#endif
+}
+
+// called by init_cworthy once the PC pairs are defined, the cache is
+// allocated on the first extended attribute
+
+void init_color_cache(void)
+{
+   release_color_cache();
+}
+
+void release_color_cache(void)
+{
+   if (cache.entry)
+      free(cache.entry);
+   if (cache.bucket)
+      free(cache.bucket);
+   cache.entry = NULL;
+   cache.bucket = NULL;
+   cache.size = cache.used = cache.pairs = 0;
+   cache.head = cache.tail = cache.last = -1;
+   cw_stats.color_pairs = 0;
+}
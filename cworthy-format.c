@@ -0,0 +1,274 @@
+/***************************************************************************
+*
+*   Copyright(c) Jeff V. Merkey 1997-2022.  All rights reserved.
+*
+*   Licensed under the Lesser GNU Public License (LGPL) v2.1.
+*
+*   Permission to use, copy, modify, distribute, and sell this software and its
+*   documentation for any purpose is hereby granted without fee, provided that
+*   the above copyright notice appear in all copies and that both that
+*   copyright notice and this permission notice appear in supporting
+*   documentation.  No representations are made about the suitability of
+*   this software for any purpose.  It is provided "as is" without express or
+*   implied warranty.
+*
+*   Number formatting for counters.  Integers are converted two digits
+*   at a time from a 200 byte table after the digit count is worked
+*   out from the bit length, thousands groups are written from the
+*   right, and sizes are scaled to SI or IEC units with one decimal.
+*   A CWFMT appends to a caller's buffer, or to a portal line in place
+*   (see begin_portal_line), without allocating or rescanning the text
+*   already there.
+*
+**************************************************************************/
+
+#include "cworthy.h"
+
+static const char digit_pairs[201] =
+   "00010203040506070809"
+   "10111213141516171819"
+   "20212223242526272829"
+   "30313233343536373839"
+   "40414243444546474849"
+   "50515253545556575859"
+   "60616263646566676869"
+   "70717273747576777879"
+   "80818283848586878889"
+   "90919293949596979899";
+
+static const unsigned long long powers_of_10[20] =
+{
+   1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+   10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+   100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+   100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+   100000000000000000ULL, 1000000000000000000ULL,
+   10000000000000000000ULL
+};
+
+// decimal digits in v.  1233 / 4096 is just over log10(2), so the
+// estimate from the bit length is exact or one short.
+
+static inline ULONG decimal_digits(unsigned long long v)
+{
+   ULONG n;
+
+   if (!v)
+      return 1;
+   n = ((64 - __builtin_clzll(v)) * 1233) >> 12;
+   return n + (v >= powers_of_10[n]);
+}
+
+// write the n digits of v ending at p
+
+static inline void put_digits(char *p, unsigned long long v, ULONG n)
+{
+   ULONG i;
+
+   while (n >= 2)
+   {
+      i = (ULONG)(v % 100) * 2;
+      v /= 100;
+      *--p = digit_pairs[i + 1];
+      *--p = digit_pairs[i];
+      n -= 2;
+   }
+   if (n)
+      *--p = (char)('0' + v);
+}
+
+// the decimal form of v, p needs room for 21 bytes.  Returns the
+// number of digits written.
+
+ULONG fmt_decimal(char *p, unsigned long long v)
+{
+   ULONG n = decimal_digits(v);
+
+   put_digits(p + n, v, n);
+   p[n] = '\0';
+   return n;
+}
+
+// v with a separator between each group of three digits, p needs room
+// for 27 bytes.  Returns the length of the text.
+
+ULONG fmt_grouped(char *p, unsigned long long v, char sep)
+{
+   ULONG n = decimal_digits(v), len, g;
+   char *e;
+
+   len = n + (n - 1) / 3;
+   e = p + len;
+   *e = '\0';
+   while (n > 3)
+   {
+      g = (ULONG)(v % 1000);
+      v /= 1000;
+      put_digits(e, g, 3);
+      e -= 3;
+      *--e = sep;
+      n -= 3;
+   }
+   put_digits(e, v, n);
+   return len;
+}
+
+void fmt_init(CWFMT *f, char *buf, ULONG size)
+{
+   f->buf = buf;
+   f->size = size;
+   f->len = 0;
+   if (size)
+      buf[0] = '\0';
+}
+
+// append len bytes, text which does not fit is dropped and -1 is
+// returned
+
+ULONG fmt_chars(CWFMT *f, const char *s, ULONG len)
+{
+   ULONG room, ccode = 0;
+
+   if (!f->size)
+      return -1;
+
+   room = f->size - 1 - f->len;
+   if (len > room)
+   {
+      len = room;
+      ccode = -1;
+   }
+   memcpy(&f->buf[f->len], s, len);
+   f->len += len;
+   f->buf[f->len] = '\0';
+   return ccode;
+}
+
+ULONG fmt_str(CWFMT *f, const char *s)
+{
+   return fmt_chars(f, s, strlen(s));
+}
+
+ULONG fmt_char(CWFMT *f, char c)
+{
+   return fmt_chars(f, &c, 1);
+}
+
+// append spaces up to column col of the text
+
+ULONG fmt_pad(CWFMT *f, ULONG col)
+{
+   ULONG n;
+
+   if (!f->size)
+      return -1;
+
+   if (col > f->size - 1)
+      col = f->size - 1;
+   if (col <= f->len)
+      return 0;
+
+   n = col - f->len;
+   memset(&f->buf[f->len], ' ', n);
+   f->len += n;
+   f->buf[f->len] = '\0';
+   return 0;
+}
+
+ULONG fmt_dec(CWFMT *f, unsigned long long v)
+{
+   char buf[24];
+   ULONG n = fmt_decimal(buf, v);
+
+   return fmt_chars(f, buf, n);
+}
+
+// v in thousands groups separated by commas, as in 1,234,567
+
+ULONG fmt_group(CWFMT *f, unsigned long long v)
+{
+   char buf[32];
+   ULONG n = fmt_grouped(buf, v, ',');
+
+   return fmt_chars(f, buf, n);
+}
+
+// v in lower case hex, zero filled to at least width digits
+
+ULONG fmt_hex(CWFMT *f, unsigned long long v, ULONG width)
+{
+   static const char hex[] = "0123456789abcdef";
+   char buf[16];
+   ULONG n = 0;
+
+   if (width > sizeof(buf))
+      width = sizeof(buf);
+   do
+   {
+      buf[sizeof(buf) - ++n] = hex[v & 15];
+      v >>= 4;
+   } while (v && n < sizeof(buf));
+   while (n < width)
+      buf[sizeof(buf) - ++n] = '0';
+   return fmt_chars(f, &buf[sizeof(buf) - n], n);
+}
+
+// v scaled by powers of 1000 (FMT_SI) or 1024 (FMT_IEC) until it is
+// below the base, with one truncated decimal, the unit prefix and
+// unit.  FMT_SI gives 12.3 Kb for unit "b", FMT_IEC gives 12.0 KiB for
+// unit "B".  The whole part is grouped, which only shows for values
+// too small to scale.
+
+ULONG fmt_unit(CWFMT *f, unsigned long long v, ULONG flags,
+	       const char *unit)
+{
+   static const char *si[] = { "", "K", "M", "G", "T", "P", "E" };
+   static const char *iec[] = { "", "Ki", "Mi", "Gi", "Ti", "Pi", "Ei" };
+   unsigned long long base = (flags & FMT_IEC) ? 1024 : 1000;
+   unsigned long long div = 1;
+   ULONG i = 0, ccode;
+
+   while (i < 6 && v / div >= base)
+   {
+      div *= base;
+      i++;
+   }
+
+   ccode = fmt_group(f, v / div);
+   ccode |= fmt_char(f, '.');
+   ccode |= fmt_char(f, (char)('0' + (v % div) * 10 / div));
+   ccode |= fmt_char(f, ' ');
+   ccode |= fmt_str(f, (flags & FMT_IEC) ? iec[i] : si[i]);
+   ccode |= fmt_str(f, unit);
+   return ccode;
+}
+
+// anything the helpers above do not cover.  The text is formatted in
+// place at the end of the buffer.
+
+ULONG fmt_printf(CWFMT *f, const char *format, ...)
+{
+   va_list ap;
+   ULONG room;
+   int n;
+
+   if (!f->size)
+      return -1;
+
+   room = f->size - f->len;
+   va_start(ap, format);
+   n = vsnprintf(&f->buf[f->len], room, format, ap);
+   va_end(ap);
+   if (n < 0)
+   {
+      f->buf[f->len] = '\0';
+      return -1;
+   }
+   if ((ULONG)n >= room)
+   {
+      f->len = f->size - 1;
+      return -1;
+   }
+   f->len += n;
+   return 0;
+}
@@ -0,0 +1,297 @@
+/***************************************************************************
+*
+*   Copyright(c) Jeff V. Merkey 1997-2022.  All rights reserved.
+*
+*   Licensed under the Lesser GNU Public License (LGPL) v2.1.
+*
+*   Permission to use, copy, modify, distribute, and sell this software and its
+*   documentation for any purpose is hereby granted without fee, provided that
+*   the above copyright notice appear in all copies and that both that
+*   copyright notice and this permission notice appear in supporting
+*   documentation.  No representations are made about the suitability of
+*   this software for any purpose.  It is provided "as is" without express or
+*   implied warranty.
+*
+*   Session recording.  Every flushed frame is diffed against the
+*   last recorded frame and the changed spans are appended to the
+*   recording file as a timestamped delta record.  Text is stored as
+*   raw bytes and attributes as runs, so a typical portal update costs
+*   a few dozen bytes.  The render path only encodes the frame, a
+*   writer thread does the file writes so a slow disk or pipe never
+*   holds up refresh_screen.  See cworthy-record.h for the stream
+*   format and cwreplay.c for the player.
+*
+**************************************************************************/
+
+#include "cworthy.h"
+#include "cworthy-record.h"
+
+// merge changed cells separated by fewer unchanged cells than this
+#define SPAN_MERGE_GAP   3
+// encoded frames the writer thread may fall behind by
+#define RECORD_QUEUE     4
+
+typedef struct _CWRECORDER
+{
+   FILE *f;
+   ULONG rows;
+   ULONG cols;
+   ULONG size;
+   BYTE *shadow;          // last recorded screen
+   BYTE *frame;           // the screen being recorded
+   BYTE *buf;             // encode buffer for one frame
+   ULONG buf_size;
+   ULONG crow;
+   ULONG ccol;
+   struct timespec last;
+   ULONG frames;
+   pthread_t thread;
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   int running;
+   BYTE *queue;           // encoded frames waiting for the writer
+   BYTE *write_buf;       // the writer's half, swapped with queue
+   ULONG queue_len;
+   ULONG queue_size;
+} CWRECORDER;
+
+static CWRECORDER recorder;
+
+static BYTE *encode_span(BYTE *p, BYTE *cur, ULONG row, ULONG start, ULONG len)
+{
+   ULONG i, run;
+   BYTE attr;
+
+   p = cwr_put_varint(p, row);
+   p = cwr_put_varint(p, start);
+   p = cwr_put_varint(p, len);
+   for (i=0; i < len; i++)
+      *p++ = cur[(start + i) * 2];
+
+   i = 0;
+   while (i < len)
+   {
+      attr = cur[(start + i) * 2 + 1];
+      run = 1;
+      while (i + run < len && cur[(start + i + run) * 2 + 1] == attr)
+	 run++;
+      p = cwr_put_varint(p, run);
+      *p++ = attr;
+      i += run;
+   }
+   return p;
+}
+
+// called from refresh_screen with the whole screen map locked.
+// unchanged rows cost one cell_compare, and nothing is queued if the
+// frame did not change.  When the writer is too far behind to take
+// another worst case frame the frame is skipped, the shadow is left
+// alone so the next frame recorded carries its changes.
+
+static void record_flush(NWSCREEN *screen, void *context)
+{
+   CWRECORDER *r = (CWRECORDER *)context;
+   ULONG row, col, start, end, spans = 0, stride = r->cols * 2;
+   BYTE *old, *cur, *p, *body;
+   BYTE hdr[32], *h;
+   struct timespec now;
+   ULONG delta, room;
+
+   // only this hook adds to the queue, so the room can not shrink
+   pthread_mutex_lock(&r->mutex);
+   room = r->queue_size - r->queue_len;
+   pthread_mutex_unlock(&r->mutex);
+   if (room < r->buf_size + sizeof(hdr))
+      return;
+
+   copy_screen_map(screen, r->frame);
+
+   // spans are encoded first, the frame header carries their count
+   body = p = r->buf;
+   for (row=0; row < r->rows; row++)
+   {
+      old = &r->shadow[row * stride];
+      cur = &r->frame[row * stride];
+      col = cell_compare(old, cur, r->cols);
+      if (col == r->cols)
+	 continue;
+
+      while (col < r->cols)
+      {
+	 // spans separated by no more than SPAN_MERGE_GAP unchanged
+	 // cells are recorded as one
+	 start = end = col;
+	 while ((col = end + 1 + cell_compare(&old[(end + 1) * 2],
+					      &cur[(end + 1) * 2],
+					      r->cols - end - 1)) < r->cols &&
+		col - end <= SPAN_MERGE_GAP + 1)
+	    end = col;
+	 p = encode_span(p, cur, row, start, end - start + 1);
+	 spans++;
+      }
+      memcpy(old, cur, stride);
+   }
+
+   if (!spans && screen->crnt_row == r->crow &&
+       screen->crnt_column == r->ccol)
+      return;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   delta = (now.tv_sec - r->last.tv_sec) * 1000000 +
+	   (now.tv_nsec - r->last.tv_nsec) / 1000;
+   r->last = now;
+   r->crow = screen->crnt_row;
+   r->ccol = screen->crnt_column;
+
+   h = cwr_put_varint(hdr, delta);
+   h = cwr_put_varint(h, r->crow);
+   h = cwr_put_varint(h, r->ccol);
+   h = cwr_put_varint(h, spans);
+
+   pthread_mutex_lock(&r->mutex);
+   memcpy(&r->queue[r->queue_len], hdr, h - hdr);
+   r->queue_len += h - hdr;
+   memcpy(&r->queue[r->queue_len], body, p - body);
+   r->queue_len += p - body;
+   pthread_cond_signal(&r->cond);
+   pthread_mutex_unlock(&r->mutex);
+   r->frames++;
+}
+
+// writes the queued frames to the file.  The queue is swapped for the
+// empty half under the mutex and written outside it.
+
+static void *record_routine(void *p)
+{
+   CWRECORDER *r = (CWRECORDER *)p;
+   BYTE *buf;
+   ULONG len;
+
+   pthread_mutex_lock(&r->mutex);
+   while (1)
+   {
+      while (!r->queue_len && r->running)
+	 pthread_cond_wait(&r->cond, &r->mutex);
+      if (!r->queue_len)
+	 break;
+
+      buf = r->queue;
+      len = r->queue_len;
+      r->queue = r->write_buf;
+      r->queue_len = 0;
+      r->write_buf = buf;
+      pthread_mutex_unlock(&r->mutex);
+
+      fwrite(buf, 1, len, r->f);
+
+      pthread_mutex_lock(&r->mutex);
+   }
+   pthread_mutex_unlock(&r->mutex);
+   fflush(r->f);
+   return NULL;
+}
+
+static void free_recorder(CWRECORDER *r)
+{
+   if (r->f)
+      fclose(r->f);
+   if (r->shadow)
+      free(r->shadow);
+   if (r->frame)
+      free(r->frame);
+   if (r->buf)
+      free(r->buf);
+   if (r->queue)
+      free(r->queue);
+   if (r->write_buf)
+      free(r->write_buf);
+   pthread_mutex_destroy(&r->mutex);
+   pthread_cond_destroy(&r->cond);
+   memset(r, 0, sizeof(CWRECORDER));
+}
+
+// the writer empties the queue before it exits
+
+static void stop_record_thread(CWRECORDER *r)
+{
+   pthread_mutex_lock(&r->mutex);
+   r->running = 0;
+   pthread_cond_signal(&r->cond);
+   pthread_mutex_unlock(&r->mutex);
+   pthread_join(r->thread, NULL);
+}
+
+//  record every flushed frame into the file at path until
+//  stop_session_recording is called.  init_cworthy must have been
+//  called first.
+
+ULONG start_session_recording(const char *path)
+{
+   NWSCREEN *screen = get_console_screen();
+   CWRECORDER *r = &recorder;
+   BYTE hdr[32], *h;
+
+   if (r->f || !screen->p_vidmem || !path)
+      return -1;
+
+   memset(r, 0, sizeof(CWRECORDER));
+   r->rows = screen->nlines;
+   r->cols = screen->ncols;
+   r->size = r->rows * r->cols * 2;
+
+   // worst case every cell is its own span with a one cell attr run
+   r->buf_size = r->rows * r->cols * 16;
+   r->queue_size = RECORD_QUEUE * (r->buf_size + 32);
+   pthread_mutex_init(&r->mutex, NULL);
+   pthread_cond_init(&r->cond, NULL);
+   r->shadow = (BYTE *)calloc(1, r->size);
+   r->frame = (BYTE *)calloc(1, r->size);
+   r->buf = (BYTE *)malloc(r->buf_size);
+   r->queue = (BYTE *)malloc(r->queue_size);
+   r->write_buf = (BYTE *)malloc(r->queue_size);
+   r->f = fopen(path, "wb");
+   if (!r->shadow || !r->frame || !r->buf || !r->queue || !r->write_buf || !r->f)
+      goto ErrorExit;
+
+   // large stdio buffer so frames are written in big chunks
+   setvbuf(r->f, NULL, _IOFBF, 65536);
+
+   fwrite(CWR_MAGIC, 1, CWR_MAGIC_LEN, r->f);
+   h = cwr_put_varint(hdr, r->rows);
+   h = cwr_put_varint(h, r->cols);
+   fwrite(hdr, 1, h - hdr, r->f);
+
+   r->running = 1;
+   if (pthread_create(&r->thread, NULL, record_routine, r))
+      goto ErrorExit;
+
+   clock_gettime(CLOCK_MONOTONIC, &r->last);
+   if (register_flush_hook(record_flush, r))
+   {
+      stop_record_thread(r);
+      goto ErrorExit;
+   }
+
+   // record the current screen as the first frame
+   refresh_screen();
+   return 0;
+
+ErrorExit:;
+   free_recorder(r);
+   return -1;
+}
+
+ULONG stop_session_recording(void)
+{
+   CWRECORDER *r = &recorder;
+   ULONG frames;
+
+   if (!r->f)
+      return -1;
+
+   unregister_flush_hook(record_flush, r);
+   stop_record_thread(r);
+   frames = r->frames;
+   free_recorder(r);
+   return frames;
+}
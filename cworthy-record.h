@@ -0,0 +1,61 @@
+/***************************************************************************
+*
+*   Copyright(c) Jeff V. Merkey 1997-2022.  All rights reserved.
+*
+*   Licensed under the Lesser GNU Public License (LGPL) v2.1.
+*
+*   Session recording stream format.  A recording starts with the
+*   four byte magic "CWR1" followed by the screen rows and columns.
+*   Each flushed frame which changed the screen is then stored as
+*
+*      time delta in microseconds since the previous frame
+*      cursor row, cursor column
+*      span count
+*      for each span:  row, column, length, length text bytes,
+*                      then (run length, attr byte) pairs covering
+*                      the span
+*
+*   All numbers are unsigned LEB128 varints.  The replay side starts
+*   from a screen filled with zero bytes.  Text and attributes are the
+*   screen map bytes, so characters outside ASCII are recorded as
+*   CW_WIDE_GLYPH and extended attributes as the nearest PC attribute.
+*
+**************************************************************************/
+
+#ifndef _CWORTHY_RECORD_
+#define _CWORTHY_RECORD_
+
+#define CWR_MAGIC       "CWR1"
+#define CWR_MAGIC_LEN   4
+
+static inline BYTE *cwr_put_varint(BYTE *p, ULONG v)
+{
+   while (v >= 0x80)
+   {
+      *p++ = (BYTE)(v | 0x80);
+      v >>= 7;
+   }
+   *p++ = (BYTE)v;
+   return p;
+}
+
+// returns 0 at end of file or on a truncated varint
+static inline int cwr_get_varint(FILE *f, ULONG *v)
+{
+   ULONG shift = 0, val = 0;
+   int c;
+
+   do
+   {
+      c = getc(f);
+      if (c == EOF || shift > 56)
+	 return 0;
+      val |= (ULONG)(c & 0x7F) << shift;
+      shift += 7;
+   } while (c & 0x80);
+
+   *v = val;
+   return 1;
+}
+
+#endif
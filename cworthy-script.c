@@ -0,0 +1,390 @@
+/***************************************************************************
+*
+*   Copyright(c) Jeff V. Merkey 1997-2022.  All rights reserved.
+*
+*   Licensed under the Lesser GNU Public License (LGPL) v2.1.
+*
+*   Permission to use, copy, modify, distribute, and sell this software and its
+*   documentation for any purpose is hereby granted without fee, provided that
+*   the above copyright notice appear in all copies and that both that
+*   copyright notice and this permission notice appear in supporting
+*   documentation.  No representations are made about the suitability of
+*   this software for any purpose.  It is provided "as is" without express or
+*   implied warranty.
+*
+*   Key scripts.  A script is a text file which is fed into the get_key
+*   input queue by a background thread, so menus, portals and forms can
+*   be driven through repeatable scenarios without a keyboard.  One
+*   command per line, '#' starts a comment:
+*
+*      key <name> [count]   push a key, name is a key name below, a
+*                           single character, or a number (0x109)
+*      text <string>        push every character of the rest of the line
+*      delay <ms>           delay between keys from here on (default 0)
+*      sleep <ms>           pause the script
+*      sync                 wait until the application has drained the
+*                           queue and is waiting in get_key again
+*      repeat <count>       repeat the commands up to the matching end
+*      end
+*
+*   key names:  UP DOWN LEFT RIGHT PGUP PGDN HOME END INS DEL BKSP
+*               ENTER ESC TAB SPACE F1 - F12
+*
+**************************************************************************/
+
+#include "cworthy.h"
+
+#define OP_KEY      1
+#define OP_TEXT     2
+#define OP_DELAY    3
+#define OP_SLEEP    4
+#define OP_SYNC     5
+#define OP_REPEAT   6
+#define OP_END      7
+
+#define MAX_REPEAT_DEPTH   16
+
+typedef struct _SCRIPT_OP
+{
+   ULONG op;
+   ULONG arg;
+   ULONG count;
+   ULONG end;             // index of the matching end for repeat
+   char *text;
+} SCRIPT_OP;
+
+typedef struct _KEY_SCRIPT
+{
+   SCRIPT_OP *ops;
+   ULONG count;
+   ULONG size;
+   ULONG delay;
+   ULONG keys;
+   int stop;              // set by stop_key_script, atomic
+   int running;
+   pthread_t thread;
+} KEY_SCRIPT;
+
+static KEY_SCRIPT script;
+
+static struct
+{
+   const char *name;
+   ULONG key;
+} key_names[] =
+{
+   { "UP", UP_ARROW },       { "DOWN", DOWN_ARROW },
+   { "LEFT", LEFT_ARROW },   { "RIGHT", RIGHT_ARROW },
+   { "PGUP", PG_UP },        { "PGDN", PG_DOWN },
+   { "HOME", HOME },         { "END", END },
+   { "INS", INS },           { "DEL", DEL },
+   { "BKSP", BKSP },         { "ENTER", ENTER },
+   { "ESC", ESC },           { "TAB", TAB },
+   { "SPACE", SPACE },
+   { "F1", F1 },   { "F2", F2 },   { "F3", F3 },   { "F4", F4 },
+   { "F5", F5 },   { "F6", F6 },   { "F7", F7 },   { "F8", F8 },
+   { "F9", F9 },   { "F10", F10 }, { "F11", F11 }, { "F12", F12 },
+   { NULL, 0 }
+};
+
+static int parse_key(const char *name, ULONG *key)
+{
+   char *end;
+   int i;
+
+   for (i=0; key_names[i].name; i++)
+   {
+      if (!strcasecmp(name, key_names[i].name))
+      {
+	 *key = key_names[i].key;
+	 return 0;
+      }
+   }
+
+   if (name[0] && !name[1])
+   {
+      *key = (BYTE)name[0];
+      return 0;
+   }
+
+   *key = strtoul(name, &end, 0);
+   if (end == name || *end)
+      return -1;
+   return 0;
+}
+
+static SCRIPT_OP *add_op(KEY_SCRIPT *s, ULONG op)
+{
+   SCRIPT_OP *p;
+
+   if (s->count >= s->size)
+   {
+      p = (SCRIPT_OP *)realloc(s->ops, (s->size + 64) * sizeof(SCRIPT_OP));
+      if (!p)
+	 return NULL;
+      s->ops = p;
+      s->size += 64;
+   }
+   p = &s->ops[s->count++];
+   memset(p, 0, sizeof(SCRIPT_OP));
+   p->op = op;
+   return p;
+}
+
+static void free_script(KEY_SCRIPT *s)
+{
+   ULONG i;
+
+   for (i=0; i < s->count; i++)
+      if (s->ops[i].text)
+	 free(s->ops[i].text);
+   if (s->ops)
+      free(s->ops);
+   s->ops = NULL;
+   s->count = s->size = 0;
+}
+
+static int parse_script(KEY_SCRIPT *s, const char *text)
+{
+   ULONG stack[MAX_REPEAT_DEPTH], depth = 0, line_len;
+   char line[1024], cmd[32], arg[256], *p;
+   const char *next;
+   SCRIPT_OP *op;
+   int n;
+
+   while (text && *text)
+   {
+      next = strchr(text, '\n');
+      line_len = next ? (ULONG)(next - text) : strlen(text);
+      if (line_len >= sizeof(line))
+	 return -1;
+      memcpy(line, text, line_len);
+      line[line_len] = '\0';
+      text = next ? next + 1 : NULL;
+
+      if (line_len && line[line_len - 1] == '\r')
+	 line[--line_len] = '\0';
+
+      p = line;
+      while (*p == ' ' || *p == '\t')
+	 p++;
+      if (!*p || *p == '#')
+	 continue;
+
+      cmd[0] = arg[0] = '\0';
+      n = sscanf(p, "%31s %255s", cmd, arg);
+
+      if (!strcasecmp(cmd, "key"))
+      {
+	 if (n < 2 || !(op = add_op(s, OP_KEY)) || parse_key(arg, &op->arg))
+	    return -1;
+	 op->count = 1;
+	 sscanf(p, "%*s %*s %lu", &op->count);
+      }
+      else if (!strcasecmp(cmd, "text"))
+      {
+	 // everything after the first blank is typed as is
+	 p += 4;
+	 if (*p)
+	    p++;
+	 if (!(op = add_op(s, OP_TEXT)) || !(op->text = strdup(p)))
+	    return -1;
+      }
+      else if (!strcasecmp(cmd, "delay") || !strcasecmp(cmd, "sleep"))
+      {
+	 if (n < 2 || !(op = add_op(s, !strcasecmp(cmd, "delay")
+				       ? OP_DELAY : OP_SLEEP)))
+	    return -1;
+	 op->arg = strtoul(arg, NULL, 0);
+      }
+      else if (!strcasecmp(cmd, "sync"))
+      {
+	 if (!add_op(s, OP_SYNC))
+	    return -1;
+      }
+      else if (!strcasecmp(cmd, "repeat"))
+      {
+	 if (n < 2 || depth >= MAX_REPEAT_DEPTH || !(op = add_op(s, OP_REPEAT)))
+	    return -1;
+	 op->count = strtoul(arg, NULL, 0);
+	 stack[depth++] = s->count - 1;
+      }
+      else if (!strcasecmp(cmd, "end"))
+      {
+	 if (!depth || !add_op(s, OP_END))
+	    return -1;
+	 s->ops[stack[--depth]].end = s->count - 1;
+      }
+      else
+	 return -1;
+   }
+   return depth ? -1 : 0;
+}
+
+static void script_sleep(ULONG ms)
+{
+   struct timespec ts;
+
+   ts.tv_sec = ms / 1000;
+   ts.tv_nsec = (ms % 1000) * 1000000L;
+   nanosleep(&ts, NULL);
+}
+
+// the queue is bounded, so wait for room rather than dropping keys
+
+static int script_key(KEY_SCRIPT *s, ULONG key)
+{
+   if (s->delay)
+      script_sleep(s->delay);
+
+   while (push_key(key))
+   {
+      if (__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE))
+	 return -1;
+      script_sleep(1);
+   }
+   s->keys++;
+   return __atomic_load_n(&s->stop, __ATOMIC_ACQUIRE) ? -1 : 0;
+}
+
+static int run_ops(KEY_SCRIPT *s, ULONG start, ULONG end)
+{
+   SCRIPT_OP *op;
+   ULONG i, n;
+   char *p;
+
+   for (i=start; i < end; i++)
+   {
+      op = &s->ops[i];
+      switch (op->op)
+      {
+	 case OP_KEY:
+	    for (n=0; n < op->count; n++)
+	       if (script_key(s, op->arg))
+		  return -1;
+	    break;
+
+	 case OP_TEXT:
+	    for (p=op->text; *p; p++)
+	       if (script_key(s, (BYTE)*p))
+		  return -1;
+	    break;
+
+	 case OP_DELAY:
+	    s->delay = op->arg;
+	    break;
+
+	 case OP_SLEEP:
+	    script_sleep(op->arg);
+	    break;
+
+	 case OP_SYNC:
+	    while (!key_input_idle())
+	    {
+	       if (__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE))
+		  return -1;
+	       script_sleep(1);
+	    }
+	    break;
+
+	 case OP_REPEAT:
+	    for (n=0; n < op->count; n++)
+	       if (run_ops(s, i + 1, op->end))
+		  return -1;
+	    i = op->end;
+	    break;
+
+	 default:
+	    break;
+      }
+   }
+   return 0;
+}
+
+static void *script_routine(void *p)
+{
+   KEY_SCRIPT *s = (KEY_SCRIPT *)p;
+
+   run_ops(s, 0, s->count);
+   return NULL;
+}
+
+ULONG start_key_script_text(const char *text)
+{
+   KEY_SCRIPT *s = &script;
+
+   if (s->running || !text)
+      return -1;
+
+   memset(s, 0, sizeof(KEY_SCRIPT));
+   if (parse_script(s, text))
+   {
+      free_script(s);
+      return -1;
+   }
+
+   if (pthread_create(&s->thread, NULL, script_routine, s))
+   {
+      free_script(s);
+      return -1;
+   }
+   s->running = 1;
+   return 0;
+}
+
+ULONG start_key_script(const char *path)
+{
+   struct stat st;
+   char *text;
+   ULONG ccode;
+   FILE *f;
+
+   if (!path)
+      return -1;
+
+   f = fopen(path, "r");
+   if (!f)
+      return -1;
+
+   if (fstat(fileno(f), &st) || !(text = (char *)malloc(st.st_size + 1)))
+   {
+      fclose(f);
+      return -1;
+   }
+
+   text[fread(text, 1, st.st_size, f)] = '\0';
+   fclose(f);
+
+   ccode = start_key_script_text(text);
+   free(text);
+   return ccode;
+}
+
+// wait for the script to push its last key.  returns the number of
+// keys pushed.
+
+ULONG wait_key_script(void)
+{
+   KEY_SCRIPT *s = &script;
+   ULONG keys;
+
+   if (!s->running)
+      return -1;
+
+   pthread_join(s->thread, NULL);
+   keys = s->keys;
+   free_script(s);
+   s->running = 0;
+   return keys;
+}
+
+ULONG stop_key_script(void)
+{
+   KEY_SCRIPT *s = &script;
+
+   if (!s->running)
+      return -1;
+
+   __atomic_store_n(&s->stop, 1, __ATOMIC_RELEASE);
+   return wait_key_script();
+}
@@ -0,0 +1,637 @@
+/***************************************************************************
+*
+*   Copyright(c) Jeff V. Merkey 1997-2022.  All rights reserved.
+*
+*   Licensed under the Lesser GNU Public License (LGPL) v2.1.
+*
+*   Permission to use, copy, modify, distribute, and sell this software and its
+*   documentation for any purpose is hereby granted without fee, provided that
+*   the above copyright notice appear in all copies and that both that
+*   copyright notice and this permission notice appear in supporting
+*   documentation.  No representations are made about the suitability of
+*   this software for any purpose.  It is provided "as is" without express or
+*   implied warranty.
+*
+*   Shared console server.  The application renders once and the
+*   screen map is fanned out to every attached viewer.  New clients
+*   receive a full frame and after that only the cells which changed
+*   since the last frame that client was sent.  A client that cannot
+*   keep up simply skips frames, since its next update is computed
+*   against the newest screen once its socket drains.  One client
+*   attached over the Unix domain socket may take control and send
+*   keys into the application input queue.
+*
+**************************************************************************/
+
+#include "cworthy.h"
+#include "cworthy-server.h"
+#include <poll.h>
+#include <sys/un.h>
+
+#define MAX_CLIENTS      64
+
+// adjacent changed spans closer than this are merged to save
+// the span header
+#define SPAN_MERGE_GAP   3
+
+typedef struct _CWCLIENT
+{
+   int fd;
+   int tcp;
+   BYTE *shadow;         // last screen this client was sent
+   ULONG seq;            // sequence of shadow, 0 = needs full frame
+   BYTE *out;
+   ULONG out_len;
+   ULONG out_pos;
+   BYTE in[CWS_MAX_CLIENT_MSG];
+   ULONG in_len;
+   int control_pending;
+} CWCLIENT;
+
+typedef struct _CWSERVER
+{
+   int running;
+   int unix_fd;
+   int tcp_fd;
+   int wake[2];
+   char path[108];
+   pthread_t thread;
+   pthread_mutex_t mutex;
+   ULONG rows;
+   ULONG cols;
+   ULONG size;
+   BYTE *frame;          // latest flushed screen, guarded by mutex
+   ULONG seq;
+   ULONG crow;
+   ULONG ccol;
+   BYTE *snapshot;       // server thread copy of frame
+   ULONG snap_seq;
+   ULONG snap_crow;
+   ULONG snap_ccol;
+   ULONG out_size;
+   int controller;
+   CWCLIENT client[MAX_CLIENTS];
+} CWSERVER;
+
+static CWSERVER server;
+
+// called from refresh_screen with the whole screen map locked.  We only copy
+// the screen map here and wake the server thread, all encoding is
+// done off the render path.
+
+static void server_flush(NWSCREEN *screen, void *context)
+{
+   CWSERVER *s = (CWSERVER *)context;
+   int changed = 0;
+
+   pthread_mutex_lock(&s->mutex);
+   if (screen->crnt_row != s->crow || screen->crnt_column != s->ccol)
+   {
+      s->crow = screen->crnt_row;
+      s->ccol = screen->crnt_column;
+      changed++;
+   }
+   if (copy_screen_map(screen, s->frame))
+      changed++;
+   if (changed)
+      s->seq++;
+   pthread_mutex_unlock(&s->mutex);
+
+   if (changed)
+   {
+      if (write(s->wake[1], "f", 1) < 0)
+         ;  // pipe full, the server is already awake
+   }
+}
+
+static int set_nonblock(int fd)
+{
+   int flags = fcntl(fd, F_GETFL, 0);
+
+   if (flags < 0)
+      return -1;
+   return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void drop_client(CWSERVER *s, int i)
+{
+   CWCLIENT *c = &s->client[i];
+
+   if (c->fd < 0)
+      return;
+
+   close(c->fd);
+   if (c->shadow)
+      free(c->shadow);
+   if (c->out)
+      free(c->out);
+   memset(c, 0, sizeof(CWCLIENT));
+   c->fd = -1;
+   if (s->controller == i)
+      s->controller = -1;
+}
+
+static void add_client(CWSERVER *s, int fd, int tcp)
+{
+   int i;
+
+   set_nonblock(fd);
+   for (i=0; i < MAX_CLIENTS; i++)
+   {
+      if (s->client[i].fd < 0)
+	 break;
+   }
+
+   if (i >= MAX_CLIENTS)
+   {
+      close(fd);
+      return;
+   }
+
+   s->client[i].shadow = (BYTE *)malloc(s->size);
+   s->client[i].out = (BYTE *)malloc(s->out_size);
+   if (!s->client[i].shadow || !s->client[i].out)
+   {
+      if (s->client[i].shadow)
+	 free(s->client[i].shadow);
+      if (s->client[i].out)
+	 free(s->client[i].out);
+      s->client[i].shadow = NULL;
+      s->client[i].out = NULL;
+      close(fd);
+      return;
+   }
+   s->client[i].fd = fd;
+   s->client[i].tcp = tcp;
+   s->client[i].seq = 0;
+   s->client[i].out_len = 0;
+   s->client[i].out_pos = 0;
+   s->client[i].in_len = 0;
+}
+
+static ULONG encode_frame(CWSERVER *s, BYTE *out)
+{
+   out[0] = CWS_MSG_FRAME;
+   cws_put32(&out[1], CWS_FRAME_HDR_LEN + s->size);
+   cws_put16(&out[5], s->rows);
+   cws_put16(&out[7], s->cols);
+   cws_put16(&out[9], s->snap_crow);
+   cws_put16(&out[11], s->snap_ccol);
+   memcpy(&out[CWS_HDR_LEN + CWS_FRAME_HDR_LEN], s->snapshot, s->size);
+   return CWS_HDR_LEN + CWS_FRAME_HDR_LEN + s->size;
+}
+
+// encode the changed spans between the client shadow and the
+// snapshot.  returns 0 if the diff would be larger than a full
+// frame, in which case the caller sends a full frame instead.
+
+static ULONG encode_diff(CWSERVER *s, CWCLIENT *c, BYTE *out)
+{
+   ULONG row, col, start, end, len, spans = 0;
+   ULONG limit = CWS_HDR_LEN + CWS_FRAME_HDR_LEN + s->size;
+   ULONG pos = CWS_HDR_LEN + CWS_DIFF_HDR_LEN;
+   ULONG stride = s->cols * 2;
+   BYTE *old, *cur;
+
+   for (row=0; row < s->rows; row++)
+   {
+      old = &c->shadow[row * stride];
+      cur = &s->snapshot[row * stride];
+      col = cell_compare(old, cur, s->cols);
+      if (col == s->cols)
+	 continue;
+
+      while (col < s->cols)
+      {
+	 // spans separated by no more than SPAN_MERGE_GAP unchanged
+	 // cells are sent as one
+	 start = end = col;
+	 while ((col = end + 1 + cell_compare(&old[(end + 1) * 2],
+					      &cur[(end + 1) * 2],
+					      s->cols - end - 1)) < s->cols &&
+		col - end <= SPAN_MERGE_GAP + 1)
+	    end = col;
+
+	 len = end - start + 1;
+	 if (pos + CWS_SPAN_HDR_LEN + len * 2 > limit)
+	    return 0;
+
+	 cws_put16(&out[pos], row);
+	 cws_put16(&out[pos + 2], start);
+	 cws_put16(&out[pos + 4], len);
+	 memcpy(&out[pos + CWS_SPAN_HDR_LEN], &cur[start * 2], len * 2);
+	 pos += CWS_SPAN_HDR_LEN + len * 2;
+	 spans++;
+      }
+   }
+
+   out[0] = CWS_MSG_DIFF;
+   cws_put32(&out[1], pos - CWS_HDR_LEN);
+   cws_put16(&out[5], s->snap_crow);
+   cws_put16(&out[7], s->snap_ccol);
+   cws_put32(&out[9], spans);
+   return pos;
+}
+
+static void update_client(CWSERVER *s, int i)
+{
+   CWCLIENT *c = &s->client[i];
+   ULONG len = 0, pos = 0;
+
+   // a client still draining an earlier update skips frames until
+   // its socket catches up, then gets the net change in one diff
+   if (c->out_len)
+      return;
+
+   if (c->control_pending)
+   {
+      c->out[0] = CWS_MSG_CONTROL;
+      cws_put32(&c->out[1], 1);
+      c->out[CWS_HDR_LEN] = (s->controller == i) ? 1 : 0;
+      pos = CWS_HDR_LEN + 1;
+      c->control_pending = 0;
+   }
+
+   if (c->seq != s->snap_seq)
+   {
+      if (c->seq)
+	 len = encode_diff(s, c, &c->out[pos]);
+      if (!len)
+	 len = encode_frame(s, &c->out[pos]);
+
+      memcpy(c->shadow, s->snapshot, s->size);
+      c->seq = s->snap_seq;
+   }
+   c->out_len = pos + len;
+   c->out_pos = 0;
+}
+
+static int flush_client(CWSERVER *s, int i)
+{
+   CWCLIENT *c = &s->client[i];
+   ssize_t n;
+
+   while (c->out_pos < c->out_len)
+   {
+      n = send(c->fd, &c->out[c->out_pos], c->out_len - c->out_pos,
+	       MSG_NOSIGNAL);
+      if (n < 0)
+      {
+	 if (errno == EAGAIN || errno == EWOULDBLOCK)
+	    return 0;
+	 if (errno == EINTR)
+	    continue;
+	 return -1;
+      }
+      c->out_pos += n;
+   }
+   c->out_len = c->out_pos = 0;
+   return 0;
+}
+
+static void client_message(CWSERVER *s, int i, BYTE type, BYTE *p, ULONG len)
+{
+   CWCLIENT *c = &s->client[i];
+
+   switch (type)
+   {
+      case CWS_MSG_HELLO:
+	 // keyboard control is only offered on the Unix socket,
+	 // which is protected by file permissions
+	 if (len >= 1 && (p[0] & CWS_HELLO_CONTROL) && !c->tcp &&
+	     s->controller < 0)
+	    s->controller = i;
+	 c->control_pending = 1;
+	 break;
+
+      case CWS_MSG_RELEASE:
+	 if (s->controller == i)
+	    s->controller = -1;
+	 c->control_pending = 1;
+	 break;
+
+      case CWS_MSG_KEY:
+	 if (len >= 4 && s->controller == i)
+	    push_key(cws_get32(p));
+	 break;
+
+      default:
+	 break;
+   }
+}
+
+static int read_client(CWSERVER *s, int i)
+{
+   CWCLIENT *c = &s->client[i];
+   ULONG len, pos;
+   ssize_t n;
+
+   n = recv(c->fd, &c->in[c->in_len], CWS_MAX_CLIENT_MSG - c->in_len, 0);
+   if (n < 0)
+      return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+   if (n == 0)
+      return -1;
+   c->in_len += n;
+
+   pos = 0;
+   while (c->in_len - pos >= CWS_HDR_LEN)
+   {
+      len = cws_get32(&c->in[pos + 1]);
+      if (len > CWS_MAX_CLIENT_MSG - CWS_HDR_LEN)
+	 return -1;
+      if (c->in_len - pos < CWS_HDR_LEN + len)
+	 break;
+      client_message(s, i, c->in[pos], &c->in[pos + CWS_HDR_LEN], len);
+      pos += CWS_HDR_LEN + len;
+   }
+   if (pos)
+   {
+      memmove(c->in, &c->in[pos], c->in_len - pos);
+      c->in_len -= pos;
+   }
+   return 0;
+}
+
+static void *server_routine(void *p)
+{
+   CWSERVER *s = (CWSERVER *)p;
+   struct pollfd pfd[MAX_CLIENTS + 3];
+   int map[MAX_CLIENTS + 3];
+   int i, n, fd, count;
+   char buf[64];
+
+   while (s->running)
+   {
+      n = 0;
+      pfd[n].fd = s->wake[0];
+      pfd[n].events = POLLIN;
+      map[n++] = -1;
+      if (s->unix_fd >= 0)
+      {
+	 pfd[n].fd = s->unix_fd;
+	 pfd[n].events = POLLIN;
+	 map[n++] = -2;
+      }
+      if (s->tcp_fd >= 0)
+      {
+	 pfd[n].fd = s->tcp_fd;
+	 pfd[n].events = POLLIN;
+	 map[n++] = -3;
+      }
+      for (i=0; i < MAX_CLIENTS; i++)
+      {
+	 if (s->client[i].fd < 0)
+	    continue;
+	 pfd[n].fd = s->client[i].fd;
+	 pfd[n].events = POLLIN | (s->client[i].out_len ? POLLOUT : 0);
+	 map[n++] = i;
+      }
+
+      count = poll(pfd, n, -1);
+      if (count < 0)
+      {
+	 if (errno == EINTR)
+	    continue;
+	 break;
+      }
+
+      for (i=0; i < n; i++)
+      {
+	 if (!pfd[i].revents)
+	    continue;
+
+	 switch (map[i])
+	 {
+	    case -1:
+	       while (read(s->wake[0], buf, sizeof(buf)) > 0)
+		  ;
+	       break;
+
+	    case -2:
+	    case -3:
+	       fd = accept(pfd[i].fd, NULL, NULL);
+	       if (fd >= 0)
+		  add_client(s, fd, map[i] == -3);
+	       break;
+
+	    default:
+	       if (pfd[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+	       {
+		  drop_client(s, map[i]);
+		  break;
+	       }
+	       if ((pfd[i].revents & POLLIN) && read_client(s, map[i]))
+	       {
+		  drop_client(s, map[i]);
+		  break;
+	       }
+	       break;
+	 }
+      }
+
+      // take one snapshot of the newest frame and fan it out
+      pthread_mutex_lock(&s->mutex);
+      if (s->snap_seq != s->seq)
+      {
+	 memcpy(s->snapshot, s->frame, s->size);
+	 s->snap_seq = s->seq;
+	 s->snap_crow = s->crow;
+	 s->snap_ccol = s->ccol;
+      }
+      pthread_mutex_unlock(&s->mutex);
+
+      for (i=0; i < MAX_CLIENTS; i++)
+      {
+	 if (s->client[i].fd < 0)
+	    continue;
+	 update_client(s, i);
+	 if (flush_client(s, i))
+	    drop_client(s, i);
+      }
+   }
+   return NULL;
+}
+
+static int open_unix_socket(const char *path)
+{
+   struct sockaddr_un addr;
+   struct stat st;
+   mode_t mask;
+   int fd, ccode;
+
+   if (strlen(path) >= sizeof(addr.sun_path))
+      return -1;
+
+   // only a stale socket left by an earlier run is removed, any
+   // other file at path is left alone and the server is not started
+   if (!lstat(path, &st))
+   {
+      if (!S_ISSOCK(st.st_mode) || unlink(path))
+	 return -1;
+   }
+
+   fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0)
+      return -1;
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   memcpy(addr.sun_path, path, strlen(path) + 1);
+
+   // the socket is created owner only rather than changed after
+   // bind, so it is never reachable with the default permissions
+   mask = umask(0077);
+   ccode = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+   umask(mask);
+   if (ccode)
+   {
+      close(fd);
+      return -1;
+   }
+   if (listen(fd, 16))
+   {
+      close(fd);
+      unlink(path);
+      return -1;
+   }
+   set_nonblock(fd);
+   return fd;
+}
+
+static int open_tcp_socket(int port)
+{
+   struct sockaddr_in addr;
+   int fd, on = 1;
+
+   fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (fd < 0)
+      return -1;
+
+   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 16))
+   {
+      close(fd);
+      return -1;
+   }
+   set_nonblock(fd);
+   return fd;
+}
+
+static void close_server(CWSERVER *s)
+{
+   int i;
+
+   for (i=0; i < MAX_CLIENTS; i++)
+      drop_client(s, i);
+
+   if (s->unix_fd >= 0)
+   {
+      close(s->unix_fd);
+      unlink(s->path);
+   }
+   if (s->tcp_fd >= 0)
+      close(s->tcp_fd);
+   if (s->wake[0] >= 0)
+      close(s->wake[0]);
+   if (s->wake[1] >= 0)
+      close(s->wake[1]);
+   if (s->frame)
+      free(s->frame);
+   if (s->snapshot)
+      free(s->snapshot);
+   pthread_mutex_destroy(&s->mutex);
+   memset(s, 0, sizeof(CWSERVER));
+}
+
+//  start serving the console screen.  path is the Unix domain socket
+//  to listen on (NULL for the default), port is an optional TCP port
+//  bound to the loopback interface (0 to disable).  init_cworthy must
+//  have been called first.
+
+ULONG start_console_server(const char *path, int port)
+{
+   NWSCREEN *screen = get_console_screen();
+   CWSERVER *s = &server;
+   int i;
+
+   if (s->running || !screen->p_vidmem)
+      return -1;
+
+   memset(s, 0, sizeof(CWSERVER));
+   s->unix_fd = s->tcp_fd = -1;
+   s->wake[0] = s->wake[1] = -1;
+   s->controller = -1;
+   s->seq = 1;
+   for (i=0; i < MAX_CLIENTS; i++)
+      s->client[i].fd = -1;
+   pthread_mutex_init(&s->mutex, NULL);
+
+   s->rows = screen->nlines;
+   s->cols = screen->ncols;
+   s->size = s->rows * s->cols * 2;
+   s->out_size = CWS_HDR_LEN + 1 + CWS_HDR_LEN + CWS_FRAME_HDR_LEN + s->size;
+   s->frame = (BYTE *)calloc(1, s->size);
+   s->snapshot = (BYTE *)calloc(1, s->size);
+   if (!s->frame || !s->snapshot)
+      goto ErrorExit;
+
+   if (pipe(s->wake))
+   {
+      s->wake[0] = s->wake[1] = -1;
+      goto ErrorExit;
+   }
+   set_nonblock(s->wake[0]);
+   set_nonblock(s->wake[1]);
+
+   if (path && strlen(path) >= sizeof(s->path))
+      goto ErrorExit;
+   snprintf(s->path, sizeof(s->path), "%s", path ? path : CWS_DEFAULT_PATH);
+   s->unix_fd = open_unix_socket(s->path);
+   if (s->unix_fd < 0)
+      goto ErrorExit;
+
+   if (port)
+   {
+      s->tcp_fd = open_tcp_socket(port);
+      if (s->tcp_fd < 0)
+	 goto ErrorExit;
+   }
+
+   // seed the first frame so clients attaching before the next
+   // refresh still get the current screen
+   s->running = 1;
+   if (register_flush_hook(server_flush, s))
+      goto ErrorExit;
+   refresh_screen();
+
+   if (pthread_create(&s->thread, NULL, server_routine, s))
+   {
+      unregister_flush_hook(server_flush, s);
+      goto ErrorExit;
+   }
+   return 0;
+
+ErrorExit:;
+   close_server(s);
+   return -1;
+}
+
+ULONG stop_console_server(void)
+{
+   CWSERVER *s = &server;
+
+   if (!s->running)
+      return -1;
+
+   unregister_flush_hook(server_flush, s);
+   s->running = 0;
+   if (write(s->wake[1], "q", 1) < 0)
+      ;
+   pthread_join(s->thread, NULL);
+   close_server(s);
+   return 0;
+}
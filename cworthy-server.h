@@ -0,0 +1,79 @@
+/***************************************************************************
+*
+*   Copyright(c) Jeff V. Merkey 1997-2022.  All rights reserved.
+*
+*   Licensed under the Lesser GNU Public License (LGPL) v2.1.
+*
+*   Shared console server wire protocol.  A cworthy application
+*   started with a console server streams its screen map to any
+*   number of viewers (cwview) attached over a Unix domain socket
+*   or a TCP port on the loopback interface.
+*
+*   Every message is a one byte type followed by a 32 bit little
+*   endian payload length.  Screen cells are sent as the same
+*   (char, attr) byte pairs used by the screen map in NWSCREEN, so
+*   a character outside ASCII arrives as CW_WIDE_GLYPH and an
+*   extended attribute as its nearest PC attribute.
+*
+*   server -> client
+*      CWS_MSG_FRAME    rows, cols, cursor row, cursor col (16 bit)
+*                       followed by rows * cols cells
+*      CWS_MSG_DIFF     cursor row, cursor col (16 bit), span
+*                       count (32 bit), then for each span row,
+*                       col, length (16 bit) and length cells
+*      CWS_MSG_CONTROL  one byte, non-zero if this client is the
+*                       controller
+*
+*   client -> server
+*      CWS_MSG_HELLO    one byte of CWS_HELLO flags
+*      CWS_MSG_KEY      32 bit key code (controller only)
+*      CWS_MSG_RELEASE  give up control, no payload
+*
+**************************************************************************/
+
+#ifndef _CWORTHY_SERVER_
+#define _CWORTHY_SERVER_
+
+#define CWS_MSG_HELLO        'H'
+#define CWS_MSG_KEY          'K'
+#define CWS_MSG_RELEASE      'R'
+#define CWS_MSG_FRAME        'F'
+#define CWS_MSG_DIFF         'D'
+#define CWS_MSG_CONTROL      'C'
+
+#define CWS_HELLO_CONTROL    0x01
+
+#define CWS_HDR_LEN          5
+#define CWS_FRAME_HDR_LEN    8
+#define CWS_DIFF_HDR_LEN     8
+#define CWS_SPAN_HDR_LEN     6
+#define CWS_MAX_CLIENT_MSG   64
+
+#define CWS_DEFAULT_PATH     "/tmp/cworthy.sock"
+
+static inline void cws_put16(BYTE *p, ULONG v)
+{
+   p[0] = (BYTE)(v & 0xFF);
+   p[1] = (BYTE)((v >> 8) & 0xFF);
+}
+
+static inline void cws_put32(BYTE *p, ULONG v)
+{
+   p[0] = (BYTE)(v & 0xFF);
+   p[1] = (BYTE)((v >> 8) & 0xFF);
+   p[2] = (BYTE)((v >> 16) & 0xFF);
+   p[3] = (BYTE)((v >> 24) & 0xFF);
+}
+
+static inline ULONG cws_get16(const BYTE *p)
+{
+   return (ULONG)p[0] | ((ULONG)p[1] << 8);
+}
+
+static inline ULONG cws_get32(const BYTE *p)
+{
+   return (ULONG)p[0] | ((ULONG)p[1] << 8) |
+          ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+}
+
+#endif
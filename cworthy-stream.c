@@ -0,0 +1,414 @@
+/***************************************************************************
+*
+*   Copyright(c) Jeff V. Merkey 1997-2022.  All rights reserved.
+*
+*   Licensed under the Lesser GNU Public License (LGPL) v2.1.
+*
+*   Permission to use, copy, modify, distribute, and sell this software and its
+*   documentation for any purpose is hereby granted without fee, provided that
+*   the above copyright notice appear in all copies and that both that
+*   copyright notice and this permission notice appear in supporting
+*   documentation.  No representations are made about the suitability of
+*   this software for any purpose.  It is provided "as is" without express or
+*   implied warranty.
+*
+*   Portal streams.  A file descriptor (pipe, socket, command output or
+*   a file being tailed) is attached to a portal and its output shown
+*   there as lines, oldest at the top.  One thread polls every attached
+*   descriptor, reads whatever is waiting without blocking and splits
+*   it into lines, keeping text which has not reached its newline for
+*   the next read.  Complete lines go into a ring holding one portal of
+*   text.  The portal itself is only written from the refresh
+*   scheduler every STREAM_REFRESH_MS, in one portal update, so a fast
+*   writer costs a copy per line and at most one redraw per interval,
+*   and nothing at all while the portal is hidden.
+*
+**************************************************************************/
+
+#include "cworthy.h"
+#include <poll.h>
+#include <sys/stat.h>
+
+#define STREAM_REFRESH_MS   50
+#define STREAM_FILE_MS      100        // files are polled by timeout
+#define STREAM_CHUNK        65536
+#define STREAM_BUDGET       (4 * STREAM_CHUNK)
+#define STREAM_COL          1
+#define STREAM_TAB          8
+
+typedef struct _PORTAL_STREAM
+{
+   ULONG portal;
+   int fd;
+   int file;                   // regular file, read again at EOF
+   int eof;
+   ULONG attr;
+   ULONG count;                // lines in the portal and the ring
+   ULONG width;                // characters per line
+   char *ring;                 // count lines of width + 1
+   char *partial;              // the line being read
+   ULONG plen;
+   LONGLONG written;           // complete lines read
+   LONGLONG flushed;           // lines written to the portal
+   PORTAL_LINE *lines;
+} PORTAL_STREAM;
+
+typedef struct _STREAM_TABLE
+{
+   pthread_mutex_t mutex;
+   pthread_t thread;
+   int running;
+   int stop;
+   int wake[2];
+   ULONG count;
+   PORTAL_STREAM *streams[MAX_MENU];
+} STREAM_TABLE;
+
+static STREAM_TABLE st = { PTHREAD_MUTEX_INITIALIZER };
+static char stream_buffer[STREAM_CHUNK];
+
+static inline char *ring_line(PORTAL_STREAM *s, LONGLONG line)
+{
+   return &s->ring[(line % s->count) * (s->width + 1)];
+}
+
+static void end_line(PORTAL_STREAM *s)
+{
+   char *p = ring_line(s, s->written);
+
+   memcpy(p, s->partial, s->plen);
+   p[s->plen] = '\0';
+   s->plen = 0;
+   s->written++;
+}
+
+// split len bytes into lines.  Tabs are expanded, other control
+// characters dropped, and lines longer than the portal are wrapped.
+
+static void stream_text(PORTAL_STREAM *s, const char *p, ULONG len)
+{
+   const char *end = p + len;
+   unsigned char c;
+
+   while (p < end)
+   {
+      c = (unsigned char)*p++;
+      if (c == '\n')
+      {
+	 end_line(s);
+	 continue;
+      }
+      if (c == '\t')
+      {
+	 do
+	 {
+	    s->partial[s->plen++] = ' ';
+	 } while ((s->plen % STREAM_TAB) && s->plen < s->width);
+      }
+      else if (c < ' ' || c == 0x7F)
+	 continue;
+      else
+	 s->partial[s->plen++] = c;
+
+      if (s->plen >= s->width)
+	 end_line(s);
+   }
+}
+
+// read what is waiting, called with the table locked.  Each stream
+// gets at most STREAM_BUDGET bytes per pass so one busy writer can
+// not hold up the others.
+
+static void stream_read(PORTAL_STREAM *s)
+{
+   ULONG total = 0;
+   ssize_t n;
+
+   while (total < STREAM_BUDGET)
+   {
+      n = read(s->fd, stream_buffer, sizeof(stream_buffer));
+      if (n > 0)
+      {
+	 stream_text(s, stream_buffer, n);
+	 total += n;
+	 continue;
+      }
+      if (n < 0 && errno == EINTR)
+	 continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	 break;
+
+      // end of the stream, a file being tailed may still grow
+      if (!n && s->file)
+	 break;
+      if (s->plen)
+	 end_line(s);
+      s->eof = 1;
+      break;
+   }
+}
+
+static void *stream_routine(void *p)
+{
+   struct pollfd pfd[MAX_MENU + 1];
+   ULONG index[MAX_MENU + 1];
+   PORTAL_STREAM *s;
+   ULONG i, n;
+   int files, timeout;
+   char drain[64];
+
+   pthread_mutex_lock(&st.mutex);
+   while (!st.stop)
+   {
+      pfd[0].fd = st.wake[0];
+      pfd[0].events = POLLIN;
+      for (i=1, n=1, files=0; i < MAX_MENU; i++)
+      {
+	 s = st.streams[i];
+	 if (!s || s->eof)
+	    continue;
+	 if (s->file)
+	 {
+	    files++;
+	    continue;
+	 }
+	 pfd[n].fd = s->fd;
+	 pfd[n].events = POLLIN;
+	 index[n++] = i;
+      }
+      timeout = files ? STREAM_FILE_MS : -1;
+      pthread_mutex_unlock(&st.mutex);
+
+      if (poll(pfd, n, timeout) < 0 && errno != EINTR)
+	 n = 0;
+
+      pthread_mutex_lock(&st.mutex);
+      if (pfd[0].revents & POLLIN)
+	 while (read(st.wake[0], drain, sizeof(drain)) > 0)
+	    ;
+
+      // a stream may have been detached while we were waiting
+      for (i=1; i < n; i++)
+      {
+	 s = st.streams[index[i]];
+	 if (s && s->fd == pfd[i].fd && !s->eof && pfd[i].revents)
+	    stream_read(s);
+      }
+      if (files)
+      {
+	 for (i=1; i < MAX_MENU; i++)
+	 {
+	    s = st.streams[i];
+	    if (s && s->file)
+	       stream_read(s);
+	 }
+      }
+   }
+   pthread_mutex_unlock(&st.mutex);
+   return NULL;
+}
+
+// refresh provider, copy the lines read since the last call into the
+// portal.  Until the ring has wrapped new lines are appended, after
+// that the whole portal is rewritten oldest first.
+
+static ULONG stream_flush(ULONG portal, void *context)
+{
+   PORTAL_STREAM *s = (PORTAL_STREAM *)context;
+   LONGLONG first, line;
+   ULONG n = 0;
+
+   pthread_mutex_lock(&st.mutex);
+   if (s->flushed == s->written)
+   {
+      pthread_mutex_unlock(&st.mutex);
+      return 1;
+   }
+
+   first = (s->written > (LONGLONG)s->count) ? s->written - s->count : 0;
+   line = (s->written > (LONGLONG)s->count) ? first : s->flushed;
+   for (; line < s->written; line++, n++)
+   {
+      s->lines[n].text = ring_line(s, line);
+      s->lines[n].row = line - first;
+      s->lines[n].col = STREAM_COL;
+      s->lines[n].attr = s->attr;
+      s->lines[n].flags = PORTAL_CLEOL;
+   }
+   write_portal_lines(portal, s->lines, n);
+   s->flushed = s->written;
+   pthread_mutex_unlock(&st.mutex);
+   return 0;
+}
+
+static void free_stream(PORTAL_STREAM *s)
+{
+   if (s->ring)
+      free(s->ring);
+   if (s->partial)
+      free(s->partial);
+   if (s->lines)
+      free(s->lines);
+   free(s);
+}
+
+static void wake_streams(void)
+{
+   char c = 0;
+
+   if (write(st.wake[1], &c, 1) < 0)
+      return;
+}
+
+// show the output of fd in portal.  fd is made non blocking and is
+// not closed by the library.  The portal can not also have a refresh
+// provider of its own.
+
+ULONG attach_portal_stream(ULONG portal, int fd, ULONG attr)
+{
+   PORTAL_STREAM *s;
+   struct stat sb;
+   int flags;
+
+   if (!portal || portal >= MAX_MENU || fd < 0 || !frame[portal].owner ||
+       !frame[portal].el_count || frame[portal].screen->ncols < STREAM_COL + 2)
+      return -1;
+
+   flags = fcntl(fd, F_GETFL);
+   if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+      return -1;
+
+   s = (PORTAL_STREAM *)calloc(1, sizeof(PORTAL_STREAM));
+   if (!s)
+      return -1;
+
+   s->portal = portal;
+   s->fd = fd;
+   s->file = !fstat(fd, &sb) && S_ISREG(sb.st_mode);
+   s->attr = attr;
+   s->count = frame[portal].el_count;
+   s->width = frame[portal].screen->ncols - 1 - STREAM_COL;
+   s->ring = (char *)malloc(s->count * (s->width + 1));
+   s->partial = (char *)malloc(s->width + STREAM_TAB);
+   s->lines = (PORTAL_LINE *)malloc(s->count * sizeof(PORTAL_LINE));
+   if (!s->ring || !s->partial || !s->lines)
+   {
+      free_stream(s);
+      return -1;
+   }
+
+   pthread_mutex_lock(&st.mutex);
+   if (st.streams[portal])
+   {
+      pthread_mutex_unlock(&st.mutex);
+      free_stream(s);
+      return -1;
+   }
+
+   if (!st.running)
+   {
+      if (pipe(st.wake))
+      {
+	 pthread_mutex_unlock(&st.mutex);
+	 free_stream(s);
+	 return -1;
+      }
+      fcntl(st.wake[0], F_SETFL, O_NONBLOCK);
+      fcntl(st.wake[1], F_SETFL, O_NONBLOCK);
+      fcntl(st.wake[0], F_SETFD, FD_CLOEXEC);
+      fcntl(st.wake[1], F_SETFD, FD_CLOEXEC);
+      st.stop = 0;
+      if (pthread_create(&st.thread, NULL, stream_routine, NULL))
+      {
+	 close(st.wake[0]);
+	 close(st.wake[1]);
+	 pthread_mutex_unlock(&st.mutex);
+	 free_stream(s);
+	 return -1;
+      }
+      st.running = 1;
+   }
+
+   if (register_portal_refresh(portal, STREAM_REFRESH_MS, stream_flush, s))
+   {
+      pthread_mutex_unlock(&st.mutex);
+      free_stream(s);
+      return -1;
+   }
+   st.streams[portal] = s;
+   st.count++;
+   wake_streams();
+   pthread_mutex_unlock(&st.mutex);
+   return 0;
+}
+
+// once this returns fd is no longer read and the portal is no longer
+// written, the caller may close fd and free the portal
+
+ULONG detach_portal_stream(ULONG portal)
+{
+   PORTAL_STREAM *s;
+
+   if (!portal || portal >= MAX_MENU)
+      return -1;
+
+   pthread_mutex_lock(&st.mutex);
+   s = st.streams[portal];
+   pthread_mutex_unlock(&st.mutex);
+   if (!s)
+      return -1;
+
+   // the provider takes the table lock, so it is removed first
+   unregister_portal_refresh(portal);
+
+   pthread_mutex_lock(&st.mutex);
+   st.streams[portal] = NULL;
+   st.count--;
+   wake_streams();
+   pthread_mutex_unlock(&st.mutex);
+   free_stream(s);
+   return 0;
+}
+
+// true once the writer has closed its end and every line has been
+// read
+
+ULONG portal_stream_done(ULONG portal)
+{
+   PORTAL_STREAM *s;
+   ULONG done = 0;
+
+   if (!portal || portal >= MAX_MENU)
+      return 0;
+
+   pthread_mutex_lock(&st.mutex);
+   s = st.streams[portal];
+   if (s)
+      done = s->eof;
+   pthread_mutex_unlock(&st.mutex);
+   return done;
+}
+
+void stop_portal_streams(void)
+{
+   ULONG i;
+
+   for (i=1; i < MAX_MENU; i++)
+      if (st.streams[i])
+	 detach_portal_stream(i);
+
+   pthread_mutex_lock(&st.mutex);
+   if (!st.running)
+   {
+      pthread_mutex_unlock(&st.mutex);
+      return;
+   }
+   st.stop = 1;
+   wake_streams();
+   pthread_mutex_unlock(&st.mutex);
+
+   pthread_join(st.thread, NULL);
+   close(st.wake[0]);
+   close(st.wake[1]);
+   st.running = 0;
+}
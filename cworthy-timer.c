@@ -0,0 +1,437 @@
+/***************************************************************************
+*
+*   Copyright(c) Jeff V. Merkey 1997-2022.  All rights reserved.
+*
+*   Licensed under the Lesser GNU Public License (LGPL) v2.1.
+*
+*   Permission to use, copy, modify, distribute, and sell this software and its
+*   documentation for any purpose is hereby granted without fee, provided that
+*   the above copyright notice appear in all copies and that both that
+*   copyright notice and this permission notice appear in supporting
+*   documentation.  No representations are made about the suitability of
+*   this software for any purpose.  It is provided "as is" without express or
+*   implied warranty.
+*
+*   Portal refresh scheduler.  A single thread sleeping on one timerfd
+*   runs the data provider of every registered portal on its interval.
+*   Timers live in a three level hierarchical timing wheel with 10ms
+*   ticks, so adding, removing and expiring a timer is O(1) however
+*   many portals are registered.  Providers due in the same tick are
+*   run together and their portals redrawn once.  Portals which are
+*   masked, inactive or covered by the screensaver are skipped, and a
+*   provider which missed a tick while hidden is run again as soon as
+*   its portal becomes visible, rather than at its next interval.
+*   Background portals are treated the same way while a slow link is
+*   congested, see set_slow_link().
+*
+**************************************************************************/
+
+#include "cworthy.h"
+#include <poll.h>
+#include <sys/timerfd.h>
+
+#define TICK_NS          10000000LL   // 10ms
+#define WHEEL0_BITS      8
+#define WHEEL1_BITS      6
+#define WHEEL2_BITS      6
+#define WHEEL0_SIZE      (1 << WHEEL0_BITS)
+#define WHEEL1_SIZE      (1 << WHEEL1_BITS)
+#define WHEEL2_SIZE      (1 << WHEEL2_BITS)
+#define WHEEL1_SHIFT     WHEEL0_BITS
+#define WHEEL2_SHIFT     (WHEEL0_BITS + WHEEL1_BITS)
+#define WHEEL_SPAN       (1LL << (WHEEL0_BITS + WHEEL1_BITS + WHEEL2_BITS))
+
+typedef struct _REFRESH_TIMER
+{
+   struct _REFRESH_TIMER *next;
+   struct _REFRESH_TIMER *prior;
+   struct _REFRESH_TIMER **slot;
+   ULONG portal;
+   LONGLONG interval;          // ticks
+   LONGLONG expires;           // absolute tick
+   ULONG (*callback)(ULONG portal, void *context);
+   void *context;
+   ULONG busy;
+   ULONG dead;
+   ULONG missed;               // skipped a tick while hidden
+} REFRESH_TIMER;
+
+typedef struct _TIMER_WHEEL
+{
+   pthread_mutex_t mutex;
+   pthread_cond_t idle;
+   pthread_t thread;
+   int running;
+   int stop;
+   int catch_up;
+   int tfd;
+   LONGLONG base_ns;
+   LONGLONG current;           // last tick processed
+   ULONG count;
+   REFRESH_TIMER *wheel0[WHEEL0_SIZE];
+   REFRESH_TIMER *wheel1[WHEEL1_SIZE];
+   REFRESH_TIMER *wheel2[WHEEL2_SIZE];
+   REFRESH_TIMER *portals[MAX_MENU];
+} TIMER_WHEEL;
+
+static TIMER_WHEEL tw = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static inline LONGLONG current_tick(void)
+{
+   return (get_ns() - tw.base_ns) / TICK_NS;
+}
+
+static void link_timer(REFRESH_TIMER **slot, REFRESH_TIMER *t)
+{
+   t->slot = slot;
+   t->prior = NULL;
+   t->next = *slot;
+   if (*slot)
+      (*slot)->prior = t;
+   *slot = t;
+}
+
+static REFRESH_TIMER **timer_slot(REFRESH_TIMER *t)
+{
+   LONGLONG delta = t->expires - tw.current;
+
+   if (delta < WHEEL0_SIZE)
+      return &tw.wheel0[t->expires & (WHEEL0_SIZE - 1)];
+   if (delta < (1LL << WHEEL2_SHIFT))
+      return &tw.wheel1[(t->expires >> WHEEL1_SHIFT) & (WHEEL1_SIZE - 1)];
+   return &tw.wheel2[(t->expires >> WHEEL2_SHIFT) & (WHEEL2_SIZE - 1)];
+}
+
+static void insert_timer(REFRESH_TIMER *t)
+{
+   if (t->expires <= tw.current)
+      t->expires = tw.current + 1;
+   if (t->expires - tw.current >= WHEEL_SPAN)
+      t->expires = tw.current + WHEEL_SPAN - 1;
+   link_timer(timer_slot(t), t);
+}
+
+static void remove_timer(REFRESH_TIMER *t)
+{
+   if (t->prior)
+      t->prior->next = t->next;
+   else
+      *t->slot = t->next;
+   if (t->next)
+      t->next->prior = t->prior;
+   t->next = t->prior = NULL;
+}
+
+// move every timer in a higher level slot down to its new position
+
+static void cascade(REFRESH_TIMER **slot)
+{
+   REFRESH_TIMER *t, *list = *slot;
+
+   *slot = NULL;
+   while (list)
+   {
+      t = list;
+      list = t->next;
+      link_timer(timer_slot(t), t);
+   }
+}
+
+// arm the timerfd for the next occupied tick.  Only level 0 is
+// searched, anything further out wakes us at the next cascade.
+
+static void arm_timer(void)
+{
+   struct itimerspec its;
+   LONGLONG tick, ns;
+   ULONG i;
+
+   memset(&its, 0, sizeof(its));
+   if (tw.stop || tw.catch_up)
+      its.it_value.tv_nsec = 1;
+   else if (tw.count)
+   {
+      tick = (tw.current | (WHEEL0_SIZE - 1)) + 1;
+      for (i=1; i < WHEEL0_SIZE; i++)
+      {
+	 if (tw.wheel0[(tw.current + i) & (WHEEL0_SIZE - 1)])
+	 {
+	    tick = tw.current + i;
+	    break;
+	 }
+      }
+      ns = tw.base_ns + tick * TICK_NS - get_ns();
+      if (ns <= 0)
+	 ns = 1;
+      its.it_value.tv_sec = ns / 1000000000LL;
+      its.it_value.tv_nsec = ns % 1000000000LL;
+   }
+   timerfd_settime(tw.tfd, 0, &its, NULL);
+}
+
+// all providers due in a tick run first, then each portal they fed
+// is redrawn, so the screen is flushed once per tick
+
+static void run_due(REFRESH_TIMER **due, ULONG count)
+{
+   BYTE redraw[MAX_MENU];
+   ULONG i, portal;
+
+   memset(redraw, 0, sizeof(redraw));
+   for (i=0; i < count; i++)
+   {
+      portal = due[i]->portal;
+      if (!portal_visible(portal) || defer_portal_update(portal))
+      {
+	 due[i]->missed = 1;
+	 continue;
+      }
+      due[i]->missed = 0;
+      if (!(due[i]->callback)(portal, due[i]->context))
+	 redraw[portal] = 1;
+   }
+
+   for (i=0; i < count; i++)
+   {
+      portal = due[i]->portal;
+      if (redraw[portal] && !due[i]->dead)
+      {
+	 redraw[portal] = 0;
+	 update_static_portal(portal);
+      }
+   }
+}
+
+static void *timer_routine(void *p)
+{
+   REFRESH_TIMER *due[MAX_MENU], *t;
+   struct pollfd pfd;
+   LONGLONG now;
+   ULONG count, i, idx;
+   uint64_t expirations;
+
+   pfd.fd = tw.tfd;
+   pfd.events = POLLIN;
+
+   pthread_mutex_lock(&tw.mutex);
+   while (!tw.stop)
+   {
+      arm_timer();
+      pthread_mutex_unlock(&tw.mutex);
+
+      if (poll(&pfd, 1, -1) > 0 &&
+	  read(tw.tfd, &expirations, sizeof(expirations)) < 0)
+	 expirations = 0;
+
+      pthread_mutex_lock(&tw.mutex);
+      if (tw.stop)
+	 break;
+
+      now = current_tick();
+      if (!tw.count)
+	 tw.current = now;
+
+      count = 0;
+      while (tw.current < now)
+      {
+	 tw.current++;
+	 idx = tw.current & (WHEEL0_SIZE - 1);
+	 if (!idx)
+	 {
+	    if (!((tw.current >> WHEEL1_SHIFT) & (WHEEL1_SIZE - 1)))
+	       cascade(&tw.wheel2[(tw.current >> WHEEL2_SHIFT) &
+				  (WHEEL2_SIZE - 1)]);
+	    cascade(&tw.wheel1[(tw.current >> WHEEL1_SHIFT) &
+			       (WHEEL1_SIZE - 1)]);
+	 }
+
+	 // collect everything due up to now, a late wakeup runs each
+	 // provider once rather than once per missed interval
+	 while ((t = tw.wheel0[idx]))
+	 {
+	    remove_timer(t);
+	    t->expires = tw.current + t->interval;
+	    if (t->expires <= now)
+	       t->expires = now + 1;
+	    insert_timer(t);
+	    if (count < MAX_MENU)
+	    {
+	       t->busy = 1;
+	       due[count++] = t;
+	    }
+	 }
+      }
+
+      // portals which became visible again get the data they missed
+      if (tw.catch_up)
+      {
+	 tw.catch_up = 0;
+	 for (i=1; i < MAX_MENU && count < MAX_MENU; i++)
+	 {
+	    t = tw.portals[i];
+	    if (t && t->missed && !t->busy && portal_visible(i))
+	    {
+	       t->busy = 1;
+	       due[count++] = t;
+	    }
+	 }
+      }
+
+      if (!count)
+	 continue;
+
+      pthread_mutex_unlock(&tw.mutex);
+      run_due(due, count);
+      pthread_mutex_lock(&tw.mutex);
+
+      for (i=0; i < count; i++)
+      {
+	 due[i]->busy = 0;
+	 if (due[i]->dead)
+	    free(due[i]);
+      }
+      pthread_cond_broadcast(&tw.idle);
+   }
+   pthread_mutex_unlock(&tw.mutex);
+   return NULL;
+}
+
+// call callback for portal every interval_ms milliseconds, starting
+// at the next tick.  The portal is redrawn after the callback unless
+// the callback returns non zero.  One provider per portal.
+
+ULONG register_portal_refresh(ULONG portal, ULONG interval_ms,
+			      ULONG (*callback)(ULONG portal, void *context),
+			      void *context)
+{
+   REFRESH_TIMER *t;
+
+   if (!portal || portal >= MAX_MENU || !callback)
+      return -1;
+
+   t = (REFRESH_TIMER *)calloc(1, sizeof(REFRESH_TIMER));
+   if (!t)
+      return -1;
+
+   t->portal = portal;
+   t->interval = (interval_ms * 1000000LL + TICK_NS - 1) / TICK_NS;
+   if (!t->interval)
+      t->interval = 1;
+   t->callback = callback;
+   t->context = context;
+
+   pthread_mutex_lock(&tw.mutex);
+   if (tw.portals[portal])
+   {
+      pthread_mutex_unlock(&tw.mutex);
+      free(t);
+      return -1;
+   }
+
+   if (!tw.running)
+   {
+      tw.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+      if (tw.tfd < 0)
+      {
+	 pthread_mutex_unlock(&tw.mutex);
+	 free(t);
+	 return -1;
+      }
+      tw.base_ns = get_ns();
+      tw.current = 0;
+      tw.stop = 0;
+      if (pthread_create(&tw.thread, NULL, timer_routine, NULL))
+      {
+	 close(tw.tfd);
+	 pthread_mutex_unlock(&tw.mutex);
+	 free(t);
+	 return -1;
+      }
+      tw.running = 1;
+   }
+
+   // an empty wheel is not advanced by the thread, catch it up here
+   if (!tw.count)
+      tw.current = current_tick();
+   t->expires = current_tick() + 1;
+   insert_timer(t);
+   tw.portals[portal] = t;
+   tw.count++;
+   arm_timer();
+   pthread_mutex_unlock(&tw.mutex);
+   return 0;
+}
+
+// once this returns the callback is not running and will not be
+// called again, so the caller may free the portal and its context.
+
+ULONG unregister_portal_refresh(ULONG portal)
+{
+   REFRESH_TIMER *t;
+
+   if (!portal || portal >= MAX_MENU)
+      return -1;
+
+   pthread_mutex_lock(&tw.mutex);
+   t = tw.portals[portal];
+   if (!t)
+   {
+      pthread_mutex_unlock(&tw.mutex);
+      return -1;
+   }
+   remove_timer(t);
+   tw.portals[portal] = NULL;
+   tw.count--;
+
+   // a provider removing itself is freed by the thread after its tick
+   if (t->busy && pthread_equal(tw.thread, pthread_self()))
+   {
+      t->dead = 1;
+      pthread_mutex_unlock(&tw.mutex);
+      return 0;
+   }
+
+   while (t->busy)
+      pthread_cond_wait(&tw.idle, &tw.mutex);
+   pthread_mutex_unlock(&tw.mutex);
+   free(t);
+   return 0;
+}
+
+void stop_portal_refresh(void)
+{
+   ULONG i;
+
+   for (i=1; i < MAX_MENU; i++)
+      if (tw.portals[i])
+	 unregister_portal_refresh(i);
+
+   pthread_mutex_lock(&tw.mutex);
+   if (!tw.running)
+   {
+      pthread_mutex_unlock(&tw.mutex);
+      return;
+   }
+   tw.stop = 1;
+   arm_timer();
+   pthread_mutex_unlock(&tw.mutex);
+
+   pthread_join(tw.thread, NULL);
+   close(tw.tfd);
+   tw.running = 0;
+}
+
+// called when any portal is shown, unmasked or uncovered by the
+// screensaver.  wakes the thread to run providers which missed a
+// tick while their portal was hidden.
+
+void portal_refresh_catch_up(void)
+{
+   pthread_mutex_lock(&tw.mutex);
+   if (tw.running && tw.count)
+   {
+      tw.catch_up = 1;
+      arm_timer();
+   }
+   pthread_mutex_unlock(&tw.mutex);
+}
@@ -0,0 +1,360 @@
+/***************************************************************************
+*
+*   Copyright(c) Jeff V. Merkey 1997-2022.  All rights reserved.
+*
+*   Licensed under the Lesser GNU Public License (LGPL) v2.1.
+*
+*   Permission to use, copy, modify, distribute, and sell this software and its
+*   documentation for any purpose is hereby granted without fee, provided that
+*   the above copyright notice appear in all copies and that both that
+*   copyright notice and this permission notice appear in supporting
+*   documentation.  No representations are made about the suitability of
+*   this software for any purpose.  It is provided "as is" without express or
+*   implied warranty.
+*
+*   UTF-8 decoding and display widths for unicode mode.  Widths come
+*   from a two level table built on first use from the range lists
+*   below, 256 code points per block with identical blocks shared, so
+*   a lookup is two array reads and the table needs about 20K.  The
+*   widths do not depend on the locale or the libc wcwidth.
+*
+**************************************************************************/
+
+#include "cworthy.h"
+#include <stdint.h>
+
+#define WBLOCK_BITS      8
+#define WBLOCK_SIZE      (1 << WBLOCK_BITS)
+#define WBLOCK_BYTES     (WBLOCK_SIZE / 4)      // 2 bits per code point
+#define MAX_CODEPOINT    0x110000
+#define BLOCKS           (MAX_CODEPOINT >> WBLOCK_BITS)
+#define REPLACEMENT      0xFFFD
+
+typedef struct _WIDTH_RANGE
+{
+   ULONG first;
+   ULONG last;
+} WIDTH_RANGE;
+
+// combining marks and format characters, drawn in no columns
+
+static const WIDTH_RANGE zero_width[] =
+{
+   { 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD },
+   { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 }, { 0x05C4, 0x05C5 },
+   { 0x05C7, 0x05C7 }, { 0x0610, 0x061A }, { 0x064B, 0x065F },
+   { 0x0670, 0x0670 }, { 0x06D6, 0x06DC }, { 0x06DF, 0x06E4 },
+   { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED }, { 0x0711, 0x0711 },
+   { 0x0730, 0x074A }, { 0x07A6, 0x07B0 }, { 0x07EB, 0x07F3 },
+   { 0x0816, 0x082D }, { 0x0859, 0x085B }, { 0x08D3, 0x0902 },
+   { 0x093A, 0x093A }, { 0x093C, 0x093C }, { 0x0941, 0x0948 },
+   { 0x094D, 0x094D }, { 0x0951, 0x0957 }, { 0x0962, 0x0963 },
+   { 0x0981, 0x0981 }, { 0x09BC, 0x09BC }, { 0x09C1, 0x09C4 },
+   { 0x09CD, 0x09CD }, { 0x09E2, 0x09E3 }, { 0x0A01, 0x0A02 },
+   { 0x0A3C, 0x0A3C }, { 0x0A41, 0x0A51 }, { 0x0A70, 0x0A71 },
+   { 0x0A81, 0x0A82 }, { 0x0ABC, 0x0ABC }, { 0x0AC1, 0x0AC8 },
+   { 0x0ACD, 0x0ACD }, { 0x0B01, 0x0B01 }, { 0x0B3C, 0x0B3C },
+   { 0x0B41, 0x0B44 }, { 0x0B4D, 0x0B4D }, { 0x0BC0, 0x0BC0 },
+   { 0x0BCD, 0x0BCD }, { 0x0C3E, 0x0C40 }, { 0x0C46, 0x0C56 },
+   { 0x0CBC, 0x0CBC }, { 0x0CCC, 0x0CCD }, { 0x0D41, 0x0D44 },
+   { 0x0D4D, 0x0D4D }, { 0x0DCA, 0x0DCA }, { 0x0DD2, 0x0DD6 },
+   { 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E },
+   { 0x0EB1, 0x0EB1 }, { 0x0EB4, 0x0EBC }, { 0x0EC8, 0x0ECD },
+   { 0x0F18, 0x0F19 }, { 0x0F35, 0x0F39 }, { 0x0F71, 0x0F84 },
+   { 0x0F86, 0x0F87 }, { 0x0F8D, 0x0FBC }, { 0x102D, 0x1037 },
+   { 0x1039, 0x103A }, { 0x1160, 0x11FF }, { 0x135D, 0x135F },
+   { 0x1712, 0x1714 }, { 0x1732, 0x1734 }, { 0x17B4, 0x17B5 },
+   { 0x17B7, 0x17BD }, { 0x17C6, 0x17C6 }, { 0x17C9, 0x17D3 },
+   { 0x180B, 0x180E }, { 0x1A17, 0x1A18 }, { 0x1AB0, 0x1AFF },
+   { 0x1B00, 0x1B03 }, { 0x1B34, 0x1B34 }, { 0x1B36, 0x1B3A },
+   { 0x1DC0, 0x1DFF }, { 0x200B, 0x200F }, { 0x202A, 0x202E },
+   { 0x2060, 0x2064 }, { 0x20D0, 0x20F0 }, { 0x2CEF, 0x2CF1 },
+   { 0x2DE0, 0x2DFF }, { 0x302A, 0x302D }, { 0x3099, 0x309A },
+   { 0xA66F, 0xA672 }, { 0xA674, 0xA67D }, { 0xA69E, 0xA69F },
+   { 0xA6F0, 0xA6F1 }, { 0xA802, 0xA802 }, { 0xA806, 0xA806 },
+   { 0xA80B, 0xA80B }, { 0xA825, 0xA826 }, { 0xA8E0, 0xA8F1 },
+   { 0xFB1E, 0xFB1E }, { 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F },
+   { 0xFEFF, 0xFEFF }, { 0xFFF9, 0xFFFB }, { 0x101FD, 0x101FD },
+   { 0x10A01, 0x10A0F }, { 0x10A38, 0x10A3F }, { 0x1D167, 0x1D169 },
+   { 0x1D173, 0x1D182 }, { 0x1D185, 0x1D18B }, { 0x1D1AA, 0x1D1AD },
+   { 0x1E8D0, 0x1E8D6 }, { 0xE0001, 0xE007F }, { 0xE0100, 0xE01EF },
+};
+
+// east asian wide and fullwidth characters and emoji, drawn in two
+// columns
+
+static const WIDTH_RANGE double_width[] =
+{
+   { 0x1100, 0x115F }, { 0x231A, 0x231B }, { 0x2329, 0x232A },
+   { 0x23E9, 0x23EC }, { 0x23F0, 0x23F0 }, { 0x23F3, 0x23F3 },
+   { 0x25FD, 0x25FE }, { 0x2614, 0x2615 }, { 0x2648, 0x2653 },
+   { 0x267F, 0x267F }, { 0x2693, 0x2693 }, { 0x26A1, 0x26A1 },
+   { 0x26AA, 0x26AB }, { 0x26BD, 0x26BE }, { 0x26C4, 0x26C5 },
+   { 0x26CE, 0x26CE }, { 0x26D4, 0x26D4 }, { 0x26EA, 0x26EA },
+   { 0x26F2, 0x26F3 }, { 0x26F5, 0x26F5 }, { 0x26FA, 0x26FA },
+   { 0x26FD, 0x26FD }, { 0x2705, 0x2705 }, { 0x270A, 0x270B },
+   { 0x2728, 0x2728 }, { 0x274C, 0x274C }, { 0x274E, 0x274E },
+   { 0x2753, 0x2755 }, { 0x2757, 0x2757 }, { 0x2795, 0x2797 },
+   { 0x27B0, 0x27B0 }, { 0x27BF, 0x27BF }, { 0x2B1B, 0x2B1C },
+   { 0x2B50, 0x2B50 }, { 0x2B55, 0x2B55 }, { 0x2E80, 0x3029 },
+   { 0x302E, 0x303E }, { 0x3041, 0x3098 }, { 0x309B, 0x33FF },
+   { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF },
+   { 0xA960, 0xA97F }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF },
+   { 0xFE10, 0xFE19 }, { 0xFE30, 0xFE6F }, { 0xFF00, 0xFF60 },
+   { 0xFFE0, 0xFFE6 }, { 0x16FE0, 0x16FE4 }, { 0x17000, 0x18AFF },
+   { 0x1B000, 0x1B2FF }, { 0x1F004, 0x1F004 }, { 0x1F0CF, 0x1F0CF },
+   { 0x1F18E, 0x1F18E }, { 0x1F191, 0x1F19A }, { 0x1F200, 0x1F202 },
+   { 0x1F210, 0x1F23B }, { 0x1F240, 0x1F248 }, { 0x1F250, 0x1F251 },
+   { 0x1F300, 0x1F320 }, { 0x1F32D, 0x1F335 }, { 0x1F337, 0x1F37C },
+   { 0x1F37E, 0x1F393 }, { 0x1F3A0, 0x1F3CA }, { 0x1F3CF, 0x1F3D3 },
+   { 0x1F3E0, 0x1F3F0 }, { 0x1F3F4, 0x1F3F4 }, { 0x1F3F8, 0x1F43E },
+   { 0x1F440, 0x1F440 }, { 0x1F442, 0x1F4FC }, { 0x1F4FF, 0x1F53D },
+   { 0x1F54B, 0x1F54E }, { 0x1F550, 0x1F567 }, { 0x1F57A, 0x1F57A },
+   { 0x1F595, 0x1F596 }, { 0x1F5A4, 0x1F5A4 }, { 0x1F5FB, 0x1F64F },
+   { 0x1F680, 0x1F6C5 }, { 0x1F6CC, 0x1F6CC }, { 0x1F6D0, 0x1F6D2 },
+   { 0x1F6D5, 0x1F6D7 }, { 0x1F6EB, 0x1F6EC }, { 0x1F6F4, 0x1F6FC },
+   { 0x1F7E0, 0x1F7EB }, { 0x1F90C, 0x1F93A }, { 0x1F93C, 0x1F945 },
+   { 0x1F947, 0x1F9FF }, { 0x1FA70, 0x1FAFF }, { 0x20000, 0x2FFFD },
+   { 0x30000, 0x3FFFD },
+};
+
+#define ZERO_RANGES     (sizeof(zero_width) / sizeof(WIDTH_RANGE))
+#define DOUBLE_RANGES   (sizeof(double_width) / sizeof(WIDTH_RANGE))
+
+static WORD width_index[BLOCKS];
+static BYTE *width_blocks;
+static pthread_once_t width_once = PTHREAD_ONCE_INIT;
+
+static void apply_ranges(BYTE *w, ULONG base, const WIDTH_RANGE *r,
+			 ULONG count, ULONG *next, BYTE width)
+{
+   ULONG i, first, last;
+
+   // ranges are sorted, skip those ending before this block
+   while (*next < count && r[*next].last < base)
+      (*next)++;
+
+   for (i = *next; i < count && r[i].first < base + WBLOCK_SIZE; i++)
+   {
+      first = (r[i].first > base) ? r[i].first - base : 0;
+      last = (r[i].last < base + WBLOCK_SIZE - 1) ? r[i].last - base
+	     : WBLOCK_SIZE - 1;
+      memset(&w[first], width, last - first + 1);
+   }
+}
+
+static void build_width_table(void)
+{
+   BYTE w[WBLOCK_SIZE], packed[WBLOCK_BYTES], *p;
+   ULONG block, i, count = 0, size = 64, zero_next = 0, double_next = 0;
+
+   width_blocks = (BYTE *)malloc(size * WBLOCK_BYTES);
+   if (!width_blocks)
+      return;
+
+   for (block=0; block < BLOCKS; block++)
+   {
+      memset(w, 1, sizeof(w));
+      apply_ranges(w, block << WBLOCK_BITS, zero_width, ZERO_RANGES,
+		   &zero_next, 0);
+      apply_ranges(w, block << WBLOCK_BITS, double_width, DOUBLE_RANGES,
+		   &double_next, 2);
+
+      memset(packed, 0, sizeof(packed));
+      for (i=0; i < WBLOCK_SIZE; i++)
+	 packed[i >> 2] |= w[i] << ((i & 3) * 2);
+
+      // most blocks repeat the previous one or are all single width,
+      // which is always the first block stored after block 0
+      if (count && !memcmp(&width_blocks[(count - 1) * WBLOCK_BYTES],
+			   packed, WBLOCK_BYTES))
+      {
+	 width_index[block] = count - 1;
+	 continue;
+      }
+      if (count > 1 && !memcmp(&width_blocks[1 * WBLOCK_BYTES], packed,
+			       WBLOCK_BYTES))
+      {
+	 width_index[block] = 1;
+	 continue;
+      }
+
+      if (count >= size)
+      {
+	 p = (BYTE *)realloc(width_blocks, size * 2 * WBLOCK_BYTES);
+	 if (!p)
+	 {
+	    free(width_blocks);
+	    width_blocks = NULL;
+	    return;
+	 }
+	 width_blocks = p;
+	 size *= 2;
+      }
+      memcpy(&width_blocks[count * WBLOCK_BYTES], packed, WBLOCK_BYTES);
+      width_index[block] = count++;
+   }
+}
+
+// columns used by a code point: 0 for combining marks, 2 for wide
+// characters, otherwise 1
+
+ULONG cw_wcwidth(ULONG cp)
+{
+   BYTE b;
+
+   if (cp < 0x300)
+      return 1;
+   if (cp >= MAX_CODEPOINT)
+      return 1;
+
+   pthread_once(&width_once, build_width_table);
+   if (!width_blocks)
+      return 1;
+
+   b = width_blocks[width_index[cp >> WBLOCK_BITS] * WBLOCK_BYTES +
+		    ((cp & (WBLOCK_SIZE - 1)) >> 2)];
+   return (b >> ((cp & 3) * 2)) & 3;
+}
+
+// decode one character and advance the string.  Malformed sequences
+// and C1 controls decode to U+FFFD one byte at a time so a bad byte
+// can never swallow the text after it.
+
+ULONG utf8_decode(const BYTE **s)
+{
+   const BYTE *p = *s;
+   ULONG cp, len, i;
+
+   if (p[0] < 0x80)
+   {
+      *s = p + 1;
+      return p[0];
+   }
+
+   if ((p[0] & 0xE0) == 0xC0)
+   {
+      cp = p[0] & 0x1F;
+      len = 2;
+   }
+   else if ((p[0] & 0xF0) == 0xE0)
+   {
+      cp = p[0] & 0x0F;
+      len = 3;
+   }
+   else if ((p[0] & 0xF8) == 0xF0)
+   {
+      cp = p[0] & 0x07;
+      len = 4;
+   }
+   else
+   {
+      *s = p + 1;
+      return REPLACEMENT;
+   }
+
+   for (i=1; i < len; i++)
+   {
+      if ((p[i] & 0xC0) != 0x80)
+      {
+	 *s = p + 1;
+	 return REPLACEMENT;
+      }
+      cp = (cp << 6) | (p[i] & 0x3F);
+   }
+
+   // overlong forms, surrogates and out of range values
+   if ((len == 2 && cp < 0x80) || (len == 3 && cp < 0x800) ||
+       (len == 4 && cp < 0x10000) || cp >= MAX_CODEPOINT ||
+       (cp >= 0xD800 && cp <= 0xDFFF) || (cp >= 0x80 && cp < 0xA0))
+   {
+      *s = p + 1;
+      return REPLACEMENT;
+   }
+
+   *s = p + len;
+   return cp;
+}
+
+// true if the first len bytes of s, or the bytes before a nul if it
+// comes sooner, are all below 0x80.  Whole words are only read while
+// they lie inside len, the tail is checked a byte at a time.
+
+int utf8_ascii(const char *s, ULONG len)
+{
+   const BYTE *p = (const BYTE *)s, *end = p + len;
+   unsigned long w;
+
+   while (p < end && ((uintptr_t)p & (sizeof(w) - 1)))
+   {
+      if (!*p)
+	 return 1;
+      if (*p++ & 0x80)
+	 return 0;
+   }
+
+   while ((ULONG)(end - p) >= sizeof(w))
+   {
+      memcpy(&w, p, sizeof(w));
+      // stop on a high byte or on the terminator
+      if ((w & (~0UL / 255 * 0x80)) ||
+	  ((w - ~0UL / 255) & ~w & (~0UL / 255 * 0x80)))
+	 break;
+      p += sizeof(w);
+   }
+
+   for (; p < end && *p; p++)
+      if (*p & 0x80)
+	 return 0;
+   return 1;
+}
+
+// split a string into characters which fit in max_cols columns.
+// Zero width characters are dropped and a wide character which
+// would straddle the limit is left out.  Returns the number of
+// characters stored, *cols is set to the columns they use.
+
+ULONG utf8_layout(const char *s, CWGLYPH *g, ULONG max_cols, ULONG *cols)
+{
+   const BYTE *p = (const BYTE *)s, *start;
+   ULONG cp, width, count = 0, used = 0;
+
+   while (*p && used < max_cols)
+   {
+      start = p;
+      cp = utf8_decode(&p);
+      width = cw_wcwidth(cp);
+      if (!width)
+	 continue;
+      if (used + width > max_cols)
+	 break;
+      g[count].cp = cp;
+      g[count].width = width;
+      g[count].offset = start - (const BYTE *)s;
+      count++;
+      used += width;
+   }
+   if (cols)
+      *cols = used;
+   return count;
+}
+
+// number of columns a string uses on screen
+
+ULONG utf8_width(const char *s)
+{
+   const BYTE *p = (const BYTE *)s;
+   ULONG width = 0;
+
+   while (*p)
+   {
+      if (*p < 0x80)
+      {
+	 width++;
+	 p++;
+	 continue;
+      }
+      width += cw_wcwidth(utf8_decode(&p));
+   }
+   return width;
+}
@@ -68,6 +68,9 @@
 #define __GNU_SOURCE
 
 #include "cworthy.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #if (LINUX_UTIL)
 #include "netware-screensaver.h"
@@ -90,11 +93,19 @@ ULONG screensaver;
 ULONG time_delay = 60 * 3; // default screensaver activates in 3 minutes
 ULONG refresh_pending = 0; // ncurses is not posix thread safe, set refresh
 			   // flag and call refresh from main thread only
+CWSTATS cw_stats;
+ULONG stats_overlay = 0;
+ULONG stats_overlay_key = 0;
+ULONG stats_tty_bytes = 0;
+pthread_t ui_thread;
+int io_fd = -1;
+ULONG console_blank;       // kernel blank interval (secs) we turned off
 #endif
 
 ULONG text_mode = 0;
 ULONG mono_mode = 0;
 ULONG unicode_mode = 0;
+ULONG focus_frame = 0;     // frame waiting for a key
 ULONG insert = 0;
 NWSCREEN console_screen =
 {
@@ -214,14 +225,39 @@ int attr_map[128]=
    A_BOLD, A_BOLD, A_BOLD, A_BOLD
 };
 
+// the 64 pairs are created in PC attribute order, fg in the low
+// three bits of the pair index and bg in the next three, as each is
+// first used rather than all of them in init_cworthy
+
+int pc_colors[8]=
+{
+   COLOR_BLACK, COLOR_BLUE, COLOR_GREEN, COLOR_CYAN,
+   COLOR_RED, COLOR_MAGENTA, COLOR_YELLOW, COLOR_WHITE
+};
+
+BYTE pc_pair_ready[65];
+
 ULONG get_color_pair(ULONG attr)
 {
-   return ((COLOR_PAIR(color_map[attr & 0x7F]) |
+   int pair = color_map[attr & 0x7F];
+
+   if (!pc_pair_ready[pair])
+   {
+      init_pair(pair, pc_colors[(pair - 1) & 7], pc_colors[(pair - 1) >> 3]);
+      pc_pair_ready[pair] = 1;
+   }
+   return ((COLOR_PAIR(pair) |
 	  attr_map[attr & 0x7F] | ((attr & BLINK) ? A_BLINK : 0)));
 }
 
 void set_color(ULONG attr)
 {
+    if (attr & CW_XATTR)
+    {
+       if (has_color)
+	  set_xattr_color(attr);
+       return;
+    }
     if (has_color)
        attrset(get_color_pair(attr));
     else
@@ -259,8 +295,35 @@ BYTE *get_term_name(void)
 // allows the program to store multi byte characters as single byte
 // ASCII codes in a screen map for overlapping windows under ncurses.
 
+static void mvputwc(ULONG row, ULONG col, ULONG cp)
+{
+   wchar_t wc[2];
+
+   wc[0] = (wchar_t)cp;
+   wc[1] = 0;
+   mvaddnwstr(row, col, wc, 1);
+}
+
 void mvputc(ULONG row, ULONG col, const chtype ch)
 {
+   ULONG idx;
+
+   cw_stats.cells_emitted++;
+   if ((ch & 0xFF) == CW_WIDE_CELL && console_screen.p_wide)
+   {
+      idx = row * console_screen.ncols + col;
+      if (console_screen.p_wide[idx])
+	 mvputwc(row, col, console_screen.p_wide[idx]);
+      // the right half of a double width character, redraw the left
+      // half if it is still there, otherwise the cell is blank
+      else if (col && console_screen.p_vidmem[(idx - 1) * 2] == CW_WIDE_CELL &&
+	       console_screen.p_wide[idx - 1])
+	 mvputwc(row, col - 1, console_screen.p_wide[idx - 1]);
+      else
+	 mvaddch(row, col, ' ');
+      return;
+   }
+
    if (text_mode)
    {
       switch (ch & 0xFF)
@@ -471,2820 +534,4771 @@ void disable_cursor(void)
 }
 
 #if (LINUX_UTIL)
-void refresh_screen(void)
+
+LONGLONG get_ns(void)
 {
-   if (pthread_mutex_lock(&vidmem_mutex))
-      return;
-   refresh();
-   pthread_mutex_unlock(&vidmem_mutex);
-   return;
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (LONGLONG)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
-#endif
 
-ULONG init_cworthy(void)
-{
+// counted lock wrappers.  The uncontended case is a single trylock,
+// the clock is only read when we actually have to wait.
 
-#if (WINDOWS_NT_UTIL)
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    BOOL bSuccess;
-    CONSOLE_SCREEN_BUFFER_INFO csbi; /* to get buffer info */
+static inline int lock_vidmem(void)
+{
+   LONGLONG start;
+   int ccode;
 
-    /* get the number of character cells in the current buffer */
-    bSuccess = GetConsoleScreenBufferInfo( hConsole, &csbi );
+   __sync_fetch_and_add(&cw_stats.vidmem_locks, 1);
+   if (!pthread_mutex_trylock(&vidmem_mutex))
+      return 0;
 
-    console_screen.ncols = csbi.srWindow.Right - csbi.srWindow.Left;
-    console_screen.nlines = csbi.srWindow.Bottom - csbi.srWindow.Top;
+   start = get_ns();
+   ccode = pthread_mutex_lock(&vidmem_mutex);
+   __sync_fetch_and_add(&cw_stats.vidmem_contended, 1);
+   __sync_fetch_and_add(&cw_stats.vidmem_wait_ns, get_ns() - start);
+   return ccode;
+}
 
-    if ((console_screen.ncols < 80) || (console_screen.nlines < 19))
-    {
-        printf("Your display is too small to run cworthy (%d lines, %d cols).\n"
-	       "The program requires a minimum of"
-	       " 19 lines and 80 columns\n",
-	       console_screen.nlines, console_screen.ncols);
-	return -1;
-    }
+static inline int lock_frame(ULONG num)
+{
+   LONGLONG start;
+   int ccode;
 
-    console_screen.p_vidmem = malloc(console_screen.ncols *
-				   console_screen.nlines * 2);
-    if (!console_screen.p_vidmem)
-       return -1;
+   __sync_fetch_and_add(&cw_stats.frame_locks, 1);
+   if (!pthread_mutex_trylock(&frame[num].mutex))
+      return 0;
 
-    console_screen.p_saved = malloc(console_screen.ncols *
-				  console_screen.nlines * 2);
-    if (!console_screen.p_saved)
-    {
-       free(console_screen.p_vidmem);
-       return -1;
-    }
+   start = get_ns();
+   ccode = pthread_mutex_lock(&frame[num].mutex);
+   __sync_fetch_and_add(&cw_stats.frame_contended, 1);
+   __sync_fetch_and_add(&cw_stats.frame_wait_ns, get_ns() - start);
+   return ccode;
+}
 
-    clear_screen(&console_screen);
-    disable_cursor();
-    return 0;
-#endif
+// the screen map is split into bands of CW_BAND_ROWS rows.  Writers
+// lock only the bands their rows fall in, so portals in different
+// parts of the screen are written in parallel, and mark the cells
+// they change dirty.  Nothing is handed to ncurses until
+// refresh_screen, which holds vidmem_mutex (the ncurses lock) and
+// draws the dirty cells a band at a time.  The sequence count of a
+// band is odd while a writer is in it, so get_char() and
+// get_char_attribute() read the map without locking and retry if a
+// writer got in the way.  Operations on the whole screen take
+// vidmem_mutex and then every band, in order.
+
+static inline void lock_band(CWBAND *b)
+{
+   LONGLONG start;
 
-#if (DOS_UTIL)
-     console_screen.ncols = ScreenCols();
-     console_screen.nlines = ScreenRows();
+   __sync_fetch_and_add(&cw_stats.vidmem_locks, 1);
+   if (!pthread_mutex_trylock(&b->mutex))
+      return;
 
-     if ((console_screen.ncols < 80) || (console_screen.nlines < 19))
-     {
-        printf("Your display is too small to run cworthy (%d lines, %d cols).\n"
-	       "The program requires a minimum of"
-	       " 19 lines and 80 columns\n",
-	       console_screen.nlines, console_screen.ncols);
-	return -1;
-     }
+   start = get_ns();
+   pthread_mutex_lock(&b->mutex);
+   __sync_fetch_and_add(&cw_stats.vidmem_contended, 1);
+   __sync_fetch_and_add(&cw_stats.vidmem_wait_ns, get_ns() - start);
+}
 
-     console_screen.p_vidmem = malloc(console_screen.ncols *
-				    console_screen.nlines * 2);
-     if (!console_screen.p_vidmem)
-	return -1;
+static inline ULONG row_band(NWSCREEN *screen, ULONG row)
+{
+   if (row >= screen->nlines)
+      row = screen->nlines - 1;
+   return row / CW_BAND_ROWS;
+}
 
-     console_screen.p_saved = malloc(console_screen.ncols *
-				    console_screen.nlines * 2);
-     if (!console_screen.p_saved)
-     {
-	free(console_screen.p_vidmem);
-	return -1;
-     }
+static int lock_rows(NWSCREEN *screen, ULONG first, ULONG last)
+{
+   ULONG i;
 
-     ScreenRetrieve(console_screen.p_vidmem);
-     ScreenRetrieve(console_screen.p_saved);
-     ScreenGetCursor(&screen_x, &screen_y);
+   if (!screen->bands)
+      return -1;
 
-     disable_cursor();
-#endif
+   for (i=row_band(screen, first); i <= row_band(screen, last); i++)
+   {
+      lock_band(&screen->bands[i]);
+      __atomic_store_n(&screen->bands[i].seq, screen->bands[i].seq + 1,
+		       __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+   }
+   return 0;
+}
 
-#if (LINUX_UTIL)
-     int i, pair;
-     BYTE *tname;
-     unsigned long w;
-     FILE *f;
-     char wait[100];
-     int bg_colors[8]=
-     {
-        COLOR_BLACK, COLOR_BLUE, COLOR_GREEN, COLOR_CYAN,
-        COLOR_RED, COLOR_MAGENTA, COLOR_YELLOW, COLOR_WHITE
-     };
+static void unlock_rows(NWSCREEN *screen, ULONG first, ULONG last)
+{
+   ULONG i;
 
-     pthread_mutex_init(&vidmem_mutex, NULL);
+   for (i=row_band(screen, last) + 1; i-- > row_band(screen, first); )
+   {
+      __atomic_store_n(&screen->bands[i].seq, screen->bands[i].seq + 1,
+		       __ATOMIC_RELEASE);
+      pthread_mutex_unlock(&screen->bands[i].mutex);
+   }
+}
 
-     // setlocale must be called to enable utf8 (unicode) character
-     // display settings.
-     setlocale(LC_ALL, "");
+static int lock_screen(NWSCREEN *screen)
+{
+   if (lock_vidmem())
+      return -1;
+   if (lock_rows(screen, 0, screen->nlines - 1))
+   {
+      pthread_mutex_unlock(&vidmem_mutex);
+      return -1;
+   }
+   return 0;
+}
 
-     initscr();
-     nonl();
-     intrflush(stdscr, FALSE);
-     keypad(stdscr, TRUE);
-     noecho();
+static void unlock_screen(NWSCREEN *screen)
+{
+   unlock_rows(screen, 0, screen->nlines - 1);
+   pthread_mutex_unlock(&vidmem_mutex);
+}
 
-     tname = (BYTE *)termname();
-     if (tname)
-     {
-        memset(terminal_name, 0, 256);
-        strncpy((char *)terminal_name, (const char *)tname, 255);
-        if (strcasestr((const char *)terminal_name, "linux"))
-           linux_term = TRUE;
-        if (strcasestr((const char *)terminal_name, "xterm"))
-           xterm = TRUE;
-        if (strcasestr((const char *)terminal_name, "ansi"))
-           ansi = TRUE;
-     }
+// called with the band of row locked
 
-     if ((COLS < 80) || (LINES < 19))
-     {
-        endwin();
-        printf("Your display is too small to run cworthy (%d lines, %d cols).\n"
-	       "The program requires a minimum of"
-	       " 19 lines and 80 columns\n", LINES, COLS);
-	return -1;
-     }
+static inline void mark_dirty(NWSCREEN *screen, ULONG row, ULONG col,
+			      ULONG count)
+{
+   if (!count || row >= screen->nlines || col >= screen->ncols)
+      return;
+   if (count > screen->ncols - col)
+      count = screen->ncols - col;
+   if (col < screen->dirty_lo[row])
+      screen->dirty_lo[row] = col;
+   if (col + count > screen->dirty_hi[row])
+      screen->dirty_hi[row] = col + count;
+   screen->bands[row / CW_BAND_ROWS].dirty |= 1UL << (row % CW_BAND_ROWS);
+}
 
-     console_screen.ncols = COLS;
-     console_screen.nlines = LINES;
+static void clear_dirty(NWSCREEN *screen, ULONG row)
+{
+   screen->dirty_lo[row] = screen->ncols;
+   screen->dirty_hi[row] = 0;
+}
 
-     console_screen.p_vidmem = (BYTE *)malloc(console_screen.ncols *
-				            console_screen.nlines * 2);
-     if (!console_screen.p_vidmem)
-     {
-        endwin();
-	return -1;
-     }
+// read a cell of the screen map without taking a lock
 
-     console_screen.p_saved = (BYTE *)malloc(console_screen.ncols *
-				           console_screen.nlines * 2);
-     if (!console_screen.p_saved)
-     {
-        free(console_screen.p_vidmem);
-        endwin();
-        return -1;
-     }
+static inline void read_cell(NWSCREEN *screen, ULONG row, ULONG col,
+			     BYTE *cell)
+{
+   const volatile BYTE *v = screen->p_vidmem +
+			    (row * screen->ncols + col) * 2;
+   CWBAND *b;
+   ULONG seq;
 
-     // if the terminal does not support colors, or if the
-     // terminal cannot support at least eight primary colors
-     // for foreground/background color pairs, then default
-     // the library to use ASCII characters < 127 (7 bit), disable
-     // ncurses color attributes, and do not attempt to use
-     // the alternate character set for graphic characters.
+   if (!screen->bands)
+   {
+      cell[0] = v[0];
+      cell[1] = v[1];
+      return;
+   }
 
-     if (has_colors() && !mono_mode)
-     {
-	if (start_color() == OK)
-	{
-	   if (COLORS >= 8)
-	   {
-	      has_color = TRUE;
-              pair = 1;
-
-              // We create our color pairs in the order defined
-              // by the PC based text attribute color scheme.  We do
-              // this to make it relatively simple to use a table
-              // driven method for mapping the PC style text attributes
-              // to ncurses.
-
-              for (i=0; i < 8; i++)
-              {
-	         init_pair(pair++, COLOR_BLACK, bg_colors[i]);
-	         init_pair(pair++, COLOR_BLUE, bg_colors[i]);
-	         init_pair(pair++, COLOR_GREEN, bg_colors[i]);
-	         init_pair(pair++, COLOR_CYAN, bg_colors[i]);
-	         init_pair(pair++, COLOR_RED, bg_colors[i]);
-	         init_pair(pair++, COLOR_MAGENTA, bg_colors[i]);
-	         init_pair(pair++, COLOR_YELLOW, bg_colors[i]);
-	         init_pair(pair++, COLOR_WHITE, bg_colors[i]);
-	      }
-	   }
-	}
-     }
+   b = &screen->bands[row_band(screen, row)];
+   do
+   {
+      while ((seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE)) & 1)
+	 sched_yield();
+      cell[0] = v[0];
+      cell[1] = v[1];
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+   } while (__atomic_load_n(&b->seq, __ATOMIC_RELAXED) != seq);
+}
 
-     wclear(stdscr);
-     disable_cursor();
-     refresh_screen();
+// p_wide and p_xattr are allocated on first use by whichever writer
+// needs them first
 
-     f = fopen("/sys/module/kernel/parameters/consoleblank", "r");
-     if (f != NULL)
-     {
-        fgets(wait, 98, f);
-        fclose(f);
-        sscanf(wait, "%lu", &w);
-#if VERBOSE
-	printf("console blank timer: %lu\n", w);
-#endif
-     }
-     // disable screen blanking and enable
-     // cworthy screensaver
-     if (w)
-        system("setterm -blank 0");
-#endif
-     return 0;
+static ULONG *screen_plane(NWSCREEN *screen, ULONG **plane)
+{
+   ULONG *p;
+
+   if (*plane)
+      return *plane;
+   p = (ULONG *)calloc(screen->ncols * screen->nlines, sizeof(ULONG));
+   if (p && !__sync_bool_compare_and_swap(plane, (ULONG *)NULL, p))
+      free(p);
+   return *plane;
 }
 
-ULONG release_cworthy(void)
+static int alloc_bands(NWSCREEN *screen)
 {
-#if (WINDOWS_NT_UTIL)
-    clear_screen(&console_screen);
-    enable_cursor(0);
-    if (console_screen.p_vidmem)
-       free(console_screen.p_vidmem);
-    if (console_screen.p_saved)
-       free(console_screen.p_saved);
-#endif
+   ULONG i, count = (screen->nlines + CW_BAND_ROWS - 1) / CW_BAND_ROWS;
 
-    clear_screen(&console_screen);
+   screen->bands = (CWBAND *)calloc(count, sizeof(CWBAND));
+   screen->dirty_lo = (ULONG *)malloc(screen->nlines * sizeof(ULONG));
+   screen->dirty_hi = (ULONG *)malloc(screen->nlines * sizeof(ULONG));
+   if (!screen->bands || !screen->dirty_lo || !screen->dirty_hi)
+   {
+      free(screen->bands);
+      free(screen->dirty_lo);
+      free(screen->dirty_hi);
+      screen->bands = NULL;
+      return -1;
+   }
+   for (i=0; i < count; i++)
+      pthread_mutex_init(&screen->bands[i].mutex, NULL);
+   for (i=0; i < screen->nlines; i++)
+      clear_dirty(screen, i);
+   return 0;
+}
 
-#if (DOS_UTIL)
-    clear_screen(&console_screen);
-    enable_cursor(0);
-    ScreenSetCursor(screen_x, screen_y);
-    screen_write(console_screen.p_saved);
-    if (console_screen.p_vidmem)
-       free(console_screen.p_vidmem);
-    if (console_screen.p_saved)
-       free(console_screen.p_saved);
-#endif
+static void free_bands(NWSCREEN *screen)
+{
+   ULONG i;
 
-#if (LINUX_UTIL)
-    pthread_mutex_destroy(&vidmem_mutex);
+   if (!screen->bands)
+      return;
+   for (i=0; i <= row_band(screen, screen->nlines - 1); i++)
+      pthread_mutex_destroy(&screen->bands[i].mutex);
+   free(screen->bands);
+   free(screen->dirty_lo);
+   free(screen->dirty_hi);
+   screen->bands = NULL;
+   screen->dirty_lo = screen->dirty_hi = NULL;
+}
 
-    enable_cursor(0);
-    endwin();
+// ncurses writes straight to the terminal file descriptor, so the
+// bytes it emitted are taken from this thread's write counter.  That
+// costs two reads of /proc around every refresh, so it is only done
+// while the overlay, the slow link mode or set_stats_tty_bytes() needs
+// the count.
 
-    // reset terminal escape sequence
-    printf("%c%c", 0x1B, 'c');
+static LONGLONG get_tty_wchar(void)
+{
+   char buf[256], *p;
+   ssize_t n;
 
-    if (console_screen.p_vidmem)
-       free(console_screen.p_vidmem);
-    if (console_screen.p_saved)
-       free(console_screen.p_saved);
+   if (io_fd < 0 || !pthread_equal(ui_thread, pthread_self()))
+      return -1;
 
-    // enable screen blanking
-#if 0
-    system("setterm -blank 10");
-#endif
-#endif
-    return 0;
+   n = pread(io_fd, buf, sizeof(buf) - 1, 0);
+   if (n <= 0)
+      return -1;
+   buf[n] = '\0';
+
+   p = strstr(buf, "wchar:");
+   if (!p)
+      return -1;
+   return strtoll(p + 6, NULL, 10);
 }
 
-void copy_data(ULONG *src, ULONG *dest, ULONG len)
+ULONG get_cworthy_stats(CWSTATS *stats)
 {
-    memcpy(dest, src, len);
-#if 0
-   ULONG i;
-
-   for (i=0; i < ((len + 3) / 4); i++)
-      *dest++ = *src++;
-   return;
-#endif
+   if (!stats)
+      return -1;
+   *stats = cw_stats;
+   return 0;
 }
 
-void set_data(ULONG *dest, ULONG value, ULONG len)
+void reset_cworthy_stats(void)
 {
-   memset(dest, value, len);
-#if 0
-   ULONG i;
+   LONGLONG pairs = cw_stats.color_pairs;
 
-   for (i=0; i < ((len + 3) / 4); i++)
-      *dest++ = value;
-   return;
-#endif
+   memset(&cw_stats, 0, sizeof(CWSTATS));
+   cw_stats.color_pairs = pairs;
 }
 
-void set_data_b(BYTE *dest, BYTE value, ULONG len)
+ULONG get_frame_memory(ULONG num)
 {
-   memset(dest, value, len);
-#if 0
-   ULONG i;
+   if (!num || num >= MAX_MENU)
+      return 0;
+   return frame[num].memory;
+}
 
-   for (i=0; i < len; i++)
-      *dest++ = value;
-   return;
-#endif
+static void display_stats_overlay(int force);
+static void display_notifications(void);
+static void flush_dirty(NWSCREEN *screen);
+static void run_queued_dialogs(void);
+static void cancel_queued_dialogs(void);
+ULONG dialogs_queued = 0;
+ULONG dialog_active = 0;
+ULONG notes_queued = 0;
+ULONG note_showing = 0;
+
+// frame flush hooks.  Consumers such as the console server register
+// a function here which is called after every screen refresh with
+// vidmem_mutex held.  Each consumer keeps its own copy of the last
+// frame it saw and diffs the screen map against it, so nothing is
+// done on the render path when no hooks are registered.
+
+#define MAX_FLUSH_HOOKS   8
+
+typedef struct _FLUSH_HOOK
+{
+   void (*func)(NWSCREEN *, void *);
+   void *context;
+} FLUSH_HOOK;
 
-}
+FLUSH_HOOK flush_hooks[MAX_FLUSH_HOOKS];
+ULONG flush_hook_count = 0;
 
-#if (LINUX_UTIL)
-int _kbhit(void)
+int register_flush_hook(void (*func)(NWSCREEN *, void *), void *context)
 {
-   int STDIN = 0, bytes = 0;
-   struct termios init;
-   struct termios term;
+   if (!func)
+      return -1;
 
-   tcgetattr(STDIN, &init);
-   tcgetattr(STDIN, &term);
-   term.c_lflag &=	~ICANON;
-   tcsetattr(STDIN, TCSANOW, &term);
+   if (lock_vidmem())
+      return -1;
 
-   setbuf(stdin, NULL);
-   ioctl(STDIN, FIONREAD, &bytes);
+   if (flush_hook_count >= MAX_FLUSH_HOOKS)
+   {
+      pthread_mutex_unlock(&vidmem_mutex);
+      return -1;
+   }
+   flush_hooks[flush_hook_count].func = func;
+   flush_hooks[flush_hook_count].context = context;
+   flush_hook_count++;
 
-   tcsetattr(STDIN, TCSANOW, &init);
-   return bytes;
+   pthread_mutex_unlock(&vidmem_mutex);
+   return 0;
 }
-#endif
 
-#if (LINUX_UTIL)
-ULONG set_screensaver_interval(ULONG seconds)
+int unregister_flush_hook(void (*func)(NWSCREEN *, void *), void *context)
 {
-   ULONG t = time_delay;
-   time_delay = seconds;
-   return t;
+   ULONG i;
+
+   if (lock_vidmem())
+      return -1;
+
+   for (i=0; i < flush_hook_count; i++)
+   {
+      if (flush_hooks[i].func == func && flush_hooks[i].context == context)
+      {
+         flush_hook_count--;
+         flush_hooks[i] = flush_hooks[flush_hook_count];
+         pthread_mutex_unlock(&vidmem_mutex);
+         return 0;
+      }
+   }
+   pthread_mutex_unlock(&vidmem_mutex);
+   return -1;
 }
-#endif
 
-ULONG get_key(void)
+// copy the screen map for a flush hook.  Viewers and recordings carry
+// byte cells only, so a character outside ASCII is shown as
+// CW_WIDE_GLYPH and the right half of a double width one as a blank
+// instead of the CW_WIDE_CELL marker.  Returns 0 if dest already held
+// the same cells.
+
+ULONG copy_screen_map(NWSCREEN *screen, BYTE *dest)
 {
-#if (WINDOWS_NT_UTIL)
-    ULONG c;
+   ULONG i, size = screen->nlines * screen->ncols * 2, changed = 0;
+   BYTE *v = screen->p_vidmem, c;
 
-    c = _getch();
-    if ((!c) || ((c & 0xFF) == 0xE0))
-    {
-       c = _getch();
-       c |= 0x0100; // identify this key as special
-       return c;
-    }
-    return c;
-#endif
+   if (!screen->p_wide)
+   {
+      if (!memcmp(dest, v, size))
+	 return 0;
+      memcpy(dest, v, size);
+      return 1;
+   }
 
-#if (DOS_UTIL)
-    ULONG c;
+   for (i=0; i < size; i += 2)
+   {
+      c = v[i];
+      if (c == CW_WIDE_CELL)
+	 c = screen->p_wide[i / 2] ? CW_WIDE_GLYPH : ' ';
+      if (dest[i] != c || dest[i + 1] != v[i + 1])
+      {
+	 dest[i] = c;
+	 dest[i + 1] = v[i + 1];
+	 changed = 1;
+      }
+   }
+   return changed;
+}
 
-    c = getch();
-    if ((!c) || ((c & 0xFF) == 0xE0))
-    {
-       c = getch();
-       c |= 0x0100; // identify this key as special
-       return c;
-    }
-    return c;
-#endif
+// slow link mode.  On a serial console or a congested ssh session
+// ncurses can queue frames faster than the line drains them, and keys
+// then wait behind seconds of stale output.  With a lag budget set,
+// refresh_screen estimates how far the terminal is behind from its
+// output queue (TIOCOUTQ) and the drain rate, and from how long the
+// last write blocked, and skips the refresh while that is over the
+// budget.  curses keeps every update, so the next refresh sends only
+// the difference to the latest frame.  While the line is congested
+// the refresh scheduler defers background portals and only the frame
+// waiting for input is redrawn.
+
+typedef struct _SLOW_LINK
+{
+   LONGLONG budget_ns;
+   LONGLONG rate;             // bytes per second, 0 while unknown
+   LONGLONG queued;           // output queue at the last sample
+   LONGLONG sample_ns;
+   LONGLONG hold_ns;          // a blocked write, behind until then
+   int fd;
+   int congested;
+   int deferred;              // a background portal was skipped
+} SLOW_LINK;
+
+SLOW_LINK slow_link = { 0, 0, 0, 0, 0, -1, 0, 0 };
+
+static struct
+{
+   speed_t speed;
+   LONGLONG baud;
+} link_speeds[] =
+{
+   { B1200, 1200 },     { B2400, 2400 },     { B4800, 4800 },
+   { B9600, 9600 },     { B19200, 19200 },   { B38400, 38400 },
+   { B57600, 57600 },   { B115200, 115200 }, { B230400, 230400 },
+   { B0, 0 }
+};
 
-#if (LINUX_UTIL)
-    ULONG c;
-    struct timespec ts = { 0, 10000000L };
-    static ULONG seconds = 0;
+// budget in milliseconds, 0 turns slow link mode off.  Turning it on
+// also selects text mode, which avoids the alternate character set
+// switches, so call it before any frame is made.
 
-    refresh_screen();
-    while (!_kbhit())
-    {
-       fflush(stdout);
-       nanosleep(&ts, NULL);
-       // convert ns to seconds
-       if ((seconds++ / 100) > time_delay)
-       {
-          if (screensaver == FALSE)
-	  {
-	     screensaver = TRUE;
-             wclear(stdscr);
-	     disable_cursor();
-	     refresh_screen();
-             cworthy_netware_screensaver();
-	  }
-	  seconds = 0;
-       }
+ULONG set_slow_link(ULONG budget_ms)
+{
+   struct termios t;
+   int i, fd = fileno(stdout);
 
-       if (refresh_pending) {
-          refresh_pending = 0;
-          refresh_screen();
-       }
-    }
-    // read buffered key
-    c = getch();
-    seconds = 0;
+   if (!budget_ms)
+   {
+      slow_link.budget_ns = 0;
+      slow_link.congested = 0;
+      return 0;
+   }
 
-    if (screensaver == TRUE) {
-       screensaver = FALSE;
-       restore_screen();
-       refresh_screen();
-       // if screensaver was active swallow the key
-       c = 0;
-    }
-    refresh_screen();
-    return c;
-#endif
+   if (!isatty(fd))
+      return -1;
 
+   // the line speed is only a first guess until the queue has been
+   // seen draining.  pseudo terminals never report a queue, there
+   // only blocked writes are seen.
+   slow_link.rate = 0;
+   if (!tcgetattr(fd, &t))
+   {
+      for (i=0; link_speeds[i].baud; i++)
+      {
+	 if (cfgetospeed(&t) == link_speeds[i].speed)
+	 {
+	    slow_link.rate = link_speeds[i].baud / 10;
+	    break;
+	 }
+      }
+   }
+   slow_link.fd = fd;
+   slow_link.queued = 0;
+   slow_link.hold_ns = 0;
+   slow_link.sample_ns = get_ns();
+   slow_link.budget_ns = budget_ms * 1000000LL;
+   text_mode = 1;
+   return 0;
 }
 
-void set_xy(NWSCREEN *screen, ULONG row, ULONG col)
+ULONG get_slow_link(void)
 {
-    screen->crnt_row = row;
-    screen->crnt_column = col;
-    hard_xy(row, col);
-    return;
+   return slow_link.budget_ns / 1000000LL;
 }
 
-void get_xy(NWSCREEN *screen, ULONG *row, ULONG *col)
+static LONGLONG link_queued(void)
 {
-    *row = screen->crnt_row;
-    *col = screen->crnt_column;
-    return;
+   int n;
+
+   if (ioctl(slow_link.fd, TIOCOUTQ, &n) < 0)
+      return 0;
+   return n;
 }
 
-void clear_screen(NWSCREEN *screen)
+static void link_rate_sample(LONGLONG bytes, LONGLONG elapsed)
 {
-#if (WINDOWS_NT_UTIL)
-   HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-   COORD coordScreen = { 0, 0 };
-   BOOL bSuccess;
-   DWORD cCharsWritten;
-   CONSOLE_SCREEN_BUFFER_INFO csbi; /* to get buffer info */
-   DWORD dwConSize;                 /* number of character cells in
-				       the current buffer */
-
-   /* get the number of character cells in the current buffer */
+   LONGLONG rate;
 
-   bSuccess = GetConsoleScreenBufferInfo( hConsole, &csbi );
-   dwConSize = csbi.dwSize.X * csbi.dwSize.Y;
-
-   /* fill the entire screen with blanks */
+   if (elapsed <= 0)
+      return;
+   rate = bytes * 1000000000LL / elapsed;
+   slow_link.rate = slow_link.rate ? (slow_link.rate * 3 + rate) / 4 : rate;
+   cw_stats.link_rate = slow_link.rate;
+}
 
-   bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) ' ',
-      dwConSize, coordScreen, &cCharsWritten );
+static LONGLONG link_lag(LONGLONG now, LONGLONG queued)
+{
+   LONGLONG lag = 0;
+
+   if (queued > 0)
+      lag = slow_link.rate ? queued * 1000000000LL / slow_link.rate
+			   : slow_link.budget_ns + 1;
+   if (slow_link.hold_ns - now > lag)
+      lag = slow_link.hold_ns - now;
+   return lag;
+}
 
-   /* get the current text attribute */
+// called with vidmem_mutex held before a refresh.  the queue only
+// shows the drain rate while it did not run empty since the last
+// sample, nothing else writes to the terminal in between.
 
-   bSuccess = GetConsoleScreenBufferInfo( hConsole, &csbi );
+static int link_behind(void)
+{
+   LONGLONG now = get_ns(), queued = link_queued();
 
-   /* now set the buffer's attributes accordingly */
+   // back to back refreshes are too close together to measure
+   if (now - slow_link.sample_ns >= 10000000LL)
+   {
+      if (queued && slow_link.queued >= queued)
+	 link_rate_sample(slow_link.queued - queued,
+			  now - slow_link.sample_ns);
+      slow_link.queued = queued;
+      slow_link.sample_ns = now;
+   }
+   cw_stats.link_queued = queued;
+   return link_lag(now, queued) > slow_link.budget_ns;
+}
 
-   bSuccess = FillConsoleOutputAttribute( hConsole, csbi.wAttributes,
-      dwConSize, coordScreen, &cCharsWritten );
+// after a refresh.  A write which blocked measures the line directly,
+// the terminal is at least as far behind as the write was held up.
+// returns non zero when deferred portals may be redrawn again.
 
-   /* put the cursor at (0, 0) */
+static int link_written(LONGLONG before, LONGLONG bytes, LONGLONG elapsed)
+{
+   LONGLONG now = get_ns(), queued = link_queued();
+   int was_congested = slow_link.congested;
 
-   bSuccess = SetConsoleCursorPosition( hConsole, coordScreen );
+   if (elapsed > 1000000LL && before + bytes > queued)
+   {
+      link_rate_sample(before + bytes - queued, elapsed);
+      if (elapsed > slow_link.budget_ns / 2)
+	 slow_link.hold_ns = now + elapsed;
+   }
+   slow_link.queued = queued;
+   slow_link.sample_ns = now;
+   cw_stats.link_queued = queued;
+
+   // keep polling until the line has caught up, so background
+   // portals are not left deferred while the keyboard is idle
+   slow_link.congested = link_lag(now, queued) > slow_link.budget_ns / 2;
+   if (slow_link.congested)
+      refresh_pending++;
+   if (was_congested && !slow_link.congested && slow_link.deferred)
+   {
+      slow_link.deferred = 0;
+      return 1;
+   }
+   return 0;
+}
 
-   return;
-#endif
+// called by the refresh scheduler before it updates a portal
 
-#if (DOS_UTIL | LINUX_UTIL)
-   ULONG fill;
-   BYTE ch;
+int defer_portal_update(ULONG num)
+{
+   if (!slow_link.budget_ns || !slow_link.congested || num == focus_frame)
+      return 0;
+   slow_link.deferred = 1;
+   cw_stats.portals_deferred++;
+   return 1;
+}
 
+void refresh_screen(void)
+{
+   LONGLONG start, elapsed, wchar, queued = 0, written = 0;
+   int catch_up = 0;
+   ULONG i;
 
-#if LINUX_UTIL
-   if (pthread_mutex_lock(&vidmem_mutex))
+   if (lock_vidmem())
       return;
-#endif
-   ch = (BYTE)(screen->norm_vid & 0xFF);
-   fill = 0x00200020;  //  ' ' space
-   fill = fill | (ULONG)(ch << 24);
-   fill = fill | (ULONG)(ch << 8);
-   set_data((ULONG *)screen->p_vidmem, fill,
-	    (screen->ncols * screen->nlines * 2));
+   flush_dirty(&console_screen);
 
-#if (DOS_UTIL)
-   screen_write(console_screen.p_vidmem);
-#endif
+   if (slow_link.budget_ns && link_behind())
+   {
+      // curses still holds the frame, it goes out with the next refresh
+      slow_link.congested = 1;
+      cw_stats.frames_dropped++;
+      refresh_pending++;
+   }
+   else
+   {
+      queued = cw_stats.link_queued;
+      if (stats_overlay || stats_tty_bytes || slow_link.budget_ns)
+	 wchar = get_tty_wchar();
+      else
+	 wchar = -1;
+      start = get_ns();
+      refresh();
+      elapsed = get_ns() - start;
+
+      cw_stats.refreshes++;
+      cw_stats.render_ns += elapsed;
+      cw_stats.last_render_ns = elapsed;
+      if (elapsed > cw_stats.render_max_ns)
+	 cw_stats.render_max_ns = elapsed;
+      if (wchar >= 0)
+      {
+	 start = get_tty_wchar();
+	 if (start > wchar)
+	    written = start - wchar;
+	 cw_stats.tty_bytes += written;
+      }
+      if (slow_link.budget_ns)
+	 catch_up = link_written(queued, written, elapsed);
+   }
 
-#if (LINUX_UTIL)
-   wclear(stdscr);
+   // the hooks read the whole map, keep writers out while they do
+   if (flush_hook_count &&
+       !lock_rows(&console_screen, 0, console_screen.nlines - 1))
+   {
+      for (i=0; i < flush_hook_count; i++)
+	 (flush_hooks[i].func)(&console_screen, flush_hooks[i].context);
+      unlock_rows(&console_screen, 0, console_screen.nlines - 1);
+   }
    pthread_mutex_unlock(&vidmem_mutex);
-#endif
-
-#endif
 
+   if (catch_up)
+      portal_refresh_catch_up();
    return;
 }
 
-void move_string(NWSCREEN *screen,
-		 ULONG srcRow, ULONG srcCol,
-		 ULONG destRow, ULONG destCol,
-		 ULONG length)
-{
-    ULONG i;
-    BYTE *src_v, *dest_v, c;
-    int attr = 0;
-
-#if LINUX_UTIL
-   if (pthread_mutex_lock(&vidmem_mutex))
-      return;
-#endif
-    src_v = screen->p_vidmem;
-    src_v += (srcRow * (screen->ncols * 2)) + srcCol * 2;
-
-    dest_v = screen->p_vidmem;
-    dest_v += (destRow * (screen->ncols * 2)) + destCol * 2;
-
-    for (i=0; i < length; i++)
-    {
-       c = *src_v;
-       attr = *(src_v + 1);
-       *dest_v++ = *src_v++;
-       *dest_v++ = *src_v++;
+// keys pushed by other threads (console server controller, scripts)
+// are queued here and returned by get_key ahead of the keyboard.
+// Each entry carries the time it becomes readable, so a sequence
+// pushed in one call can still be replayed with inter-key delays.
 
-#if (LINUX_UTIL)
-       set_color(attr);
-       mvputc(destRow, destCol++, c);
-       clear_color();
-#endif
-#if (DOS_UTIL)
-       ScreenPutChar(c, attr, destCol++, destRow);
-#endif
-    }
-#if (LINUX_UTIL)
-    refresh_pending++;
-    pthread_mutex_unlock(&vidmem_mutex);
-#endif
+#define KEY_QUEUE_SIZE   256
 
+typedef struct _KEY_ENTRY
+{
+   ULONG key;
+   LONGLONG due;
+} KEY_ENTRY;
+
+pthread_mutex_t key_mutex = PTHREAD_MUTEX_INITIALIZER;
+KEY_ENTRY key_queue[KEY_QUEUE_SIZE];
+ULONG key_head = 0;
+ULONG key_tail = 0;
+LONGLONG key_last_due = 0;
+ULONG key_waiting = 0;
+LONGLONG key_issued_ns = 0;
+CWLATENCY key_latency;
+ULONG key_from_queue = 0;      // the last key came from the queue
+ULONG typeahead_key = 0;       // read ahead by the menus, returned next
+
+static inline ULONG key_queue_free(void)
+{
+   return KEY_QUEUE_SIZE - 1 -
+	  ((key_head + KEY_QUEUE_SIZE - key_tail) % KEY_QUEUE_SIZE);
 }
 
+// queue count keys, each delay_ms after the previous one.  The whole
+// sequence is queued or nothing is.
 
-void put_string(NWSCREEN *screen, const char *s, BYTE *attr_array,
-		ULONG row, ULONG col, ULONG attr)
+ULONG push_key_sequence(const ULONG *keys, ULONG count, ULONG delay_ms)
 {
-#if (WINDOWS_NT_UTIL)
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    BOOL bSuccess;
-    DWORD cCharsWritten;
-    COORD coordScreen;
+   LONGLONG now;
+   ULONG i;
 
-    coordScreen.X = (short)col;
-    coordScreen.Y = (short)row;
+   if (!keys)
+      return -1;
 
-    bSuccess = WriteConsoleOutputCharacter( hConsole, (LPSTR) s,
-				lstrlen(s), coordScreen, &cCharsWritten );
+   now = get_ns();
+   pthread_mutex_lock(&key_mutex);
+   if (count > key_queue_free())
+   {
+      pthread_mutex_unlock(&key_mutex);
+      return -1;
+   }
+   // delays run from the later of now and the last queued key
+   if (key_head == key_tail || key_last_due < now)
+      key_last_due = now;
+   for (i=0; i < count; i++)
+   {
+      key_last_due += (LONGLONG)delay_ms * 1000000LL;
+      key_queue[key_head].key = keys[i];
+      key_queue[key_head].due = delay_ms ? key_last_due : 0;
+      key_head = (key_head + 1) % KEY_QUEUE_SIZE;
+   }
+   pthread_mutex_unlock(&key_mutex);
+   return 0;
+}
 
-    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
-				lstrlen(s), coordScreen, &cCharsWritten );
-#endif
+ULONG push_key_delay(ULONG key, ULONG delay_ms)
+{
+   return push_key_sequence(&key, 1, delay_ms);
+}
 
-#if (DOS_UTIL | LINUX_UTIL)
-    BYTE *v, c;
-    ULONG len = strlen((const char *)s), count;
+ULONG push_key(ULONG key)
+{
+   return push_key_sequence(&key, 1, 0);
+}
 
-#if LINUX_UTIL
-   if (pthread_mutex_lock(&vidmem_mutex))
-      return;
-#endif
-    count = 0;
-    v = screen->p_vidmem;
-    v += (row * (screen->ncols * 2)) + col * 2;
-    while (*s)
-    {
-       if (count + 1 >
-          ((len <= (screen->ncols - col)) ? len : (screen->ncols - col)))
-	  break;
+// returns the number of queued keys once the first one is due
 
-       c = *s;
-       *v++ = *s++;
-       //*v++ = attr;
-       *v++ = (attr_array && attr_array[count]) ? attr_array[count] : attr;
-       count++;
+int key_queue_pending(void)
+{
+   int count = 0;
+
+   pthread_mutex_lock(&key_mutex);
+   if (key_head != key_tail &&
+       (!key_queue[key_tail].due || key_queue[key_tail].due <= get_ns()))
+      count = (key_head + KEY_QUEUE_SIZE - key_tail) % KEY_QUEUE_SIZE;
+   pthread_mutex_unlock(&key_mutex);
+   return count;
+}
 
-#if (LINUX_UTIL)
-       set_color(attr);
-       mvputc(row, col++, c);
-       clear_color();
-#endif
-#if (DOS_UTIL)
-       ScreenPutChar(c, attr, col++, row);
-#endif
-    }
-#if (LINUX_UTIL)
-    pthread_mutex_unlock(&vidmem_mutex);
-#endif
+// true when no keys are queued and get_key is waiting for input.
+// Scripts use this to wait for the application to catch up.
 
-#endif
+int key_input_idle(void)
+{
+   int idle;
 
+   pthread_mutex_lock(&key_mutex);
+   idle = (key_head == key_tail) && key_waiting;
+   pthread_mutex_unlock(&key_mutex);
+   return idle;
 }
 
-void put_string_transparent(NWSCREEN *screen, const char *s, BYTE *attr_array,
-			    ULONG row, ULONG col, ULONG attr)
+static int pop_key(ULONG *key)
 {
+   pthread_mutex_lock(&key_mutex);
+   if (key_head == key_tail ||
+       (key_queue[key_tail].due && key_queue[key_tail].due > get_ns()))
+   {
+      pthread_mutex_unlock(&key_mutex);
+      return 0;
+   }
+   *key = key_queue[key_tail].key;
+   key_tail = (key_tail + 1) % KEY_QUEUE_SIZE;
+   pthread_mutex_unlock(&key_mutex);
+   return 1;
+}
 
-#if (WINDOWS_NT_UTIL)
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    BOOL bSuccess;
-    DWORD cCharsWritten;
-    COORD coordScreen;
-
-    coordScreen.X = (short)col;
-    coordScreen.Y = (short)row;
-
-    bSuccess = WriteConsoleOutputCharacter( hConsole, (LPSTR) s,
-				    lstrlen(s), coordScreen, &cCharsWritten );
-
-    if (attr)
-       bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
-				    lstrlen(s), coordScreen, &cCharsWritten );
-#endif
-
-#if (DOS_UTIL | LINUX_UTIL)
-    BYTE *v, c;
-    ULONG len = strlen((const char *)s), count, color;
+// a key typed at the terminal if one has already arrived, 0 if not.
+// Never waits, so the menus can take in the keys typed while they were
+// drawing.  Keys in the queue above are never read here.
 
-#if LINUX_UTIL
-   if (pthread_mutex_lock(&vidmem_mutex))
-      return;
-#endif
-    count = 0;
-    v = screen->p_vidmem;
-    v += (row * (screen->ncols * 2)) + col * 2;
-    while (*s)
-    {
-       if (count + 1 >
-	  ((len <= (screen->ncols - col)) ? len : (screen->ncols - col)))
-	  break;
+static ULONG read_typeahead(void)
+{
+   int ch;
 
-       c = *s;
-       *v++ = *s++;
-       if (attr || (attr_array && attr_array[count])) {
-	  //*v |= attr;
-          *v = (attr_array && attr_array[count]) ? attr_array[count] : attr;
-       }
-       color = *v++;
-       count++;
+   if (!_kbhit())
+      return 0;
+   ch = getch();
+   return (ch == ERR) ? 0 : (ULONG)ch;
+}
 
-#if (LINUX_UTIL)
-       set_color(color);
-       mvputc(row, col++, c);
-       clear_color();
-#endif
-#if (DOS_UTIL)
-       ScreenPutChar(c, color,
-		     col++, row);
-#endif
-    }
-#if (LINUX_UTIL)
-    pthread_mutex_unlock(&vidmem_mutex);
-#endif
+// interaction latency is the time from get_key returning a key until
+// the application has drawn the result and asks for the next key.
+// The histogram has CW_LATENCY_SUB buckets per power of two ns.
 
-#endif
+static void record_key_latency(LONGLONG ns)
+{
+   ULONG msb, index;
 
+   if (ns <= 0)
+      ns = 1;
+   msb = 63 - __builtin_clzll((unsigned long long)ns);
+   if (msb < 3)
+      index = ns;
+   else
+      index = (msb - 2) * CW_LATENCY_SUB +
+	      ((ns >> (msb - 3)) & (CW_LATENCY_SUB - 1));
+   if (index >= CW_LATENCY_BUCKETS)
+      index = CW_LATENCY_BUCKETS - 1;
+
+   pthread_mutex_lock(&key_mutex);
+   if (!key_latency.count || ns < key_latency.min_ns)
+      key_latency.min_ns = ns;
+   if (ns > key_latency.max_ns)
+      key_latency.max_ns = ns;
+   key_latency.count++;
+   key_latency.total_ns += ns;
+   key_latency.hist[index]++;
+   pthread_mutex_unlock(&key_mutex);
 }
 
-void put_string_cleol(NWSCREEN *screen, const char *s, BYTE *attr_array,
-		      ULONG row, ULONG attr)
+ULONG get_key_latency(CWLATENCY *lat)
 {
+   if (!lat)
+      return -1;
+   pthread_mutex_lock(&key_mutex);
+   *lat = key_latency;
+   pthread_mutex_unlock(&key_mutex);
+   return 0;
+}
 
-#if (WINDOWS_NT_UTIL)
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    BOOL bSuccess;
-    DWORD cCharsWritten;
-    COORD coordScreen;
-    ULONG len = lstrlen(s);
-    ULONG left = 0;
-
-    coordScreen.X = (short)0;
-    coordScreen.Y = (short)row;
-
-    bSuccess = WriteConsoleOutputCharacter( hConsole, (LPSTR) s,
-		       len, coordScreen, &cCharsWritten );
+void reset_key_latency(void)
+{
+   pthread_mutex_lock(&key_mutex);
+   memset(&key_latency, 0, sizeof(CWLATENCY));
+   key_issued_ns = 0;
+   pthread_mutex_unlock(&key_mutex);
+}
 
-    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
-		       len, coordScreen, &cCharsWritten );
+// upper bound of the bucket holding the given percentile
 
-    if (screen->ncols >= len)
-       left = (screen->ncols - len);
+LONGLONG key_latency_percentile(CWLATENCY *lat, ULONG percent)
+{
+   LONGLONG target, seen = 0;
+   ULONG i, msb;
 
-    if (left)
-    {
-       coordScreen.X = (short)len;
-       coordScreen.Y = (short)row;
+   if (!lat || !lat->count)
+      return 0;
 
-       bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) ' ',
-				    left, coordScreen, &cCharsWritten );
+   target = (lat->count * percent + 99) / 100;
+   if (!target)
+      target = 1;
+   for (i=0; i < CW_LATENCY_BUCKETS; i++)
+   {
+      seen += lat->hist[i];
+      if (seen >= target)
+	 break;
+   }
+   if (i >= CW_LATENCY_BUCKETS)
+      return lat->max_ns;
+   if (i < CW_LATENCY_SUB)
+      return i;
+
+   msb = (i / CW_LATENCY_SUB) + 2;
+   return ((LONGLONG)(CW_LATENCY_SUB + (i % CW_LATENCY_SUB) + 1)
+	   << (msb - 3)) - 1;
+}
+#endif
 
-       bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
-				    left, coordScreen, &cCharsWritten );
-    }
+#if (LINUX_UTIL)
+// the kernel console blanks the screen after consoleblank seconds,
+// which would hide the cworthy screensaver.  It is turned off with
+// the console escape setterm -blank would write, and the interval is
+// put back on exit.  Pseudo terminals have no blanking, so nothing is
+// read or written unless stdout is a virtual console.
 
-#endif
+static void disable_console_blank(void)
+{
+   char buf[32];
+   int fd, len;
+   char type;
 
-#if (DOS_UTIL | LINUX_UTIL)
-    ULONG i;
-    BYTE *v, c;
+   console_blank = 0;
+   if (ioctl(STDOUT_FILENO, KDGKBTYPE, &type))
+      return;
 
-#if LINUX_UTIL
-   if (pthread_mutex_lock(&vidmem_mutex))
+   fd = open("/sys/module/kernel/parameters/consoleblank", O_RDONLY);
+   if (fd < 0)
       return;
+   len = read(fd, buf, sizeof(buf) - 1);
+   close(fd);
+   if (len <= 0)
+      return;
+   buf[len] = '\0';
+   console_blank = strtoul(buf, NULL, 10);
+#if VERBOSE
+   printf("console blank timer: %lu\n", console_blank);
 #endif
-    v = screen->p_vidmem;
-    v += (row * (screen->ncols * 2)) + 0 * 2;
-    for (i = 0; i < screen->ncols; i++)
-    {
-       if (*s == '\0')
-       {
-          c = ' ';
-	  *v++ = ' ';
-	  *v++ = (attr_array && attr_array[i] && attr != bar_attribute)
-		 ? attr_array[i] : attr;
-       }
-       else
-       {
-	  c = *s;
-	  *v++ = *s++;
-	  *v++ = (attr_array && attr_array[i] && attr != bar_attribute)
-		 ? attr_array[i] : attr;
-       }
-#if (LINUX_UTIL)
-       set_color(attr_array && attr_array[i] && attr != bar_attribute
-		 ? attr_array[i] : attr);
-       mvputc(row, i, c);
-       clear_color();
-#endif
-#if (DOS_UTIL)
-       ScreenPutChar(c, attr_array && attr_array[i] && attr != bar_attribute
-		     ? attr_array[i] : attr,
-		     i, row);
-#endif
-    }
-#if (LINUX_UTIL)
-    pthread_mutex_unlock(&vidmem_mutex);
-#endif
+   if (console_blank)
+      write(STDOUT_FILENO, "\033[9;0]", 6);
+}
 
-#endif
+static void restore_console_blank(void)
+{
+   char buf[32];
+   int len;
 
+   if (!console_blank)
+      return;
+   // the escape takes minutes
+   len = snprintf(buf, sizeof(buf), "\033[9;%lu]",
+		  (console_blank + 59) / 60);
+   fflush(stdout);
+   write(STDOUT_FILENO, buf, len);
+   console_blank = 0;
 }
+#endif
 
-void put_string_to_length(NWSCREEN *screen, const char *s, BYTE *attr_array,
-			  ULONG row, ULONG col, ULONG attr, ULONG len)
+ULONG init_cworthy(void)
 {
 
 #if (WINDOWS_NT_UTIL)
     HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
     BOOL bSuccess;
-    DWORD cCharsWritten;
-    COORD coordScreen;
-    ULONG string_len = lstrlen(s);
-    ULONG left = 0;
-
-    if (len > string_len)
-       left = (len - string_len);
-    else
-       string_len = len;
-
-    coordScreen.X = (short)col;
-    coordScreen.Y = (short)row;
+    CONSOLE_SCREEN_BUFFER_INFO csbi; /* to get buffer info */
 
-    bSuccess = WriteConsoleOutputCharacter( hConsole, (LPSTR) s,
-				    string_len, coordScreen, &cCharsWritten );
+    /* get the number of character cells in the current buffer */
+    bSuccess = GetConsoleScreenBufferInfo( hConsole, &csbi );
 
-    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
-				    string_len, coordScreen, &cCharsWritten );
+    console_screen.ncols = csbi.srWindow.Right - csbi.srWindow.Left;
+    console_screen.nlines = csbi.srWindow.Bottom - csbi.srWindow.Top;
 
-    if (left)
+    if ((console_screen.ncols < 80) || (console_screen.nlines < 19))
     {
-       coordScreen.X = (short)(col + string_len);
-       coordScreen.Y = (short)row;
+        printf("Your display is too small to run cworthy (%d lines, %d cols).\n"
+	       "The program requires a minimum of"
+	       " 19 lines and 80 columns\n",
+	       console_screen.nlines, console_screen.ncols);
+	return -1;
+    }
 
-       bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) ' ',
-				    left, coordScreen, &cCharsWritten );
+    console_screen.p_vidmem = malloc(console_screen.ncols *
+				   console_screen.nlines * 2);
+    if (!console_screen.p_vidmem)
+       return -1;
 
-       bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
-				    left, coordScreen, &cCharsWritten );
+    console_screen.p_saved = malloc(console_screen.ncols *
+				  console_screen.nlines * 2);
+    if (!console_screen.p_saved)
+    {
+       free(console_screen.p_vidmem);
+       return -1;
     }
 
+    clear_screen(&console_screen);
+    disable_cursor();
+    return 0;
 #endif
 
-#if (DOS_UTIL | LINUX_UTIL)
-    ULONG i, j;
-    BYTE *v, c;
-
-#if LINUX_UTIL
-   if (pthread_mutex_lock(&vidmem_mutex))
-      return;
-#endif
-    v = screen->p_vidmem;
-    v += (row * (screen->ncols * 2)) + col * 2;
-    for (j=col,i=0; i < len && i < (screen->ncols - j); i++)
-    {
-       if (*s == '\0')
-       {
-	  c = ' ';
-	  *v++ = ' ';
-	  *v++ = (attr_array && attr_array[i] && attr != bar_attribute)
-		 ? attr_array[i] : attr;
-       }
-       else
-       {
-	  c = *s;
-	  *v++ = *s++;
-	  *v++ = (attr_array && attr_array[i] && attr != bar_attribute)
-		 ? attr_array[i] : attr;
-       }
-#if (LINUX_UTIL)
-       set_color(attr_array && attr_array[i] && attr != bar_attribute
-		 ? attr_array[i] : attr);
-       mvputc(row, col++, c);
-       clear_color();
-#endif
 #if (DOS_UTIL)
-       ScreenPutChar(c, attr_array && attr_array[i] && attr != bar_attribute
-		     ? attr_array[i] : attr,
-		     col++, row);
-#endif
-    }
-#if (LINUX_UTIL)
-    pthread_mutex_unlock(&vidmem_mutex);
-#endif
-
-#endif
+     console_screen.ncols = ScreenCols();
+     console_screen.nlines = ScreenRows();
 
-}
+     if ((console_screen.ncols < 80) || (console_screen.nlines < 19))
+     {
+        printf("Your display is too small to run cworthy (%d lines, %d cols).\n"
+	       "The program requires a minimum of"
+	       " 19 lines and 80 columns\n",
+	       console_screen.nlines, console_screen.ncols);
+	return -1;
+     }
 
-void put_char_direct(NWSCREEN *screen, int c, ULONG row, ULONG col, ULONG attr)
-{
-#if (WINDOWS_NT_UTIL)
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    BOOL bSuccess;
-    DWORD cCharsWritten;
-    COORD coordScreen;
+     console_screen.p_vidmem = malloc(console_screen.ncols *
+				    console_screen.nlines * 2);
+     if (!console_screen.p_vidmem)
+	return -1;
 
-    coordScreen.X = (short)col;
-    coordScreen.Y = (short)row;
+     console_screen.p_saved = malloc(console_screen.ncols *
+				    console_screen.nlines * 2);
+     if (!console_screen.p_saved)
+     {
+	free(console_screen.p_vidmem);
+	return -1;
+     }
 
-    bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) c,
-				    1, coordScreen, &cCharsWritten );
+     ScreenRetrieve(console_screen.p_vidmem);
+     ScreenRetrieve(console_screen.p_saved);
+     ScreenGetCursor(&screen_x, &screen_y);
 
-    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
-				    1, coordScreen, &cCharsWritten );
+     disable_cursor();
 #endif
 
-#if (DOS_UTIL | LINUX_UTIL)
+#if (LINUX_UTIL)
+     BYTE *tname;
 
-#if LINUX_UTIL
-   if (pthread_mutex_lock(&vidmem_mutex))
-      return;
-#endif
+     pthread_mutex_init(&vidmem_mutex, NULL);
 
-#if (DOS_UTIL)
-    ScreenPutChar(c, attr, col, row);
-#endif
+     // tty byte accounting reads the write counter of this thread,
+     // which must be the one calling refresh_screen
+     ui_thread = pthread_self();
+     io_fd = open("/proc/thread-self/io", O_RDONLY);
 
-#if (LINUX_UTIL)
-    set_color(attr);
-    mvputc(row, col, c);
-    clear_color();
-    pthread_mutex_unlock(&vidmem_mutex);
-#endif
+     // setlocale must be called to enable utf8 (unicode) character
+     // display settings.
+     setlocale(LC_ALL, "");
 
-#endif
+     initscr();
+     nonl();
+     intrflush(stdscr, FALSE);
+     keypad(stdscr, TRUE);
+     noecho();
 
-    return;
-}
+     tname = (BYTE *)termname();
+     if (tname)
+     {
+        memset(terminal_name, 0, 256);
+        strncpy((char *)terminal_name, (const char *)tname, 255);
+        if (strcasestr((const char *)terminal_name, "linux"))
+           linux_term = TRUE;
+        if (strcasestr((const char *)terminal_name, "xterm"))
+           xterm = TRUE;
+        if (strcasestr((const char *)terminal_name, "ansi"))
+           ansi = TRUE;
+     }
 
-void put_char(NWSCREEN *screen, int c, ULONG row, ULONG col, ULONG attr)
-{
-#if (WINDOWS_NT_UTIL)
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    BOOL bSuccess;
-    DWORD cCharsWritten;
-    COORD coordScreen;
+     if ((COLS < 80) || (LINES < 19))
+     {
+        endwin();
+        printf("Your display is too small to run cworthy (%d lines, %d cols).\n"
+	       "The program requires a minimum of"
+	       " 19 lines and 80 columns\n", LINES, COLS);
+	return -1;
+     }
 
-    coordScreen.X = (short)col;
-    coordScreen.Y = (short)row;
+     console_screen.ncols = COLS;
+     console_screen.nlines = LINES;
 
-    bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) c,
-				    1, coordScreen, &cCharsWritten );
+     console_screen.p_vidmem = (BYTE *)malloc(console_screen.ncols *
+				            console_screen.nlines * 2);
+     if (!console_screen.p_vidmem)
+     {
+        endwin();
+	return -1;
+     }
+     if (alloc_bands(&console_screen))
+     {
+	free(console_screen.p_vidmem);
+	console_screen.p_vidmem = NULL;
+        endwin();
+	return -1;
+     }
 
-    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
-				    1, coordScreen, &cCharsWritten );
+     // if the terminal does not support colors, or if the
+     // terminal cannot support at least eight primary colors
+     // for foreground/background color pairs, then default
+     // the library to use ASCII characters < 127 (7 bit), disable
+     // ncurses color attributes, and do not attempt to use
+     // the alternate character set for graphic characters.
 
-#endif
+     if (has_colors() && !mono_mode)
+     {
+	if (start_color() == OK)
+	{
+	   if (COLORS >= 8)
+	   {
+	      has_color = TRUE;
 
-#if (DOS_UTIL | LINUX_UTIL)
-    BYTE *v;
+              // color pairs are created on first use, see
+              // get_color_pair()
 
-    if (col >= screen->ncols)
-       return;
+	      memset(pc_pair_ready, 0, sizeof(pc_pair_ready));
+	      init_color_cache();
+	   }
+	}
+     }
 
-    if (row >= screen->nlines)
-       return;
+     wclear(stdscr);
+     disable_cursor();
+     refresh_screen();
 
-#if LINUX_UTIL
-   if (pthread_mutex_lock(&vidmem_mutex))
-      return;
+     // disable screen blanking and enable
+     // cworthy screensaver
+     disable_console_blank();
+#endif
+     return 0;
+}
+
+ULONG release_cworthy(void)
+{
+#if (WINDOWS_NT_UTIL)
+    clear_screen(&console_screen);
+    enable_cursor(0);
+    if (console_screen.p_vidmem)
+       free(console_screen.p_vidmem);
+    if (console_screen.p_saved)
+       free(console_screen.p_saved);
 #endif
-    v = screen->p_vidmem;
-    v += (row * (screen->ncols * 2)) + col * 2;
-    *v++ = c;
-    *v = attr;
+
+    clear_screen(&console_screen);
 
 #if (DOS_UTIL)
-    ScreenPutChar(c, attr, col, row);
+    clear_screen(&console_screen);
+    enable_cursor(0);
+    ScreenSetCursor(screen_x, screen_y);
+    screen_write(console_screen.p_saved);
+    if (console_screen.p_vidmem)
+       free(console_screen.p_vidmem);
+    if (console_screen.p_saved)
+       free(console_screen.p_saved);
 #endif
 
 #if (LINUX_UTIL)
-    set_color(attr);
-    mvputc(row, col, c);
-    clear_color();
-    pthread_mutex_unlock(&vidmem_mutex);
-#endif
+    stop_portal_streams();
+    stop_portal_refresh();
+    cancel_queued_dialogs();
+    pthread_mutex_destroy(&vidmem_mutex);
+    if (io_fd >= 0)
+       close(io_fd);
+    io_fd = -1;
 
-#endif
+    enable_cursor(0);
+    endwin();
 
-    return;
+    // reset terminal escape sequence
+    printf("%c%c", 0x1B, 'c');
+
+    if (console_screen.p_vidmem)
+       free(console_screen.p_vidmem);
+    if (console_screen.p_saved)
+       free(console_screen.p_saved);
+    if (console_screen.p_wide)
+       free(console_screen.p_wide);
+    console_screen.p_wide = NULL;
+    if (console_screen.p_xattr)
+       free(console_screen.p_xattr);
+    console_screen.p_xattr = NULL;
+    free_bands(&console_screen);
+    release_color_cache();
+
+    // enable screen blanking
+    restore_console_blank();
+#endif
+    return 0;
 }
 
-int get_char(NWSCREEN *screen, ULONG row, ULONG col)
+// byte helpers, len is in bytes.  set_data stores the low byte of
+// value like memset, fills of whole cells go through cell_fill.
+
+void copy_data(ULONG *src, ULONG *dest, ULONG len)
 {
-#if (WINDOWS_NT_UTIL)
-    BYTE v[2];
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    BOOL bSuccess;
-    DWORD cCharsWritten;
-    COORD coordScreen;
+   memcpy(dest, src, len);
+}
 
-    coordScreen.X = (short)col;
-    coordScreen.Y = (short)row;
+void set_data(ULONG *dest, ULONG value, ULONG len)
+{
+   memset(dest, value, len);
+}
 
-    bSuccess = ReadConsoleOutputCharacter( hConsole, (LPSTR) &v,
-				    1, coordScreen, &cCharsWritten );
-    return (BYTE) v[0];
+void set_data_b(BYTE *dest, BYTE value, ULONG len)
+{
+   memset(dest, value, len);
+}
 
-#endif
+// cell kernels.  The screen map and the frame save buffers hold cells
+// as (char, attr) byte pairs.  These fill, recolor and compare runs of
+// cells sixteen bytes at a time with SSE2, one cell at a time
+// otherwise.  Copies are left to memmove, which libc already
+// vectorizes.  The rect forms take strides in cells.
 
-#if (DOS_UTIL | LINUX_UTIL)
-   BYTE *v;
+void cell_fill(BYTE *v, ULONG count, BYTE c, BYTE attr)
+{
+   ULONG i = 0;
+#if defined(__SSE2__)
+   __m128i pattern = _mm_set1_epi16((short)(c | (attr << 8)));
 
-#if LINUX_UTIL
-   if (pthread_mutex_lock(&vidmem_mutex))
-      return ' ';
-#endif
-   v = screen->p_vidmem;
-   v += (row * (screen->ncols * 2)) + col * 2;
-#if LINUX_UTIL
-   pthread_mutex_unlock(&vidmem_mutex);
+   for (; i + 8 <= count; i += 8)
+      _mm_storeu_si128((__m128i *)&v[i * 2], pattern);
 #endif
+   for (; i < count; i++)
+   {
+      v[i * 2] = c;
+      v[i * 2 + 1] = attr;
+   }
+}
 
-   return (BYTE)(*v);
-#endif
+void cell_recolor(BYTE *v, ULONG count, BYTE attr)
+{
+   ULONG i = 0;
+#if defined(__SSE2__)
+   __m128i chars = _mm_set1_epi16(0x00FF);
+   __m128i a = _mm_set1_epi16((short)(attr << 8));
+   __m128i x;
 
+   for (; i + 8 <= count; i += 8)
+   {
+      x = _mm_loadu_si128((const __m128i *)&v[i * 2]);
+      x = _mm_or_si128(_mm_and_si128(x, chars), a);
+      _mm_storeu_si128((__m128i *)&v[i * 2], x);
+   }
+#endif
+   for (; i < count; i++)
+      v[i * 2 + 1] = attr;
 }
 
-int get_char_attribute(NWSCREEN *screen, ULONG row, ULONG col)
+void cell_copy(BYTE *dest, const BYTE *src, ULONG count)
 {
-#if (WINDOWS_NT_UTIL)
-    int v[2];
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    BOOL bSuccess;
-    DWORD cCharsWritten;
-    COORD coordScreen;
+   memmove(dest, src, count * 2);
+}
 
-    coordScreen.X = (short)col;
-    coordScreen.Y = (short)row;
+// index of the first cell which differs, count if none do
 
-    bSuccess = ReadConsoleOutputAttribute( hConsole, (LPWORD) &v,
-				    1, coordScreen, &cCharsWritten );
-    return (BYTE) v[0];
+ULONG cell_compare(const BYTE *a, const BYTE *b, ULONG count)
+{
+   ULONG i = 0;
+#if defined(__SSE2__)
+   unsigned int mask;
 
+   for (; i + 8 <= count; i += 8)
+   {
+      mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+		_mm_loadu_si128((const __m128i *)&a[i * 2]),
+		_mm_loadu_si128((const __m128i *)&b[i * 2])));
+      if (mask != 0xFFFF)
+	 return i + (__builtin_ctz(~mask) >> 1);
+   }
 #endif
+   for (; i < count; i++)
+      if (a[i * 2] != b[i * 2] || a[i * 2 + 1] != b[i * 2 + 1])
+	 break;
+   return i;
+}
 
-#if (DOS_UTIL | LINUX_UTIL)
-   BYTE *v;
-
-#if LINUX_UTIL
-   if (pthread_mutex_lock(&vidmem_mutex))
-      return 0;
-#endif
-   v = screen->p_vidmem;
-   v += (row * (screen->ncols * 2)) + col * 2;
-   v++;
-#if LINUX_UTIL
-   pthread_mutex_unlock(&vidmem_mutex);
-#endif
-
-   return (BYTE)(*v);
-#endif
+void cell_fill_rect(BYTE *v, ULONG stride, ULONG rows, ULONG cols, BYTE c,
+		    BYTE attr)
+{
+   ULONG i;
 
+   for (i=0; i < rows; i++)
+      cell_fill(&v[i * stride * 2], cols, c, attr);
 }
 
-void put_char_cleol(NWSCREEN *screen, int c, ULONG row, ULONG attr)
+void cell_recolor_rect(BYTE *v, ULONG stride, ULONG rows, ULONG cols,
+		       BYTE attr)
 {
-#if (WINDOWS_NT_UTIL)
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    BOOL bSuccess;
-    DWORD cCharsWritten;
-    COORD coordScreen;
-
-    coordScreen.X = (short)0;
-    coordScreen.Y = (short)row;
-
-    bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) c,
-				    screen->ncols, coordScreen,
-				    &cCharsWritten );
+   ULONG i;
 
-    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
-				    screen->ncols, coordScreen,
-				    &cCharsWritten );
-#endif
+   for (i=0; i < rows; i++)
+      cell_recolor(&v[i * stride * 2], cols, attr);
+}
 
-#if (DOS_UTIL | LINUX_UTIL)
-    ULONG i;
-    for (i=0; i < screen->ncols; i++)
-       put_char(screen, c, row, i, attr);
+void cell_copy_rect(BYTE *dest, ULONG dest_stride, const BYTE *src,
+		    ULONG src_stride, ULONG rows, ULONG cols)
+{
+   ULONG i;
 
-#endif
+   for (i=0; i < rows; i++)
+      cell_copy(&dest[i * dest_stride * 2], &src[i * src_stride * 2], cols);
 }
 
-void put_char_length(NWSCREEN *screen, int c, ULONG row, ULONG col, ULONG attr,
-		     ULONG len)
+#if (LINUX_UTIL)
+int _kbhit(void)
 {
-#if (WINDOWS_NT_UTIL)
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    BOOL bSuccess;
-    DWORD cCharsWritten;
-    COORD coordScreen;
+   int STDIN = 0, bytes = 0;
+   struct termios init;
+   struct termios term;
 
-    coordScreen.X = (short)0;
-    coordScreen.Y = (short)row;
+   tcgetattr(STDIN, &init);
+   tcgetattr(STDIN, &term);
+   term.c_lflag &=	~ICANON;
+   tcsetattr(STDIN, TCSANOW, &term);
 
-    bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) c,
-				    len, coordScreen, &cCharsWritten );
+   setbuf(stdin, NULL);
+   ioctl(STDIN, FIONREAD, &bytes);
 
-    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
-				    len, coordScreen, &cCharsWritten );
+   tcsetattr(STDIN, TCSANOW, &init);
+   return bytes;
+}
 #endif
 
-#if (DOS_UTIL | LINUX_UTIL)
-    ULONG i;
-    for (i=0; i < len && (i + col) < screen->ncols; i++)
-       put_char(screen, c, row, col + i, attr);
-#endif
+#if (LINUX_UTIL)
+ULONG set_screensaver_interval(ULONG seconds)
+{
+   ULONG t = time_delay;
+   time_delay = seconds;
+   return t;
 }
+#endif
 
-ULONG scroll_display(NWSCREEN *screen, ULONG row, ULONG col,
-		     ULONG lines, ULONG cols, ULONG up)
+ULONG get_key(void)
 {
 #if (WINDOWS_NT_UTIL)
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    BOOL fSuccess;
-    SMALL_RECT srctScrollRect, srctClipRect;
-    CHAR_INFO chiFill;
-    COORD coordDest;
+    ULONG c;
 
-    if (!cols || !lines)
-       return -1;
+    c = _getch();
+    if ((!c) || ((c & 0xFF) == 0xE0))
+    {
+       c = _getch();
+       c |= 0x0100; // identify this key as special
+       return c;
+    }
+    return c;
+#endif
 
-    if (col > screen->ncols - 1)
-       return -1;
+#if (DOS_UTIL)
+    ULONG c;
 
-    if (cols > screen->ncols)
-       return -1;
+    c = getch();
+    if ((!c) || ((c & 0xFF) == 0xE0))
+    {
+       c = getch();
+       c |= 0x0100; // identify this key as special
+       return c;
+    }
+    return c;
+#endif
 
-    if (row > screen->nlines - 1)
-       return -1;
+#if (LINUX_UTIL)
+    ULONG c;
+    struct timespec ts = { 0, 10000000L };
+    static ULONG seconds = 0;
 
-    if (lines > screen->nlines)
-       return -1;
+    refresh_screen();
+    if (key_issued_ns)
+    {
+       record_key_latency(get_ns() - key_issued_ns);
+       key_issued_ns = 0;
+    }
 
-    srctScrollRect.Top = (short)row;
-    srctScrollRect.Bottom = (short)(row + lines - 1);
-    srctScrollRect.Left = (short)col;
-    srctScrollRect.Right = (short)(col + cols - 1);
+ReadKey:
+    key_waiting = 1;
+    while (!typeahead_key && !_kbhit() && !key_queue_pending())
+    {
+       // dialogs queued by other threads are shown while the UI
+       // thread is idle here, then we go back to waiting
+       if (dialogs_queued && !dialog_active &&
+	   pthread_equal(ui_thread, pthread_self()))
+       {
+	  run_queued_dialogs();
+	  key_waiting = 1;
+	  seconds = 0;
+	  continue;
+       }
 
-    /* The destination for the scroll rectangle is one row up. */
+       fflush(stdout);
+       nanosleep(&ts, NULL);
+       // convert ns to seconds
+       if ((seconds++ / 100) > time_delay)
+       {
+          if (screensaver == FALSE)
+	  {
+	     screensaver = TRUE;
+	     visibility_changed();
+             wclear(stdscr);
+	     disable_cursor();
+	     refresh_screen();
+             cworthy_netware_screensaver();
+	  }
+	  seconds = 0;
+       }
 
-    if (up)
+       if ((notes_queued || note_showing) && screensaver == FALSE &&
+	   pthread_equal(ui_thread, pthread_self()))
+	  display_notifications();
+
+       if (stats_overlay)
+          display_stats_overlay(0);
+
+       if (refresh_pending) {
+          refresh_pending = 0;
+          refresh_screen();
+       }
+    }
+    // read a key the menus read ahead, then queued or buffered keys
+    key_from_queue = 0;
+    if (typeahead_key)
     {
-       coordDest.Y = (short)(row - 1);
-       coordDest.X = (short)col;
+       c = typeahead_key;
+       typeahead_key = 0;
     }
+    else if (pop_key(&c))
+       key_from_queue = 1;
     else
+       c = getch();
+    key_waiting = 0;
+    seconds = 0;
+
+    // the overlay hotkey is consumed here and never seen by callers,
+    // who keep waiting for the next key
+    if (stats_overlay_key && c == stats_overlay_key &&
+	screensaver == FALSE)
     {
-       coordDest.Y = (short)(row + 1);
-       coordDest.X = (short)col;
+       set_stats_overlay(!stats_overlay);
+       refresh_screen();
+       goto ReadKey;
     }
 
-    /*
-     * The clipping rectangle is the same as the scrolling rectangle.
-     * The destination row is left unchanged.
-     */
+    if (c)
+       key_issued_ns = get_ns();
 
-    srctClipRect = srctScrollRect;
+    if (screensaver == TRUE) {
+       screensaver = FALSE;
+       visibility_changed();
+       restore_screen();
+       refresh_screen();
+       // if screensaver was active swallow the key
+       c = 0;
+    }
+    refresh_screen();
+    return c;
+#endif
 
-    chiFill.Attributes = (unsigned short)screen->norm_vid;
-    chiFill.Char.AsciiChar = ' ';
+}
 
-    fSuccess = ScrollConsoleScreenBuffer(
-	hConsole,        /* screen buffer handle     */
-	&srctScrollRect, /* scrolling rectangle      */
-	&srctClipRect,   /* clipping rectangle       */
-	coordDest,       /* top left destination cell*/
-	&chiFill);       /* fill character and color */
+void set_xy(NWSCREEN *screen, ULONG row, ULONG col)
+{
+    screen->crnt_row = row;
+    screen->crnt_column = col;
+    hard_xy(row, col);
+    return;
+}
 
-    if (!fSuccess)
-       return -1;
+void get_xy(NWSCREEN *screen, ULONG *row, ULONG *col)
+{
+    *row = screen->crnt_row;
+    *col = screen->crnt_column;
+    return;
+}
 
-    return 0;
-#endif
+void clear_screen(NWSCREEN *screen)
+{
+#if (WINDOWS_NT_UTIL)
+   HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+   COORD coordScreen = { 0, 0 };
+   BOOL bSuccess;
+   DWORD cCharsWritten;
+   CONSOLE_SCREEN_BUFFER_INFO csbi; /* to get buffer info */
+   DWORD dwConSize;                 /* number of character cells in
+				       the current buffer */
 
-#if (DOS_UTIL | LINUX_UTIL)
-    ULONG i, tCol, tRow;
+   /* get the number of character cells in the current buffer */
 
-    if (!cols || !lines)
-       return -1;
+   bSuccess = GetConsoleScreenBufferInfo( hConsole, &csbi );
+   dwConSize = csbi.dwSize.X * csbi.dwSize.Y;
 
-    if (col > screen->ncols - 1)
-       return -1;
+   /* fill the entire screen with blanks */
 
-    if (cols > screen->ncols)
-       return -1;
+   bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) ' ',
+      dwConSize, coordScreen, &cCharsWritten );
 
-    if (row > screen->nlines - 1)
-       return -1;
+   /* get the current text attribute */
 
-    if (lines > screen->nlines)
-       return -1;
+   bSuccess = GetConsoleScreenBufferInfo( hConsole, &csbi );
 
-    if (up)
-    {
-       tCol = col;
-       tRow = row;
-       for (i=1; i < lines; i++)
-       {
-	  move_string(screen,
-			tRow + 1,
-			tCol,
-			tRow,
-			tCol,
-			cols);
-	  tRow++;
-       }
-       for (i=0; i < cols; i++)
-       {
-	  put_char(screen,
-		     ' ',
-		     tRow,
-		     tCol + i,
-		     screen->norm_vid);
-       }
-    }
-    else
-    {
-       tCol = col;
-       tRow = row + (lines - 1);
-       for (i=1; i < lines; i++)
-       {
-	  move_string(screen,
-			tRow - 1,
-			tCol,
-			tRow,
-			tCol,
-			cols);
-	  tRow--;
-       }
-       for (i=0; i < cols; i++)
-       {
-	  put_char(screen,
-		     ' ',
-		     row,
-		     tCol + i,
-		     screen->norm_vid);
-       }
-    }
-#endif
-    return 0;
-}
+   /* now set the buffer's attributes accordingly */
 
-ULONG field_set_xy(ULONG num, ULONG row, ULONG col)
-{
-    if (!frame[num].owner)
-       return -1;
+   bSuccess = FillConsoleOutputAttribute( hConsole, csbi.wAttributes,
+      dwConSize, coordScreen, &cCharsWritten );
 
-    if (!frame[num].screen)
-       return -1;
+   /* put the cursor at (0, 0) */
 
-    if (row >= (ULONG)frame[num].el_count)
-       return -1;
+   bSuccess = SetConsoleCursorPosition( hConsole, coordScreen );
 
-    if (row < (ULONG)frame[num].top) {
-       frame[num].top = row;
-       frame[num].bottom = frame[num].top + frame[num].window_size;
-    } else if (row >= (frame[num].top + frame[num].window_size)) {
-       frame[num].top = row - (frame[num].window_size - 1);
-       frame[num].bottom = frame[num].top + frame[num].window_size;
-    }
-    update_static_portal(num);
-    return (frame_set_xy(num, row - frame[num].top, col));
+   return;
+#endif
 
-}
+#if (DOS_UTIL | LINUX_UTIL)
+#if LINUX_UTIL
+   ULONG i;
 
-ULONG frame_set_xy(ULONG num, ULONG row, ULONG col)
-{
-    if (!frame[num].owner)
-       return -1;
+   if (lock_screen(screen))
+      return;
+#endif
+   cell_fill(screen->p_vidmem, screen->ncols * screen->nlines, ' ',
+	     (BYTE)(screen->norm_vid & 0xFF));
 
-    if (!frame[num].screen)
-       return -1;
+#if (DOS_UTIL)
+   screen_write(console_screen.p_vidmem);
+#endif
 
-    if (col >= frame[num].screen->ncols)
-       return -1;
+#if (LINUX_UTIL)
+   if (screen->p_xattr)
+      memset(screen->p_xattr, 0,
+	     screen->ncols * screen->nlines * sizeof(ULONG));
+   // ncurses is cleared along with the map, nothing is left to draw
+   wclear(stdscr);
+   for (i=0; i < screen->nlines; i++)
+      clear_dirty(screen, i);
+   for (i=0; i <= row_band(screen, screen->nlines - 1); i++)
+      screen->bands[i].dirty = 0;
+   cw_stats.cells_written += screen->ncols * screen->nlines;
+   unlock_screen(screen);
+#endif
 
-    if (row >= frame[num].screen->nlines)
-       return -1;
+#endif
 
-    if ((row + frame[num].start_row) >= frame[num].screen->nlines)
-       return -1;
+   return;
+}
 
-    if ((col + frame[num].start_column) >= frame[num].screen->ncols)
-       return -1;
+// the attribute of cell i of a string written with an attribute array.
+// The bar attribute overrides the arrays.
 
-    frame[num].pcur_row = row;
-    frame[num].pcur_column = col;
+static inline ULONG array_attr(BYTE *attr_array, const ULONG *xattr_array,
+			       ULONG i, ULONG attr)
+{
+   if (attr == bar_attribute)
+      return attr;
+   if (xattr_array && xattr_array[i])
+      return xattr_array[i];
+   if (attr_array && attr_array[i])
+      return attr_array[i];
+   return attr;
+}
 
-    if (strlen((const char *)frame[num].header))
-       set_xy(frame[num].screen,
-	   frame[num].start_row + 3 + row,
-	   frame[num].start_column + 2 + col);
-    else
-       set_xy(frame[num].screen,
-	   frame[num].start_row + 1 + row,
-	   frame[num].start_column + 2 + col);
-    return 0;
+#if (LINUX_UTIL)
+// store the attribute of the cell at v.  Extended attributes keep
+// their full value in p_xattr, allocated on first use, and the
+// nearest PC attribute in the screen map.
+
+static inline BYTE cell_attr(NWSCREEN *screen, BYTE *v, ULONG attr)
+{
+   ULONG idx = (v - screen->p_vidmem) / 2;
 
+   if (attr & CW_XATTR)
+   {
+      if (screen_plane(screen, &screen->p_xattr))
+	 screen->p_xattr[idx] = attr;
+      return xattr_fallback(attr);
+   }
+   if (screen->p_xattr)
+      screen->p_xattr[idx] = 0;
+   return (BYTE)attr;
 }
 
-ULONG frame_get_xy(ULONG num, ULONG *row, ULONG *col)
+// the attribute the cell at v is drawn with
+
+static inline ULONG cell_color(NWSCREEN *screen, BYTE *v)
 {
-    if (!frame[num].owner)
-       return -1;
+   ULONG idx = (v - screen->p_vidmem) / 2;
 
-    *row = frame[num].pcur_row;
-    *col = frame[num].pcur_column;
-    return 0;
+   if (screen->p_xattr && screen->p_xattr[idx])
+      return screen->p_xattr[idx];
+   return v[1];
 }
 
-void scroll_menu(ULONG num, ULONG up)
+// cell_attr for count cells starting at v
+
+static inline BYTE cell_attrs(NWSCREEN *screen, BYTE *v, ULONG attr,
+			      ULONG count)
 {
-    ULONG row, col;
+   ULONG idx = (v - screen->p_vidmem) / 2, i;
 
-    if (strlen((const char *)frame[num].header))
-       row = frame[num].start_row + 3;
-    else
-       row = frame[num].start_row + 1;
+   if (attr & CW_XATTR)
+   {
+      if (screen_plane(screen, &screen->p_xattr))
+	 for (i=0; i < count; i++)
+	    screen->p_xattr[idx + i] = attr;
+      return xattr_fallback(attr);
+   }
+   if (screen->p_xattr)
+      memset(&screen->p_xattr[idx], 0, count * sizeof(ULONG));
+   return (BYTE)attr;
+}
+#else
+#define cell_attr(screen, v, attr)           ((BYTE)(attr))
+#define cell_attrs(screen, v, attr, count)   ((BYTE)(attr))
+#define cell_color(screen, v)                ((v)[1])
+#endif
 
-    col = frame[num].start_column + 1;
+#if (DOS_UTIL | LINUX_UTIL)
+// hand count cells of the screen map to the display.  On Linux this
+// is only done by flush_dirty, with vidmem_mutex and the band of row
+// held.  The color is only set when it changes.
 
-    scroll_display(frame[num].screen,
-		  row,
-		  col,
-		  frame[num].end_row - row,
-		  frame[num].end_column - col,
-		  up);
-    return;
+static void emit_cells(NWSCREEN *screen, ULONG row, ULONG col, ULONG count)
+{
+   BYTE *v = screen->p_vidmem + (row * screen->ncols + col) * 2;
+   ULONG i, a;
+#if (LINUX_UTIL)
+   ULONG last = (ULONG)-1;
+
+   for (i=0; i < count; i++, v += 2)
+   {
+      a = cell_color(screen, v);
+      if (a != last)
+      {
+	 clear_color();
+	 set_color(a);
+	 last = a;
+      }
+      mvputc(row, col + i, v[0]);
+   }
+   clear_color();
+#endif
+#if (DOS_UTIL)
+   for (i=0; i < count; i++, v += 2)
+   {
+      a = v[1];
+      ScreenPutChar(v[0], a, col + i, row);
+   }
+#endif
 }
 
-ULONG get_resp(ULONG num)
+#if (LINUX_UTIL)
+// hand the dirty cells of the screen map to ncurses.  Called from
+// refresh_screen with vidmem_mutex held.  Writing moves the ncurses
+// cursor, so it is put back where set_xy left it.
+
+static void flush_dirty(NWSCREEN *screen)
 {
-    ULONG key, row, col, width, temp;
-    ULONG i, ccode;
+   ULONG i, row, rows;
+   CWBAND *b;
+   int y, x;
 
-    if (strlen((const char *)frame[num].header))
-       row = frame[num].start_row + 3;
-    else
-       row = frame[num].start_row + 1;
+   if (!screen->bands)
+      return;
 
-    col = frame[num].start_column + 1;
-    width = frame[num].end_column - frame[num].start_column;
-    if (width >= 1)
-       width -= 1;
-    frame[num].top = 0;
-    frame[num].bottom = frame[num].top + frame[num].window_size;
+   getyx(stdscr, y, x);
+   for (i=0; i <= row_band(screen, screen->nlines - 1); i++)
+   {
+      b = &screen->bands[i];
+      lock_band(b);
+      if (b->dirty)
+      {
+	 rows = b->dirty;
+	 for (row=i * CW_BAND_ROWS; rows; row++, rows >>= 1)
+	 {
+	    if (!(rows & 1))
+	       continue;
+	    emit_cells(screen, row, screen->dirty_lo[row],
+		       screen->dirty_hi[row] - screen->dirty_lo[row]);
+	    clear_dirty(screen, row);
+	 }
+	 b->dirty = 0;
+      }
+      pthread_mutex_unlock(&b->mutex);
+   }
+   move(y, x);
+}
+#endif
 
-    temp = frame[num].choice;
-    frame[num].choice = 0;
-    frame[num].index = 0;
-    for (i=0; i < temp; i++)
-    {
-       frame[num].choice++;
-       frame[num].index++;
+// fill count cells of a row with c in attr and draw them
 
-       if (frame[num].index >= (long)frame[num].el_count)
-	  frame[num].index--;
+static void fill_cells(NWSCREEN *screen, int c, ULONG row, ULONG col,
+		       ULONG attr, ULONG count)
+{
+   BYTE *v;
 
-       if (frame[num].index >= (long)frame[num].window_size)
-       {
-	  frame[num].index--;
-	  if (frame[num].choice < (long)frame[num].el_count)
-	  {
-	     frame[num].top++;
-	     frame[num].bottom = frame[num].top +
-		     frame[num].window_size;
-	     scroll_menu(num, 1);
-	  }
-       }
+   if (row >= screen->nlines || col >= screen->ncols)
+      return;
+   if (count > screen->ncols - col)
+      count = screen->ncols - col;
 
-       if (frame[num].choice >= (long)frame[num].el_count)
-	  frame[num].choice--;
-    }
+#if (LINUX_UTIL)
+   if (lock_rows(screen, row, row))
+      return;
+#endif
+   v = screen->p_vidmem + (row * screen->ncols + col) * 2;
+   cell_fill(v, count, (BYTE)c, cell_attrs(screen, v, attr, count));
+#if (LINUX_UTIL)
+   mark_dirty(screen, row, col, count);
+   cw_stats.cells_written += count;
+   unlock_rows(screen, row, row);
+#else
+   emit_cells(screen, row, col, count);
+#endif
+}
 
-    for (;;)
-    {
-       if (frame[num].el_strings[frame[num].choice])
-       {
-	  if (frame[num].scroll_frame)
-          {
-	     put_char(frame[num].screen, ' ',
-		      row + frame[num].index, col,
-		      bar_attribute);
+// change the attributes of count cells of a row and leave their
+// characters alone, cell i takes the attribute array_attr gives it.
+// Called with the row locked.
 
-	     put_char(frame[num].screen,
-		      frame[num].scroll_frame,
-		      row + frame[num].index, col + 1,
-		      bar_attribute);
-
-	     put_string_to_length(frame[num].screen,
-		    (const char *)frame[num].el_strings[frame[num].choice],
-	            frame[num].el_attr[frame[num].choice],
-		    row + frame[num].index, col + 2,
-		    bar_attribute,
-		    width - 2);
-	  }
-	  else
-	  {
-	     put_string_to_length(frame[num].screen,
-		    (const char *)frame[num].el_strings[frame[num].choice],
-                    frame[num].el_attr[frame[num].choice],
-		    row + frame[num].index, col,
-		    bar_attribute, width);
-          }
-       }
+static void recolor_cells(NWSCREEN *screen, BYTE *attr_array,
+			  const ULONG *xattr_array, ULONG row, ULONG col,
+			  ULONG attr, ULONG count)
+{
+   BYTE *v = screen->p_vidmem + (row * screen->ncols + col) * 2;
+   ULONG i, n, a;
 
-       if (frame[num].el_count > frame[num].window_size &&
-                                          frame[num].top)
-       {
-	  put_char(frame[num].screen,
-		  frame[num].up_char,
-		  row,
-		  col,
-		  get_char_attribute(frame[num].screen, row, col));
-       }
-       else
-       {
-	  put_char(frame[num].screen,
-		  ' ',
-		  row,
-		  col,
-		  get_char_attribute(frame[num].screen, row, col));
-       }
+   for (i=0; i < count; i += n)
+   {
+      a = array_attr(attr_array, xattr_array, i, attr);
+      for (n=1; i + n < count &&
+	   array_attr(attr_array, xattr_array, i + n, attr) == a; n++)
+	 ;
+      cell_recolor(&v[i * 2], n, cell_attrs(screen, &v[i * 2], a, n));
+   }
+#if (LINUX_UTIL)
+   mark_dirty(screen, row, col, count);
+   cw_stats.cells_written += count;
+#endif
+#if (DOS_UTIL)
+   emit_cells(screen, row, col, count);
+#endif
+}
+#endif
 
-       if (frame[num].el_count > frame[num].window_size
-	  && frame[num].bottom < (long)frame[num].el_count)
-       {
-	  put_char(frame[num].screen,
-		  frame[num].down_char,
-		  row + frame[num].window_size - 1,
-		  col,
-		  get_char_attribute(frame[num].screen,
-				     row + frame[num].window_size - 1,
-				     col));
-       }
-       else
-       {
-	  put_char(frame[num].screen,
-		  ' ',
-		  row + frame[num].window_size - 1,
-		  col,
-		  get_char_attribute(frame[num].screen,
-				     row + frame[num].window_size - 1,
-				     col));
-       }
+#if (LINUX_UTIL)
+#define PUT_PAD           0x0001    // blank the cells up to len
+#define PUT_BAR           0x0002    // the bar attribute overrides attr_array
+#define PUT_TRANSPARENT   0x0004    // keep the cell attribute if attr is 0
+
+// store decoded characters in the screen map.  Called with the row
+// locked, returns the number of cells written.  attr_array is indexed by byte offset for text and
+// by column for padding, as in the single byte functions.
+
+static ULONG put_glyphs(NWSCREEN *screen, const CWGLYPH *g, ULONG count,
+			BYTE *attr_array, const ULONG *xattr_array,
+			ULONG row, ULONG col, ULONG attr, ULONG len,
+			ULONG flags)
+{
+   ULONG i, n, a, idx;
+   BYTE *v;
 
-       key = get_key();
-       if (frame[num].key_mask)
-	  continue;
+   if (row >= screen->nlines || col >= screen->ncols)
+      return 0;
+   if (len > screen->ncols - col)
+      len = screen->ncols - col;
 
-       if (frame[num].el_strings[frame[num].choice])
-       {
-	  if (frame[num].scroll_frame)
-	  {
-	     put_char(frame[num].screen,
-	              ' ',
-		      row + frame[num].index, col,
-		      frame[num].fill_color |
-		      frame[num].text_color);
+   if (!screen_plane(screen, &screen->p_wide))
+      return 0;
 
-	     put_char(frame[num].screen,
-	              frame[num].scroll_frame,
-		      row + frame[num].index, col + 1,
-		      frame[num].fill_color |
-		      frame[num].text_color);
-
-	     put_string_to_length(frame[num].screen,
-		    (const char *)frame[num].el_strings[frame[num].choice],
-                    frame[num].el_attr[frame[num].choice],
-		    row + frame[num].index, col + 2,
-		    frame[num].fill_color |
-		    frame[num].text_color,
-		    width - 2);
-	  }
-	  else
-	  {
-	     put_string_to_length(frame[num].screen,
-		    (const char *)frame[num].el_strings[frame[num].choice],
-                    frame[num].el_attr[frame[num].choice],
-		    row + frame[num].index, col,
-		    frame[num].fill_color |
-		    frame[num].text_color, width);
-	  }
-       }
+   idx = row * screen->ncols + col;
+   v = screen->p_vidmem + idx * 2;
+   for (i=0, n=0; i < count && n + g[i].width <= len; i++)
+   {
+      if ((flags & PUT_BAR) && attr == bar_attribute)
+	 a = attr;
+      else if (xattr_array && xattr_array[g[i].offset])
+	 a = xattr_array[g[i].offset];
+      else if (attr_array && attr_array[g[i].offset])
+	 a = attr_array[g[i].offset];
+      else if ((flags & PUT_TRANSPARENT) && !attr)
+	 a = cell_color(screen, v);
+      else
+	 a = attr;
 
-       switch (key)
-       {
-#if (LINUX_UTIL)
-          // screensaver return key
-          case 0:
-             break;
-#endif
+      if (g[i].cp < 0x80)
+      {
+	 // DEL would be taken for a wide cell
+	 v[0] = (g[i].cp == CW_WIDE_CELL) ? ' ' : (BYTE)g[i].cp;
+      }
+      else
+      {
+	 v[0] = CW_WIDE_CELL;
+	 screen->p_wide[idx] = g[i].cp;
+      }
+      v[1] = cell_attr(screen, v, a);
+      v += 2;
+      idx++;
+      n++;
 
-	  case ENTER:
-	     if (frame[num].el_func)
-	     {
-		ccode = (frame[num].el_func)
-			(frame[num].screen,
-			 frame[num].el_values[frame[num].choice],
-			 frame[num].el_strings[frame[num].choice],
-			 frame[num].choice);
-		if (ccode)
-		   return ccode;
-	     }
-	     else
-	     {
-		if (frame[num].choice >=
-		    (long)frame[num].el_count)
-		   return (ULONG) -1;
-		else
-		   return
-		      (frame[num].el_values[frame[num].choice]);
-	     }
-	     break;
+      if (g[i].width == 2)
+      {
+	 v[0] = CW_WIDE_CELL;
+	 v[1] = cell_attr(screen, v, a);
+	 screen->p_wide[idx] = 0;
+	 v += 2;
+	 idx++;
+	 n++;
+      }
+   }
+   if (flags & PUT_PAD)
+   {
+      for (; n < len; n++)
+      {
+	 if ((flags & PUT_BAR) && attr == bar_attribute)
+	    a = attr;
+	 else if (xattr_array && xattr_array[n])
+	    a = xattr_array[n];
+	 else if (attr_array && attr_array[n])
+	    a = attr_array[n];
+	 else
+	    a = attr;
+	 v[0] = ' ';
+	 v[1] = cell_attr(screen, v, a);
+	 v += 2;
+      }
+   }
+   mark_dirty(screen, row, col, n);
+   return n;
+}
 
-#if (LINUX_UTIL)
-	  case 'Q':
-          case 'q':
-	  case F3:
-#else
-	  case ESC:
-#endif
-	     if (frame[num].warn_func)
-	     {
-		ULONG retCode;
+// decode a UTF-8 string and write it, called with the row locked.
+// Writers of other rows run at the same time, so the decode buffer is
+// on the stack unless the screen is very wide.
 
-		retCode = (frame[num].warn_func)
-			(frame[num].screen, frame[num].choice);
-		if (retCode)
-		   return retCode;
-		else
-		   break;
-	     }
-	     else
-		return -1;
+#define GLYPH_STACK   256
 
-	  case PG_UP:
-	     for (i=0; i < frame[num].window_size - 1; i++)
-	     {
-		frame[num].choice--;
-		frame[num].index--;
+static ULONG put_utf8(NWSCREEN *screen, const char *s, BYTE *attr_array,
+		      const ULONG *xattr_array, ULONG row, ULONG col,
+		      ULONG attr, ULONG len, ULONG flags)
+{
+   CWGLYPH stack[GLYPH_STACK], *g = stack;
+   ULONG count;
 
-		if (frame[num].index < 0)
-		{
-		   frame[num].index = 0;
-		   if (frame[num].choice >= 0)
-		   {
-		      if (frame[num].top)
-			 frame[num].top--;
-		      frame[num].bottom = frame[num].top +
-                                               frame[num].window_size;
-		   }
-		}
-		if (frame[num].choice < 0)
-		   frame[num].choice = 0;
-	     }
+   if (col >= screen->ncols)
+      return 0;
+   if (len > screen->ncols - col)
+      len = screen->ncols - col;
 
-             for (i=0; i < frame[num].window_size; i++)
-             {
-               if (i < frame[num].el_count)
-               {
-	          if (frame[num].el_strings[frame[num].top + i])
-	          {
-	             if (frame[num].scroll_frame)
-                     {
-			put_char(frame[num].screen,
-			    ' ',
-			    row + i, col,
-			    ((row + i == row + frame[num].index) &&
-                             frame[num].focus)
-			    ? bar_attribute : frame[num].fill_color |
-			    frame[num].text_color);
-
-			put_char(frame[num].screen,
-			    frame[num].scroll_frame,
-			    row + i, col + 1,
-			    ((row + i == row + frame[num].index) &&
-                             frame[num].focus)
-			    ? bar_attribute : frame[num].fill_color |
-			    frame[num].text_color);
-
-			put_string_to_length(frame[num].screen,
-			    (const char *)
-			    frame[num].el_strings[frame[num].top + i],
-			    frame[num].el_attr[frame[num].top + i],
-			    row + i, col + 2,
-			    ((row + i == row + frame[num].index) &&
-                             frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color,
-			    width - 2);
-                     }
-	             else
-		     {
-			put_string_to_length(frame[num].screen,
-			    (const char *)
-			    frame[num].el_strings[frame[num].top + i],
-			    frame[num].el_attr[frame[num].top + i],
-			    row + i, col,
-			    ((row + i == row + frame[num].index) &&
-                             frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color,
-			    width);
-                     }
-	          }
-               }
-            }
+   if (len > GLYPH_STACK)
+   {
+      g = (CWGLYPH *)malloc(len * sizeof(CWGLYPH));
+      if (!g)
+	 return 0;
+   }
 
-            if (frame[num].el_count > frame[num].window_size &&
-	       frame[num].top)
-            {
-	       put_char(frame[num].screen,
-		  frame[num].up_char,
-		  row,
-		  col,
-		  get_char_attribute(frame[num].screen, row, col));
-            }
-            else
-            {
-	      put_char(frame[num].screen,
-		  ' ',
-		  row,
-		  col,
-		  get_char_attribute(frame[num].screen, row, col));
-            }
+   count = utf8_layout(s, g, len, NULL);
+   count = put_glyphs(screen, g, count, attr_array, xattr_array,
+		      row, col, attr, len, flags);
+   if (g != stack)
+      free(g);
+   return count;
+}
+#endif
 
-            if ((frame[num].el_count > frame[num].window_size) &&
-               (frame[num].bottom < (long)(frame[num].el_count)))
-            {
-	       put_char(frame[num].screen,
-		  frame[num].down_char,
-		  row + frame[num].window_size - 1,
-		  col,
-		  get_char_attribute(frame[num].screen,
-				     row + frame[num].window_size - 1,
-				     col));
-            }
-            else
-            {
-	       put_char(frame[num].screen,
-		  ' ',
-		  row + frame[num].window_size - 1,
-		  col,
-		  get_char_attribute(frame[num].screen,
-				     row + frame[num].window_size - 1,
-				     col));
-             }
-	     break;
+void move_string(NWSCREEN *screen,
+		 ULONG srcRow, ULONG srcCol,
+		 ULONG destRow, ULONG destCol,
+		 ULONG length)
+{
+    BYTE *src_v, *dest_v;
+#if LINUX_UTIL
+    ULONG first = srcRow < destRow ? srcRow : destRow;
+    ULONG last = srcRow < destRow ? destRow : srcRow;
 
-	  case PG_DOWN:
-	     for (i=0; i < frame[num].window_size - 1; i++)
-	     {
-		frame[num].choice++;
-		frame[num].index++;
+   if (lock_rows(screen, first, last))
+      return;
+#endif
+    src_v = screen->p_vidmem;
+    src_v += (srcRow * (screen->ncols * 2)) + srcCol * 2;
 
-		if (frame[num].index >= (long)frame[num].el_count)
-		   frame[num].index--;
+    dest_v = screen->p_vidmem;
+    dest_v += (destRow * (screen->ncols * 2)) + destCol * 2;
 
-		if (frame[num].index >= (long)frame[num].window_size)
-		{
-		   frame[num].index--;
-		   if (frame[num].choice <
-		       (long)frame[num].el_count)
-		   {
-		      frame[num].top++;
-		      frame[num].bottom = frame[num].top +
-			      frame[num].window_size;
-		   }
-		}
-		if (frame[num].choice >=
-                    (long)frame[num].el_count)
-		   frame[num].choice--;
-	     }
+#if (LINUX_UTIL)
+    if (screen->p_wide)
+       memmove(&screen->p_wide[destRow * screen->ncols + destCol],
+	       &screen->p_wide[srcRow * screen->ncols + srcCol],
+	       length * sizeof(ULONG));
+    if (screen->p_xattr)
+       memmove(&screen->p_xattr[destRow * screen->ncols + destCol],
+	       &screen->p_xattr[srcRow * screen->ncols + srcCol],
+	       length * sizeof(ULONG));
+#endif
+    cell_copy(dest_v, src_v, length);
+#if (LINUX_UTIL)
+    mark_dirty(screen, destRow, destCol, length);
+    cw_stats.cells_written += length;
+    refresh_pending++;
+    unlock_rows(screen, first, last);
+#else
+    emit_cells(screen, destRow, destCol, length);
+#endif
 
-             for (i=0; i < frame[num].window_size; i++)
-             {
-               if (i < frame[num].el_count)
-               {
-	          if (frame[num].el_strings[frame[num].top + i])
-	          {
-	             if (frame[num].scroll_frame)
-                     {
-			put_char(frame[num].screen,
-			    ' ',
-			    row + i, col,
-			    ((row + i == row + frame[num].index) &&
-                             frame[num].focus)
-			    ? bar_attribute : frame[num].fill_color |
-			    frame[num].text_color);
-
-			put_char(frame[num].screen,
-			    frame[num].scroll_frame,
-			    row + i, col + 1,
-			    ((row + i == row + frame[num].index) &&
-                             frame[num].focus)
-			    ? bar_attribute : frame[num].fill_color |
-			    frame[num].text_color);
-
-		        put_string_to_length(frame[num].screen,
-			    (const char *)
-			    frame[num].el_strings[frame[num].top + i],
-			    frame[num].el_attr[frame[num].top + i],
-			    row + i, col + 2,
-			    ((row + i == row + frame[num].index) &&
-                             frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color,
-			    width - 2);
-                     }
-	             else
-		     {
-		        put_string_to_length(frame[num].screen,
-			    (const char *)
-			    frame[num].el_strings[frame[num].top + i],
-			    frame[num].el_attr[frame[num].top + i],
-			    row + i, col,
-			    ((row + i == row + frame[num].index) &&
-                             frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color,
-			    width);
-		     }
-	          }
-               }
-            }
+}
 
-            if (frame[num].el_count > frame[num].window_size &&
-	       frame[num].top)
-            {
-	       put_char(frame[num].screen,
-		  frame[num].up_char,
-		  row,
-		  col,
-		  get_char_attribute(frame[num].screen, row, col));
-            }
-            else
-            {
-	      put_char(frame[num].screen,
-		  ' ',
-		  row,
-		  col,
-		  get_char_attribute(frame[num].screen, row, col));
-            }
 
-            if ((frame[num].el_count > frame[num].window_size) &&
-               (frame[num].bottom < (long)(frame[num].el_count)))
-            {
-	       put_char(frame[num].screen,
-		  frame[num].down_char,
-		  row + frame[num].window_size - 1,
-		  col,
-		  get_char_attribute(frame[num].screen,
-				     row + frame[num].window_size - 1,
-				     col));
-            }
-            else
-            {
-	       put_char(frame[num].screen,
-		  ' ',
-		  row + frame[num].window_size - 1,
-		  col,
-		  get_char_attribute(frame[num].screen,
-				     row + frame[num].window_size - 1,
-				     col));
-             }
-	     break;
+void put_string(NWSCREEN *screen, const char *s, BYTE *attr_array,
+		ULONG row, ULONG col, ULONG attr)
+{
+#if (WINDOWS_NT_UTIL)
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    BOOL bSuccess;
+    DWORD cCharsWritten;
+    COORD coordScreen;
 
-	  case BKSP:
-	  case UP_ARROW:
-	     frame[num].choice--;
-	     frame[num].index--;
+    coordScreen.X = (short)col;
+    coordScreen.Y = (short)row;
 
-	     if (frame[num].index < 0)
-	     {
-		frame[num].index = 0;
-		if (frame[num].choice >= 0)
-		{
-		   if (frame[num].top)
-		      frame[num].top--;
-		   frame[num].bottom = frame[num].top +
-			   frame[num].window_size;
-		   scroll_menu(num, 0);
-		}
-	     }
+    bSuccess = WriteConsoleOutputCharacter( hConsole, (LPSTR) s,
+				lstrlen(s), coordScreen, &cCharsWritten );
 
-	     if (frame[num].choice < 0)
-		frame[num].choice = 0;
+    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
+				lstrlen(s), coordScreen, &cCharsWritten );
+#endif
 
-	     break;
+#if (DOS_UTIL | LINUX_UTIL)
+    BYTE *v, c;
+    ULONG len = strlen((const char *)s), count;
 
-          case ' ':
-	  case DOWN_ARROW:
-	     frame[num].choice++;
-	     frame[num].index++;
+#if LINUX_UTIL
+   if (lock_rows(screen, row, row))
+      return;
+   if (unicode_mode && !text_mode && !utf8_ascii(s, len))
+   {
+      cw_stats.cells_written += put_utf8(screen, s, attr_array, NULL, row,
+					 col, attr, screen->ncols - col, 0);
+      unlock_rows(screen, row, row);
+      return;
+   }
+#endif
+    count = 0;
+    v = screen->p_vidmem;
+    v += (row * (screen->ncols * 2)) + col * 2;
+    while (*s)
+    {
+       if (count + 1 >
+          ((len <= (screen->ncols - col)) ? len : (screen->ncols - col)))
+	  break;
 
-	     if (frame[num].index >= (long)frame[num].el_count)
-		frame[num].index--;
+       c = *s++;
+       *v++ = c;
+       //*v++ = attr;
+       *v = cell_attr(screen, v - 1, (attr_array && attr_array[count])
+		      ? attr_array[count] : attr);
+       v++;
+       count++;
 
-	     if (frame[num].index >= (long)frame[num].window_size)
-	     {
-		frame[num].index--;
-		if (frame[num].choice < (long)frame[num].el_count)
-		{
-		   frame[num].top++;
-		   frame[num].bottom = frame[num].top +
-			   frame[num].window_size;
-		   scroll_menu(num, 1);
-		}
-	     }
+#if (DOS_UTIL)
+       ScreenPutChar(c, attr, col++, row);
+#endif
+    }
+#if (LINUX_UTIL)
+    mark_dirty(screen, row, col, count);
+    cw_stats.cells_written += count;
+    unlock_rows(screen, row, row);
+#endif
 
-	     if (frame[num].choice >= (long)frame[num].el_count)
-		frame[num].choice--;
+#endif
 
-	     break;
+}
 
-	  default:
-	     if (frame[num].key_handler)
-	     {
-		ULONG retCode;
+void put_string_transparent(NWSCREEN *screen, const char *s, BYTE *attr_array,
+			    ULONG row, ULONG col, ULONG attr)
+{
 
-		retCode = (frame[num].key_handler)
-			(frame[num].screen, key, frame[num].choice, num);
-		if (retCode)
-		   return (retCode);
-	     }
-	     break;
+#if (WINDOWS_NT_UTIL)
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    BOOL bSuccess;
+    DWORD cCharsWritten;
+    COORD coordScreen;
+
+    coordScreen.X = (short)col;
+    coordScreen.Y = (short)row;
+
+    bSuccess = WriteConsoleOutputCharacter( hConsole, (LPSTR) s,
+				    lstrlen(s), coordScreen, &cCharsWritten );
+
+    if (attr)
+       bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
+				    lstrlen(s), coordScreen, &cCharsWritten );
+#endif
+
+#if (DOS_UTIL | LINUX_UTIL)
+    BYTE *v, c;
+    ULONG len = strlen((const char *)s), count;
+#if (DOS_UTIL)
+    ULONG color;
+#endif
+
+#if LINUX_UTIL
+   if (lock_rows(screen, row, row))
+      return;
+   if (unicode_mode && !text_mode && !utf8_ascii(s, len))
+   {
+      cw_stats.cells_written += put_utf8(screen, s, attr_array, NULL, row,
+					 col, attr, screen->ncols - col,
+					 PUT_TRANSPARENT);
+      unlock_rows(screen, row, row);
+      return;
+   }
+#endif
+    count = 0;
+    v = screen->p_vidmem;
+    v += (row * (screen->ncols * 2)) + col * 2;
+    while (*s)
+    {
+       if (count + 1 >
+	  ((len <= (screen->ncols - col)) ? len : (screen->ncols - col)))
+	  break;
+
+       c = *s++;
+       *v++ = c;
+       if (attr || (attr_array && attr_array[count])) {
+	  //*v |= attr;
+          *v = cell_attr(screen, v - 1, (attr_array && attr_array[count])
+			 ? attr_array[count] : attr);
        }
+       v++;
+       count++;
 
+#if (DOS_UTIL)
+       color = cell_color(screen, v - 2);
+       ScreenPutChar(c, color,
+		     col++, row);
+#endif
     }
+#if (LINUX_UTIL)
+    mark_dirty(screen, row, col, count);
+    cw_stats.cells_written += count;
+    unlock_rows(screen, row, row);
+#endif
 
-}
+#endif
 
+}
 
-ULONG fill_menu(ULONG num, ULONG ch, ULONG attr)
+void put_string_cleol(NWSCREEN *screen, const char *s, BYTE *attr_array,
+		      ULONG row, ULONG attr)
 {
+
 #if (WINDOWS_NT_UTIL)
     HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
     BOOL bSuccess;
-    DWORD cCharsWritten, i;
+    DWORD cCharsWritten;
     COORD coordScreen;
+    ULONG len = lstrlen(s);
+    ULONG left = 0;
 
-    for (i=frame[num].start_row; i < frame[num].end_row + 1; i++)
+    coordScreen.X = (short)0;
+    coordScreen.Y = (short)row;
+
+    bSuccess = WriteConsoleOutputCharacter( hConsole, (LPSTR) s,
+		       len, coordScreen, &cCharsWritten );
+
+    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
+		       len, coordScreen, &cCharsWritten );
+
+    if (screen->ncols >= len)
+       left = (screen->ncols - len);
+
+    if (left)
     {
-       coordScreen.X = (short)frame[num].start_column;
-       coordScreen.Y = (short)i;
+       coordScreen.X = (short)len;
+       coordScreen.Y = (short)row;
 
-       bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) ch,
-				   (frame[num].end_column + 1) -
-				    frame[num].start_column,
-				    coordScreen, &cCharsWritten );
+       bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) ' ',
+				    left, coordScreen, &cCharsWritten );
 
        bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
-				   (frame[num].end_column + 1) -
-				    frame[num].start_column,
-				    coordScreen, &cCharsWritten );
+				    left, coordScreen, &cCharsWritten );
     }
-    return 0;
 
 #endif
 
 #if (DOS_UTIL | LINUX_UTIL)
-   ULONG i, j;
+    ULONG i, a;
+    BYTE *v, c;
 
-   for (i=frame[num].start_column; i < frame[num].end_column + 1; i++)
+#if LINUX_UTIL
+   if (lock_rows(screen, row, row))
+      return;
+   if (unicode_mode && !text_mode && !utf8_ascii(s, strlen(s)))
    {
-      for (j=frame[num].start_row; j < frame[num].end_row + 1; j++)
-      {
-	 put_char(frame[num].screen, ch, j, i, attr);
-      }
+      cw_stats.cells_written += put_utf8(screen, s, attr_array, NULL, row, 0,
+					 attr, screen->ncols,
+					 PUT_PAD | PUT_BAR);
+      unlock_rows(screen, row, row);
+      return;
    }
-   return 0;
+#endif
+    v = screen->p_vidmem;
+    v += (row * (screen->ncols * 2)) + 0 * 2;
+    for (i = 0; i < screen->ncols; i++)
+    {
+       a = array_attr(attr_array, NULL, i, attr);
+       if (*s == '\0')
+          c = ' ';
+       else
+	  c = *s++;
+       v[0] = c;
+       v[1] = cell_attr(screen, v, a);
+       v += 2;
+#if (DOS_UTIL)
+       ScreenPutChar(c, a, i, row);
+#endif
+    }
+#if (LINUX_UTIL)
+    mark_dirty(screen, row, 0, i);
+    cw_stats.cells_written += i;
+    unlock_rows(screen, row, row);
+#endif
 
 #endif
 
 }
 
-ULONG save_menu(ULONG num)
+static void put_bytes_to_length(NWSCREEN *screen, const char *s,
+				BYTE *attr_array, const ULONG *xattr_array,
+				ULONG row, ULONG col, ULONG attr, ULONG len)
 {
+
 #if (WINDOWS_NT_UTIL)
     HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
     BOOL bSuccess;
-    DWORD cCharsWritten, i, len;
+    DWORD cCharsWritten;
     COORD coordScreen;
-    BYTE *buf_ptr;
+    ULONG string_len = lstrlen(s);
+    ULONG left = 0;
 
-    buf_ptr = (BYTE *) frame[num].p;
-    for (i=frame[num].start_row; i < frame[num].end_row + 1; i++)
+    if (len > string_len)
+       left = (len - string_len);
+    else
+       string_len = len;
+
+    coordScreen.X = (short)col;
+    coordScreen.Y = (short)row;
+
+    bSuccess = WriteConsoleOutputCharacter( hConsole, (LPSTR) s,
+				    string_len, coordScreen, &cCharsWritten );
+
+    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
+				    string_len, coordScreen, &cCharsWritten );
+
+    if (left)
     {
-       coordScreen.X = (short)frame[num].start_column;
-       coordScreen.Y = (short)i;
+       coordScreen.X = (short)(col + string_len);
+       coordScreen.Y = (short)row;
 
-       len = frame[num].end_column - frame[num].start_column + 1;
-       bSuccess = ReadConsoleOutputCharacter(hConsole,
-					    (LPSTR)buf_ptr,
-					     len,
-					     coordScreen,
-					     &cCharsWritten);
-       buf_ptr += len;
-       bSuccess = ReadConsoleOutputAttribute(hConsole,
-					    (LPWORD)buf_ptr,
-					     len,
-					     coordScreen,
-					     &cCharsWritten);
-       buf_ptr += len * 2;
+       bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) ' ',
+				    left, coordScreen, &cCharsWritten );
+
+       bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
+				    left, coordScreen, &cCharsWritten );
     }
-    frame[num].saved = 1;
-    return 0;
+
 #endif
 
 #if (DOS_UTIL | LINUX_UTIL)
-   ULONG i, j;
-   BYTE *buf_ptr;
-   BYTE *v;
-   BYTE *t;
+    ULONG i, j, a;
+    BYTE *v, c;
 
 #if LINUX_UTIL
-   if (pthread_mutex_lock(&vidmem_mutex))
-      return -1;
+   if (lock_rows(screen, row, row))
+      return;
 #endif
-   buf_ptr = (BYTE *) frame[num].p;
-   v = frame[num].screen->p_vidmem;
-   for (i=frame[num].start_column; i < frame[num].end_column + 1; i++)
-   {
-      for (j=frame[num].start_row; j < frame[num].end_row + 1; j++)
-      {
-	 t = (v + (j * frame[num].screen->ncols * 2) + i * 2);
-	 *buf_ptr++ = *t++;
-	 *buf_ptr++ = *t;
-//	 *(t - 1) = ' ';  // fill window
-      }
-   }
-   frame[num].saved = 1;
-#if LINUX_UTIL
-   pthread_mutex_unlock(&vidmem_mutex);
+    v = screen->p_vidmem;
+    v += (row * (screen->ncols * 2)) + col * 2;
+    for (j=col,i=0; i < len && i < (screen->ncols - j); i++)
+    {
+       a = array_attr(attr_array, xattr_array, i, attr);
+       if (*s == '\0')
+	  c = ' ';
+       else
+	  c = *s++;
+       v[0] = c;
+       v[1] = cell_attr(screen, v, a);
+       v += 2;
+#if (DOS_UTIL)
+       ScreenPutChar(c, a, col++, row);
+#endif
+    }
+#if (LINUX_UTIL)
+    mark_dirty(screen, row, col, i);
+    cw_stats.cells_written += i;
+    unlock_rows(screen, row, row);
 #endif
-   return 0;
 
 #endif
 
 }
 
-ULONG restore_screen(void)
+static void put_line_to_length(NWSCREEN *screen, const char *s,
+			       BYTE *attr_array, const ULONG *xattr_array,
+			       ULONG row, ULONG col, ULONG attr, ULONG len)
 {
-#if (WINDOWS_NT_UTIL)
-    return 0;
+#if (LINUX_UTIL)
+    if (unicode_mode && !text_mode && !utf8_ascii(s, strlen(s)))
+    {
+       if (lock_rows(screen, row, row))
+	  return;
+       cw_stats.cells_written += put_utf8(screen, s, attr_array, xattr_array,
+					  row, col, attr, len,
+					  PUT_PAD | PUT_BAR);
+       unlock_rows(screen, row, row);
+       return;
+    }
 #endif
+    put_bytes_to_length(screen, s, attr_array, xattr_array, row, col, attr,
+			len);
+}
+
+void put_string_to_length(NWSCREEN *screen, const char *s, BYTE *attr_array,
+			  ULONG row, ULONG col, ULONG attr, ULONG len)
+{
+    put_line_to_length(screen, s, attr_array, NULL, row, col, attr, len);
+}
 
+// move the bar on or off a line which is already on the screen.  s
+// is size bytes long.  If the cells at row, col still hold the scroll
+// frame and s padded to len, only their attributes are changed.
+// Returns -1 if they do not and the line has to be drawn.
 
+static ULONG recolor_bar(NWSCREEN *screen, int scroll_frame, const char *s,
+			 ULONG size, BYTE *attr_array, const ULONG *xattr_array,
+			 ULONG row, ULONG col, ULONG attr, ULONG len)
+{
 #if (DOS_UTIL | LINUX_UTIL)
-    ULONG i, j;
-    BYTE *buf_ptr;
-    NWSCREEN *screen = &console_screen;
+    ULONG i, pre = scroll_frame ? 2 : 0;
+    BYTE *v, c;
 
-    if (!screen)
+    if (!s || row >= screen->nlines || col + pre >= screen->ncols)
        return -1;
+    if (len > screen->ncols - col - pre)
+       len = screen->ncols - col - pre;
 
-    buf_ptr = (BYTE *) screen->p_vidmem;
-    for (j=0; j < screen->nlines; j++)
+#if (LINUX_UTIL)
+    // decoded lines do not keep one cell per byte
+    if (unicode_mode && !text_mode && !utf8_ascii(s, size))
+       return -1;
+    if (lock_rows(screen, row, row))
+       return -1;
+#endif
+    v = screen->p_vidmem + (row * screen->ncols + col) * 2;
+    if (pre && (v[0] != ' ' || v[2] != (BYTE)scroll_frame))
+       goto Redraw;
+
+    v += pre * 2;
+    for (i=0; i < len; i++)
     {
-       for (i=0; i < screen->ncols; i++)
-       {
-	  put_char_direct(screen, *buf_ptr, j, i, *(buf_ptr + 1));
-          buf_ptr += 2;
-       }
+       c = *s ? *s++ : ' ';
+       if (v[i * 2] != c)
+	  goto Redraw;
     }
+
+    if (pre)
+       recolor_cells(screen, NULL, NULL, row, col, attr, pre);
+    recolor_cells(screen, attr_array, xattr_array, row, col + pre, attr, len);
 #if (LINUX_UTIL)
-    redrawwin(stdscr);
-    refresh_pending++;
+    unlock_rows(screen, row, row);
 #endif
     return 0;
 
+Redraw:;
+#if (LINUX_UTIL)
+    unlock_rows(screen, row, row);
 #endif
-
+#endif
+    return -1;
 }
 
-ULONG restore_menu(ULONG num)
+void put_char_direct(NWSCREEN *screen, int c, ULONG row, ULONG col, ULONG attr)
 {
 #if (WINDOWS_NT_UTIL)
     HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
     BOOL bSuccess;
-    DWORD cCharsWritten, i, len;
+    DWORD cCharsWritten;
     COORD coordScreen;
-    BYTE *buf_ptr;
 
-    if (!frame[num].saved)
-       return -1;
+    coordScreen.X = (short)col;
+    coordScreen.Y = (short)row;
 
-    buf_ptr = (BYTE *) frame[num].p;
-    for (i=frame[num].start_row; i < frame[num].end_row + 1; i++)
-    {
-       coordScreen.X = (short)frame[num].start_column;
-       coordScreen.Y = (short)i;
+    bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) c,
+				    1, coordScreen, &cCharsWritten );
 
-       len = frame[num].end_column - frame[num].start_column + 1;
-       bSuccess = WriteConsoleOutputCharacter(hConsole,
-					    (LPSTR)buf_ptr,
-					     len,
-					     coordScreen,
-					     &cCharsWritten);
-
-       buf_ptr += len;
-       bSuccess = WriteConsoleOutputAttribute(hConsole,
-					    (LPWORD)buf_ptr,
-					     len,
-					     coordScreen,
-					     &cCharsWritten);
-       buf_ptr += len * 2;
-    }
-    return 0;
-#endif
+    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
+				    1, coordScreen, &cCharsWritten );
+#endif
 
 #if (DOS_UTIL | LINUX_UTIL)
-    ULONG i, j;
-    BYTE *buf_ptr;
 
-    if (!frame[num].saved)
-       return -1;
+#if LINUX_UTIL
+   if (lock_vidmem())
+      return;
+#endif
 
-    buf_ptr = (BYTE *) frame[num].p;
-    for (i=frame[num].start_column; i < frame[num].end_column + 1;
-	 i++)
-    {
-       for (j=frame[num].start_row; j < frame[num].end_row + 1; j++)
-       {
-#if (LINUX_UTIL)
-	  put_char(frame[num].screen, *buf_ptr, j, i, *(buf_ptr + 1));
-#else
-	  put_char(frame[num].screen, *buf_ptr, j, i, *(buf_ptr + 1));
+#if (DOS_UTIL)
+    ScreenPutChar(c, attr, col, row);
 #endif
-          buf_ptr += 2;
-       }
-       frame[num].active = 0;
-    }
+
 #if (LINUX_UTIL)
-    refresh_pending++;
+    set_color(attr);
+    mvputc(row, col, c);
+    clear_color();
+    pthread_mutex_unlock(&vidmem_mutex);
 #endif
-    return 0;
 
 #endif
 
+    return;
 }
 
-void free_elements(ULONG num)
+void put_char(NWSCREEN *screen, int c, ULONG row, ULONG col, ULONG attr)
 {
-   if (frame[num].el_attr_storage)
-      free((void *) frame[num].el_attr_storage);
-   frame[num].el_attr_storage = 0;
+#if (WINDOWS_NT_UTIL)
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    BOOL bSuccess;
+    DWORD cCharsWritten;
+    COORD coordScreen;
 
-   if (frame[num].el_attr)
-      free((void *) frame[num].el_attr);
-   frame[num].el_attr = 0;
+    coordScreen.X = (short)col;
+    coordScreen.Y = (short)row;
 
-   if (frame[num].el_storage)
-      free((void *) frame[num].el_storage);
-   frame[num].el_storage = 0;
+    bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) c,
+				    1, coordScreen, &cCharsWritten );
 
-   if (frame[num].el_values)
-      free((void *) frame[num].el_values);
-   frame[num].el_values = 0;
+    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
+				    1, coordScreen, &cCharsWritten );
 
-   if (frame[num].el_strings)
-      free((void *) frame[num].el_strings);
-   frame[num].el_strings = 0;
+#endif
 
-   if (frame[num].p)
-      free((void *) frame[num].p);
-   frame[num].p = 0;
+#if (DOS_UTIL | LINUX_UTIL)
+    BYTE *v;
 
-   return;
-}
+    if (col >= screen->ncols)
+       return;
 
-ULONG free_menu(ULONG num)
-{
-   FIELD_LIST *fl;
+    if (row >= screen->nlines)
+       return;
 
 #if LINUX_UTIL
-   pthread_mutex_destroy(&frame[num].mutex);
+   if (lock_rows(screen, row, row))
+      return;
 #endif
+    v = screen->p_vidmem;
+    v += (row * (screen->ncols * 2)) + col * 2;
+    v[0] = c;
+    v[1] = cell_attr(screen, v, attr);
 
-   frame[num].cur_row = 0;
-   frame[num].cur_column = 0;
-   frame[num].choice = 0;
-   frame[num].index = 0;
+#if (DOS_UTIL)
+    ScreenPutChar(c, attr, col, row);
+#endif
 
-   restore_menu(num);
-   free_elements(num);
+#if (LINUX_UTIL)
+    mark_dirty(screen, row, col, 1);
+    cw_stats.cells_written++;
+    unlock_rows(screen, row, row);
+#endif
 
-   frame[num].el_count = 0;
-   frame[num].el_func = 0;
-   frame[num].warn_func = 0;
-   frame[num].owner = 0;
+#endif
 
-   while (frame[num].head)
-   {
-      fl = frame[num].head;
-      frame[num].head = fl->next;
-      free(fl);
-   }
-   frame[num].head = frame[num].tail = 0;
-   frame[num].field_count = 0;
+    return;
+}
 
-   return 0;
+int get_char(NWSCREEN *screen, ULONG row, ULONG col)
+{
+#if (WINDOWS_NT_UTIL)
+    BYTE v[2];
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    BOOL bSuccess;
+    DWORD cCharsWritten;
+    COORD coordScreen;
+
+    coordScreen.X = (short)col;
+    coordScreen.Y = (short)row;
+
+    bSuccess = ReadConsoleOutputCharacter( hConsole, (LPSTR) &v,
+				    1, coordScreen, &cCharsWritten );
+    return (BYTE) v[0];
+
+#endif
+
+#if (DOS_UTIL)
+   BYTE *v;
+
+   v = screen->p_vidmem;
+   v += (row * (screen->ncols * 2)) + col * 2;
+   return (BYTE)(*v);
+#endif
+
+#if (LINUX_UTIL)
+   BYTE cell[2];
+
+   read_cell(screen, row, col, cell);
+   return cell[0];
+#endif
 
 }
 
-ULONG display_menu_header(ULONG num)
+int get_char_attribute(NWSCREEN *screen, ULONG row, ULONG col)
 {
+#if (WINDOWS_NT_UTIL)
+    int v[2];
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    BOOL bSuccess;
+    DWORD cCharsWritten;
+    COORD coordScreen;
 
-   ULONG col, len, i;
+    coordScreen.X = (short)col;
+    coordScreen.Y = (short)row;
 
-   if (!frame[num].header[0])
-      return -1;
+    bSuccess = ReadConsoleOutputAttribute( hConsole, (LPWORD) &v,
+				    1, coordScreen, &cCharsWritten );
+    return (BYTE) v[0];
 
-   col = frame[num].start_column;
-   len = strlen((const char *) &frame[num].header[0]);
-   len = (frame[num].end_column - col - len) / 2;
-   if (len < 0)
-      return -1;
+#endif
 
-   col = col + len;
+#if (DOS_UTIL)
+   BYTE *v;
 
-      for (i=0; i < frame[num].end_column - frame[num].start_column;
-           i++)
-      {
-         put_char(frame[num].screen,
-		 frame[num].horizontal_frame,
-		 frame[num].start_row + 2,
-		 frame[num].start_column + i,
-		 frame[num].border_color);
-      }
+   v = screen->p_vidmem;
+   v += (row * (screen->ncols * 2)) + col * 2;
+   v++;
+   return (BYTE)(*v);
+#endif
 
-      put_char(frame[num].screen,
-	      frame[num].left_frame,
-	      frame[num].start_row + 2,
-	      frame[num].start_column,
-	      frame[num].border_color);
+#if (LINUX_UTIL)
+   BYTE cell[2];
 
-      put_char(frame[num].screen,
-	      frame[num].right_frame,
-	      frame[num].start_row + 2,
-	      frame[num].end_column,
-	      frame[num].border_color);
+   read_cell(screen, row, col, cell);
+   return cell[1];
+#endif
 
-   put_string(frame[num].screen,
-	      (const char *)frame[num].header, NULL,
-		frame[num].start_row + 1,
-		col,
-		frame[num].header_color);
+}
 
-   return 0;
+void put_char_cleol(NWSCREEN *screen, int c, ULONG row, ULONG attr)
+{
+#if (WINDOWS_NT_UTIL)
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    BOOL bSuccess;
+    DWORD cCharsWritten;
+    COORD coordScreen;
+
+    coordScreen.X = (short)0;
+    coordScreen.Y = (short)row;
 
+    bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) c,
+				    screen->ncols, coordScreen,
+				    &cCharsWritten );
+
+    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
+				    screen->ncols, coordScreen,
+				    &cCharsWritten );
+#endif
 
+#if (DOS_UTIL | LINUX_UTIL)
+    fill_cells(screen, c, row, 0, attr, screen->ncols);
+#endif
 }
 
-ULONG draw_menu_border(ULONG num)
+void put_char_length(NWSCREEN *screen, int c, ULONG row, ULONG col, ULONG attr,
+		     ULONG len)
 {
-   ULONG i;
+#if (WINDOWS_NT_UTIL)
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    BOOL bSuccess;
+    DWORD cCharsWritten;
+    COORD coordScreen;
 
-   for (i=frame[num].start_row + 1; i < frame[num].end_row; i++)
-   {
-#if (WINDOWS_NT_UTIL | LINUX_UTIL | DOS_UTIL)
-      put_char(frame[num].screen, frame[num].vertical_frame,
-	       i,
-	       frame[num].start_column,
-	       frame[num].border_color);
-      put_char(frame[num].screen, frame[num].vertical_frame,
-	       i,
-	       frame[num].end_column,
-	       frame[num].border_color);
+    coordScreen.X = (short)col;
+    coordScreen.Y = (short)row;
+
+    bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) c,
+				    len, coordScreen, &cCharsWritten );
+
+    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
+				    len, coordScreen, &cCharsWritten );
 #endif
-   }
 
-   for (i=frame[num].start_column + 1; i < frame[num].end_column; i++)
-   {
-#if (WINDOWS_NT_UTIL | LINUX_UTIL | DOS_UTIL)
-      put_char(frame[num].screen, frame[num].horizontal_frame,
-	       frame[num].start_row,
-	       i,
-	       frame[num].border_color);
-      put_char(frame[num].screen, frame[num].horizontal_frame,
-	       frame[num].end_row,
-	       i,
-	       frame[num].border_color);
+#if (DOS_UTIL | LINUX_UTIL)
+    fill_cells(screen, c, row, col, attr, len);
 #endif
-   }
+}
 
-   put_char(frame[num].screen, frame[num].upper_left,
-	    frame[num].start_row,
-	    frame[num].start_column,
-	    frame[num].border_color);
+// change the attribute of len cells starting at row, col and leave
+// the characters as they are
+
+void put_attr_length(NWSCREEN *screen, ULONG row, ULONG col, ULONG attr,
+		     ULONG len)
+{
+#if (WINDOWS_NT_UTIL)
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    BOOL bSuccess;
+    DWORD cCharsWritten;
+    COORD coordScreen;
+
+    coordScreen.X = (short)col;
+    coordScreen.Y = (short)row;
+
+    bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
+				    len, coordScreen, &cCharsWritten );
+#endif
+
+#if (DOS_UTIL | LINUX_UTIL)
+    if (row >= screen->nlines || col >= screen->ncols)
+       return;
+    if (len > screen->ncols - col)
+       len = screen->ncols - col;
+
+#if (LINUX_UTIL)
+    if (lock_rows(screen, row, row))
+       return;
+#endif
+    recolor_cells(screen, NULL, NULL, row, col, attr, len);
+#if (LINUX_UTIL)
+    unlock_rows(screen, row, row);
+#endif
+#endif
+}
+
+ULONG scroll_display(NWSCREEN *screen, ULONG row, ULONG col,
+		     ULONG lines, ULONG cols, ULONG up)
+{
+#if (WINDOWS_NT_UTIL)
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    BOOL fSuccess;
+    SMALL_RECT srctScrollRect, srctClipRect;
+    CHAR_INFO chiFill;
+    COORD coordDest;
+
+    if (!cols || !lines)
+       return -1;
+
+    if (col > screen->ncols - 1)
+       return -1;
+
+    if (cols > screen->ncols)
+       return -1;
+
+    if (row > screen->nlines - 1)
+       return -1;
+
+    if (lines > screen->nlines)
+       return -1;
+
+    srctScrollRect.Top = (short)row;
+    srctScrollRect.Bottom = (short)(row + lines - 1);
+    srctScrollRect.Left = (short)col;
+    srctScrollRect.Right = (short)(col + cols - 1);
+
+    /* The destination for the scroll rectangle is one row up. */
+
+    if (up)
+    {
+       coordDest.Y = (short)(row - 1);
+       coordDest.X = (short)col;
+    }
+    else
+    {
+       coordDest.Y = (short)(row + 1);
+       coordDest.X = (short)col;
+    }
+
+    /*
+     * The clipping rectangle is the same as the scrolling rectangle.
+     * The destination row is left unchanged.
+     */
+
+    srctClipRect = srctScrollRect;
+
+    chiFill.Attributes = (unsigned short)screen->norm_vid;
+    chiFill.Char.AsciiChar = ' ';
+
+    fSuccess = ScrollConsoleScreenBuffer(
+	hConsole,        /* screen buffer handle     */
+	&srctScrollRect, /* scrolling rectangle      */
+	&srctClipRect,   /* clipping rectangle       */
+	coordDest,       /* top left destination cell*/
+	&chiFill);       /* fill character and color */
+
+    if (!fSuccess)
+       return -1;
+
+    return 0;
+#endif
+
+#if (DOS_UTIL | LINUX_UTIL)
+    ULONG i, tCol, tRow;
+
+    if (!cols || !lines)
+       return -1;
+
+    if (col > screen->ncols - 1)
+       return -1;
+
+    if (cols > screen->ncols)
+       return -1;
+
+    if (row > screen->nlines - 1)
+       return -1;
+
+    if (lines > screen->nlines)
+       return -1;
+
+    if (up)
+    {
+       tCol = col;
+       tRow = row;
+       for (i=1; i < lines; i++)
+       {
+	  move_string(screen,
+			tRow + 1,
+			tCol,
+			tRow,
+			tCol,
+			cols);
+	  tRow++;
+       }
+       fill_cells(screen, ' ', tRow, tCol, screen->norm_vid, cols);
+    }
+    else
+    {
+       tCol = col;
+       tRow = row + (lines - 1);
+       for (i=1; i < lines; i++)
+       {
+	  move_string(screen,
+			tRow - 1,
+			tCol,
+			tRow,
+			tCol,
+			cols);
+	  tRow--;
+       }
+       fill_cells(screen, ' ', row, tCol, screen->norm_vid, cols);
+    }
+#endif
+    return 0;
+}
+
+ULONG field_set_xy(ULONG num, ULONG row, ULONG col)
+{
+    if (!frame[num].owner)
+       return -1;
+
+    if (!frame[num].screen)
+       return -1;
+
+    if (row >= (ULONG)frame[num].el_count)
+       return -1;
+
+    if (row < (ULONG)frame[num].top) {
+       frame[num].top = row;
+       frame[num].bottom = frame[num].top + frame[num].window_size;
+    } else if (row >= (frame[num].top + frame[num].window_size)) {
+       frame[num].top = row - (frame[num].window_size - 1);
+       frame[num].bottom = frame[num].top + frame[num].window_size;
+    }
+    update_static_portal(num);
+    return (frame_set_xy(num, row - frame[num].top, col));
+
+}
+
+ULONG frame_set_xy(ULONG num, ULONG row, ULONG col)
+{
+    if (!frame[num].owner)
+       return -1;
+
+    if (!frame[num].screen)
+       return -1;
+
+    if (col >= frame[num].screen->ncols)
+       return -1;
+
+    if (row >= frame[num].screen->nlines)
+       return -1;
+
+    if ((row + frame[num].start_row) >= frame[num].screen->nlines)
+       return -1;
+
+    if ((col + frame[num].start_column) >= frame[num].screen->ncols)
+       return -1;
+
+    frame[num].pcur_row = row;
+    frame[num].pcur_column = col;
+
+    if (strlen((const char *)frame[num].header))
+       set_xy(frame[num].screen,
+	   frame[num].start_row + 3 + row,
+	   frame[num].start_column + 2 + col);
+    else
+       set_xy(frame[num].screen,
+	   frame[num].start_row + 1 + row,
+	   frame[num].start_column + 2 + col);
+    return 0;
+
+}
+
+ULONG frame_get_xy(ULONG num, ULONG *row, ULONG *col)
+{
+    if (!frame[num].owner)
+       return -1;
+
+    *row = frame[num].pcur_row;
+    *col = frame[num].pcur_column;
+    return 0;
+}
+
+void scroll_menu(ULONG num, ULONG up)
+{
+    ULONG row, col;
+
+    if (strlen((const char *)frame[num].header))
+       row = frame[num].start_row + 3;
+    else
+       row = frame[num].start_row + 1;
+
+    col = frame[num].start_column + 1;
+
+    scroll_display(frame[num].screen,
+		  row,
+		  col,
+		  frame[num].end_row - row,
+		  frame[num].end_column - col,
+		  up);
+    return;
+}
+
+// move the selection of a menu or portal to line choice of count.
+// The bar keeps its row in the window when it can, otherwise the
+// window is moved just far enough to show it.
+
+static void set_choice(ULONG num, long choice, ULONG count)
+{
+   long window = frame[num].window_size, index, low, high;
+
+   if (choice >= (long)count)
+      choice = count - 1;
+   if (choice < 0)
+      choice = 0;
+
+   high = (choice < window - 1) ? choice : window - 1;
+   low = ((long)count > window) ? choice - ((long)count - window) : choice;
+   if (low < 0)
+      low = 0;
+
+   index = frame[num].index + choice - frame[num].choice;
+   if (index > high)
+      index = high;
+   if (index < low)
+      index = low;
+
+   frame[num].choice = choice;
+   frame[num].index = index;
+   frame[num].top = choice - index;
+   frame[num].bottom = frame[num].top + window;
+}
+
+#if (LINUX_UTIL)
+static long nav_step(ULONG num, ULONG key)
+{
+   switch (key)
+   {
+      case UP_ARROW:
+	 return -1;
+      case DOWN_ARROW:
+	 return 1;
+      case PG_UP:
+	 return -((long)frame[num].window_size - 1);
+      case PG_DOWN:
+	 return (long)frame[num].window_size - 1;
+   }
+   return 0;
+}
+
+// with a key held down the keyboard repeats faster than a menu can
+// redraw.  When more arrow or page keys are already waiting behind
+// key they are all applied to the choice here, one at a time as the
+// switch in get_resp would, and the caller draws the result once.
+// The first other key is held for the next get_key.  Only keys typed
+// at the terminal are folded, injected and scripted keys are each
+// drawn.  Returns 0 if nothing was waiting.
+
+static int fold_nav_keys(ULONG num, ULONG key, ULONG count)
+{
+   ULONG next;
+
+   if (!count || key_from_queue || !nav_step(num, key))
+      return 0;
+
+   next = read_typeahead();
+   if (!next)
+      return 0;
+   if (!nav_step(num, next))
+   {
+      typeahead_key = next;
+      return 0;
+   }
+
+   set_choice(num, frame[num].choice + nav_step(num, key), count);
+   do
+   {
+      set_choice(num, frame[num].choice + nav_step(num, next), count);
+      __sync_fetch_and_add(&cw_stats.keys_coalesced, 1);
+      next = read_typeahead();
+   } while (next && nav_step(num, next));
+
+   typeahead_key = next;
+   return 1;
+}
+#else
+#define fold_nav_keys(num, key, count)   0
+#endif
+
+// draw line of a menu at row, when the line is already there only
+// its attributes are changed
+
+static void put_menu_line(ULONG num, ULONG line, ULONG row, ULONG col,
+			  ULONG width, ULONG attr)
+{
+   if (!recolor_bar(frame[num].screen, frame[num].scroll_frame,
+		    (const char *)frame[num].el_strings[line],
+		    strlen((const char *)frame[num].el_strings[line]),
+		    frame[num].el_attr[line], NULL, row, col, attr,
+		    frame[num].scroll_frame ? width - 2 : width))
+      return;
+
+   if (frame[num].scroll_frame)
+   {
+      put_char(frame[num].screen, ' ', row, col, attr);
+      put_char(frame[num].screen, frame[num].scroll_frame, row, col + 1,
+	       attr);
+      put_string_to_length(frame[num].screen,
+			   (const char *)frame[num].el_strings[line],
+			   frame[num].el_attr[line], row, col + 2, attr,
+			   width - 2);
+   }
+   else
+      put_string_to_length(frame[num].screen,
+			   (const char *)frame[num].el_strings[line],
+			   frame[num].el_attr[line], row, col, attr, width);
+}
+
+// draw the lines of a menu window from top, the scroll arrows are
+// drawn with the bar
+
+static void put_menu_window(ULONG num, ULONG row, ULONG col, ULONG width)
+{
+   ULONG i;
+
+   for (i=0; i < frame[num].window_size; i++)
+   {
+      if (frame[num].top + i < frame[num].el_count &&
+	  frame[num].el_strings[frame[num].top + i])
+	 put_menu_line(num, frame[num].top + i, row + i, col, width,
+		       ((long)i == frame[num].index && frame[num].focus)
+		       ? bar_attribute
+		       : frame[num].fill_color | frame[num].text_color);
+   }
+}
+
+ULONG get_resp(ULONG num)
+{
+    ULONG key, row, col, width, temp;
+    ULONG ccode;
+
+    if (strlen((const char *)frame[num].header))
+       row = frame[num].start_row + 3;
+    else
+       row = frame[num].start_row + 1;
+
+    col = frame[num].start_column + 1;
+    width = frame[num].end_column - frame[num].start_column;
+    if (width >= 1)
+       width -= 1;
+    frame[num].top = 0;
+    frame[num].bottom = frame[num].top + frame[num].window_size;
+
+    // put the bar back on the choice of the last call
+    temp = frame[num].choice;
+    frame[num].choice = 0;
+    frame[num].index = 0;
+    set_choice(num, temp, frame[num].el_count);
+    if (frame[num].top)
+       put_menu_window(num, row, col, width);
+
+    for (;;)
+    {
+       if (frame[num].el_strings[frame[num].choice])
+	  put_menu_line(num, frame[num].choice, row + frame[num].index, col,
+			width, bar_attribute);
+
+       if (frame[num].el_count > frame[num].window_size &&
+                                          frame[num].top)
+       {
+	  put_char(frame[num].screen,
+		  frame[num].up_char,
+		  row,
+		  col,
+		  get_char_attribute(frame[num].screen, row, col));
+       }
+       else
+       {
+	  put_char(frame[num].screen,
+		  ' ',
+		  row,
+		  col,
+		  get_char_attribute(frame[num].screen, row, col));
+       }
+
+       if (frame[num].el_count > frame[num].window_size
+	  && frame[num].bottom < (long)frame[num].el_count)
+       {
+	  put_char(frame[num].screen,
+		  frame[num].down_char,
+		  row + frame[num].window_size - 1,
+		  col,
+		  get_char_attribute(frame[num].screen,
+				     row + frame[num].window_size - 1,
+				     col));
+       }
+       else
+       {
+	  put_char(frame[num].screen,
+		  ' ',
+		  row + frame[num].window_size - 1,
+		  col,
+		  get_char_attribute(frame[num].screen,
+				     row + frame[num].window_size - 1,
+				     col));
+       }
+
+       focus_frame = num;
+       key = get_key();
+       if (frame[num].key_mask)
+	  continue;
+
+       if (frame[num].el_strings[frame[num].choice])
+	  put_menu_line(num, frame[num].choice, row + frame[num].index, col,
+			width, frame[num].fill_color | frame[num].text_color);
+
+       temp = frame[num].top;
+       if (fold_nav_keys(num, key, frame[num].el_count))
+       {
+	  if (frame[num].top != (long)temp)
+	     put_menu_window(num, row, col, width);
+	  continue;
+       }
+
+       switch (key)
+       {
+#if (LINUX_UTIL)
+          // screensaver return key
+          case 0:
+             break;
+#endif
+
+	  case ENTER:
+	     if (frame[num].el_func)
+	     {
+		ccode = (frame[num].el_func)
+			(frame[num].screen,
+			 frame[num].el_values[frame[num].choice],
+			 frame[num].el_strings[frame[num].choice],
+			 frame[num].choice);
+		if (ccode)
+		   return ccode;
+	     }
+	     else
+	     {
+		if (frame[num].choice >=
+		    (long)frame[num].el_count)
+		   return (ULONG) -1;
+		else
+		   return
+		      (frame[num].el_values[frame[num].choice]);
+	     }
+	     break;
+
+#if (LINUX_UTIL)
+	  case 'Q':
+          case 'q':
+	  case F3:
+#else
+	  case ESC:
+#endif
+	     if (frame[num].warn_func)
+	     {
+		ULONG retCode;
+
+		retCode = (frame[num].warn_func)
+			(frame[num].screen, frame[num].choice);
+		if (retCode)
+		   return retCode;
+		else
+		   break;
+	     }
+	     else
+		return -1;
+
+	  case PG_UP:
+	     set_choice(num, frame[num].choice -
+			(long)frame[num].window_size + 1,
+			frame[num].el_count);
+	     put_menu_window(num, row, col, width);
+	     break;
+
+	  case PG_DOWN:
+	     set_choice(num, frame[num].choice +
+			(long)frame[num].window_size - 1,
+			frame[num].el_count);
+	     put_menu_window(num, row, col, width);
+	     break;
+
+	  case BKSP:
+	  case UP_ARROW:
+	     frame[num].choice--;
+	     frame[num].index--;
+
+	     if (frame[num].index < 0)
+	     {
+		frame[num].index = 0;
+		if (frame[num].choice >= 0)
+		{
+		   if (frame[num].top)
+		      frame[num].top--;
+		   frame[num].bottom = frame[num].top +
+			   frame[num].window_size;
+		   scroll_menu(num, 0);
+		}
+	     }
+
+	     if (frame[num].choice < 0)
+		frame[num].choice = 0;
+
+	     break;
+
+          case ' ':
+	  case DOWN_ARROW:
+	     frame[num].choice++;
+	     frame[num].index++;
+
+	     if (frame[num].index >= (long)frame[num].el_count)
+		frame[num].index--;
+
+	     if (frame[num].index >= (long)frame[num].window_size)
+	     {
+		frame[num].index--;
+		if (frame[num].choice < (long)frame[num].el_count)
+		{
+		   frame[num].top++;
+		   frame[num].bottom = frame[num].top +
+			   frame[num].window_size;
+		   scroll_menu(num, 1);
+		}
+	     }
+
+	     if (frame[num].choice >= (long)frame[num].el_count)
+		frame[num].choice--;
+
+	     break;
+
+	  default:
+	     if (frame[num].key_handler)
+	     {
+		ULONG retCode;
+
+		retCode = (frame[num].key_handler)
+			(frame[num].screen, key, frame[num].choice, num);
+		if (retCode)
+		   return (retCode);
+	     }
+	     break;
+       }
+
+    }
+
+}
+
+
+ULONG fill_menu(ULONG num, ULONG ch, ULONG attr)
+{
+#if (WINDOWS_NT_UTIL)
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    BOOL bSuccess;
+    DWORD cCharsWritten, i;
+    COORD coordScreen;
+
+    for (i=frame[num].start_row; i < frame[num].end_row + 1; i++)
+    {
+       coordScreen.X = (short)frame[num].start_column;
+       coordScreen.Y = (short)i;
+
+       bSuccess = FillConsoleOutputCharacter( hConsole, (TCHAR) ch,
+				   (frame[num].end_column + 1) -
+				    frame[num].start_column,
+				    coordScreen, &cCharsWritten );
+
+       bSuccess = FillConsoleOutputAttribute( hConsole, (WORD)attr,
+				   (frame[num].end_column + 1) -
+				    frame[num].start_column,
+				    coordScreen, &cCharsWritten );
+    }
+    return 0;
+
+#endif
+
+#if (DOS_UTIL | LINUX_UTIL)
+   ULONG j;
+
+   for (j=frame[num].start_row; j < frame[num].end_row + 1; j++)
+      fill_cells(frame[num].screen, ch, j, frame[num].start_column, attr,
+		 frame[num].end_column - frame[num].start_column + 1);
+   return 0;
+
+#endif
+
+}
+
+ULONG save_menu(ULONG num)
+{
+#if (WINDOWS_NT_UTIL)
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    BOOL bSuccess;
+    DWORD cCharsWritten, i, len;
+    COORD coordScreen;
+    BYTE *buf_ptr;
+
+    buf_ptr = (BYTE *) frame[num].p;
+    for (i=frame[num].start_row; i < frame[num].end_row + 1; i++)
+    {
+       coordScreen.X = (short)frame[num].start_column;
+       coordScreen.Y = (short)i;
+
+       len = frame[num].end_column - frame[num].start_column + 1;
+       bSuccess = ReadConsoleOutputCharacter(hConsole,
+					    (LPSTR)buf_ptr,
+					     len,
+					     coordScreen,
+					     &cCharsWritten);
+       buf_ptr += len;
+       bSuccess = ReadConsoleOutputAttribute(hConsole,
+					    (LPWORD)buf_ptr,
+					     len,
+					     coordScreen,
+					     &cCharsWritten);
+       buf_ptr += len * 2;
+    }
+    frame[num].saved = 1;
+    return 0;
+#endif
+
+#if (DOS_UTIL | LINUX_UTIL)
+   NWSCREEN *screen = frame[num].screen;
+   ULONG cols = frame[num].end_column - frame[num].start_column + 1;
+   ULONG rows = frame[num].end_row - frame[num].start_row + 1;
+   ULONG base = frame[num].start_row * screen->ncols + frame[num].start_column;
+#if LINUX_UTIL
+   ULONG i;
+#endif
+
+#if LINUX_UTIL
+   if (lock_rows(screen, frame[num].start_row, frame[num].end_row))
+      return -1;
+#endif
+   // the cells under the frame are kept row by row
+   cell_copy_rect(frame[num].p, cols, &screen->p_vidmem[base * 2],
+		  screen->ncols, rows, cols);
+   frame[num].saved = 1;
+#if LINUX_UTIL
+   // unicode characters under the frame, in the same order as p
+   if (screen->p_wide)
+   {
+      if (!frame[num].wide_saved)
+	 frame[num].wide_saved = (ULONG *)malloc(cols * rows * sizeof(ULONG));
+      if (frame[num].wide_saved)
+	 for (i=0; i < rows; i++)
+	    memcpy(&frame[num].wide_saved[i * cols],
+		   &screen->p_wide[base + i * screen->ncols],
+		   cols * sizeof(ULONG));
+   }
+   // and their extended attributes
+   if (screen->p_xattr)
+   {
+      if (!frame[num].xattr_saved)
+	 frame[num].xattr_saved = (ULONG *)malloc(cols * rows * sizeof(ULONG));
+      if (frame[num].xattr_saved)
+	 for (i=0; i < rows; i++)
+	    memcpy(&frame[num].xattr_saved[i * cols],
+		   &screen->p_xattr[base + i * screen->ncols],
+		   cols * sizeof(ULONG));
+   }
+   else if (frame[num].xattr_saved)
+   {
+      free(frame[num].xattr_saved);
+      frame[num].xattr_saved = 0;
+   }
+   unlock_rows(screen, frame[num].start_row, frame[num].end_row);
+#endif
+   return 0;
+
+#endif
+
+}
+
+ULONG restore_screen(void)
+{
+#if (WINDOWS_NT_UTIL)
+    return 0;
+#endif
+
+
+#if (DOS_UTIL)
+    ULONG i, j;
+    BYTE *buf_ptr;
+    NWSCREEN *screen = &console_screen;
+
+    buf_ptr = (BYTE *) screen->p_vidmem;
+    for (j=0; j < screen->nlines; j++)
+    {
+       for (i=0; i < screen->ncols; i++)
+       {
+	  put_char_direct(screen, *buf_ptr, j, i, *(buf_ptr + 1));
+          buf_ptr += 2;
+       }
+    }
+    return 0;
+#endif
+
+#if (LINUX_UTIL)
+    NWSCREEN *screen = &console_screen;
+    ULONG i;
+
+    // the whole map is drawn again with the next refresh
+    if (lock_screen(screen))
+       return -1;
+    for (i=0; i < screen->nlines; i++)
+       mark_dirty(screen, i, 0, screen->ncols);
+    redrawwin(stdscr);
+    unlock_screen(screen);
+    refresh_pending++;
+    return 0;
+#endif
+
+}
+
+ULONG restore_menu(ULONG num)
+{
+#if (WINDOWS_NT_UTIL)
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    BOOL bSuccess;
+    DWORD cCharsWritten, i, len;
+    COORD coordScreen;
+    BYTE *buf_ptr;
+
+    if (!frame[num].saved)
+       return -1;
+
+    buf_ptr = (BYTE *) frame[num].p;
+    for (i=frame[num].start_row; i < frame[num].end_row + 1; i++)
+    {
+       coordScreen.X = (short)frame[num].start_column;
+       coordScreen.Y = (short)i;
+
+       len = frame[num].end_column - frame[num].start_column + 1;
+       bSuccess = WriteConsoleOutputCharacter(hConsole,
+					    (LPSTR)buf_ptr,
+					     len,
+					     coordScreen,
+					     &cCharsWritten);
+
+       buf_ptr += len;
+       bSuccess = WriteConsoleOutputAttribute(hConsole,
+					    (LPWORD)buf_ptr,
+					     len,
+					     coordScreen,
+					     &cCharsWritten);
+       buf_ptr += len * 2;
+    }
+    return 0;
+#endif
+
+#if (DOS_UTIL | LINUX_UTIL)
+    NWSCREEN *screen = frame[num].screen;
+    ULONG cols = frame[num].end_column - frame[num].start_column + 1;
+    ULONG rows = frame[num].end_row - frame[num].start_row + 1;
+    ULONG base = frame[num].start_row * screen->ncols + frame[num].start_column;
+    ULONG i;
+
+    if (!frame[num].saved)
+       return -1;
+
+#if (LINUX_UTIL)
+    if (lock_rows(screen, frame[num].start_row, frame[num].end_row))
+       return -1;
+
+    // put back the code points of unicode characters and the extended
+    // attributes under the frame before their cells are redrawn
+    if (frame[num].wide_saved && screen->p_wide)
+       for (i=0; i < rows; i++)
+	  memcpy(&screen->p_wide[base + i * screen->ncols],
+		 &frame[num].wide_saved[i * cols], cols * sizeof(ULONG));
+
+    if (frame[num].xattr_saved)
+       screen_plane(screen, &screen->p_xattr);
+    if (screen->p_xattr)
+       for (i=0; i < rows; i++)
+       {
+	  if (frame[num].xattr_saved)
+	     memcpy(&screen->p_xattr[base + i * screen->ncols],
+		    &frame[num].xattr_saved[i * cols], cols * sizeof(ULONG));
+	  else
+	     memset(&screen->p_xattr[base + i * screen->ncols], 0,
+		    cols * sizeof(ULONG));
+       }
+#endif
+
+    cell_copy_rect(&screen->p_vidmem[base * 2], screen->ncols, frame[num].p,
+		   cols, rows, cols);
+    for (i=0; i < rows; i++)
+#if (LINUX_UTIL)
+       mark_dirty(screen, frame[num].start_row + i, frame[num].start_column,
+		  cols);
+#else
+       emit_cells(screen, frame[num].start_row + i, frame[num].start_column,
+		  cols);
+#endif
+    frame[num].active = 0;
+#if (LINUX_UTIL)
+    cw_stats.cells_written += rows * cols;
+    unlock_rows(screen, frame[num].start_row, frame[num].end_row);
+    visibility_changed();
+    refresh_pending++;
+#endif
+    return 0;
+
+#endif
+
+}
+
+void free_elements(ULONG num)
+{
+   ULONG i;
+
+#if (LINUX_UTIL)
+   if (frame[num].el_lines)
+   {
+      for (i=0; i < frame[num].el_count; i++)
+	 if (frame[num].el_lines[i].glyph)
+	    free(frame[num].el_lines[i].glyph);
+      free(frame[num].el_lines);
+   }
+   frame[num].el_lines = 0;
+
+   if (frame[num].wide_saved)
+      free(frame[num].wide_saved);
+   frame[num].wide_saved = 0;
+
+   if (frame[num].xattr_saved)
+      free(frame[num].xattr_saved);
+   frame[num].xattr_saved = 0;
+#endif
+
+   if (frame[num].el_text)
+   {
+      for (i=0; i < frame[num].el_count * 3; i++)
+      {
+	 if (frame[num].el_text[i].size)
+	    free(frame[num].el_text[i].text);
+	 if (frame[num].el_text[i].run)
+	    free(frame[num].el_text[i].run);
+      }
+      free((void *) frame[num].el_text);
+   }
+   frame[num].el_text = 0;
+
+   if (frame[num].el_state)
+      free((void *) frame[num].el_state);
+   frame[num].el_state = 0;
+
+   if (frame[num].batch_map)
+      free((void *) frame[num].batch_map);
+   frame[num].batch_map = 0;
+
+   if (frame[num].el_scratch)
+      free((void *) frame[num].el_scratch);
+   frame[num].el_scratch = 0;
+
+   if (frame[num].el_attr_storage)
+      free((void *) frame[num].el_attr_storage);
+   frame[num].el_attr_storage = 0;
+
+   if (frame[num].el_attr)
+      free((void *) frame[num].el_attr);
+   frame[num].el_attr = 0;
+
+   if (frame[num].el_storage)
+      free((void *) frame[num].el_storage);
+   frame[num].el_storage = 0;
+
+   if (frame[num].el_values)
+      free((void *) frame[num].el_values);
+   frame[num].el_values = 0;
+
+   if (frame[num].el_strings)
+      free((void *) frame[num].el_strings);
+   frame[num].el_strings = 0;
+
+   if (frame[num].p)
+      free((void *) frame[num].p);
+   frame[num].p = 0;
+
+   frame[num].memory = 0;
+   return;
+}
+
+ULONG free_menu(ULONG num)
+{
+   FIELD_LIST *fl;
+
+#if LINUX_UTIL
+   pthread_mutex_destroy(&frame[num].mutex);
+#endif
+
+   frame[num].cur_row = 0;
+   frame[num].cur_column = 0;
+   frame[num].choice = 0;
+   frame[num].index = 0;
+
+   restore_menu(num);
+   free_elements(num);
+
+   frame[num].el_count = 0;
+   frame[num].el_func = 0;
+   frame[num].warn_func = 0;
+   frame[num].owner = 0;
+#if (LINUX_UTIL)
+   visibility_changed();
+#endif
+
+   while (frame[num].head)
+   {
+      fl = frame[num].head;
+      frame[num].head = fl->next;
+      free(fl);
+   }
+   frame[num].head = frame[num].tail = 0;
+   frame[num].field_count = 0;
+   if (frame[num].field_index)
+      free(frame[num].field_index);
+   frame[num].field_index = NULL;
+   frame[num].field_index_size = 0;
+
+   return 0;
+
+}
+
+ULONG display_menu_header(ULONG num)
+{
+
+   ULONG col, len;
+
+   if (!frame[num].header[0])
+      return -1;
+
+   col = frame[num].start_column;
+   len = strlen((const char *) &frame[num].header[0]);
+   len = (frame[num].end_column - col - len) / 2;
+   if (len < 0)
+      return -1;
+
+   col = col + len;
+
+      put_char_length(frame[num].screen, frame[num].horizontal_frame,
+		      frame[num].start_row + 2, frame[num].start_column,
+		      frame[num].border_color,
+		      frame[num].end_column - frame[num].start_column);
+
+      put_char(frame[num].screen,
+	      frame[num].left_frame,
+	      frame[num].start_row + 2,
+	      frame[num].start_column,
+	      frame[num].border_color);
+
+      put_char(frame[num].screen,
+	      frame[num].right_frame,
+	      frame[num].start_row + 2,
+	      frame[num].end_column,
+	      frame[num].border_color);
+
+   put_string(frame[num].screen,
+	      (const char *)frame[num].header, NULL,
+		frame[num].start_row + 1,
+		col,
+		frame[num].header_color);
+
+   return 0;
+
+
+}
+
+ULONG draw_menu_border(ULONG num)
+{
+   ULONG i;
+
+   for (i=frame[num].start_row + 1; i < frame[num].end_row; i++)
+   {
+#if (WINDOWS_NT_UTIL | LINUX_UTIL | DOS_UTIL)
+      put_char(frame[num].screen, frame[num].vertical_frame,
+	       i,
+	       frame[num].start_column,
+	       frame[num].border_color);
+      put_char(frame[num].screen, frame[num].vertical_frame,
+	       i,
+	       frame[num].end_column,
+	       frame[num].border_color);
+#endif
+   }
+
+   for (i=frame[num].start_column + 1; i < frame[num].end_column; i++)
+   {
+#if (WINDOWS_NT_UTIL | LINUX_UTIL | DOS_UTIL)
+      put_char(frame[num].screen, frame[num].horizontal_frame,
+	       frame[num].start_row,
+	       i,
+	       frame[num].border_color);
+      put_char(frame[num].screen, frame[num].horizontal_frame,
+	       frame[num].end_row,
+	       i,
+	       frame[num].border_color);
+#endif
+   }
+
+   put_char(frame[num].screen, frame[num].upper_left,
+	    frame[num].start_row,
+	    frame[num].start_column,
+	    frame[num].border_color);
+
+   put_char(frame[num].screen, frame[num].lower_left,
+	    frame[num].end_row,
+	    frame[num].start_column,
+	    frame[num].border_color);
+
+   put_char(frame[num].screen, frame[num].upper_right,
+	    frame[num].start_row,
+	    frame[num].end_column,
+	    frame[num].border_color);
+
+   put_char(frame[num].screen, frame[num].lower_right,
+	    frame[num].end_row,
+	    frame[num].end_column,
+	    frame[num].border_color);
+
+   return 0;
+
+
+}
+
+void display_menu(ULONG num)
+{
+    ULONG i, row, col, count, width;
+
+    if (strlen((const char *)frame[num].header))
+       row = frame[num].start_row + 3;
+    else
+       row = frame[num].start_row + 1;
+
+    count = frame[num].window_size;
+    col = frame[num].start_column + 1;
+    width = frame[num].end_column - frame[num].start_column;
+    if (width >= 1)
+       width -= 1;
+
+    for (i=0; i < count; i++)
+    {
+       if ((i < frame[num].el_count) &&
+	   frame[num].el_strings &&
+	   frame[num].el_strings[i])
+       {
+	  if (frame[num].scroll_frame)
+	  {
+	     put_char(frame[num].screen,
+		    ' ',
+		    row + i, col,
+		    frame[num].fill_color |
+		    frame[num].text_color);
+
+	     put_char(frame[num].screen,
+		    frame[num].scroll_frame,
+		    row + i, col + 1,
+		    frame[num].fill_color |
+		    frame[num].text_color);
+
+             put_string_to_length(frame[num].screen,
+		    (const char *)frame[num].el_strings[i],
+		    frame[num].el_attr[i],
+		    row + i, col + 2,
+		    frame[num].fill_color |
+		    frame[num].text_color,
+		    width - 2);
+	  }
+	  else
+	  {
+             put_string_to_length(frame[num].screen,
+		    (const char *)frame[num].el_strings[i],
+		    frame[num].el_attr[i],
+		    row + i, col,
+		    frame[num].fill_color | frame[num].text_color,
+		    width);
+	  }
+
+       }
+       else
+       {
+	  if (frame[num].scroll_frame)
+	  {
+	     put_char(frame[num].screen,
+		     ' ',
+		     row + i, col,
+		     frame[num].fill_color |
+		     frame[num].text_color);
+
+	     put_char(frame[num].screen,
+		     frame[num].scroll_frame,
+		     row + i, col + 1,
+		     frame[num].fill_color |
+		     frame[num].text_color);
+	  }
+       }
+    }
+}
+
+ULONG add_item_to_menu(ULONG num, const char *p, ULONG value)
+{
+   ULONG i;
+   BYTE *v;
+
+    if (frame[num].owner && frame[num].el_strings &&
+        frame[num].el_count < frame[num].el_limit)
+    {
+       v = frame[num].el_strings[frame[num].el_count];
+       if (!v)
+	  return -1;
+
+       for (i=0; *p && (i < frame[num].screen->ncols); i++)
+	  *v++ = *p++;
+
+       frame[num].el_strings[frame[num].el_count]
+                                [frame[num].screen->ncols - 1] = '\0';
+       frame[num].el_values[frame[num].el_count++] = value;
+
+       return 0;
+    }
+    return -1;
+}
+
+ULONG activate_menu(ULONG num)
+{
+
+   ULONG len;
+   ULONG i, retCode;
+
+   if (!frame[num].screen)
+      return -1;
+
+   get_xy(frame[num].screen, (ULONG *)&frame[num].pcur_row,
+	  (ULONG *)&frame[num].pcur_column);
+
+   len = 0;
+   for (i=0; i < frame[num].el_count; i++)
+   {
+      if (strlen((const char *)frame[num].el_strings[i]) > len)
+	 len = strlen((const char *)frame[num].el_strings[i]);
+   }
+
+   if (frame[num].header)
+   {
+      if (strlen((const char *)frame[num].header) > len)
+	 len = strlen((const char *)frame[num].header);
+   }
+
+   frame[num].end_column = len + 3 + frame[num].start_column;
+
+   if (strlen((const char *)frame[num].header))
+   {
+      if (frame[num].window_size)
+	 frame[num].end_row = frame[num].window_size + 3 +
+				frame[num].start_row;
+      else
+	 frame[num].end_row = frame[num].el_count + 3 +
+				frame[num].start_row;
+   }
+   else
+   {
+      if (frame[num].window_size)
+	 frame[num].end_row = frame[num].window_size + 1 +
+				frame[num].start_row;
+      else
+	 frame[num].end_row = frame[num].el_count + 1 +
+				frame[num].start_row;
+
+   }
+
+   if (frame[num].end_row + 1 > frame[num].screen->nlines - 1 ||
+      frame[num].end_column + 1 > frame[num].screen->ncols - 1)
+   {
+      return -1;
+   }
+
+   if (!frame[num].active)
+   {
+      frame[num].active = TRUE;
+      save_menu(num);
+      fill_menu(num, ' ', frame[num].fill_color);
+#if (LINUX_UTIL)
+      visibility_changed();
+#endif
+   }
+
+   if (frame[num].border)
+   {
+      draw_menu_border(num);
+      display_menu_header(num);
+   }
+
+   display_menu(num);
+
+   retCode = get_resp(num);
+
+   restore_menu(num);
+
+   return retCode;
+
+}
+
+ULONG get_horizontal_frame(int num) 
+{
+   if (!frame[num].screen)
+      return 0;
+
+   if (!frame[num].owner)
+      return 0;
+
+   if (!num || num > MAX_MENU)
+      return 0;
+
+   return (ULONG)frame[num].horizontal_frame;
+}
+
+ULONG make_menu(NWSCREEN *screen,
+	       const char *header,
+	       ULONG start_row,
+	       ULONG start_column,
+	       ULONG window_size,
+	       ULONG border,
+	       ULONG hcolor,
+	       ULONG bcolor,
+	       ULONG fcolor,
+	       ULONG tcolor,
+	       ULONG (*el_func)(NWSCREEN *, ULONG, BYTE *, ULONG),
+	       ULONG (*warn_func)(NWSCREEN *, ULONG),
+	       ULONG (*key_handler)(NWSCREEN *, ULONG, ULONG, ULONG),
+	       ULONG scroll_barPresent,
+	       ULONG max_lines)
+{
+
+   ULONG i;
+   ULONG num;
+
+   if ((max_lines == (ULONG) -1) || (!max_lines))
+      max_lines = 100;
+
+   for (num=1; num < MAX_MENU; num++)
+   {
+      if (!frame[num].owner)
+	 break;
+   }
+
+   if (!num || num > MAX_MENU)
+      return 0;
+
+   if (start_row > screen->nlines - 1 || start_row < 0 ||
+       start_column > screen->ncols - 2 || start_column < 0)
+      return 0;
+
+   frame[num].p = (BYTE *)malloc(screen->nlines * screen->ncols * 2);
+   if (!frame[num].p)
+   {
+      free_elements(num);
+      return 0;
+   }
+   set_data((ULONG *)frame[num].p, 0, screen->nlines * screen->ncols * 2);
+
+   frame[num].el_storage =
+                     (BYTE *)malloc(max_lines * screen->ncols);
+   if (!frame[num].el_storage)
+   {
+      free_elements(num);
+      return 0;
+   }
+   set_data_b((BYTE *) frame[num].el_storage, 0,
+	      max_lines * screen->ncols);
+
+   frame[num].el_strings =
+                  (BYTE **)malloc(max_lines * sizeof(BYTE *));
+   if (!frame[num].el_strings)
+   {
+      free_elements(num);
+      return 0;
+   }
+   set_data((ULONG *) frame[num].el_strings, 0,
+                max_lines * sizeof(BYTE *));
+
+   frame[num].el_values =
+              (ULONG *)malloc(max_lines * sizeof(ULONG));
+   if (!frame[num].el_values)
+   {
+      free_elements(num);
+      return 0;
+   }
+   set_data((ULONG *) frame[num].el_values, 0,
+                        max_lines * sizeof(ULONG));
+
+   frame[num].el_attr_storage =
+                     (BYTE *)malloc(max_lines * screen->ncols);
+   if (!frame[num].el_attr_storage)
+   {
+      free_elements(num);
+      return 0;
+   }
+   set_data_b((BYTE *) frame[num].el_attr_storage, 0,
+                       max_lines * screen->ncols);
+
+   frame[num].el_attr =
+                  (BYTE **)malloc(max_lines * sizeof(BYTE *));
+   if (!frame[num].el_attr)
+   {
+      free_elements(num);
+      return 0;
+   }
+   set_data((ULONG *) frame[num].el_attr, 0,
+	    max_lines * sizeof(BYTE *));
+
+   frame[num].memory = (screen->nlines * screen->ncols * 2) +
+		       (max_lines * screen->ncols * 2) +
+		       (max_lines * (sizeof(BYTE *) * 2 + sizeof(ULONG)));
+
+   for (i=0; i < max_lines; i++)
+   {
+      BYTE *p = &frame[num].el_storage[i * screen->ncols];
+      add_item_to_portal(num, frame[num].el_strings, p, i);
+      p[screen->ncols - 1] = '\0';
+   }
+
+   for (i=0; i < max_lines; i++)
+   {
+      BYTE *p = &frame[num].el_attr_storage[i * screen->ncols];
+      add_item_to_portal(num, frame[num].el_attr, p, i);
+      p[screen->ncols - 1] = '\0';
+   }
+
+   for (i=0; i < (HEADER_LEN - 1); i++)
+   {
+      if (!header || !header[i])
+	 break;
+      frame[num].header[i] = header[i];
+   }
+   frame[num].header[i] = 0x00;   // null terminate string
+
+   frame[num].start_row = start_row;
+   frame[num].end_row = start_row + 1;
+   frame[num].start_column = start_column;
+   frame[num].end_column = start_column + 1;
+   frame[num].screen = screen;
+   frame[num].border = border;
+   frame[num].num = num;
+   frame[num].active = 0;
+   frame[num].cur_row = 0;
+   frame[num].cur_column = 0;
+   frame[num].header_color = BRITEWHITE;
+   frame[num].border_color = BRITEWHITE;
+   frame[num].fill_color = BRITEWHITE;
+   frame[num].text_color = BRITEWHITE;
+   frame[num].window_size = window_size;
+   frame[num].el_func = el_func;
+   frame[num].el_count = 0;
+   frame[num].warn_func = warn_func;
+   frame[num].key_handler = key_handler;
+   frame[num].el_limit = max_lines;
+   frame[num].head = frame[num].tail = 0;
+   frame[num].field_count = 0;
+   frame[num].field_index = NULL;
+   frame[num].field_index_size = 0;
+   frame[num].choice = 0;
+   frame[num].index = 0;
+   frame[num].top = 0;
+   frame[num].bottom = 0;
+   frame[num].focus = 0;
+   frame[num].sleep_count = 0;
+   frame[num].enable_focus = 0;
+   frame[num].mask = 0;
+   frame[num].saved = 0;
+
+#if LINUX_UTIL
+   // Unicode UTF8 Box Characters
+   if (border == BORDER_SINGLE)
+   {
+      frame[num].w_upper_left       = "\u250c";
+      frame[num].w_upper_right      = "\u2510";
+      frame[num].w_lower_left       = "\u2514";
+      frame[num].w_lower_right      = "\u2518";
+      frame[num].w_left_frame       = "\u251c";
+      frame[num].w_right_frame      = "\u2524";
+      frame[num].w_vertical_frame   = "\u2500";
+      frame[num].w_horizontal_frame = "\u2502";
+      frame[num].w_up_char          = "\u25b3";
+      frame[num].w_down_char        = "\u25bd";
+   }
+   else
+   if (border == BORDER_DOUBLE)
+   {
+      frame[num].w_upper_left       = "\u2554";
+      frame[num].w_upper_right      = "\u2557";
+      frame[num].w_lower_left       = "\u255a";
+      frame[num].w_lower_right      = "\u255d";
+      frame[num].w_left_frame       = "\u2560";
+      frame[num].w_right_frame      = "\u2563";
+      frame[num].w_vertical_frame   = "\u2550";
+      frame[num].w_horizontal_frame = "\u2551";
+      frame[num].w_up_char          = "\u25b3";
+      frame[num].w_down_char        = "\u25bd";
+   }
+   else
+   {
+      frame[num].w_upper_left       = 0;
+      frame[num].w_upper_right      = 0;
+      frame[num].w_lower_left       = 0;
+      frame[num].w_lower_right      = 0;
+      frame[num].w_left_frame       = 0;
+      frame[num].w_right_frame      = 0;
+      frame[num].w_vertical_frame   = 0;
+      frame[num].w_horizontal_frame = 0;
+      frame[num].w_up_char          = 0;
+      frame[num].w_down_char        = 0;
+   }
+   if (scroll_barPresent)
+      frame[num].w_scroll_frame     = "\u2502";
+   else
+      frame[num].w_scroll_frame     = 0;
+#endif
+
+#if (DOS_UTIL | WINDOWS_NT_UTIL)
+   if (border == BORDER_SINGLE)
+   {
+      frame[num].upper_left       = 218;
+      frame[num].upper_right      = 191;
+      frame[num].lower_left       = 192;
+      frame[num].lower_right      = 217;
+      frame[num].left_frame       = 195;
+      frame[num].right_frame      = 180;
+      frame[num].vertical_frame   = 179;
+      frame[num].horizontal_frame = 196;
+      frame[num].up_char          = 0x1E;
+      frame[num].down_char        = 0x1F;
+   }
+   else
+   if (border == BORDER_DOUBLE)
+   {
+      frame[num].upper_left       = 201;
+      frame[num].upper_right      = 187;
+      frame[num].lower_left       = 200;
+      frame[num].lower_right      = 188;
+      frame[num].left_frame       = 204;
+      frame[num].right_frame      = 185;
+      frame[num].vertical_frame   = 186;
+      frame[num].horizontal_frame = 205;
+      frame[num].up_char          = 0x1E;
+      frame[num].down_char        = 0x1F;
+   }
+   else
+   {
+      frame[num].upper_left       = 0;
+      frame[num].upper_right      = 0;
+      frame[num].lower_left       = 0;
+      frame[num].lower_right      = 0;
+      frame[num].left_frame       = 0;
+      frame[num].right_frame      = 0;
+      frame[num].vertical_frame   = 0;
+      frame[num].horizontal_frame = 0;
+      frame[num].up_char          = 0;
+      frame[num].down_char        = 0;
+   }
+   if (scroll_barPresent)
+      frame[num].scroll_frame     = 179;
+   else
+      frame[num].scroll_frame     = 0;
+
+#endif
+
+#if (LINUX_UTIL)
+   if (text_mode)
+   {
+      if (border == BORDER_SINGLE)
+      {
+	 frame[num].upper_left       = '+';
+	 frame[num].upper_right      = '+';
+	 frame[num].lower_left       = '+';
+	 frame[num].lower_right      = '+';
+	 frame[num].left_frame       = '+';
+	 frame[num].right_frame      = '+';
+	 frame[num].vertical_frame   = '|';
+	 frame[num].horizontal_frame = '-';
+	 frame[num].up_char          = '*';
+	 frame[num].down_char        = '*';
+      }
+      else
+      if (border == BORDER_DOUBLE)
+      {
+	 frame[num].upper_left       = '*';
+	 frame[num].upper_right      = '*';
+	 frame[num].lower_left       = '*';
+	 frame[num].lower_right      = '*';
+	 frame[num].left_frame       = '*';
+	 frame[num].right_frame      = '*';
+	 frame[num].vertical_frame   = '|';
+	 frame[num].horizontal_frame = '=';
+	 frame[num].up_char          = '*';
+	 frame[num].down_char        = '*';
+      }
+      else
+      {
+	 frame[num].upper_left       = 0;
+	 frame[num].upper_right      = 0;
+	 frame[num].lower_left       = 0;
+	 frame[num].lower_right      = 0;
+	 frame[num].left_frame       = 0;
+	 frame[num].right_frame      = 0;
+	 frame[num].vertical_frame   = 0;
+	 frame[num].horizontal_frame = 0;
+	 frame[num].up_char          = 0;
+	 frame[num].down_char        = 0;
+      }
+      if (scroll_barPresent)
+	 frame[num].scroll_frame     = '|';
+      else
+	 frame[num].scroll_frame     = 0;
+   }
+   else
+   {
+      if (border == BORDER_SINGLE)
+      {
+	 frame[num].upper_left       = 218 | A_ALTCHARSET;
+	 frame[num].upper_right      = 191 | A_ALTCHARSET;
+	 frame[num].lower_left       = 192 | A_ALTCHARSET;
+	 frame[num].lower_right      = 217 | A_ALTCHARSET;
+	 frame[num].left_frame       = 195 | A_ALTCHARSET;
+	 frame[num].right_frame      = 180 | A_ALTCHARSET;
+	 frame[num].vertical_frame   = 179 | A_ALTCHARSET;
+	 frame[num].horizontal_frame = 196 | A_ALTCHARSET;
+#if 0
+	 frame[num].up_char          = 0x1E | A_ALTCHARSET;
+	 frame[num].down_char        = 0x1F | A_ALTCHARSET;
+#endif
+	 frame[num].up_char          = '*';
+	 frame[num].down_char        = '*';
+      }
+      else
+      if (border == BORDER_DOUBLE)
+      {
+	 frame[num].upper_left       = 201 | A_ALTCHARSET;
+	 frame[num].upper_right      = 187 | A_ALTCHARSET;
+	 frame[num].lower_left       = 200 | A_ALTCHARSET;
+	 frame[num].lower_right      = 188 | A_ALTCHARSET;
+	 frame[num].left_frame       = 204 | A_ALTCHARSET;
+	 frame[num].right_frame      = 185 | A_ALTCHARSET;
+	 frame[num].vertical_frame   = 186 | A_ALTCHARSET;
+	 frame[num].horizontal_frame = 205 | A_ALTCHARSET;
+#if 0
+	 frame[num].up_char          = 0x1E | A_ALTCHARSET;
+         frame[num].down_char        = 0x1F | A_ALTCHARSET;
+#endif
+	 frame[num].up_char          = '*';
+	 frame[num].down_char        = '*';
+      }
+      else
+      {
+	 frame[num].upper_left       = 0;
+	 frame[num].upper_right      = 0;
+	 frame[num].lower_left       = 0;
+	 frame[num].lower_right      = 0;
+	 frame[num].left_frame       = 0;
+	 frame[num].right_frame      = 0;
+	 frame[num].vertical_frame   = 0;
+	 frame[num].horizontal_frame = 0;
+	 frame[num].up_char          = 0;
+	 frame[num].down_char        = 0;
+      }
+      if (scroll_barPresent)
+	frame[num].scroll_frame     = 179 | A_ALTCHARSET;
+      else
+	 frame[num].scroll_frame     = 0;
+   }
+#endif
+
+   if (hcolor)
+      frame[num].header_color = hcolor;
+   if (bcolor)
+      frame[num].border_color = bcolor;
+   if (fcolor)
+      frame[num].fill_color = fcolor;
+   if (tcolor)
+      frame[num].text_color = tcolor;
+
+   frame[num].owner = 1;
+
+#if LINUX_UTIL
+   pthread_mutex_init(&frame[num].mutex, NULL);
+#endif
+
+   return num;
 
-   put_char(frame[num].screen, frame[num].lower_left,
-	    frame[num].end_row,
-	    frame[num].start_column,
-	    frame[num].border_color);
+}
 
-   put_char(frame[num].screen, frame[num].upper_right,
-	    frame[num].start_row,
-	    frame[num].end_column,
-	    frame[num].border_color);
+ULONG menu_write_string(ULONG num, BYTE *p, ULONG row, ULONG col, ULONG attr)
+{
 
-   put_char(frame[num].screen, frame[num].lower_right,
-	    frame[num].end_row,
-	    frame[num].end_column,
-	    frame[num].border_color);
+   if (!frame[num].active)
+      return -1;
 
-   return 0;
+   put_string(frame[num].screen,
+	        (const char *)p, NULL,
+		frame[num].start_row + 1 + row,
+		frame[num].start_column + 1 + col,
+		attr);
 
+   return 0;
 
 }
 
-void display_menu(ULONG num)
+void scroll_portal(ULONG num, ULONG up)
 {
-    ULONG i, row, col, count, width;
 
-    if (strlen((const char *)frame[num].header))
+    ULONG row, col;
+
+    if (strlen((const char *)frame[num].header) ||
+        strlen((const char *)frame[num].subheader))
+    {
        row = frame[num].start_row + 3;
+       if (strlen((const char *)frame[num].subheader))
+	  row++;
+    }
     else
        row = frame[num].start_row + 1;
 
-    count = frame[num].window_size;
-    col = frame[num].start_column + 1;
-    width = frame[num].end_column - frame[num].start_column;
-    if (width >= 1)
-       width -= 1;
+    if (frame[num].scroll_frame)
+       col = frame[num].start_column + 3;
+    else
+       col = frame[num].start_column + 1;
 
-    for (i=0; i < count; i++)
-    {
-       if ((i < frame[num].el_count) &&
-	   frame[num].el_strings &&
-	   frame[num].el_strings[i])
-       {
-	  if (frame[num].scroll_frame)
-	  {
-	     put_char(frame[num].screen,
-		    ' ',
-		    row + i, col,
-		    frame[num].fill_color |
-		    frame[num].text_color);
+    scroll_display(frame[num].screen,
+		  row,
+		  col,
+		  frame[num].end_row - row,
+		  frame[num].end_column - col,
+		  up);
+    return;
 
-	     put_char(frame[num].screen,
-		    frame[num].scroll_frame,
-		    row + i, col + 1,
-		    frame[num].fill_color |
-		    frame[num].text_color);
+}
 
-             put_string_to_length(frame[num].screen,
-		    (const char *)frame[num].el_strings[i],
-		    frame[num].el_attr[i],
-		    row + i, col + 2,
-		    frame[num].fill_color |
-		    frame[num].text_color,
-		    width - 2);
-	  }
-	  else
-	  {
-             put_string_to_length(frame[num].screen,
-		    (const char *)frame[num].el_strings[i],
-		    frame[num].el_attr[i],
-		    row + i, col,
-		    frame[num].fill_color | frame[num].text_color,
-		    width);
-	  }
+void enable_portal_focus(ULONG num, ULONG interval)
+{
+    frame[num].enable_focus = 1;
+    frame[num].focus_interval = interval;
+    return;
+}
 
-       }
-       else
-       {
-	  if (frame[num].scroll_frame)
-	  {
-	     put_char(frame[num].screen,
-		     ' ',
-		     row + i, col,
-		     frame[num].fill_color |
-		     frame[num].text_color);
+void disable_portal_focus(ULONG num)
+{
+    frame[num].enable_focus = 0;
+    frame[num].focus_interval = 0;
+    return;
+}
 
-	     put_char(frame[num].screen,
-		     frame[num].scroll_frame,
-		     row + i, col + 1,
-		     frame[num].fill_color |
-		     frame[num].text_color);
-	  }
-       }
+void set_portal_focus(ULONG num)
+{
+    if (frame[num].enable_focus)
+    {
+       frame[num].focus = 1;
+       frame[num].sleep_count = 0;
     }
+    return;
 }
 
-ULONG add_item_to_menu(ULONG num, const char *p, ULONG value)
+void clear_portal_focus(ULONG num)
 {
-   ULONG i;
-   BYTE *v;
-
-    if (frame[num].owner && frame[num].el_strings &&
-        frame[num].el_count < frame[num].el_limit)
+    if (frame[num].enable_focus)
     {
-       v = frame[num].el_strings[frame[num].el_count];
-       if (!v)
-	  return -1;
-
-       for (i=0; *p && (i < frame[num].screen->ncols); i++)
-	  *v++ = *p++;
+       frame[num].focus = 0;
+       frame[num].sleep_count = 0;
+    }
+    return;
+}
 
-       frame[num].el_strings[frame[num].el_count]
-                                [frame[num].screen->ncols - 1] = '\0';
-       frame[num].el_values[frame[num].el_count++] = value;
+int get_sleep_count(ULONG num)
+{
+    if (frame[num].enable_focus)
+    {
+       if (frame[num].focus_interval == -1)
+          return 1;
 
-       return 0;
+       frame[num].sleep_count++;
+       if (frame[num].sleep_count > frame[num].focus_interval)
+       {
+          frame[num].sleep_count = 0;
+          return 0;
+       }
+       return 1;
     }
     return -1;
 }
 
-ULONG activate_menu(ULONG num)
+int get_portal_focus(ULONG num)
 {
+    if (frame[num].enable_focus)
+    {
+      return frame[num].focus;
+    }
+    return -1;
+}
 
-   ULONG len;
-   ULONG i, retCode;
-
-   if (!frame[num].screen)
-      return -1;
-
-   get_xy(frame[num].screen, (ULONG *)&frame[num].pcur_row,
-	  (ULONG *)&frame[num].pcur_column);
-
-   len = 0;
-   for (i=0; i < frame[num].el_count; i++)
-   {
-      if (strlen((const char *)frame[num].el_strings[i]) > len)
-	 len = strlen((const char *)frame[num].el_strings[i]);
-   }
-
-   if (frame[num].header)
-   {
-      if (strlen((const char *)frame[num].header) > len)
-	 len = strlen((const char *)frame[num].header);
-   }
-
-   frame[num].end_column = len + 3 + frame[num].start_column;
-
-   if (strlen((const char *)frame[num].header))
-   {
-      if (frame[num].window_size)
-	 frame[num].end_row = frame[num].window_size + 3 +
-				frame[num].start_row;
-      else
-	 frame[num].end_row = frame[num].el_count + 3 +
-				frame[num].start_row;
-   }
-   else
-   {
-      if (frame[num].window_size)
-	 frame[num].end_row = frame[num].window_size + 1 +
-				frame[num].start_row;
-      else
-	 frame[num].end_row = frame[num].el_count + 1 +
-				frame[num].start_row;
-
-   }
-
-   if (frame[num].end_row + 1 > frame[num].screen->nlines - 1 ||
-      frame[num].end_column + 1 > frame[num].screen->ncols - 1)
-   {
-      return -1;
-   }
+#if (LINUX_UTIL)
+static inline void stale_line(ULONG num, ULONG line)
+{
+   if (frame[num].el_lines)
+      frame[num].el_lines[line].state = CWLINE_STALE;
+}
+#endif
 
-   if (!frame[num].active)
-   {
-      frame[num].active = TRUE;
-      save_menu(num);
-      fill_menu(num, ' ', frame[num].fill_color);
-   }
+static inline void add_frame_memory(ULONG num, ULONG size)
+{
+#if (LINUX_UTIL)
+   __sync_fetch_and_add(&frame[num].memory, size);
+#else
+   frame[num].memory += size;
+#endif
+}
 
-   if (frame[num].border)
-   {
-      draw_menu_border(num);
-      display_menu_header(num);
-   }
+// portal lines are triple buffered so threads writing a portal never
+// wait for the thread drawing it.  Writers hold store_mutex and write
+// the back buffer of a line, then swap it with the ready buffer.  The
+// thread drawing the portal holds the frame mutex and swaps the ready
+// buffer to the front when it is newer, a window at a time before the
+// window is drawn (pull_lines).  Between swaps each buffer belongs to
+// one side only, and a swap is a single compare and swap of the state
+// word of the line.  The back buffer is brought up to date with the
+// last published line when it is next written.
+
+#define LINE_FRONT(s)         ((s) & 3)
+#define LINE_BACK(s)          (((s) >> 2) & 3)
+#define LINE_READY(s)         (((s) >> 4) & 3)
+#define LINE_STATE(f, b, r)   ((f) | ((b) << 2) | ((r) << 4))
+#define LINE_FRESH            0x40    // ready is newer than front
+#define LINE_BEHIND           0x80    // back is older than the last write
+
+static inline ULONG line_state(ULONG num, ULONG line)
+{
+#if (LINUX_UTIL)
+   return __atomic_load_n(&frame[num].el_state[line], __ATOMIC_ACQUIRE);
+#else
+   return frame[num].el_state[line];
+#endif
+}
 
-   display_menu(num);
+static inline ULONG line_swap(ULONG num, ULONG line, ULONG old, ULONG state)
+{
+#if (LINUX_UTIL)
+   return __sync_bool_compare_and_swap(&frame[num].el_state[line], old,
+				       state);
+#else
+   frame[num].el_state[line] = state;
+   return 1;
+#endif
+}
 
-   retCode = get_resp(num);
+static inline CWTEXT *line_buffer(ULONG num, ULONG line, ULONG n)
+{
+   return &frame[num].el_text[line * 3 + n];
+}
 
-   restore_menu(num);
+// the thread with an update open on a portal already holds
+// store_mutex, its writes are published by commit_portal_update
 
-   return retCode;
+static inline int store_held(ULONG num)
+{
+#if (LINUX_UTIL)
+   return __atomic_load_n(&frame[num].batch_thread, __ATOMIC_RELAXED) ==
+	  (ULONG)pthread_self();
+#else
+   return frame[num].batch != 0;
+#endif
+}
 
+static inline void lock_store(ULONG num)
+{
+#if (LINUX_UTIL)
+   if (!store_held(num))
+      pthread_mutex_lock(&frame[num].store_mutex);
+#endif
 }
 
-ULONG get_horizontal_frame(int num) 
+static inline void unlock_store(ULONG num)
 {
-   if (!frame[num].screen)
-      return 0;
+#if (LINUX_UTIL)
+   if (!store_held(num))
+      pthread_mutex_unlock(&frame[num].store_mutex);
+#endif
+}
 
-   if (!frame[num].owner)
-      return 0;
+// portal lines start out empty and share empty_line.  Text grows as
+// cells are written, cells between the old end of the line and a new
+// write are blank.  The last cell of a line is always the nul.
 
-   if (!num || num > MAX_MENU)
-      return 0;
+static BYTE empty_line[1];
 
-   return (ULONG)frame[num].horizontal_frame;
+static inline ULONG line_cells(ULONG num)
+{
+   return frame[num].screen->ncols - 1;
 }
 
-ULONG make_menu(NWSCREEN *screen,
-	       const char *header,
-	       ULONG start_row,
-	       ULONG start_column,
-	       ULONG window_size,
-	       ULONG border,
-	       ULONG hcolor,
-	       ULONG bcolor,
-	       ULONG fcolor,
-	       ULONG tcolor,
-	       ULONG (*el_func)(NWSCREEN *, ULONG, BYTE *, ULONG),
-	       ULONG (*warn_func)(NWSCREEN *, ULONG),
-	       ULONG (*key_handler)(NWSCREEN *, ULONG, ULONG, ULONG),
-	       ULONG scroll_barPresent,
-	       ULONG max_lines)
+static ULONG line_reserve(ULONG num, CWTEXT *t, ULONG len)
 {
+   ULONG size;
+   BYTE *p;
 
-   ULONG i;
-   ULONG num;
-
-   if ((max_lines == (ULONG) -1) || (!max_lines))
-      max_lines = 100;
-
-   for (num=1; num < MAX_MENU; num++)
-   {
-      if (!frame[num].owner)
-	 break;
-   }
-
-   if (!num || num > MAX_MENU)
+   if (len + 1 <= t->size)
       return 0;
 
-   if (start_row > screen->nlines - 1 || start_row < 0 ||
-       start_column > screen->ncols - 2 || start_column < 0)
-      return 0;
+   size = t->size ? t->size : 16;
+   while (size < len + 1)
+      size *= 2;
+   if (size > frame[num].screen->ncols)
+      size = frame[num].screen->ncols;
 
-   frame[num].p = (BYTE *)malloc(screen->nlines * screen->ncols * 2);
-   if (!frame[num].p)
-   {
-      free_elements(num);
-      return 0;
-   }
-   set_data((ULONG *)frame[num].p, 0, screen->nlines * screen->ncols * 2);
+   p = (BYTE *)realloc(t->size ? t->text : NULL, size);
+   if (!p)
+      return -1;
+   add_frame_memory(num, size - t->size);
+   t->text = p;
+   t->size = size;
+   return 0;
+}
 
-   frame[num].el_storage =
-                     (BYTE *)malloc(max_lines * screen->ncols);
-   if (!frame[num].el_storage)
-   {
-      free_elements(num);
+static ULONG line_extend(ULONG num, CWTEXT *t, ULONG len)
+{
+   if (len > line_cells(num))
+      len = line_cells(num);
+   if (len <= t->len)
       return 0;
-   }
-   set_data_b((BYTE *) frame[num].el_storage, 0,
-	      max_lines * screen->ncols);
 
-   frame[num].el_strings =
-                  (BYTE **)malloc(max_lines * sizeof(BYTE *));
-   if (!frame[num].el_strings)
-   {
-      free_elements(num);
-      return 0;
-   }
-   set_data((ULONG *) frame[num].el_strings, 0,
-                max_lines * sizeof(BYTE *));
+   if (line_reserve(num, t, len))
+      return -1;
+   set_data_b(&t->text[t->len], ' ', len - t->len);
+   t->len = len;
+   t->text[len] = '\0';
+   return 0;
+}
 
-   frame[num].el_values =
-              (ULONG *)malloc(max_lines * sizeof(ULONG));
-   if (!frame[num].el_values)
+static inline void line_truncate(CWTEXT *t, ULONG len)
+{
+   if (len < t->len)
    {
-      free_elements(num);
-      return 0;
+      t->len = len;
+      t->text[len] = '\0';
    }
-   set_data((ULONG *) frame[num].el_values, 0,
-                        max_lines * sizeof(ULONG));
+}
 
-   frame[num].el_attr_storage =
-                     (BYTE *)malloc(max_lines * screen->ncols);
-   if (!frame[num].el_attr_storage)
-   {
-      free_elements(num);
-      return 0;
-   }
-   set_data_b((BYTE *) frame[num].el_attr_storage, 0,
-                       max_lines * screen->ncols);
+static ULONG line_runs(ULONG num, CWTEXT *t, ULONG runs)
+{
+   CWRUN *r;
+   ULONG n;
 
-   frame[num].el_attr =
-                  (BYTE **)malloc(max_lines * sizeof(BYTE *));
-   if (!frame[num].el_attr)
-   {
-      free_elements(num);
+   if (runs <= t->run_size)
       return 0;
-   }
-   set_data((ULONG *) frame[num].el_attr, 0,
-	    max_lines * sizeof(BYTE *));
-
-   for (i=0; i < max_lines; i++)
-   {
-      BYTE *p = &frame[num].el_storage[i * screen->ncols];
-      add_item_to_portal(num, frame[num].el_strings, p, i);
-      p[screen->ncols - 1] = '\0';
-   }
 
-   for (i=0; i < max_lines; i++)
-   {
-      BYTE *p = &frame[num].el_attr_storage[i * screen->ncols];
-      add_item_to_portal(num, frame[num].el_attr, p, i);
-      p[screen->ncols - 1] = '\0';
-   }
+   n = t->run_size ? t->run_size * 2 : 4;
+   while (n < runs)
+      n *= 2;
+   r = (CWRUN *)realloc(t->run, n * sizeof(CWRUN));
+   if (!r)
+      return -1;
+   add_frame_memory(num, (n - t->run_size) * sizeof(CWRUN));
+   t->run = r;
+   t->run_size = n;
+   return 0;
+}
 
-   for (i=0; i < (HEADER_LEN - 1); i++)
-   {
-      if (!header || !header[i])
-	 break;
-      frame[num].header[i] = header[i];
-   }
-   frame[num].header[i] = 0x00;   // null terminate string
+// give cells start..start+len attribute attr, 0 returns them to the
+// portal text attribute.  Runs which become adjacent with the same
+// attribute are merged, so writing a line left to right just extends
+// the last run.
 
-   frame[num].start_row = start_row;
-   frame[num].end_row = start_row + 1;
-   frame[num].start_column = start_column;
-   frame[num].end_column = start_column + 1;
-   frame[num].screen = screen;
-   frame[num].border = border;
-   frame[num].num = num;
-   frame[num].active = 0;
-   frame[num].cur_row = 0;
-   frame[num].cur_column = 0;
-   frame[num].header_color = BRITEWHITE;
-   frame[num].border_color = BRITEWHITE;
-   frame[num].fill_color = BRITEWHITE;
-   frame[num].text_color = BRITEWHITE;
-   frame[num].window_size = window_size;
-   frame[num].el_func = el_func;
-   frame[num].el_count = 0;
-   frame[num].warn_func = warn_func;
-   frame[num].key_handler = key_handler;
-   frame[num].el_limit = max_lines;
-   frame[num].head = frame[num].tail = 0;
-   frame[num].field_count = 0;
-   frame[num].choice = 0;
-   frame[num].index = 0;
-   frame[num].top = 0;
-   frame[num].bottom = 0;
-   frame[num].focus = 0;
-   frame[num].sleep_count = 0;
-   frame[num].enable_focus = 0;
-   frame[num].mask = 0;
-   frame[num].saved = 0;
+static ULONG line_attr(ULONG num, CWTEXT *t, ULONG start, ULONG len,
+		       ULONG attr)
+{
+   ULONG end = start + len, i, j, k, n;
+   CWRUN left, right, *r;
+   int has_left = 0, has_right = 0;
 
-#if LINUX_UTIL
-   // Unicode UTF8 Box Characters
-   if (border == BORDER_SINGLE)
-   {
-      frame[num].w_upper_left       = "\u250c";
-      frame[num].w_upper_right      = "\u2510";
-      frame[num].w_lower_left       = "\u2514";
-      frame[num].w_lower_right      = "\u2518";
-      frame[num].w_left_frame       = "\u251c";
-      frame[num].w_right_frame      = "\u2524";
-      frame[num].w_vertical_frame   = "\u2500";
-      frame[num].w_horizontal_frame = "\u2502";
-      frame[num].w_up_char          = "\u25b3";
-      frame[num].w_down_char        = "\u25bd";
-   }
-   else
-   if (border == BORDER_DOUBLE)
-   {
-      frame[num].w_upper_left       = "\u2554";
-      frame[num].w_upper_right      = "\u2557";
-      frame[num].w_lower_left       = "\u255a";
-      frame[num].w_lower_right      = "\u255d";
-      frame[num].w_left_frame       = "\u2560";
-      frame[num].w_right_frame      = "\u2563";
-      frame[num].w_vertical_frame   = "\u2550";
-      frame[num].w_horizontal_frame = "\u2551";
-      frame[num].w_up_char          = "\u25b3";
-      frame[num].w_down_char        = "\u25bd";
-   }
-   else
-   {
-      frame[num].w_upper_left       = 0;
-      frame[num].w_upper_right      = 0;
-      frame[num].w_lower_left       = 0;
-      frame[num].w_lower_right      = 0;
-      frame[num].w_left_frame       = 0;
-      frame[num].w_right_frame      = 0;
-      frame[num].w_vertical_frame   = 0;
-      frame[num].w_horizontal_frame = 0;
-      frame[num].w_up_char          = 0;
-      frame[num].w_down_char        = 0;
-   }
-   if (scroll_barPresent)
-      frame[num].w_scroll_frame     = "\u2502";
-   else
-      frame[num].w_scroll_frame     = 0;
-#endif
+   if (!len)
+      return 0;
 
-#if (DOS_UTIL | WINDOWS_NT_UTIL)
-   if (border == BORDER_SINGLE)
-   {
-      frame[num].upper_left       = 218;
-      frame[num].upper_right      = 191;
-      frame[num].lower_left       = 192;
-      frame[num].lower_right      = 217;
-      frame[num].left_frame       = 195;
-      frame[num].right_frame      = 180;
-      frame[num].vertical_frame   = 179;
-      frame[num].horizontal_frame = 196;
-      frame[num].up_char          = 0x1E;
-      frame[num].down_char        = 0x1F;
-   }
-   else
-   if (border == BORDER_DOUBLE)
-   {
-      frame[num].upper_left       = 201;
-      frame[num].upper_right      = 187;
-      frame[num].lower_left       = 200;
-      frame[num].lower_right      = 188;
-      frame[num].left_frame       = 204;
-      frame[num].right_frame      = 185;
-      frame[num].vertical_frame   = 186;
-      frame[num].horizontal_frame = 205;
-      frame[num].up_char          = 0x1E;
-      frame[num].down_char        = 0x1F;
-   }
-   else
+   if (t->runs)
    {
-      frame[num].upper_left       = 0;
-      frame[num].upper_right      = 0;
-      frame[num].lower_left       = 0;
-      frame[num].lower_right      = 0;
-      frame[num].left_frame       = 0;
-      frame[num].right_frame      = 0;
-      frame[num].vertical_frame   = 0;
-      frame[num].horizontal_frame = 0;
-      frame[num].up_char          = 0;
-      frame[num].down_char        = 0;
+      r = &t->run[t->runs - 1];
+      if ((ULONG)(r->start + r->len) <= start)
+      {
+	 if (!attr)
+	    return 0;
+	 if (r->attr == attr && (ULONG)(r->start + r->len) == start)
+	 {
+	    r->len += len;
+	    return 0;
+	 }
+      }
    }
-   if (scroll_barPresent)
-      frame[num].scroll_frame     = 179;
-   else
-      frame[num].scroll_frame     = 0;
+   else if (!attr)
+      return 0;
 
-#endif
+   if (line_runs(num, t, t->runs + 2))
+      return -1;
 
-#if (LINUX_UTIL)
-   if (text_mode)
+   // runs i..j-1 overlap the cells, keep the parts outside them
+   for (i=0; i < t->runs && (ULONG)(t->run[i].start + t->run[i].len) <= start;
+	i++)
+      ;
+   for (j=i; j < t->runs && t->run[j].start < end; j++)
+      ;
+   if (i < j && t->run[i].start < start)
    {
-      if (border == BORDER_SINGLE)
-      {
-	 frame[num].upper_left       = '+';
-	 frame[num].upper_right      = '+';
-	 frame[num].lower_left       = '+';
-	 frame[num].lower_right      = '+';
-	 frame[num].left_frame       = '+';
-	 frame[num].right_frame      = '+';
-	 frame[num].vertical_frame   = '|';
-	 frame[num].horizontal_frame = '-';
-	 frame[num].up_char          = '*';
-	 frame[num].down_char        = '*';
-      }
-      else
-      if (border == BORDER_DOUBLE)
-      {
-	 frame[num].upper_left       = '*';
-	 frame[num].upper_right      = '*';
-	 frame[num].lower_left       = '*';
-	 frame[num].lower_right      = '*';
-	 frame[num].left_frame       = '*';
-	 frame[num].right_frame      = '*';
-	 frame[num].vertical_frame   = '|';
-	 frame[num].horizontal_frame = '=';
-	 frame[num].up_char          = '*';
-	 frame[num].down_char        = '*';
-      }
-      else
-      {
-	 frame[num].upper_left       = 0;
-	 frame[num].upper_right      = 0;
-	 frame[num].lower_left       = 0;
-	 frame[num].lower_right      = 0;
-	 frame[num].left_frame       = 0;
-	 frame[num].right_frame      = 0;
-	 frame[num].vertical_frame   = 0;
-	 frame[num].horizontal_frame = 0;
-	 frame[num].up_char          = 0;
-	 frame[num].down_char        = 0;
-      }
-      if (scroll_barPresent)
-	 frame[num].scroll_frame     = '|';
-      else
-	 frame[num].scroll_frame     = 0;
+      left = t->run[i];
+      left.len = start - left.start;
+      has_left = 1;
    }
-   else
+   if (i < j && (ULONG)(t->run[j - 1].start + t->run[j - 1].len) > end)
    {
-      if (border == BORDER_SINGLE)
-      {
-	 frame[num].upper_left       = 218 | A_ALTCHARSET;
-	 frame[num].upper_right      = 191 | A_ALTCHARSET;
-	 frame[num].lower_left       = 192 | A_ALTCHARSET;
-	 frame[num].lower_right      = 217 | A_ALTCHARSET;
-	 frame[num].left_frame       = 195 | A_ALTCHARSET;
-	 frame[num].right_frame      = 180 | A_ALTCHARSET;
-	 frame[num].vertical_frame   = 179 | A_ALTCHARSET;
-	 frame[num].horizontal_frame = 196 | A_ALTCHARSET;
-#if 0
-	 frame[num].up_char          = 0x1E | A_ALTCHARSET;
-	 frame[num].down_char        = 0x1F | A_ALTCHARSET;
-#endif
-	 frame[num].up_char          = '*';
-	 frame[num].down_char        = '*';
-      }
-      else
-      if (border == BORDER_DOUBLE)
-      {
-	 frame[num].upper_left       = 201 | A_ALTCHARSET;
-	 frame[num].upper_right      = 187 | A_ALTCHARSET;
-	 frame[num].lower_left       = 200 | A_ALTCHARSET;
-	 frame[num].lower_right      = 188 | A_ALTCHARSET;
-	 frame[num].left_frame       = 204 | A_ALTCHARSET;
-	 frame[num].right_frame      = 185 | A_ALTCHARSET;
-	 frame[num].vertical_frame   = 186 | A_ALTCHARSET;
-	 frame[num].horizontal_frame = 205 | A_ALTCHARSET;
-#if 0
-	 frame[num].up_char          = 0x1E | A_ALTCHARSET;
-         frame[num].down_char        = 0x1F | A_ALTCHARSET;
-#endif
-	 frame[num].up_char          = '*';
-	 frame[num].down_char        = '*';
-      }
-      else
+      right = t->run[j - 1];
+      right.len = right.start + right.len - end;
+      right.start = end;
+      has_right = 1;
+   }
+
+   n = has_left + (attr ? 1 : 0) + has_right;
+   memmove(&t->run[i + n], &t->run[j], (t->runs - j) * sizeof(CWRUN));
+   t->runs = t->runs - (j - i) + n;
+
+   k = i;
+   if (has_left)
+      t->run[k++] = left;
+   if (attr)
+   {
+      t->run[k].start = start;
+      t->run[k].len = len;
+      t->run[k].attr = attr;
+      k++;
+   }
+   if (has_right)
+      t->run[k++] = right;
+
+   for (j=i ? i : 1; j <= k && j < t->runs; )
+   {
+      r = &t->run[j - 1];
+      if (r->attr == r[1].attr && (ULONG)(r->start + r->len) == r[1].start)
       {
-	 frame[num].upper_left       = 0;
-	 frame[num].upper_right      = 0;
-	 frame[num].lower_left       = 0;
-	 frame[num].lower_right      = 0;
-	 frame[num].left_frame       = 0;
-	 frame[num].right_frame      = 0;
-	 frame[num].vertical_frame   = 0;
-	 frame[num].horizontal_frame = 0;
-	 frame[num].up_char          = 0;
-	 frame[num].down_char        = 0;
+	 r->len += r[1].len;
+	 memmove(&r[1], &r[2], (t->runs - j - 1) * sizeof(CWRUN));
+	 t->runs--;
+	 k--;
       }
-      if (scroll_barPresent)
-	frame[num].scroll_frame     = 179 | A_ALTCHARSET;
       else
-	 frame[num].scroll_frame     = 0;
+	 j++;
    }
-#endif
+   return 0;
+}
 
-   if (hcolor)
-      frame[num].header_color = hcolor;
-   if (bcolor)
-      frame[num].border_color = bcolor;
-   if (fcolor)
-      frame[num].fill_color = fcolor;
-   if (tcolor)
-      frame[num].text_color = tcolor;
+// O(1) per line, the text and run buffers are kept for reuse
 
-   frame[num].owner = 1;
+static inline void clear_line(CWTEXT *t)
+{
+   t->len = 0;
+   t->runs = 0;
+   if (t->size)
+      t->text[0] = '\0';
+}
 
-#if LINUX_UTIL
-   pthread_mutex_init(&frame[num].mutex, NULL);
-#endif
+static ULONG line_copy(ULONG num, CWTEXT *t, const CWTEXT *from)
+{
+   if ((from->len && line_reserve(num, t, from->len)) ||
+       line_runs(num, t, from->runs))
+      return -1;
 
-   return num;
+   if (t->size)
+      memcpy(t->text, from->text, from->len + 1);
+   t->len = from->len;
+   if (from->runs)
+      memcpy(t->run, from->run, from->runs * sizeof(CWRUN));
+   t->runs = from->runs;
+   return 0;
+}
 
+// the buffer a writer fills, called with store_mutex held.  keep
+// brings it up to date with the line as last written, a writer which
+// replaces the whole line does not need the old contents.
+
+static CWTEXT *line_back(ULONG num, ULONG line, int keep)
+{
+   ULONG s, last;
+   CWTEXT *t;
+
+   for (;;)
+   {
+      s = line_state(num, line);
+      t = line_buffer(num, line, LINE_BACK(s));
+      if (!(s & LINE_BEHIND))
+	 return t;
+
+      // only this writer sets LINE_FRESH, so the last line written is
+      // ready while it is set and front after it was drawn
+      last = (s & LINE_FRESH) ? LINE_READY(s) : LINE_FRONT(s);
+      if (keep && line_copy(num, t, line_buffer(num, line, last)))
+	 return NULL;
+      if (line_swap(num, line, s, s & ~LINE_BEHIND))
+	 return t;
+   }
 }
 
-ULONG menu_write_string(ULONG num, BYTE *p, ULONG row, ULONG col, ULONG attr)
+// hand the back buffer of a line to the drawing side, called with
+// store_mutex held
+
+static void line_publish(ULONG num, ULONG line)
 {
+   ULONG s;
 
-   if (!frame[num].active)
-      return -1;
+   do
+   {
+      s = line_state(num, line);
+   } while (!line_swap(num, line, s,
+		       LINE_STATE(LINE_FRONT(s), LINE_READY(s), LINE_BACK(s)) |
+		       LINE_FRESH | LINE_BEHIND));
+}
 
-   put_string(frame[num].screen,
-	        (const char *)p, NULL,
-		frame[num].start_row + 1 + row,
-		frame[num].start_column + 1 + col,
-		attr);
+// lines written in the open update, a bit per line
 
-   return 0;
+#define BATCH_BITS            (sizeof(ULONG) * 8)
 
+static inline void batch_mark(ULONG num, ULONG line)
+{
+   frame[num].batch_map[line / BATCH_BITS] |= 1UL << (line % BATCH_BITS);
 }
 
-void scroll_portal(ULONG num, ULONG up)
+static inline void batch_unmark(ULONG num, ULONG line)
 {
+   frame[num].batch_map[line / BATCH_BITS] &= ~(1UL << (line % BATCH_BITS));
+}
 
-    ULONG row, col;
+static inline int batch_marked(ULONG num, ULONG line)
+{
+   return (frame[num].batch_map[line / BATCH_BITS] >>
+	   (line % BATCH_BITS)) & 1;
+}
 
-    if (strlen((const char *)frame[num].header) ||
-        strlen((const char *)frame[num].subheader))
-    {
-       row = frame[num].start_row + 3;
-       if (strlen((const char *)frame[num].subheader))
-	  row++;
-    }
-    else
-       row = frame[num].start_row + 1;
+// a line has been written.  Inside an update it is only noted and
+// published with the rest of the update.
 
-    if (frame[num].scroll_frame)
-       col = frame[num].start_column + 3;
-    else
-       col = frame[num].start_column + 1;
+static void line_done(ULONG num, ULONG line)
+{
+   if (!store_held(num))
+   {
+      line_publish(num, line);
+      return;
+   }
+   batch_mark(num, line);
+   if (line < frame[num].batch_first)
+      frame[num].batch_first = line;
+   if (line + 1 > frame[num].batch_last)
+      frame[num].batch_last = line + 1;
+}
 
-    scroll_display(frame[num].screen,
-		  row,
-		  col,
-		  frame[num].end_row - row,
-		  frame[num].end_column - col,
-		  up);
-    return;
+// a write which could not be finished after line_back, called with
+// store_mutex held.  The back buffer may hold part of the write, so it
+// is marked behind to be brought up to date by the next writer, and an
+// open update does not publish the line.
+
+static void line_abandon(ULONG num, ULONG line)
+{
+   ULONG s;
 
+   do
+   {
+      s = line_state(num, line);
+   } while (!line_swap(num, line, s, s | LINE_BEHIND));
+   if (store_held(num))
+      batch_unmark(num, line);
 }
 
-void enable_portal_focus(ULONG num, ULONG interval)
+// the end of a write, called with store_mutex held.  Lines added by
+// an update are counted in el_limit when it is committed.
+
+static void end_write(ULONG num, ULONG row)
 {
-    frame[num].enable_focus = 1;
-    frame[num].focus_interval = interval;
-    return;
+   if (store_held(num))
+   {
+      if (row + 1 > frame[num].batch_last)
+	 frame[num].batch_last = row + 1;
+   }
+   else if ((row + 1) > frame[num].el_limit)
+      frame[num].el_limit = (row + 1);
+   unlock_store(num);
+}
+
+// empty a line, called with store_mutex held.  Lines which are
+// already empty are left alone.
+
+static void line_clear(ULONG num, ULONG line)
+{
+   ULONG s = line_state(num, line);
+   const CWTEXT *last;
+   CWTEXT *t;
+
+   last = line_buffer(num, line,
+		      (s & LINE_FRESH) ? LINE_READY(s) : LINE_FRONT(s));
+   if (!last->len && !last->runs)
+      return;
+
+   t = line_back(num, line, 0);
+   clear_line(t);
+   line_done(num, line);
+}
+
+// the buffer a line is drawn from, called with the frame mutex held
+
+static inline CWTEXT *line_front(ULONG num, ULONG line)
+{
+   return line_buffer(num, line, LINE_FRONT(line_state(num, line)));
+}
+
+// swap in a line written since it was last drawn and drop its
+// decoded copy
+
+static void line_pull(ULONG num, ULONG line)
+{
+   ULONG s;
+
+   for (;;)
+   {
+      s = line_state(num, line);
+      if (!(s & LINE_FRESH))
+	 return;
+      if (line_swap(num, line, s,
+		    LINE_STATE(LINE_READY(s), LINE_BACK(s), LINE_FRONT(s)) |
+		    (s & LINE_BEHIND)))
+	 break;
+   }
+   frame[num].el_strings[line] = line_buffer(num, line, LINE_READY(s))->text;
+#if (LINUX_UTIL)
+   stale_line(num, line);
+#endif
+}
+
+// bring lines first..first+count up to date before drawing them,
+// called with the frame mutex held.  An update publishes its lines
+// while el_seq is odd, and the lines are pulled again if one was
+// published meanwhile, so an update is drawn whole or not at all.
+
+static void pull_lines(ULONG num, ULONG first, ULONG count)
+{
+   ULONG i, seq;
+
+   if (first >= frame[num].el_count)
+      return;
+   if (count > frame[num].el_count - first)
+      count = frame[num].el_count - first;
+
+#if (LINUX_UTIL)
+   do
+   {
+      while ((seq = __atomic_load_n(&frame[num].el_seq, __ATOMIC_ACQUIRE)) & 1)
+	 sched_yield();
+      for (i=first; i < first + count; i++)
+	 line_pull(num, i);
+   } while (__atomic_load_n(&frame[num].el_seq, __ATOMIC_ACQUIRE) != seq);
+#else
+   for (i=first; i < first + count; i++)
+      line_pull(num, i);
+#endif
 }
 
-void disable_portal_focus(ULONG num)
-{
-    frame[num].enable_focus = 0;
-    frame[num].focus_interval = 0;
-    return;
+// attributes of a line one per cell for the draw routines, NULL if
+// the whole line uses the portal text attribute
+
+static ULONG *line_attrs(ULONG num, const CWTEXT *t)
+{
+   ULONG *x = frame[num].el_scratch;
+   ULONG i, j;
+
+   if (!t->runs || !x)
+      return NULL;
+
+   set_data_b((BYTE *)x, 0, frame[num].screen->ncols * sizeof(ULONG));
+   for (i=0; i < t->runs; i++)
+      for (j=0; j < t->run[i].len; j++)
+	 x[t->run[i].start + j] = t->run[i].attr;
+   return x;
+}
+
+// draw a portal line.  Attribute runs are expanded into el_scratch,
+// and in unicode mode each line is decoded once and
+// the characters are kept in el_lines until the line is written
+// again, lines found to be plain ASCII take the single byte path.
+
+static void put_portal_line(ULONG num, ULONG line, ULONG row, ULONG col,
+			    ULONG attr, ULONG len)
+{
+   NWSCREEN *screen = frame[num].screen;
+   const CWTEXT *t = line_front(num, line);
+   const char *s = (const char *)t->text;
+   const ULONG *xattr_array = line_attrs(num, t);
+#if (LINUX_UTIL)
+   CWLINE *l;
+   CWGLYPH *g;
+   ULONG i;
+
+   if (!unicode_mode || text_mode)
+   {
+      put_bytes_to_length(screen, s, NULL, xattr_array, row, col, attr, len);
+      return;
+   }
+
+   if (!frame[num].el_lines)
+   {
+      frame[num].el_lines = (CWLINE *)calloc(frame[num].el_count,
+					     sizeof(CWLINE));
+      if (!frame[num].el_lines)
+      {
+	 put_line_to_length(screen, s, NULL, xattr_array, row, col, attr,
+			    len);
+	 return;
+      }
+      add_frame_memory(num, frame[num].el_count * sizeof(CWLINE));
+   }
+
+   l = &frame[num].el_lines[line];
+   if (l->state == CWLINE_STALE)
+   {
+      l->state = CWLINE_ASCII;
+      if (!utf8_ascii(s, t->len))
+      {
+	 if (l->size < screen->ncols)
+	 {
+	    g = (CWGLYPH *)realloc(l->glyph, screen->ncols * sizeof(CWGLYPH));
+	    if (!g)
+	    {
+	       l->state = CWLINE_STALE;
+	       put_line_to_length(screen, s, NULL, xattr_array, row, col,
+				  attr, len);
+	       return;
+	    }
+	    add_frame_memory(num, (screen->ncols - l->size) * sizeof(CWGLYPH));
+	    l->glyph = g;
+	    l->size = screen->ncols;
+	 }
+	 l->count = utf8_layout(s, l->glyph, screen->ncols, NULL);
+	 l->state = CWLINE_UTF8;
+
+	 // the cells past the end of the text are laid out as blanks
+	 // so their attributes stay indexed by byte offset
+	 for (i=t->len;
+	      i < line_cells(num) && l->count < l->size; i++)
+	 {
+	    g = &l->glyph[l->count++];
+	    g->cp = ' ';
+	    g->width = 1;
+	    g->offset = i;
+	 }
+      }
+   }
+
+   if (l->state == CWLINE_UTF8)
+   {
+      if (lock_rows(screen, row, row))
+	 return;
+      cw_stats.cells_written += put_glyphs(screen, l->glyph, l->count,
+					   NULL, xattr_array, row, col,
+					   attr, len, PUT_PAD | PUT_BAR);
+      unlock_rows(screen, row, row);
+      return;
+   }
+#endif
+   put_bytes_to_length(screen, s, NULL, xattr_array, row, col, attr, len);
 }
 
-void set_portal_focus(ULONG num)
-{
-    if (frame[num].enable_focus)
-    {
-       frame[num].focus = 1;
-       frame[num].sleep_count = 0;
-    }
-    return;
-}
+// draw line of a portal at row, when the line is already there only
+// its attributes are changed
 
-void clear_portal_focus(ULONG num)
+static void put_portal_bar(ULONG num, ULONG line, ULONG row, ULONG col,
+			   ULONG width, ULONG attr)
 {
-    if (frame[num].enable_focus)
-    {
-       frame[num].focus = 0;
-       frame[num].sleep_count = 0;
-    }
-    return;
-}
+   const CWTEXT *t = line_front(num, line);
 
-int get_sleep_count(ULONG num)
-{
-    if (frame[num].enable_focus)
-    {
-       if (frame[num].focus_interval == -1)
-          return 1;
+   if (!recolor_bar(frame[num].screen, frame[num].scroll_frame,
+		    (const char *)t->text, t->len, NULL,
+		    line_attrs(num, t), row, col, attr,
+		    frame[num].scroll_frame ? width - 2 : width))
+      return;
 
-       frame[num].sleep_count++;
-       if (frame[num].sleep_count > frame[num].focus_interval)
-       {
-          frame[num].sleep_count = 0;
-          return 0;
-       }
-       return 1;
-    }
-    return -1;
+   if (frame[num].scroll_frame)
+   {
+      put_char(frame[num].screen, ' ', row, col, attr);
+      put_char(frame[num].screen, frame[num].scroll_frame, row, col + 1,
+	       attr);
+      put_portal_line(num, line, row, col + 2, attr, width - 2);
+   }
+   else
+      put_portal_line(num, line, row, col, attr, width);
 }
 
-int get_portal_focus(ULONG num)
+// draw the lines of a portal window from top, the scroll arrows are
+// drawn with the bar
+
+static void put_portal_window(ULONG num, ULONG row, ULONG col, ULONG width)
 {
-    if (frame[num].enable_focus)
-    {
-      return frame[num].focus;
-    }
-    return -1;
+   ULONG i;
+
+   pull_lines(num, frame[num].top, frame[num].window_size);
+   for (i=0; i < frame[num].window_size; i++)
+   {
+      if (frame[num].top + i < frame[num].el_limit &&
+	  frame[num].el_strings[frame[num].top + i])
+	 put_portal_bar(num, frame[num].top + i, row + i, col, width,
+			((long)i == frame[num].index && frame[num].focus)
+			? bar_attribute
+			: frame[num].fill_color | frame[num].text_color);
+   }
 }
 
 ULONG get_portal_resp(ULONG num)
 {
-    ULONG key, row, col, width;
-    ULONG i;
+    ULONG key, row, col, width, top;
     ULONG retCode;
 
 #if LINUX_UTIL
-    if (pthread_mutex_lock(&frame[num].mutex))
+    if (lock_frame(num))
        return -1;
 #endif
 
@@ -3316,36 +5330,8 @@ ULONG get_portal_resp(ULONG num)
     for (;;)
     {
        if (frame[num].el_strings[frame[num].choice])
-       {
-	  if (frame[num].scroll_frame)
-	  {
-	     put_char(frame[num].screen,
-		    ' ',
-		    row + frame[num].index, col,
-		    bar_attribute);
-
-	     put_char(frame[num].screen,
-		    frame[num].scroll_frame,
-		    row + frame[num].index, col + 1,
-		    bar_attribute);
-
-	     put_string_to_length(frame[num].screen,
-		    (const char *)
-	            frame[num].el_strings[frame[num].choice],
-	            frame[num].el_attr[frame[num].choice],
-		    row + frame[num].index, col + 2,
-		    bar_attribute, width - 2);
-	  }
-	  else
-	  {
-	     put_string_to_length(frame[num].screen,
-		    (const char *)
-	            frame[num].el_strings[frame[num].choice],
-	            frame[num].el_attr[frame[num].choice],
-		    row + frame[num].index, col,
-		    bar_attribute, width);
-	  }
-       }
+	  put_portal_bar(num, frame[num].choice, row + frame[num].index, col,
+			 width, bar_attribute);
 
        if (frame[num].el_limit > frame[num].window_size &&
            frame[num].top)
@@ -3390,12 +5376,13 @@ ULONG get_portal_resp(ULONG num)
 #if LINUX_UTIL
        pthread_mutex_unlock(&frame[num].mutex);
 #endif
+       focus_frame = num;
        key = get_key();
 
        set_portal_focus(num);
 
 #if LINUX_UTIL
-       if (pthread_mutex_lock(&frame[num].mutex))
+       if (lock_frame(num))
        {
           clear_portal_focus(num);
           return -1;
@@ -3405,40 +5392,8 @@ ULONG get_portal_resp(ULONG num)
 	  continue;
 
        if (frame[num].el_strings[frame[num].choice])
-       {
-	  if (frame[num].scroll_frame)
-	  {
-	     put_char(frame[num].screen,
-		    ' ',
-		    row + frame[num].index, col,
-		    frame[num].fill_color |
-		    frame[num].text_color);
-
-	     put_char(frame[num].screen,
-		    frame[num].scroll_frame,
-		    row + frame[num].index, col + 1,
-		    frame[num].fill_color |
-		    frame[num].text_color);
-
-	     put_string_to_length(frame[num].screen,
-		    (const char *)
-		    frame[num].el_strings[frame[num].choice],
-	            frame[num].el_attr[frame[num].choice],
-		    row + frame[num].index, col + 2,
-		    frame[num].fill_color |
-		    frame[num].text_color, width - 2);
-	  }
-	  else
-	  {
-	     put_string_to_length(frame[num].screen,
-		    (const char *)
-		    frame[num].el_strings[frame[num].choice],
-	            frame[num].el_attr[frame[num].choice],
-		    row + frame[num].index, col,
-		    frame[num].fill_color |
-		    frame[num].text_color, width);
-	  }
-       }
+	  put_portal_bar(num, frame[num].choice, row + frame[num].index, col,
+			 width, frame[num].fill_color | frame[num].text_color);
 
        if (frame[num].el_limit > frame[num].window_size &&
            frame[num].top)
@@ -3480,6 +5435,15 @@ ULONG get_portal_resp(ULONG num)
 				     col));
        }
 
+       top = frame[num].top;
+       if (fold_nav_keys(num, key, frame[num].el_limit))
+       {
+	  if (frame[num].top != (long)top)
+	     put_portal_window(num, row, col, width);
+	  frame[num].selected = 1;
+	  continue;
+       }
+
        switch (key)
        {
 #if (LINUX_UTIL)
@@ -3516,502 +5480,39 @@ ULONG get_portal_resp(ULONG num)
 	     };
 
 	  case PG_UP:
-	     for (i=0; i < frame[num].window_size - 1; i++)
-	     {
-		frame[num].choice--;
-		frame[num].index--;
-
-		if (frame[num].index < 0)
-		{
-		   frame[num].index = 0;
-		   if (frame[num].choice >= 0)
-		   {
-		      if (frame[num].top)
-			 frame[num].top--;
-		      frame[num].bottom = frame[num].top +
-                                               frame[num].window_size;
-		   }
-		}
-		if (frame[num].choice < 0)
-		   frame[num].choice = 0;
-	     }
-
-             for (i=0; i < frame[num].window_size; i++)
-             {
-               if (i < frame[num].el_limit)
-               {
-	          if (frame[num].el_strings[frame[num].top + i])
-	          {
-	             if (frame[num].scroll_frame)
-                     {
-			put_char(frame[num].screen,
-			    ' ',
-			    row + i, col,
-			    ((row + i == row + frame[num].index) &&
-                             frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color);
-
-			put_char(frame[num].screen,
-			    frame[num].scroll_frame,
-			    row + i, col + 1,
-			    ((row + i == row + frame[num].index) &&
-                             frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color);
-
-			put_string_to_length(frame[num].screen,
-			    (const char *)
-			    frame[num].el_strings[frame[num].top + i],
-			    frame[num].el_attr[frame[num].top + i],
-			    row + i, col + 2,
-			    ((row + i == row + frame[num].index) &&
-                             frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color,
-			    width - 2);
-                     }
-	             else
-		     {
-			put_string_to_length(frame[num].screen,
-			    (const char *)
-			    frame[num].el_strings[frame[num].top + i],
-			    frame[num].el_attr[frame[num].top + i],
-			    row + i,
-			    col,
-			    ((row + i == row + frame[num].index) &&
-                             frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color,
-			    width);
-	             }
-	          }
-               }
-            }
-
-            if (frame[num].el_limit > frame[num].window_size &&
-	       frame[num].top)
-            {
-	       put_char(frame[num].screen,
-		  frame[num].up_char,
-		  row,
-		  col,
-		  get_char_attribute(frame[num].screen, row, col));
-            }
-            else
-            {
-	      put_char(frame[num].screen,
-		  ' ',
-		  row,
-		  col,
-		  get_char_attribute(frame[num].screen, row, col));
-            }
-
-            if ((frame[num].el_limit > frame[num].window_size) &&
-               (frame[num].bottom < (long)(frame[num].el_limit)))
-            {
-	       put_char(frame[num].screen,
-		  frame[num].down_char,
-		  row + frame[num].window_size - 1,
-		  col,
-		  get_char_attribute(frame[num].screen,
-				     row + frame[num].window_size - 1,
-				     col));
-            }
-            else
-            {
-	       put_char(frame[num].screen,
-		  ' ',
-		  row + frame[num].window_size - 1,
-		  col,
-		  get_char_attribute(frame[num].screen,
-				     row + frame[num].window_size - 1,
-				     col));
-             }
-
-             frame[num].selected = 1;
-             break;
-
-	  case PG_DOWN:
-	     for (i=0; i < frame[num].window_size - 1; i++)
-	     {
-		if (frame[num].choice >=
-                    (long)frame[num].el_limit)
-		   break;
-
-		frame[num].choice++;
-		frame[num].index++;
-
-		if (frame[num].index >= (long)frame[num].el_limit)
-		   frame[num].index--;
-
-		if (frame[num].index >= (long)frame[num].window_size)
-		{
-		   frame[num].index--;
-		   if (frame[num].choice <
-                      (long)frame[num].el_limit)
-		   {
-		      frame[num].top++;
-		      frame[num].bottom = frame[num].top +
-                                               frame[num].window_size;
-		   }
-		}
-		if (frame[num].choice >=
-                   (long)frame[num].el_limit)
-		   frame[num].choice--;
-	     }
-
-             for (i=0; i < frame[num].window_size; i++)
-             {
-               if (i < frame[num].el_limit)
-               {
-	          if (frame[num].el_strings[frame[num].top + i])
-	          {
-	             if (frame[num].scroll_frame)
-                     {
-			put_char(frame[num].screen,
-			    ' ',
-			    row + i, col,
-			    ((row + i == row + frame[num].index) &&
-                            frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color);
-
-			put_char(frame[num].screen,
-			    frame[num].scroll_frame,
-			    row + i, col + 1,
-			    ((row + i == row + frame[num].index) &&
-                            frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color);
-
-			put_string_to_length(frame[num].screen,
-			    (const char *)
-			    frame[num].el_strings[frame[num].top + i],
-			    frame[num].el_attr[frame[num].top + i],
-			    row + i, col + 2,
-			    ((row + i == row + frame[num].index) &&
-                            frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color, width - 2);
-                     }
-	             else
-		     {
-			put_string_to_length(frame[num].screen,
-			    (const char *)
-			    frame[num].el_strings[frame[num].top + i],
-			    frame[num].el_attr[frame[num].top + i],
-			    row + i, col,
-			    ((row + i == row + frame[num].index) &&
-                            frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color, width);
-		     }
-	          }
-               }
-            }
-
-            if (frame[num].el_limit > frame[num].window_size &&
-	       frame[num].top)
-            {
-	       put_char(frame[num].screen,
-		  frame[num].up_char,
-		  row,
-		  col,
-		  get_char_attribute(frame[num].screen, row, col));
-            }
-            else
-            {
-	      put_char(frame[num].screen,
-		  ' ',
-		  row,
-		  col,
-		  get_char_attribute(frame[num].screen, row, col));
-            }
-
-            if ((frame[num].el_limit > frame[num].window_size) &&
-               (frame[num].bottom < (long)(frame[num].el_limit)))
-            {
-	       put_char(frame[num].screen,
-		  frame[num].down_char,
-		  row + frame[num].window_size - 1,
-		  col,
-		  get_char_attribute(frame[num].screen,
-				     row + frame[num].window_size - 1,
-				     col));
-            }
-            else
-            {
-	       put_char(frame[num].screen,
-		  ' ',
-		  row + frame[num].window_size - 1,
-		  col,
-		  get_char_attribute(frame[num].screen,
-				     row + frame[num].window_size - 1,
-				     col));
-             }
-
-             frame[num].selected = 1;
-             break;
-#if LINUX_UTIL
-	  case VT220_HOME:
-#endif
-	  case HOME:
-             frame[num].choice = 0;
-             frame[num].index = 0;
-             frame[num].top = 0;
-             frame[num].bottom = frame[num].top +
-                                      frame[num].window_size;
-	     for (i=0; i < frame[num].window_size; i++)
-	     {
-		if (frame[num].choice >=
-		    (long)frame[num].el_limit)
-		   break;
-
-		if (frame[num].el_strings[frame[num].choice])
-		{
-		   if (frame[num].scroll_frame)
-		   {
-		      put_char(frame[num].screen,
-			     ' ',
-			     row + frame[num].index, col,
-			     frame[num].fill_color |
-			     frame[num].text_color);
-
-		      put_char(frame[num].screen,
-			     frame[num].scroll_frame,
-			     row + frame[num].index, col + 1,
-			     frame[num].fill_color |
-			     frame[num].text_color);
-
-		      put_string_to_length(frame[num].screen,
-			     (const char *)
-		             frame[num].el_strings[frame[num].choice],
-		             frame[num].el_attr[frame[num].choice],
-			     row + frame[num].index, col + 2,
-			     frame[num].fill_color |
-			     frame[num].text_color, width - 2);
-		   }
-		   else
-		   {
-		      put_string_to_length(frame[num].screen,
-			     (const char *)
-		             frame[num].el_strings[frame[num].choice],
-		             frame[num].el_attr[frame[num].choice],
-			     row + frame[num].index, col,
-			     frame[num].fill_color |
-			     frame[num].text_color, width);
-		   }
-		}
-
-		frame[num].choice++;
-		frame[num].index++;
-
-		if (frame[num].index >= (long)frame[num].el_limit)
-		   frame[num].index--;
-
-		if (frame[num].index >= (long)frame[num].window_size)
-		{
-		   frame[num].index--;
-		}
-
-		if (frame[num].choice >=
-		    (long)frame[num].el_limit)
-		   frame[num].choice--;
-	     }
-             frame[num].choice = 0;
-             frame[num].index = 0;
-             frame[num].top = 0;
-             frame[num].bottom = frame[num].top +
-                                      frame[num].window_size;
-             frame[num].selected = 1;
-             break;
-
-#if LINUX_UTIL
-	  case VT220_END:
-#endif
-	  case END:
-	     if (frame[num].el_limit)
-             {
-	        frame[num].choice = frame[num].el_limit - 1;
-	        frame[num].index = frame[num].window_size - 1;
-	        frame[num].top = frame[num].el_limit -
-	                              frame[num].window_size;
-                frame[num].bottom = frame[num].top +
-                                      frame[num].window_size;
-             }
-             else
-             {
-                frame[num].choice = 0;
-                frame[num].index = 0;
-                frame[num].top = 0;
-                frame[num].bottom = frame[num].top +
-                                         frame[num].window_size;
-             }
-
-	     for (i=0; i < frame[num].window_size; i++)
-	     {
-		if (frame[num].choice >=
-		    (long)frame[num].el_limit)
-		   break;
-
-		if (frame[num].el_strings[frame[num].choice])
-		{
-		   if (frame[num].scroll_frame)
-		   {
-		      put_char(frame[num].screen,
-			     ' ',
-			     row + frame[num].index, col,
-			     frame[num].fill_color |
-			     frame[num].text_color);
-
-		      put_char(frame[num].screen,
-			     frame[num].scroll_frame,
-			     row + frame[num].index, col + 1,
-			     frame[num].fill_color |
-			     frame[num].text_color);
-
-		      put_string_to_length(frame[num].screen,
-			     (const char *)
-		             frame[num].el_strings[frame[num].choice],
-	                     frame[num].el_attr[frame[num].choice],
-			     row + frame[num].index, col + 2,
-			     frame[num].fill_color |
-			     frame[num].text_color, width - 2);
-		   }
-		   else
-		   {
-		      put_string_to_length(frame[num].screen,
-			     (const char *)
-		             frame[num].el_strings[frame[num].choice],
-		             frame[num].el_attr[frame[num].choice],
-			     row + frame[num].index, col,
-			     frame[num].fill_color |
-			     frame[num].text_color, width);
-		   }
-		}
-
-		frame[num].choice++;
-		frame[num].index++;
-
-		if (frame[num].index >= (long)frame[num].el_limit)
-		   frame[num].index--;
-
-		if (frame[num].index >= (long)frame[num].window_size)
-		{
-		   frame[num].index--;
-		}
-
-		if (frame[num].choice >=
-		    (long)frame[num].el_limit)
-		   frame[num].choice--;
-	     }
-
-
-             for (i=0; i < frame[num].window_size; i++)
-             {
-               if (i < frame[num].el_limit)
-               {
-	          if (frame[num].el_strings[frame[num].top + i])
-	          {
-	             if (frame[num].scroll_frame)
-                     {
-			put_char(frame[num].screen,
-			    ' ',
-			    row + i, col,
-			    ((row + i == row + frame[num].index) &&
-                            frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color);
-
-			put_char(frame[num].screen,
-			    frame[num].scroll_frame,
-			    row + i, col + 1,
-			    ((row + i == row + frame[num].index) &&
-                            frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color);
-
-			put_string_to_length(frame[num].screen,
-			    (const char *)
-			    frame[num].el_strings[frame[num].top + i],
-			    frame[num].el_attr[frame[num].top + i],
-			    row + i, col + 2,
-			    ((row + i == row + frame[num].index) &&
-                            frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color, width - 2);
-                     }
-	             else
-		     {
-			put_string_to_length(frame[num].screen,
-			    (const char *)
-			    frame[num].el_strings[frame[num].top + i],
-			    frame[num].el_attr[frame[num].top + i],
-			    row + i, col,
-			    ((row + i == row + frame[num].index) &&
-                            frame[num].focus)
-			    ? bar_attribute
-			    : frame[num].fill_color |
-			    frame[num].text_color, width);
-		     }
-	          }
-               }
-            }
+	     set_choice(num, frame[num].choice -
+			(long)frame[num].window_size + 1,
+			frame[num].el_limit);
+	     put_portal_window(num, row, col, width);
+	     frame[num].selected = 1;
+	     break;
 
-            if (frame[num].el_limit > frame[num].window_size &&
-	       frame[num].top)
-            {
-	       put_char(frame[num].screen,
-		  frame[num].up_char,
-		  row,
-		  col,
-		  get_char_attribute(frame[num].screen, row, col));
-            }
-            else
-            {
-	      put_char(frame[num].screen,
-		  ' ',
-		  row,
-		  col,
-		  get_char_attribute(frame[num].screen, row, col));
-            }
+	  case PG_DOWN:
+	     set_choice(num, frame[num].choice +
+			(long)frame[num].window_size - 1,
+			frame[num].el_limit);
+	     put_portal_window(num, row, col, width);
+	     frame[num].selected = 1;
+	     break;
 
-            if ((frame[num].el_limit > frame[num].window_size) &&
-               (frame[num].bottom < (long)(frame[num].el_limit)))
-            {
-	       put_char(frame[num].screen,
-		  frame[num].down_char,
-		  row + frame[num].window_size - 1,
-		  col,
-		  get_char_attribute(frame[num].screen,
-				     row + frame[num].window_size - 1,
-				     col));
-            }
-            else
-            {
-	       put_char(frame[num].screen,
-		  ' ',
-		  row + frame[num].window_size - 1,
-		  col,
-		  get_char_attribute(frame[num].screen,
-				     row + frame[num].window_size - 1,
-				     col));
-             }
+#if LINUX_UTIL
+	  case VT220_HOME:
+#endif
+	  case HOME:
+	     set_choice(num, 0, frame[num].el_limit);
+	     put_portal_window(num, row, col, width);
+	     frame[num].selected = 1;
+	     break;
 
-             frame[num].selected = 1;
-             break;
+#if LINUX_UTIL
+	  case VT220_END:
+#endif
+	  case END:
+	     set_choice(num, (long)frame[num].el_limit - 1,
+			frame[num].el_limit);
+	     put_portal_window(num, row, col, width);
+	     frame[num].selected = 1;
+	     break;
 
 	  case BKSP:
 	  case UP_ARROW:
@@ -4070,7 +5571,7 @@ ULONG get_portal_resp(ULONG num)
 		retCode = (frame[num].el_func)
 			(frame[num].screen,
 			 frame[num].el_values[frame[num].choice],
-			 frame[num].el_strings[frame[num].choice],
+			 line_front(num, frame[num].choice)->text,
 			 frame[num].choice);
 		if (retCode)
                    goto UnlockMutex;
@@ -4115,7 +5616,13 @@ ULONG free_portal(ULONG num)
    FIELD_LIST *fl;
 
 #if (LINUX_UTIL)
+   // stop any stream or refresh provider before the portal goes, once
+   // these return neither will touch the frame again
+   detach_portal_stream(num);
+   unregister_portal_refresh(num);
+
    pthread_mutex_destroy(&frame[num].mutex);
+   pthread_mutex_destroy(&frame[num].store_mutex);
 #endif
 
    frame[num].cur_row = 0;
@@ -4131,6 +5638,9 @@ ULONG free_portal(ULONG num)
    frame[num].el_func = 0;
    frame[num].warn_func = 0;
    frame[num].owner = 0;
+#if (LINUX_UTIL)
+   visibility_changed();
+#endif
 
    while (frame[num].head)
    {
@@ -4140,6 +5650,10 @@ ULONG free_portal(ULONG num)
    }
    frame[num].head = frame[num].tail = 0;
    frame[num].field_count = 0;
+   if (frame[num].field_index)
+      free(frame[num].field_index);
+   frame[num].field_index = NULL;
+   frame[num].field_index_size = 0;
 
    return 0;
 
@@ -4158,7 +5672,7 @@ ULONG add_item_to_portal(ULONG num, BYTE **list, BYTE *item, ULONG index)
 
 ULONG display_portal_header(ULONG num)
 {
-   ULONG col, len, i, adjust;
+   ULONG col, len, adjust;
 
    if (!frame[num].header[0])
       return -1;
@@ -4179,14 +5693,10 @@ ULONG display_portal_header(ULONG num)
       col = col + len;
    }
 
-   for (i=0; i < frame[num].end_column - frame[num].start_column; i++)
-   {
-      put_char(frame[num].screen,
-		 frame[num].horizontal_frame,
-		 frame[num].start_row + adjust,
-		 frame[num].start_column + i,
-		 frame[num].border_color);
-   }
+   put_char_length(frame[num].screen, frame[num].horizontal_frame,
+		   frame[num].start_row + adjust, frame[num].start_column,
+		   frame[num].border_color,
+		   frame[num].end_column - frame[num].start_column);
 
    put_char(frame[num].screen,
 	      frame[num].left_frame,
@@ -4237,20 +5747,16 @@ ULONG draw_portal_border(ULONG num)
 #endif
    }
 
-   for (i=frame[num].start_column + 1; i < frame[num].end_column; i++)
-   {
 #if (WINDOWS_NT_UTIL | LINUX_UTIL | DOS_UTIL)
-      put_char(frame[num].screen, frame[num].horizontal_frame,
-	       frame[num].start_row,
-	       i,
-	       frame[num].border_color);
-
-      put_char(frame[num].screen, frame[num].horizontal_frame,
-	       frame[num].end_row,
-	       i,
-	       frame[num].border_color);
+   put_char_length(frame[num].screen, frame[num].horizontal_frame,
+		   frame[num].start_row, frame[num].start_column + 1,
+		   frame[num].border_color,
+		   frame[num].end_column - frame[num].start_column - 1);
+   put_char_length(frame[num].screen, frame[num].horizontal_frame,
+		   frame[num].end_row, frame[num].start_column + 1,
+		   frame[num].border_color,
+		   frame[num].end_column - frame[num].start_column - 1);
 #endif
-   }
 
    put_char(frame[num].screen, frame[num].upper_left,
 	    frame[num].start_row,
@@ -4293,6 +5799,9 @@ ULONG activate_portal(ULONG num)
 	 draw_portal_border(num);
 	 display_portal_header(num);
       }
+#if (LINUX_UTIL)
+      visibility_changed();
+#endif
    }
 
    display_portal(num);
@@ -4320,6 +5829,9 @@ ULONG activate_static_portal(ULONG num)
 	 draw_portal_border(num);
 	 display_portal_header(num);
       }
+#if (LINUX_UTIL)
+      visibility_changed();
+#endif
    }
    display_portal(num);
    return 0;
@@ -4329,15 +5841,89 @@ ULONG activate_static_portal(ULONG num)
 ULONG mask_portal(ULONG num)
 {
    frame[num].mask = TRUE;
+#if (LINUX_UTIL)
+   visibility_changed();
+#endif
    return 0;
 }
 
 ULONG unmask_portal(ULONG num)
 {
    frame[num].mask = 0;
+#if (LINUX_UTIL)
+   visibility_changed();
+#endif
    return 0;
 }
 
+// true while a portal is on screen and not covered by a mask or the
+// screensaver, i.e. while refreshing its contents is worth doing
+
+ULONG portal_visible(ULONG num)
+{
+   if (!num || num >= MAX_MENU)
+      return 0;
+#if (LINUX_UTIL)
+   if (screensaver)
+      return 0;
+#endif
+   return (frame[num].active && !frame[num].mask) ? 1 : 0;
+}
+
+#if (LINUX_UTIL)
+
+// producers waiting for their portal to become visible sleep here.
+// visibility_changed is called whenever a frame is shown, hidden,
+// masked or freed and when the screensaver starts or stops.
+
+pthread_mutex_t visible_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t visible_cond = PTHREAD_COND_INITIALIZER;
+
+void visibility_changed(void)
+{
+   pthread_mutex_lock(&visible_mutex);
+   pthread_cond_broadcast(&visible_cond);
+   pthread_mutex_unlock(&visible_mutex);
+
+   // let the refresh scheduler catch up portals it skipped
+   portal_refresh_catch_up();
+}
+
+// wait until the portal is visible.  timeout_ms of zero waits
+// forever.  returns 0 once visible, -1 on timeout or if the portal
+// is freed while waiting.
+
+ULONG wait_portal_visible(ULONG num, ULONG timeout_ms)
+{
+   struct timespec ts;
+   ULONG ccode;
+
+   if (!num || num >= MAX_MENU)
+      return -1;
+
+   clock_gettime(CLOCK_REALTIME, &ts);
+   ts.tv_sec += timeout_ms / 1000;
+   ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+   if (ts.tv_nsec >= 1000000000L)
+   {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+   }
+
+   pthread_mutex_lock(&visible_mutex);
+   while (frame[num].owner && !portal_visible(num))
+   {
+      if (!timeout_ms)
+	 pthread_cond_wait(&visible_cond, &visible_mutex);
+      else if (pthread_cond_timedwait(&visible_cond, &visible_mutex, &ts))
+	 break;
+   }
+   ccode = portal_visible(num) ? 0 : -1;
+   pthread_mutex_unlock(&visible_mutex);
+   return ccode;
+}
+#endif
+
 ULONG deactivate_static_portal(ULONG num)
 {
    if (!frame[num].active)
@@ -4390,15 +5976,31 @@ ULONG make_portal(NWSCREEN *screen,
    }
    set_data((ULONG *) frame[num].p, 0, screen->nlines * screen->ncols * 2);
 
-   frame[num].el_storage =
-	   (BYTE *)malloc(num_lines * screen->ncols);
-   if (!frame[num].el_storage)
+   frame[num].el_text =
+	   (CWTEXT *)malloc(num_lines * 3 * sizeof(CWTEXT));
+   if (!frame[num].el_text)
+   {
+      free_elements(num);
+      return 0;
+   }
+   set_data((ULONG *) frame[num].el_text, 0,
+	    num_lines * 3 * sizeof(CWTEXT));
+
+   frame[num].el_state =
+	   (ULONG *)malloc(num_lines * sizeof(ULONG));
+   if (!frame[num].el_state)
+   {
+      free_elements(num);
+      return 0;
+   }
+
+   frame[num].batch_map =
+	   (ULONG *)calloc(num_lines / BATCH_BITS + 1, sizeof(ULONG));
+   if (!frame[num].batch_map)
    {
       free_elements(num);
       return 0;
    }
-   set_data_b((BYTE *) frame[num].el_storage, 0x20,
-	      num_lines * screen->ncols);
 
    frame[num].el_strings =
 	   (BYTE **)malloc(num_lines * sizeof(BYTE *));
@@ -4420,38 +6022,30 @@ ULONG make_portal(NWSCREEN *screen,
    set_data((ULONG *) frame[num].el_values, 0,
 	    num_lines * sizeof(ULONG));
 
-   frame[num].el_attr_storage =
-                     (BYTE *)malloc(num_lines * screen->ncols);
-   if (!frame[num].el_attr_storage)
+   frame[num].el_scratch =
+		  (ULONG *)malloc(screen->ncols * sizeof(ULONG));
+   if (!frame[num].el_scratch)
    {
       free_elements(num);
       return 0;
    }
-   set_data_b((BYTE *) frame[num].el_attr_storage, 0,
-                       num_lines * screen->ncols);
 
-   frame[num].el_attr =
-                  (BYTE **)malloc(num_lines * sizeof(BYTE *));
-   if (!frame[num].el_attr)
-   {
-      free_elements(num);
-      return 0;
-   }
-   set_data((ULONG *) frame[num].el_attr, 0,
-                num_lines * sizeof(BYTE *));
+   frame[num].memory = (screen->nlines * screen->ncols * 2) +
+		       (screen->ncols * sizeof(ULONG)) +
+		       (num_lines * (3 * sizeof(CWTEXT) + sizeof(BYTE *) +
+				     2 * sizeof(ULONG))) +
+		       ((num_lines / BATCH_BITS + 1) * sizeof(ULONG));
 
-   for (i=0; i < num_lines; i++)
-   {
-      BYTE *p = &frame[num].el_storage[i * screen->ncols];
-      add_item_to_portal(num, frame[num].el_strings, p, i);
-      p[screen->ncols - 1] = '\0';
-   }
+   // lines are empty until written, el_strings follows the text of
+   // the buffer each line is drawn from
 
    for (i=0; i < num_lines; i++)
    {
-      BYTE *p = &frame[num].el_attr_storage[i * screen->ncols];
-      add_item_to_portal(num, frame[num].el_attr, p, i);
-      p[screen->ncols - 1] = '\0';
+      frame[num].el_text[i * 3].text = empty_line;
+      frame[num].el_text[i * 3 + 1].text = empty_line;
+      frame[num].el_text[i * 3 + 2].text = empty_line;
+      frame[num].el_state[i] = LINE_STATE(0, 1, 2);
+      add_item_to_portal(num, frame[num].el_strings, empty_line, i);
    }
 
    for (i=0; i < (HEADER_LEN - 1); i++)
@@ -4491,6 +6085,8 @@ ULONG make_portal(NWSCREEN *screen,
    frame[num].el_limit = 0;
    frame[num].head = frame[num].tail = 0;
    frame[num].field_count = 0;
+   frame[num].field_index = NULL;
+   frame[num].field_index_size = 0;
    frame[num].choice = 0;
    frame[num].index = 0;
    frame[num].top = 0;
@@ -4717,6 +6313,7 @@ ULONG make_portal(NWSCREEN *screen,
 
 #if (LINUX_UTIL)
    pthread_mutex_init(&frame[num].mutex, NULL);
+   pthread_mutex_init(&frame[num].store_mutex, NULL);
 #endif
 
    return num;
@@ -4803,41 +6400,91 @@ ULONG write_portal_subheader(ULONG num, BYTE *p, ULONG attr)
 
 ULONG write_portal_line(ULONG num, ULONG row, ULONG attr)
 {
-   ULONG i;
-   BYTE *v, *a;
+   CWTEXT *t;
+   ULONG len;
 
    if (!frame[num].owner)
       return -1;
 
-   if (row > frame[num].el_count)
+   if (row >= frame[num].el_count)
       return -1;
 
-   if (frame[num].el_strings)
+   if (frame[num].el_text)
    {
-      v = frame[num].el_strings[row];
-      if (!v)
+      lock_store(num);
+      len = line_cells(num);
+      t = line_back(num, row, 1);
+      if (!t || line_extend(num, t, len))
+      {
+	 if (t)
+	    line_abandon(num, row);
+	 unlock_store(num);
 	 return -1;
-
-      a = frame[num].el_attr[row];
-      if (!a)
+      }
+      set_data_b(t->text, (BYTE)frame[num].horizontal_frame, len);
+      if (line_attr(num, t, 0, len, attr))
+      {
+	 line_abandon(num, row);
+	 unlock_store(num);
 	 return -1;
+      }
+      line_done(num, row);
+      end_write(num, row);
+      return 0;
+   }
+   return -1;
 
-#if LINUX_UTIL
-      if (pthread_mutex_lock(&frame[num].mutex))
-         return -1;
-#endif
-      for (i=0; i < frame[num].screen->ncols; i++)
+}
+
+// store a string into a portal line.  write_portal leaves the rest of
+// the line alone, with cleol the line ends after the string and the
+// blank cells to the right take attr.
+
+static ULONG store_portal(ULONG num, const char *p, ULONG row, ULONG col,
+			  ULONG attr, int cleol)
+{
+   CWTEXT *t;
+   ULONG len;
+
+   if (!frame[num].owner)
+      return -1;
+
+   if (row >= frame[num].el_count)
+      return -1;
+
+   if (col > frame[num].screen->ncols || !*p)
+      return -1;
+
+   if (frame[num].el_text)
+   {
+      lock_store(num);
+      if (col < line_cells(num))
       {
-	 v[i] = frame[num].horizontal_frame;
-	 a[i] = (BYTE)(attr & 0xFF);
-      }
-      frame[num].el_strings[row][frame[num].screen->ncols - 1] = '\0';
-      if ((row + 1) > frame[num].el_limit)
-	 frame[num].el_limit = (row + 1);
+	 len = strlen(p);
+	 if (len > line_cells(num) - col)
+	    len = line_cells(num) - col;
 
-#if LINUX_UTIL
-      pthread_mutex_unlock(&frame[num].mutex);
-#endif
+	 t = line_back(num, row, 1);
+	 if (!t || line_extend(num, t, col + len))
+	 {
+	    if (t)
+	       line_abandon(num, row);
+	    unlock_store(num);
+	    return -1;
+	 }
+	 memcpy(&t->text[col], p, len);
+	 if (cleol)
+	    line_truncate(t, col + len);
+	 if (line_attr(num, t, col, cleol ? line_cells(num) - col : len,
+		       attr))
+	 {
+	    line_abandon(num, row);
+	    unlock_store(num);
+	    return -1;
+	 }
+	 line_done(num, row);
+      }
+      end_write(num, row);
       return 0;
    }
    return -1;
@@ -4846,184 +6493,488 @@ ULONG write_portal_line(ULONG num, ULONG row, ULONG attr)
 
 ULONG write_portal(ULONG num, const char *p, ULONG row, ULONG col, ULONG attr)
 {
+   return store_portal(num, p, row, col, attr, 0);
+}
 
-   ULONG i;
-   BYTE *v, *a;
+ULONG write_portal_char(ULONG num, BYTE p, ULONG row, ULONG col, ULONG attr)
+{
+   CWTEXT *t;
 
    if (!frame[num].owner)
       return -1;
 
-   if (attr) {};
-
-   if (row > frame[num].el_count)
+   if (row >= frame[num].el_count)
       return -1;
 
-   if (col > frame[num].screen->ncols || !*p)
+   if (col >= line_cells(num))
       return -1;
 
-   if (frame[num].el_strings)
+   if (frame[num].el_text)
    {
-#if LINUX_UTIL
-      if (pthread_mutex_lock(&frame[num].mutex))
-         return -1;
-#endif
-      v = frame[num].el_strings[row];
-      if (!v)
+      lock_store(num);
+      t = line_back(num, row, 1);
+      if (!t || line_extend(num, t, col + 1))
       {
-#if LINUX_UTIL
-         pthread_mutex_unlock(&frame[num].mutex);
-#endif
+	 if (t)
+	    line_abandon(num, row);
+	 unlock_store(num);
 	 return -1;
       }
-
-      a = frame[num].el_attr[row];
-      if (!a)
+      t->text[col] = p;
+      if (line_attr(num, t, col, 1, attr))
       {
-#if LINUX_UTIL
-         pthread_mutex_unlock(&frame[num].mutex);
-#endif
+	 line_abandon(num, row);
+	 unlock_store(num);
 	 return -1;
       }
+      line_done(num, row);
+      end_write(num, row);
+      return 0;
+   }
+   return -1;
+
+}
+
+ULONG write_portal_cleol(ULONG num, const char *p, ULONG row, ULONG col,
+			 ULONG attr)
+{
+   return store_portal(num, p, row, col, attr, 1);
+}
+
+// writes to a portal between begin_portal_update and
+// commit_portal_update are drawn together.  The update holds the
+// portal store lock, so each write inside it only fills the back
+// buffer of its line, and the commit publishes every line written
+// and the new el_limit in one step.  Updates nest within a thread.
+
+ULONG begin_portal_update(ULONG num)
+{
+   if (!frame[num].owner || !frame[num].el_text)
+      return -1;
+
+   if (store_held(num))
+   {
+      frame[num].batch++;
+      return 0;
+   }
+
+#if (LINUX_UTIL)
+   pthread_mutex_lock(&frame[num].store_mutex);
+   __atomic_store_n(&frame[num].batch_thread, (ULONG)pthread_self(),
+		    __ATOMIC_RELAXED);
+#endif
+   frame[num].batch = 1;
+   frame[num].batch_first = frame[num].el_count;
+   frame[num].batch_last = 0;
+   return 0;
+}
+
+ULONG commit_portal_update(ULONG num)
+{
+   ULONG i;
+
+   if (!frame[num].owner || !frame[num].el_text || !store_held(num))
+      return -1;
+
+   if (--frame[num].batch)
+      return 0;
+
+   // only lines marked by line_done are published, a line whose
+   // write was abandoned keeps what was last published
+#if (LINUX_UTIL)
+   __atomic_store_n(&frame[num].el_seq, frame[num].el_seq + 1,
+		    __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+#endif
+   for (i=frame[num].batch_first; i < frame[num].batch_last; i++)
+   {
+      if (batch_marked(num, i))
+      {
+	 batch_unmark(num, i);
+	 line_publish(num, i);
+      }
+   }
+   if (frame[num].batch_last > frame[num].el_limit)
+      frame[num].el_limit = frame[num].batch_last;
+#if (LINUX_UTIL)
+   __atomic_store_n(&frame[num].el_seq, frame[num].el_seq + 1,
+		    __ATOMIC_RELEASE);
+   __atomic_store_n(&frame[num].batch_thread, 0, __ATOMIC_RELAXED);
+   pthread_mutex_unlock(&frame[num].store_mutex);
+#endif
+   return 0;
+}
+
+// format a portal line in place.  f appends straight into the back
+// buffer of the line from col, and end_portal_line ends the line
+// after the text as write_portal_cleol does.  Both run inside a
+// portal update, so nothing else may write this line in between.
+
+ULONG begin_portal_line(CWFMT *f, ULONG num, ULONG row, ULONG col)
+{
+   CWTEXT *t;
+
+   fmt_init(f, NULL, 0);
+   if (!frame[num].owner || !frame[num].el_text)
+      return -1;
+
+   if (row >= frame[num].el_count || col >= line_cells(num))
+      return -1;
+
+   if (begin_portal_update(num))
+      return -1;
+
+   // the whole line is reserved so appending never moves the text
+   t = line_back(num, row, 1);
+   if (!t || line_extend(num, t, col) ||
+       line_reserve(num, t, line_cells(num)))
+   {
+      if (t)
+	 line_abandon(num, row);
+      commit_portal_update(num);
+      return -1;
+   }
+   fmt_init(f, (char *)&t->text[col], line_cells(num) - col + 1);
+   f->num = num;
+   f->row = row;
+   f->col = col;
+   return 0;
+}
+
+ULONG end_portal_line(CWFMT *f, ULONG attr)
+{
+   ULONG num = f->num, row = f->row, col = f->col;
+   CWTEXT *t;
+
+   if (!f->buf)
+      return -1;
+
+   t = line_back(num, row, 1);
+   t->len = col + f->len;
+   t->text[t->len] = '\0';
+   fmt_init(f, NULL, 0);
+   if (line_attr(num, t, col, line_cells(num) - col, attr))
+   {
+      line_abandon(num, row);
+      commit_portal_update(num);
+      return -1;
+   }
+   line_done(num, row);
+   return commit_portal_update(num);
+}
+
+// write a block of lines as one update, returns -1 if any line could
+// not be written
+
+ULONG write_portal_lines(ULONG num, const PORTAL_LINE *lines, ULONG count)
+{
+   ULONG i, ccode = 0;
+
+   if (begin_portal_update(num))
+      return -1;
 
-      for (i=0; i < frame[num].screen->ncols; i++)
+   for (i=0; i < count; i++)
+   {
+      if (lines[i].flags & PORTAL_RULE)
       {
-	 if (*p && i >= col)
-	 {
-	    v[i] = *p++;
-	    a[i] = (BYTE)(attr & 0xFF);
-	 }
-	 if (*p == '\0')
-            break;
+	 if (write_portal_line(num, lines[i].row, lines[i].attr))
+	    ccode = -1;
       }
-      frame[num].el_strings[row][frame[num].screen->ncols - 1] = '\0';
-      if ((row + 1) > frame[num].el_limit)
-	 frame[num].el_limit = (row + 1);
+      else if (!lines[i].text ||
+	       store_portal(num, lines[i].text, lines[i].row, lines[i].col,
+			    lines[i].attr, lines[i].flags & PORTAL_CLEOL))
+	 ccode = -1;
+   }
 
-#if LINUX_UTIL
-      pthread_mutex_unlock(&frame[num].mutex);
+   commit_portal_update(num);
+   return ccode;
+}
+
+#if (LINUX_UTIL)
+BYTE comment_line[256];
+ULONG comment_attr = 0;
+ULONG comment_valid = 0;
+ULONG stats_overlay_width = 0;
+#endif
+
+ULONG write_screen_comment_line(NWSCREEN *screen, const char *p, ULONG attr)
+{
+#if (LINUX_UTIL)
+    // a notification on the status row is left alone, the new text is
+    // drawn when it goes away
+    if (!note_showing || screen != &console_screen)
+#endif
+    put_string_cleol(screen, (const char *)p, NULL, screen->nlines - 1, attr);
+#if (LINUX_UTIL)
+    // remember the status text so the stats overlay can be removed
+    snprintf((char *)comment_line, sizeof(comment_line), "%s", p);
+    comment_attr = attr;
+    comment_valid = 1;
+    if (stats_overlay)
+       display_stats_overlay(1);
 #endif
-      return 0;
-   }
-   return -1;
-
+    return 0;
 }
 
-ULONG write_portal_char(ULONG num, BYTE p, ULONG row, ULONG col, ULONG attr)
+#if (LINUX_UTIL)
+
+// the stats overlay shows per second rates computed from the library
+// counters right aligned on the status row.  It is redrawn from the
+// get_key idle loop once a second and whenever the status row changes.
+
+static void display_stats_overlay(int force)
 {
-   BYTE *v, *a;
+    static LONGLONG last_ns = 0;
+    static CWSTATS last;
+    static char text[128] = "";
+    NWSCREEN *screen = &console_screen;
+    LONGLONG now, elapsed, refreshes, render, wait;
+    ULONG len;
 
-   if (!frame[num].owner)
-      return -1;
+    if (!screen->p_vidmem)
+       return;
 
-   if (attr) {};
+    now = get_ns();
+    elapsed = now - last_ns;
+    if (elapsed >= 1000000000LL || !text[0])
+    {
+       if (!last_ns)
+	  elapsed = 0;
+       refreshes = cw_stats.refreshes - last.refreshes;
+       render = cw_stats.render_ns - last.render_ns;
+       wait = (cw_stats.vidmem_wait_ns - last.vidmem_wait_ns) +
+	      (cw_stats.frame_wait_ns - last.frame_wait_ns);
+
+#define PER_SEC(f)  (elapsed ? (cw_stats.f - last.f) * 1000000000LL / elapsed : 0)
+       snprintf(text, sizeof(text),
+		" wr %lld em %lld tty %lldB rf %lld/s rnd %lldus"
+		" max %lldus lk %lld/%lldus ",
+		PER_SEC(cells_written), PER_SEC(cells_emitted),
+		PER_SEC(tty_bytes), PER_SEC(refreshes),
+		refreshes ? render / refreshes / 1000 : 0,
+		cw_stats.render_max_ns / 1000,
+		(cw_stats.vidmem_contended - last.vidmem_contended) +
+		(cw_stats.frame_contended - last.frame_contended),
+		wait / 1000);
+#undef PER_SEC
+       last = cw_stats;
+       last_ns = now;
+    }
+    else if (!force)
+       return;
 
-   if (row > frame[num].el_count)
-      return -1;
+    // the overlay only grows so a shorter sample does not leave
+    // stale digits behind on the status row
+    len = strlen(text);
+    if (len > stats_overlay_width)
+       stats_overlay_width = len;
+    if (stats_overlay_width > screen->ncols)
+       stats_overlay_width = screen->ncols;
+    if (len > stats_overlay_width)
+       len = stats_overlay_width;
+    put_string_to_length(screen, &text[strlen(text) - len], NULL,
+			 screen->nlines - 1, screen->ncols - stats_overlay_width,
+			 error_attribute, stats_overlay_width);
+    refresh_pending++;
+}
 
-   if (col > frame[num].screen->ncols)
-      return -1;
+void set_stats_overlay(ULONG on)
+{
+    NWSCREEN *screen = &console_screen;
 
-   if (frame[num].el_strings)
-   {
-      v = frame[num].el_strings[row];
-      if (!v)
-	 return -1;
+    if (!on == !stats_overlay)
+       return;
 
-      a = frame[num].el_attr[row];
-      if (!a)
-	 return -1;
+    stats_overlay = on ? 1 : 0;
+    if (stats_overlay)
+    {
+       display_stats_overlay(1);
+       return;
+    }
 
-#if LINUX_UTIL
-      if (pthread_mutex_lock(&frame[num].mutex))
-         return -1;
-#endif
-      v[col] = p;
-      a[col] = (BYTE)(attr & 0xFF);
+    // put back whatever the overlay covered
+    stats_overlay_width = 0;
+    if (comment_valid)
+       put_string_cleol(screen, (const char *)comment_line, NULL,
+			screen->nlines - 1, comment_attr);
+    else
+       put_char_length(screen, ' ', screen->nlines - 1, 0,
+		       screen->norm_vid, screen->ncols);
+    refresh_pending++;
+}
 
-      if ((row + 1) > frame[num].el_limit)
-	 frame[num].el_limit = (row + 1);
+ULONG get_stats_overlay(void)
+{
+    return stats_overlay;
+}
 
-#if LINUX_UTIL
-      pthread_mutex_unlock(&frame[num].mutex);
-#endif
-      return 0;
-   }
-   return -1;
+// there is no overlay hotkey unless the application picks one, a
+// key value of zero disables it again
 
+void set_stats_overlay_key(ULONG key)
+{
+    stats_overlay_key = key;
 }
 
-ULONG write_portal_cleol(ULONG num, const char *p, ULONG row, ULONG col,
-			 ULONG attr)
+// tty_bytes is only counted while something reads it, a caller which
+// wants the count without the overlay turns it on here
+
+void set_stats_tty_bytes(ULONG on)
 {
+    stats_tty_bytes = on ? 1 : 0;
+}
 
-   ULONG i;
-   BYTE *v, *a;
+// notifications.  Any thread may post a short message, which costs a
+// lock and a few string compares.  Messages wait in a small fixed
+// queue and a message already waiting or on screen only has its
+// repeat count raised, so a flood of the same event is one entry.
+// When the queue is full the oldest waiting message is dropped.  The
+// UI thread shows them one at a time on the status row from the
+// get_key idle loop, for note_time_ms each, or NOTE_MIN_MS while
+// others are waiting, then puts the status text back.
 
-   if (!frame[num].owner)
-      return -1;
+#define NOTE_QUEUE_SIZE   16
+#define NOTE_TEXT_SIZE    128
+#define NOTE_MIN_MS       500
 
-   if (attr) {};
+typedef struct _CWNOTE
+{
+   char text[NOTE_TEXT_SIZE];
+   ULONG attr;
+   ULONG count;
+} CWNOTE;
+
+pthread_mutex_t note_mutex = PTHREAD_MUTEX_INITIALIZER;
+CWNOTE note_queue[NOTE_QUEUE_SIZE];
+ULONG note_head = 0;
+ULONG note_tail = 0;
+ULONG note_changed = 0;
+ULONG note_time_ms = 3000;
+LONGLONG note_shown_ns = 0;
+
+static inline ULONG note_count(void)
+{
+    return (note_head + NOTE_QUEUE_SIZE - note_tail) % NOTE_QUEUE_SIZE;
+}
 
-   if (row > frame[num].el_count)
-      return -1;
+ULONG post_notification(const char *p, ULONG attr)
+{
+    ULONG i, n;
 
-   if (col > frame[num].screen->ncols || !*p)
-      return -1;
+    if (!p || !*p)
+       return -1;
 
-   if (frame[num].el_strings)
-   {
-#if LINUX_UTIL
-      if (pthread_mutex_lock(&frame[num].mutex))
-         return -1;
-#endif
-      v = frame[num].el_strings[row];
-      if (!v)
-      {
-#if LINUX_UTIL
-         pthread_mutex_unlock(&frame[num].mutex);
-#endif
-	 return -1;
-      }
+    pthread_mutex_lock(&note_mutex);
+    __sync_fetch_and_add(&cw_stats.notes_posted, 1);
+    for (i=note_tail; i != note_head; i = (i + 1) % NOTE_QUEUE_SIZE)
+    {
+       if (note_queue[i].attr == attr &&
+	   !strncmp(note_queue[i].text, p, NOTE_TEXT_SIZE - 1))
+       {
+	  note_queue[i].count++;
+	  if (i == note_tail && note_showing)
+	     note_changed = 1;
+	  __sync_fetch_and_add(&cw_stats.notes_coalesced, 1);
+	  pthread_mutex_unlock(&note_mutex);
+	  return 0;
+       }
+    }
 
-      a = frame[num].el_attr[row];
-      if (!a)
-      {
-#if LINUX_UTIL
-         pthread_mutex_unlock(&frame[num].mutex);
-#endif
-	 return -1;
-      }
+    if (note_count() == NOTE_QUEUE_SIZE - 1)
+    {
+       // the message on screen stays, the next one goes
+       i = note_showing ? (note_tail + 1) % NOTE_QUEUE_SIZE : note_tail;
+       for (n=i; (n + 1) % NOTE_QUEUE_SIZE != note_head;
+	    n = (n + 1) % NOTE_QUEUE_SIZE)
+	  note_queue[n] = note_queue[(n + 1) % NOTE_QUEUE_SIZE];
+       note_head = n;
+       __sync_fetch_and_add(&cw_stats.notes_dropped, 1);
+    }
 
-      for (i=0; i < frame[num].screen->ncols; i++)
-      {
-	 if (*p && i >= col)
-	 {
-	    v[i] = *p++;
-	    a[i] = (BYTE)(attr & 0xFF);
-	 }
-	 else if (i >= col) {
-	    v[i] = ' ';
-	    a[i] = (BYTE)(attr & 0xFF);
-         }
-      }
-      frame[num].el_strings[row][frame[num].screen->ncols - 1] = '\0';
-      if ((row + 1) > frame[num].el_limit)
-	 frame[num].el_limit = (row + 1);
+    snprintf(note_queue[note_head].text, NOTE_TEXT_SIZE, "%s", p);
+    note_queue[note_head].attr = attr;
+    note_queue[note_head].count = 1;
+    note_head = (note_head + 1) % NOTE_QUEUE_SIZE;
+    notes_queued = note_count();
+    pthread_mutex_unlock(&note_mutex);
+    return 0;
+}
 
-#if LINUX_UTIL
-      pthread_mutex_unlock(&frame[num].mutex);
-#endif
-      return 0;
-   }
-   return -1;
+// how long each notification stays on screen, returns the old value
+
+ULONG set_notification_time(ULONG ms)
+{
+    ULONG t = note_time_ms;
 
+    note_time_ms = ms ? ms : 1;
+    return t;
 }
 
-ULONG write_screen_comment_line(NWSCREEN *screen, const char *p, ULONG attr)
+static void display_notifications(void)
 {
-    put_string_cleol(screen, (const char *)p, NULL, screen->nlines - 1, attr);
-    return 0;
+    NWSCREEN *screen = &console_screen;
+    LONGLONG now = get_ns(), limit;
+    char text[NOTE_TEXT_SIZE + 32];
+    ULONG attr = 0, draw = 0, restore = 0;
+    CWFMT f;
+
+    if (!screen->p_vidmem)
+       return;
+
+    pthread_mutex_lock(&note_mutex);
+    if (note_showing)
+    {
+       limit = (note_count() > 1 ? NOTE_MIN_MS : note_time_ms) * 1000000LL;
+       if (now - note_shown_ns >= limit)
+       {
+	  note_tail = (note_tail + 1) % NOTE_QUEUE_SIZE;
+	  note_showing = 0;
+	  restore = 1;
+       }
+    }
+    if (!note_showing && note_count())
+    {
+       note_showing = 1;
+       note_changed = 1;
+       note_shown_ns = now;
+    }
+    if (note_showing && note_changed)
+    {
+       fmt_init(&f, text, sizeof(text));
+       fmt_char(&f, ' ');
+       fmt_str(&f, note_queue[note_tail].text);
+       if (note_queue[note_tail].count > 1)
+       {
+	  fmt_str(&f, " (x");
+	  fmt_dec(&f, note_queue[note_tail].count);
+	  fmt_char(&f, ')');
+       }
+       attr = note_queue[note_tail].attr;
+       note_changed = 0;
+       draw = 1;
+    }
+    notes_queued = note_count();
+    pthread_mutex_unlock(&note_mutex);
+
+    if (draw)
+       put_string_cleol(screen, text, NULL, screen->nlines - 1, attr);
+    else if (restore)
+    {
+       if (comment_valid)
+	  put_string_cleol(screen, (const char *)comment_line, NULL,
+			   screen->nlines - 1, comment_attr);
+       else
+	  put_char_length(screen, ' ', screen->nlines - 1, 0,
+			  screen->norm_vid, screen->ncols);
+    }
+    else
+       return;
+
+    if (stats_overlay)
+       display_stats_overlay(1);
+    refresh_pending++;
 }
+#endif
 
 void display_portal(ULONG num)
 {
@@ -5053,6 +7004,11 @@ void display_portal(ULONG num)
     if (width >= 1)
        width -= 1;
 
+#if (LINUX_UTIL)
+    if (lock_frame(num))
+       return;
+#endif
+    pull_lines(num, 0, count);
     for (i=0; i < count; i++)
     {
        if ((i < frame[num].el_count) &&
@@ -5073,9 +7029,7 @@ void display_portal(ULONG num)
                     frame[num].fill_color |
 		    frame[num].text_color);
 
-	     put_string_to_length(frame[num].screen,
-	            (const char *)frame[num].el_strings[i],
-		    frame[num].el_attr[i],
+	     put_portal_line(num, i,
 		    row + i, col + 2,
                     frame[num].fill_color |
 		    frame[num].text_color,
@@ -5083,9 +7037,7 @@ void display_portal(ULONG num)
 	  }
 	  else
 	  {
-	     put_string_to_length(frame[num].screen,
-	            (const char *)frame[num].el_strings[i],
-	            frame[num].el_attr[i],
+	     put_portal_line(num, i,
 		    row + i, col,
                     frame[num].fill_color |
 		    frame[num].text_color,
@@ -5112,6 +7064,7 @@ void display_portal(ULONG num)
        }
     }
 #if (LINUX_UTIL)
+    pthread_mutex_unlock(&frame[num].mutex);
     refresh_pending++;
 #endif
 }
@@ -5136,9 +7089,10 @@ ULONG update_portal(ULONG num)
        return -1;
 
 #if (LINUX_UTIL)
-    if (pthread_mutex_lock(&frame[num].mutex))
+    if (lock_frame(num))
        return -1;
 #endif
+    pull_lines(num, frame[num].top, frame[num].window_size);
 
     if (strlen((const char *)frame[num].header) ||
         strlen((const char *)frame[num].subheader))
@@ -5179,9 +7133,7 @@ ULONG update_portal(ULONG num)
 			 frame[num].fill_color |
 			 frame[num].text_color);
 
-		put_string_to_length(frame[num].screen,
-		    (const char *)frame[num].el_strings[frame[num].top + i],
-		    frame[num].el_attr[frame[num].top + i],
+		put_portal_line(num, frame[num].top + i,
 		    row + i, col + 2,
 		    (row + i == row + frame[num].index)
 		    ? bar_attribute : frame[num].fill_color |
@@ -5189,9 +7141,7 @@ ULONG update_portal(ULONG num)
 	     }
 	     else
 	     {
-		put_string_to_length(frame[num].screen,
-		    (const char *)frame[num].el_strings[frame[num].top + i],
-		    frame[num].el_attr[frame[num].top + i],
+		put_portal_line(num, frame[num].top + i,
 		    row + i, col,
 		    (row + i == row + frame[num].index) ? bar_attribute :
 		    frame[num].fill_color | frame[num].text_color, width);
@@ -5262,9 +7212,10 @@ ULONG update_static_portal(ULONG num)
        return -1;
 
 #if (LINUX_UTIL)
-    if (pthread_mutex_lock(&frame[num].mutex))
+    if (lock_frame(num))
        return -1;
 #endif
+    pull_lines(num, frame[num].top, frame[num].window_size);
 
     if (strlen((const char *)frame[num].header) ||
         strlen((const char *)frame[num].subheader))
@@ -5307,9 +7258,7 @@ ULONG update_static_portal(ULONG num)
 		    frame[num].fill_color |
 		    frame[num].text_color);
 
-		put_string_to_length(frame[num].screen,
-		    (const char *)frame[num].el_strings[frame[num].top + i],
-	            frame[num].el_attr[frame[num].top + i],
+		put_portal_line(num, frame[num].top + i,
 		    row + i, col + 2,
 		    ((row + i == row + frame[num].index) &&
 		     frame[num].focus) ? bar_attribute :
@@ -5318,9 +7267,7 @@ ULONG update_static_portal(ULONG num)
 	     }
 	     else
 	     {
-		put_string_to_length(frame[num].screen,
-		    (const char *)frame[num].el_strings[frame[num].top + i],
-	            frame[num].el_attr[frame[num].top + i],
+		put_portal_line(num, frame[num].top + i,
 		    row + i, col,
 		    ((row + i == row + frame[num].index) &&
 		     frame[num].focus) ? bar_attribute
@@ -5381,48 +7328,15 @@ ULONG update_static_portal(ULONG num)
 
 ULONG clear_portal_storage(ULONG num)
 {
-   ULONG i, j;
-   BYTE *v, *a;
-
-   if (!frame[num].owner)
-      return -1;
+   ULONG i;
 
-#if LINUX_UTIL
-   if (pthread_mutex_lock(&frame[num].mutex))
+   if (!frame[num].owner || !frame[num].el_text)
       return -1;
-#endif
 
+   lock_store(num);
    for (i=0; i < frame[num].el_count; i++)
-   {
-      v = frame[num].el_strings[i];
-      if (!v)
-      {
-#if LINUX_UTIL
-         pthread_mutex_unlock(&frame[num].mutex);
-#endif
-	 return -1;
-      }
-
-      a = frame[num].el_attr[i];
-      if (!a)
-      {
-#if LINUX_UTIL
-         pthread_mutex_unlock(&frame[num].mutex);
-#endif
-	 return -1;
-      }
-
-      for (j=0; (j < frame[num].screen->ncols); j++)
-      {
-	 *v++ = ' ';
-	 *a++ = '\0';
-      }
-      frame[num].el_strings[i][frame[num].screen->ncols - 1] = '\0';
-
-   }
-#if LINUX_UTIL
-   pthread_mutex_unlock(&frame[num].mutex);
-#endif
+      line_clear(num, i);
+   unlock_store(num);
 
    return 0;
 
@@ -5430,48 +7344,16 @@ ULONG clear_portal_storage(ULONG num)
 
 ULONG clear_portal(ULONG num)
 {
-   ULONG i, j;
-   BYTE *v, *a;
+   ULONG i;
 
-   if (!frame[num].owner)
+   if (!frame[num].owner || !frame[num].el_text)
       return -1;
 
+   lock_store(num);
    for (i=0; i < frame[num].el_count; i++)
-   {
-#if LINUX_UTIL
-      if (pthread_mutex_lock(&frame[num].mutex))
-         return -1;
-#endif
-      v = frame[num].el_strings[i];
-      if (!v)
-      {
-#if LINUX_UTIL
-         pthread_mutex_unlock(&frame[num].mutex);
-#endif
-	 return -1;
-      }
-
-      a = frame[num].el_attr[i];
-      if (!a)
-      {
-#if LINUX_UTIL
-         pthread_mutex_unlock(&frame[num].mutex);
-#endif
-	 return -1;
-      }
-
-      for (j=0; (j < frame[num].screen->ncols); j++)
-      {
-	 *v++ = ' ';
-	 *a++ = '\0';
-      }
-      frame[num].el_strings[i][frame[num].screen->ncols - 1] = '\0';
-
-#if LINUX_UTIL
-      pthread_mutex_unlock(&frame[num].mutex);
-#endif
-   }
+      line_clear(num, i);
    frame[num].el_limit = 0;
+   unlock_store(num);
 
    frame[num].choice = 0;
    frame[num].index = 0;
@@ -5681,89 +7563,300 @@ ULONG confirm_menu(const char *confirm, ULONG row, ULONG attr)
     return retCode;
 }
 
-void append_field_node(ULONG num, FIELD_LIST *fl)
+#if (LINUX_UTIL)
+
+// asynchronous dialogs.  Any thread may queue an error, message or
+// confirm dialog and return immediately.  The dialog is shown by the
+// UI thread the next time it is idle in get_key, and the result is
+// passed to the completion function from the UI thread.  Dialogs are
+// shown one at a time in the order they were queued.
+
+#define DIALOG_ERROR     1
+#define DIALOG_MESSAGE   2
+#define DIALOG_CONFIRM   3
+
+typedef struct _CWDIALOG
+{
+   struct _CWDIALOG *next;
+   ULONG type;
+   ULONG row;
+   ULONG attr;
+   void (*complete)(ULONG result, void *context);
+   void *context;
+   char text[1];
+} CWDIALOG;
+
+pthread_mutex_t dialog_mutex = PTHREAD_MUTEX_INITIALIZER;
+CWDIALOG *dialog_head = NULL;
+CWDIALOG *dialog_tail = NULL;
+
+static ULONG queue_dialog(ULONG type, const char *p, ULONG row, ULONG attr,
+			  void (*complete)(ULONG, void *), void *context)
+{
+    CWDIALOG *d;
+    ULONG len;
+
+    if (!p)
+       return -1;
+
+    len = strlen(p);
+    if (!console_screen.ncols || (console_screen.ncols < len))
+       return -1;
+
+    d = (CWDIALOG *)malloc(sizeof(CWDIALOG) + len);
+    if (!d)
+       return -1;
+
+    d->next = NULL;
+    d->type = type;
+    d->row = row;
+    d->attr = attr;
+    d->complete = complete;
+    d->context = context;
+    memcpy(d->text, p, len + 1);
+
+    pthread_mutex_lock(&dialog_mutex);
+    if (dialog_tail)
+       dialog_tail->next = d;
+    else
+       dialog_head = d;
+    dialog_tail = d;
+    dialogs_queued++;
+    pthread_mutex_unlock(&dialog_mutex);
+    return 0;
+}
+
+static CWDIALOG *dequeue_dialog(void)
+{
+    CWDIALOG *d;
+
+    pthread_mutex_lock(&dialog_mutex);
+    d = dialog_head;
+    if (d)
+    {
+       dialog_head = d->next;
+       if (!dialog_head)
+	  dialog_tail = NULL;
+       dialogs_queued--;
+    }
+    pthread_mutex_unlock(&dialog_mutex);
+    return d;
+}
+
+static void run_queued_dialogs(void)
 {
-    if (!frame[num].head)
+    CWDIALOG *d;
+    ULONG result = 0;
+
+    dialog_active = 1;
+    while ((d = dequeue_dialog()))
     {
-       frame[num].head = fl;
-       frame[num].tail = fl;
-       fl->next = fl->prior = 0;
+       switch (d->type)
+       {
+	  case DIALOG_ERROR:
+	     result = error_portal(d->text, d->row);
+	     break;
+
+	  case DIALOG_MESSAGE:
+	     result = message_portal(d->text, d->row, d->attr, TRUE);
+	     break;
+
+	  case DIALOG_CONFIRM:
+	     result = confirm_menu(d->text, d->row, d->attr);
+	     break;
+       }
+
+       // the key which closed the dialog ends its interaction here
+       if (key_issued_ns)
+       {
+	  record_key_latency(get_ns() - key_issued_ns);
+	  key_issued_ns = 0;
+       }
+
+       if (d->complete)
+	  (d->complete)(result, d->context);
+       free(d);
     }
-    else
+    dialog_active = 0;
+}
+
+// fail any dialogs still queued at shutdown so waiters are released
+
+static void cancel_queued_dialogs(void)
+{
+    CWDIALOG *d;
+
+    while ((d = dequeue_dialog()))
     {
-       frame[num].tail->next = fl;
-       fl->next = 0;
-       fl->prior = frame[num].tail;
-       frame[num].tail = fl;
+       if (d->complete)
+	  (d->complete)((ULONG)-1, d->context);
+       free(d);
     }
-    frame[num].field_count++;
-    return;
 }
 
-FIELD_LIST *insert_field(ULONG num, FIELD_LIST *i, FIELD_LIST *top)
+ULONG error_portal_async(const char *p, ULONG row,
+			 void (*complete)(ULONG result, void *context),
+			 void *context)
+{
+    return queue_dialog(DIALOG_ERROR, p, row, 0, complete, context);
+}
+
+ULONG message_portal_async(const char *p, ULONG row, ULONG attr,
+			   void (*complete)(ULONG result, void *context),
+			   void *context)
+{
+    return queue_dialog(DIALOG_MESSAGE, p, row, attr, complete, context);
+}
+
+ULONG confirm_menu_async(const char *confirm, ULONG row, ULONG attr,
+			 void (*complete)(ULONG result, void *context),
+			 void *context)
+{
+    return queue_dialog(DIALOG_CONFIRM, confirm, row, attr, complete,
+			context);
+}
+
+// futures.  Pass complete_future and a CWFUTURE as the completion
+// function and context of an async dialog, then wait on it from the
+// worker.  Never wait on a future from the UI thread, the dialog can
+// only run while that thread is in get_key.
+
+void init_future(CWFUTURE *f)
+{
+    pthread_mutex_init(&f->mutex, NULL);
+    pthread_cond_init(&f->cond, NULL);
+    f->done = 0;
+    f->result = 0;
+}
+
+void complete_future(ULONG result, void *context)
+{
+    CWFUTURE *f = (CWFUTURE *)context;
+
+    pthread_mutex_lock(&f->mutex);
+    f->result = result;
+    f->done = 1;
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->mutex);
+}
+
+int future_done(CWFUTURE *f)
+{
+    int done;
+
+    pthread_mutex_lock(&f->mutex);
+    done = f->done;
+    pthread_mutex_unlock(&f->mutex);
+    return done;
+}
+
+ULONG wait_future(CWFUTURE *f)
+{
+    ULONG result;
+
+    pthread_mutex_lock(&f->mutex);
+    while (!f->done)
+       pthread_cond_wait(&f->cond, &f->mutex);
+    result = f->result;
+    pthread_mutex_unlock(&f->mutex);
+    return result;
+}
+
+void free_future(CWFUTURE *f)
+{
+    pthread_cond_destroy(&f->cond);
+    pthread_mutex_destroy(&f->mutex);
+}
+#endif
+
+// fields are kept in a list in row, col order for navigation and in
+// a sorted array of the same nodes, so adding a field to a large form
+// is a binary search instead of a walk of the list
+
+static ULONG find_field_slot(ULONG num, ULONG row, ULONG col)
+{
+    FIELD_LIST **index = frame[num].field_index;
+    ULONG lo = 0, hi = frame[num].field_count, mid;
+
+    // fields are usually added in order
+    if (hi && (index[hi - 1]->row < row ||
+	(index[hi - 1]->row == row && index[hi - 1]->col < col)))
+       return hi;
+
+    while (lo < hi)
+    {
+       mid = (lo + hi) / 2;
+       if (index[mid]->row < row ||
+	   (index[mid]->row == row && index[mid]->col < col))
+	  lo = mid + 1;
+       else
+	  hi = mid;
+    }
+    return lo;
+}
+
+static int link_field(ULONG num, FIELD_LIST *fl, ULONG slot)
 {
-    FIELD_LIST *old, *p;
+    FIELD_LIST **index;
+    ULONG count = frame[num].field_count, size;
 
-    if (!frame[num].tail)
-    {
-       i->next = i->prior = NULL;
-       frame[num].tail = i;
-       return i;
-    }
-    p = top;
-    old = NULL;
-    while (p)
+    if (count >= frame[num].field_index_size)
     {
-       if (p->row < i->row)
-       {
-	  old = p;
-	  p = p->next;
-       }
-       else if ((p->row == i->row) && (p->col < i->col))
-       {
-	  old = p;
-	  p = p->next;
-       }
-       else
-       {
-          if (p->prior)
-	  {
-	     p->prior->next = i;
-	     i->next = p;
-	     i->prior = p->prior;
-	     p->prior = i;
-	     return top;
-	  }
-	  i->next = p;
-	  i->prior = NULL;
-	  p->prior = i;
-	  return i;
-       }
+       size = frame[num].field_index_size ? frame[num].field_index_size * 2
+	      : 16;
+       index = (FIELD_LIST **)realloc(frame[num].field_index,
+				      size * sizeof(FIELD_LIST *));
+       if (!index)
+	  return -1;
+       add_frame_memory(num, (size - frame[num].field_index_size) *
+			sizeof(FIELD_LIST *));
+       frame[num].field_index = index;
+       frame[num].field_index_size = size;
     }
-    old->next = i;
-    i->next = NULL;
-    i->prior = old;
-    frame[num].tail = i;
-    return frame[num].head;
+    index = frame[num].field_index;
+
+    fl->prior = slot ? index[slot - 1] : NULL;
+    fl->next = (slot < count) ? index[slot] : NULL;
+    if (fl->prior)
+       fl->prior->next = fl;
+    else
+       frame[num].head = fl;
+    if (fl->next)
+       fl->next->prior = fl;
+    else
+       frame[num].tail = fl;
+
+    memmove(&index[slot + 1], &index[slot],
+	    (count - slot) * sizeof(FIELD_LIST *));
+    index[slot] = fl;
+    frame[num].field_count++;
+    return 0;
+}
 
+// returns -1 if the field index could not grow, the field is then
+// not linked at all
+
+int append_field_node(ULONG num, FIELD_LIST *fl)
+{
+    return link_field(num, fl, frame[num].field_count);
 }
 
 int add_field_node(ULONG num, FIELD_LIST *new_fl)
 {
-    FIELD_LIST *fl;
+    ULONG slot, i;
 
     // check if the node was already added
     // return 1 if already exists
-    fl = frame[num].head;
-    while (fl)
+    slot = find_field_slot(num, new_fl->row, new_fl->col);
+    for (i=slot; i < frame[num].field_count; i++)
     {
-       if (fl == new_fl)
+       if (frame[num].field_index[i]->row != new_fl->row ||
+	   frame[num].field_index[i]->col != new_fl->col)
+	  break;
+       if (frame[num].field_index[i] == new_fl)
 	  return 1;
-       fl = fl->next;
     }
-    frame[num].head = insert_field(num, new_fl, frame[num].head);
-    frame[num].field_count++;
-    return 0;
+    return link_field(num, new_fl, slot);
 }
 
 ULONG add_field_to_portal(ULONG num, ULONG row, ULONG col, ULONG attr,
@@ -5817,16 +7910,289 @@ ULONG add_field_to_portal(ULONG num, ULONG row, ULONG col, ULONG attr,
        free(fl);
        return -1;
     }
+    add_frame_memory(num, sizeof(FIELD_LIST));
     return 0;
 }
 
-ULONG input_portal_fields(ULONG num)
+// gap buffer editor for the field being typed into.  Text before the
+// cursor sits at the front of text[] and text after it at the back,
+// so typing and deleting at the cursor only moves the gap.  The field
+// buffer is written back when a key leaves the field.
+
+typedef struct _FIELD_EDIT
+{
+   FIELD_LIST *fl;
+   BYTE *text;
+   ULONG size;            // capacity, not counting the terminator
+   ULONG gap_start;
+   ULONG gap_end;
+} FIELD_EDIT;
+
+static inline ULONG edit_length(FIELD_EDIT *e)
+{
+   return e->size - (e->gap_end - e->gap_start);
+}
+
+static inline BYTE edit_char(FIELD_EDIT *e, ULONG i)
+{
+   return (i < e->gap_start) ? e->text[i]
+	  : e->text[i + e->gap_end - e->gap_start];
+}
+
+static void edit_store(FIELD_EDIT *e)
+{
+   FIELD_LIST *fl = e->fl;
+
+   if (!fl)
+      return;
+
+   memcpy(fl->buffer, e->text, e->gap_start);
+   memcpy(&fl->buffer[e->gap_start], &e->text[e->gap_end],
+	  e->size - e->gap_end);
+   fl->buffer[edit_length(e)] = '\0';
+   e->fl = NULL;
+}
+
+static void edit_load(FIELD_EDIT *e, FIELD_LIST *fl)
+{
+   ULONG len;
+
+   edit_store(e);
+   e->fl = fl;
+   e->size = fl->buflen ? fl->buflen - 1 : 0;
+   len = strnlen((const char *)fl->buffer, e->size);
+   memcpy(e->text, fl->buffer, len);
+   e->gap_start = len;
+   e->gap_end = e->size;
+}
+
+// move the gap to pos, padding with blanks if pos is past the end of
+// the text
+
+static int edit_seek(FIELD_EDIT *e, ULONG pos)
+{
+   if (pos > e->size)
+      return -1;
+
+   while (e->gap_start > pos)
+      e->text[--e->gap_end] = e->text[--e->gap_start];
+
+   while (e->gap_start < pos)
+   {
+      if (e->gap_end < e->size)
+	 e->text[e->gap_start++] = e->text[e->gap_end++];
+      else if (e->gap_start < e->gap_end)
+	 e->text[e->gap_start++] = ' ';
+      else
+	 return -1;
+   }
+   return 0;
+}
+
+// store field cells from..to (blanks past the end of the text) into
+// the portal and copy just those cells to the screen
+
+static void paint_field(ULONG num, FIELD_EDIT *e, ULONG from, ULONG to)
+{
+   FIELD_LIST *fl = e->fl;
+   ULONG i, len, base, row, col;
+   const ULONG *x;
+   CWTEXT *t;
+
+   len = edit_length(e);
+   if (to > e->size)
+      to = e->size;
+   base = fl->col + fl->plen;
+   if (base + to > line_cells(num))
+      to = base < line_cells(num) ? line_cells(num) - base : 0;
+   if (from >= to)
+      return;
+
+   lock_store(num);
+   t = line_back(num, fl->row, 1);
+   if (!t || line_extend(num, t, base + to))
+   {
+      if (t)
+	 line_abandon(num, fl->row);
+      unlock_store(num);
+      return;
+   }
+   for (i=from; i < to; i++)
+      t->text[base + i] = (i < len) ? edit_char(e, i) : ' ';
+   if (line_attr(num, t, base + from, to - from, field_attribute))
+   {
+      line_abandon(num, fl->row);
+      unlock_store(num);
+      return;
+   }
+   line_done(num, fl->row);
+   unlock_store(num);
+
+   if (!portal_visible(num) || fl->row < (ULONG)frame[num].top ||
+       fl->row >= frame[num].top + frame[num].window_size)
+      return;
+
+   if (strlen((const char *)frame[num].header) ||
+       strlen((const char *)frame[num].subheader))
+   {
+      row = frame[num].start_row + 3;
+      if (strlen((const char *)frame[num].subheader))
+	 row++;
+   }
+   else
+      row = frame[num].start_row + 1;
+   row += fl->row - frame[num].top;
+
+   col = frame[num].start_column + 1;
+   if (frame[num].scroll_frame)
+      col += 2;
+   col += base + from;
+
+#if LINUX_UTIL
+   if (lock_frame(num))
+      return;
+#endif
+   pull_lines(num, fl->row, 1);
+   t = line_front(num, fl->row);
+   x = line_attrs(num, t);
+   put_line_to_length(frame[num].screen, (const char *)&t->text[base + from],
+		      NULL, x ? &x[base + from] : NULL, row, col,
+		      frame[num].fill_color | frame[num].text_color, to - from);
+#if LINUX_UTIL
+   pthread_mutex_unlock(&frame[num].mutex);
+   refresh_pending++;
+#endif
+}
+
+// place the cursor in the field, the portal is only redrawn if the
+// field has scrolled out of the window
+
+static void field_cursor(ULONG num, FIELD_LIST *fl)
+{
+   if (fl->row >= (ULONG)frame[num].top &&
+       fl->row < frame[num].top + frame[num].window_size)
+      frame_set_xy(num, fl->row - frame[num].top,
+		   fl->col + fl->plen + fl->pos + 1);
+   else
+      field_set_xy(num, fl->row, fl->col + fl->plen + fl->pos + 1);
+}
+
+static void edit_type(ULONG num, FIELD_EDIT *e, FIELD_LIST *fl, BYTE c)
+{
+   ULONG pos = fl->pos;
+
+   if (e->fl != fl)
+      edit_load(e, fl);
+
+   if (pos >= e->size || edit_seek(e, pos))
+      return;
+
+   if (!insert && e->gap_end < e->size)
+      e->gap_end++;
+   else if (e->gap_start == e->gap_end)
+      return;
+
+   e->text[e->gap_start++] = c;
+   paint_field(num, e, pos, insert ? edit_length(e) : pos + 1);
+   fl->pos++;
+   field_cursor(num, fl);
+}
+
+static void edit_backspace(ULONG num, FIELD_EDIT *e, FIELD_LIST *fl)
+{
+   if (!fl->pos)
+      return;
+
+   if (e->fl != fl)
+      edit_load(e, fl);
+
+   fl->pos--;
+   if (fl->pos < edit_length(e) && !edit_seek(e, fl->pos + 1))
+   {
+      e->gap_start--;
+      paint_field(num, e, fl->pos, edit_length(e) + 1);
+   }
+   field_cursor(num, fl);
+}
+
+static void edit_delete(ULONG num, FIELD_EDIT *e, FIELD_LIST *fl)
+{
+   if (e->fl != fl)
+      edit_load(e, fl);
+
+   if (fl->pos < edit_length(e) && !edit_seek(e, fl->pos))
+   {
+      e->gap_end++;
+      paint_field(num, e, fl->pos, edit_length(e) + 1);
+   }
+   field_cursor(num, fl);
+}
+
+// keys which move to another field or end the form, the field buffer
+// is brought up to date before they are handled
+
+static int field_leave_key(ULONG key)
+{
+   switch (key)
+   {
+      case 0:
+      case ESC:
+      case ENTER:
+      case TAB:
+      case INS:
+      case UP_ARROW:
+      case DOWN_ARROW:
+      case PG_UP:
+      case PG_DOWN:
+      case F1: case F2: case F3: case F4: case F5: case F6:
+      case F7: case F8: case F9: case F10: case F11: case F12:
+	 return 1;
+      default:
+	 return 0;
+   }
+}
+
+// the first field which is not hidden between rows top and bottom,
+// or the last one if last is set.  The sorted field index finds the
+// rows, so paging through a large form does not walk the list.
+
+static FIELD_LIST *field_in_rows(ULONG num, ULONG top, ULONG bottom,
+				 int last)
+{
+   FIELD_LIST **index = frame[num].field_index;
+   ULONG i, first, end;
+
+   first = find_field_slot(num, top, 0);
+   end = find_field_slot(num, bottom + 1, 0);
+   for (i=first; i < end; i++)
+   {
+      FIELD_LIST *fl = index[last ? end - 1 - (i - first) : i];
+
+      if (!(fl->hide && fl->hide(num, fl)))
+	 return fl;
+   }
+   return NULL;
+}
+
+// the first field which is not hidden at or below row
+
+static FIELD_LIST *field_from_row(ULONG num, ULONG row)
+{
+   ULONG i;
+
+   for (i=find_field_slot(num, row, 0); i < frame[num].field_count; i++)
+      if (!(frame[num].field_index[i]->hide &&
+	    frame[num].field_index[i]->hide(num, frame[num].field_index[i])))
+	 return frame[num].field_index[i];
+   return NULL;
+}
+
+static ULONG edit_portal_fields(ULONG num, FIELD_EDIT *edit)
 {
-   ULONG ccode, i, temp;
+   ULONG ccode, i;
    ULONG row, col;
    ULONG key, menuRow, len, screenRow, menuCol, adj;
    FIELD_LIST *fl, *fl_search;
-   BYTE *p;
 
    if (!frame[num].owner)
       return -1;
@@ -5887,7 +8253,10 @@ ULONG input_portal_fields(ULONG num)
 
    for (;;)
    {
+      focus_frame = num;
       key = get_key();
+      if (field_leave_key(key))
+	 edit_store(edit);
       enable_cursor(insert);
       switch (key)
       {
@@ -5947,7 +8316,7 @@ ULONG input_portal_fields(ULONG num)
 	    if (fl->menu_items || fl->menu_strings)
 	       break;
 	    fl->pos = 0;
-	    field_set_xy(num, fl->row, fl->col + fl->plen + fl->pos + 1);
+	    field_cursor(num, fl);
 	    break;
 
 #if LINUX_UTIL
@@ -5956,8 +8325,9 @@ ULONG input_portal_fields(ULONG num)
 	 case END:
 	    if (fl->menu_items || fl->menu_strings)
 	       break;
+	    edit_store(edit);
 	    fl->pos = strlen((const char *)fl->buffer);
-	    field_set_xy(num, fl->row, fl->col + fl->plen + fl->pos + 1);
+	    field_cursor(num, fl);
 	    break;
 
 	 case UP_ARROW:
@@ -6096,39 +8466,26 @@ ULONG input_portal_fields(ULONG num)
             }
             update_static_portal(num);
 
-            fl = frame[num].head;
-            while (fl)
+            fl = field_in_rows(num, frame[num].top, frame[num].bottom, 0);
+            if (fl)
             {
-               if (!(fl->hide && fl->hide(num, fl)) &&
-		   (fl->row >= (ULONG)frame[num].top) &&
-		   (fl->row <= (ULONG)frame[num].bottom)) {
-	          if (fl->menu_items && fl->menu_strings)
-	          {
-                     write_portal(num,
+	       if (fl->menu_items && fl->menu_strings)
+	       {
+                  write_portal(num,
 			   (const char *)fl->menu_strings[fl->result],
 			   fl->row, fl->col + fl->plen, field_attribute);
-	          }
-	          else
-                     write_portal(num,
+	       }
+	       else
+                  write_portal(num,
 			   (const char *)fl->buffer,
 			   fl->row, fl->col + fl->plen, field_attribute);
 
-		  field_set_xy(num, fl->row, fl->col + fl->plen + fl->pos + 1);
-		  break;
-	       }
-	       fl = fl->next;
+	       field_set_xy(num, fl->row, fl->col + fl->plen + fl->pos + 1);
             }
-            if (!fl) {
+            else
+            {
 	       disable_cursor();
-	       fl = frame[num].head;
-               while (fl)
-               {
-                  if (!(fl->hide && fl->hide(num, fl)) &&
-		      (fl->row >= (ULONG)frame[num].top)) {
-		     break;
-	          }
-	          fl = fl->next;
-               }
+	       fl = field_from_row(num, frame[num].top);
 	    }
             if (!fl)
 	       fl = frame[num].head;
@@ -6165,41 +8522,26 @@ ULONG input_portal_fields(ULONG num)
 	    frame[num].bottom = frame[num].top + frame[num].window_size;
             update_static_portal(num);
 
-	    fl = frame[num].tail;
-	    while (fl)
+	    fl = field_in_rows(num, frame[num].top, frame[num].bottom, 1);
+            if (fl)
             {
-               if (!(fl->hide && fl->hide(num, fl))) {
-		  if ((fl->row >= (ULONG)frame[num].top) &&
-		      (fl->row <= (ULONG)(frame[num].bottom))) {
-	             if (fl->menu_items && fl->menu_strings)
-	             {
-                        write_portal(num,
+	       if (fl->menu_items && fl->menu_strings)
+	       {
+                  write_portal(num,
 			   (const char *)fl->menu_strings[fl->result],
 			   fl->row, fl->col + fl->plen, field_attribute);
-	             }
-	             else
-                        write_portal(num,
+	       }
+	       else
+                  write_portal(num,
 			   (const char *)fl->buffer,
 			   fl->row, fl->col + fl->plen, field_attribute);
 
-		     field_set_xy(num, fl->row, fl->col + fl->plen +
-				  fl->pos + 1);
-		     break;
-                  }
-	       }
-	       fl = fl->prior;
+	       field_set_xy(num, fl->row, fl->col + fl->plen + fl->pos + 1);
             }
-            if (!fl) {
+            else
+            {
 	       disable_cursor();
-	       fl = frame[num].head;
-               while (fl)
-               {
-                  if (!(fl->hide && fl->hide(num, fl)) &&
-		       (fl->row >= (ULONG)frame[num].top)) {
-		     break;
-                  }
-	          fl = fl->next;
-               }
+	       fl = field_from_row(num, frame[num].top);
 	    }
             if (!fl)
 	       fl = frame[num].head;
@@ -6218,20 +8560,9 @@ ULONG input_portal_fields(ULONG num)
             break;
 
 	 case DEL:
-	    p = (BYTE *) &fl->buffer[fl->pos];
-	    temp = fl->pos;
-	    p++;
-	    while ((*p) && (temp < fl->buflen))
-	    {
-	       fl->buffer[temp++] = *p++;
-	    }
-	    fl->buffer[temp] = '\0';
-
-            write_portal(num,
-		   (const char *)fl->buffer,
-		   fl->row, fl->col + fl->plen, field_attribute);
-
-	    field_set_xy(num, fl->row, fl->col + fl->plen + fl->pos + 1);
+	    if (fl->menu_items || fl->menu_strings)
+	       break;
+	    edit_delete(num, edit, fl);
 	    break;
 
 	 case LEFT_ARROW:
@@ -6241,7 +8572,7 @@ ULONG input_portal_fields(ULONG num)
 	    if (fl->pos)
 	    {
 	       fl->pos--;
-	       field_set_xy(num, fl->row, fl->col + fl->plen + fl->pos + 1);
+	       field_cursor(num, fl);
 	    }
 	    break;
 
@@ -6252,7 +8583,7 @@ ULONG input_portal_fields(ULONG num)
 	    if (fl->pos < (fl->buflen - 1))
 	    {
 	       fl->pos++;
-	       field_set_xy(num, fl->row, fl->col + fl->plen + fl->pos + 1);
+	       field_cursor(num, fl);
 	    }
 	    break;
 
@@ -6326,78 +8657,14 @@ ULONG input_portal_fields(ULONG num)
 	       break;
 	    }
 
-	    if (fl->pos < (fl->buflen - 1))
-	    {
-               if (!insert)
-               {
-	          fl->buffer[fl->pos] = ' ';
-
-		  write_portal_char(num, ' ', fl->row, fl->col + fl->plen +
-		       fl->pos, fl->attr);
-
-	          write_portal_char(num, ' ', fl->row, fl->col + fl->plen +
-		       fl->pos, field_attribute);
-
-	          fl->pos++;
-	          field_set_xy(num, fl->row, fl->col + fl->plen + fl->pos + 1);
-               }
-               else
-               {
-		  if (strlen((const char *)fl->buffer) < (fl->buflen - 1))
-                  {
-	             for (i = fl->buflen; i > fl->pos; i--)
-		        fl->buffer[i] = fl->buffer[i - 1];
-
-	             fl->buffer[fl->pos] = ' ';
-	             write_portal_char(num, ' ', fl->row, fl->col + fl->plen +
-				       fl->pos, fl->attr);
-
-	             write_portal_char(num, ' ', fl->row, fl->col + fl->plen +
-			 fl->pos, field_attribute);
-
-                     write_portal(num,
-			   (const char *)fl->buffer,
-			   fl->row, fl->col + fl->plen, field_attribute);
-
-	             fl->pos++;
-	             field_set_xy(num, fl->row, fl->col + fl->plen +
-				  fl->pos + 1);
-                  }
-               }
-	    }
+	    edit_type(num, edit, fl, ' ');
 	    break;
 
 	 case BKSP:
 	    if (fl->menu_items || fl->menu_strings)
 	       break;
 
-	    if (fl->pos)
-	    {
-	       fl->pos--;
-	       if (!fl->buffer[fl->pos + 1])
-               {
-	          write_portal_char(num, ' ', fl->row, fl->col + fl->plen +
-				       fl->pos, fl->attr);
-
-		  write_portal_char(num, ' ',
-			 fl->row, fl->col + fl->plen + fl->pos,
-			 field_attribute);
-
-		  fl->buffer[fl->pos] = '\0';
-               }
-	       else
-               {
-                  for (i = fl->pos; i < fl->buflen; i++)
-	             fl->buffer[i] = fl->buffer[i + 1];
-                  fl->buffer[i] = '\0';
-               }
-
-               write_portal(num,
-			   (const char *)fl->buffer,
-			   fl->row, fl->col + fl->plen, field_attribute);
-
-	       field_set_xy(num, fl->row, fl->col + fl->plen + fl->pos + 1);
-	    }
+	    edit_backspace(num, edit, fl);
 	    break;
 
 	 case ENTER:
@@ -6684,53 +8951,36 @@ ULONG input_portal_fields(ULONG num)
 	       break;
 	    }
 
-	    if (fl->pos < (fl->buflen - 1))
-	    {
-               if (!insert)
-               {
-	          fl->buffer[fl->pos] = (BYTE)key;
-	          write_portal_char(num, (BYTE)key,
-			 fl->row, fl->col + fl->plen + fl->pos,
-			 fl->attr);
-
-		  write_portal_char(num, (BYTE)key,
-			 fl->row, fl->col + fl->plen + fl->pos,
-			 field_attribute);
+	    edit_type(num, edit, fl, (BYTE)key);
+	    break;
+      }
+   }
+   return 0;
 
-	          fl->pos++;
-	          field_set_xy(num, fl->row, fl->col + fl->plen + fl->pos + 1);
-               }
-               else
-               {
-                  if (strlen((const char *)fl->buffer) < (fl->buflen - 1))
-                  {
-	             for (i = fl->buflen; i > fl->pos; i--)
-		        fl->buffer[i] = fl->buffer[i - 1];
+}
 
-	             fl->buffer[fl->pos] = (BYTE)key;
-	             write_portal_char(num, (BYTE)key,
-			 fl->row, fl->col + fl->plen + fl->pos,
-			 fl->attr);
+ULONG input_portal_fields(ULONG num)
+{
+   FIELD_EDIT edit;
+   FIELD_LIST *fl;
+   ULONG ccode, size = 1;
 
-	             write_portal_char(num, (BYTE)key,
-			 fl->row, fl->col + fl->plen + fl->pos,
-			 field_attribute);
+   if (!frame[num].owner)
+      return -1;
 
-                     write_portal(num,
-			   (const char *)fl->buffer,
-			   fl->row, fl->col + fl->plen, field_attribute);
+   for (fl = frame[num].head; fl; fl = fl->next)
+      if (fl->buflen > size)
+	 size = fl->buflen;
 
-	             fl->pos++;
-	             field_set_xy(num, fl->row, fl->col + fl->plen +
-				  fl->pos + 1);
-                  }
-               }
-	    }
-	    break;
-      }
-   }
-   return 0;
+   memset(&edit, 0, sizeof(FIELD_EDIT));
+   edit.text = (BYTE *)malloc(size);
+   if (!edit.text)
+      return -1;
 
+   ccode = edit_portal_fields(num, &edit);
+   edit_store(&edit);
+   free(edit.text);
+   return ccode;
 }
 
 /*
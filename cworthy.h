@@ -62,6 +62,18 @@
 #define DOS_UTIL         0
 #define WINDOWS_NT_UTIL  0
 
+// the Linux library is built with -fvisibility=hidden.  Everything
+// declared in the public headers is exported from libcworthy.so, the
+// rest of the library and declarations marked CW_INTERNAL are not, so
+// calls between the library modules bind locally.
+
+#if (LINUX_UTIL && defined(__GNUC__))
+#pragma GCC visibility push(default)
+#define CW_INTERNAL   __attribute__((visibility("hidden")))
+#else
+#define CW_INTERNAL
+#endif
+
 #if LINUX_UTIL
 #include <unistd.h>
 #include <stdio.h>
@@ -103,6 +115,7 @@
 #include <time.h>
 #include <ncurses.h>
 #include <linux/hdreg.h>
+#include <linux/kd.h>
 #include <linux/kdev_t.h>
 #include <linux/fs.h>
 #include <linux/errno.h>
@@ -280,6 +293,40 @@ typedef USHORT WORD;
 #define BGBROWN		0x60
 #define BGWHITE		0x70
 
+#if LINUX_UTIL
+// extended attributes.  An attribute with CW_XATTR set holds a
+// foreground and a background color which are either an index into
+// the 256 color palette or a 24 bit RGB_COLOR() value, and can be
+// passed anywhere a PC attribute is accepted.  The screen map stores
+// the nearest PC attribute and the full value is kept in p_xattr.
+// Colors the terminal cannot show are mapped to the nearest one.
+//
+//
+// The two colors need 25 bits each, so extended attributes are only
+// available where ULONG is 64 bits, and CW_XATTR_COLORS is defined
+// there.  On 32 bit builds CW_XATTR is 0 and every attribute is a PC
+// attribute.
+//
+//   put_string(screen, s, NULL, row, col, XATTR(RGB_COLOR(255, 96, 0), 16));
+
+#define CW_RGB		    0x01000000UL
+#define CW_COLOR_MASK	    0x01FFFFFFUL
+#define XATTR_FG(attr)	    ((ULONG)(attr) & CW_COLOR_MASK)
+#define XATTR_BG(attr)	    ((ULONG)((unsigned long long)(attr) >> 32) & \
+			     CW_COLOR_MASK)
+#if (__SIZEOF_LONG__ == 8)
+#define CW_XATTR_COLORS     1
+#define CW_XATTR	    0x8000000000000000ULL
+#define RGB_COLOR(r, g, b)  (CW_RGB | (((ULONG)(r) & 0xFF) << 16) | \
+			     (((ULONG)(g) & 0xFF) << 8) | ((ULONG)(b) & 0xFF))
+#define XATTR(fg, bg)	    ((ULONG)(CW_XATTR | \
+			     ((ULONG)(fg) & CW_COLOR_MASK) | \
+			     (((unsigned long long)(bg) & CW_COLOR_MASK) << 32)))
+#else
+#define CW_XATTR	    0UL
+#endif
+#endif
+
 #define UP_CHAR         0x1E
 #define DOWN_CHAR       0x1F
 
@@ -291,6 +338,20 @@ typedef USHORT WORD;
 
 #define HEADER_LEN     80
 
+#if LINUX_UTIL
+// the screen map is locked in bands of CW_BAND_ROWS rows, see
+// lock_rows() in cworthy.c
+
+#define CW_BAND_ROWS   4
+
+typedef struct _CWBAND
+{
+   pthread_mutex_t mutex;
+   ULONG seq;            // odd while a writer is in the band
+   ULONG dirty;          // rows with cells not yet handed to ncurses
+} CWBAND;
+#endif
+
 typedef struct _NWSCREEN
 {
    BYTE *p_vidmem;	 // pointer to crnt video buffer
@@ -303,8 +364,105 @@ typedef struct _NWSCREEN
    ULONG norm_vid;	 // 0x07 = WhiteOnBlack
    ULONG reverse_vid;	 // 0x71 = RevWhiteOnBlack
    ULONG tab_size;
+#if LINUX_UTIL
+   ULONG *p_wide;	 // code points of CW_WIDE_CELL cells
+   ULONG *p_xattr;	 // extended attributes, 0 if the cell has none
+   CWBAND *bands;
+   ULONG *dirty_lo;	 // first dirty column of each row
+   ULONG *dirty_hi;	 // one past the last dirty column
+#endif
 } NWSCREEN;
 
+#if LINUX_UTIL
+// in unicode mode a cell holding a non ASCII character stores
+// CW_WIDE_CELL in the screen map and its code point in p_wide.  The
+// right half of a double width character has a code point of 0.
+
+#define CW_WIDE_CELL   0x7F
+#define CW_WIDE_GLYPH  '?'     // what viewers and recordings show
+
+// one character of a decoded UTF-8 string.  offset is the byte
+// offset of the character in the string, used to find its attribute.
+
+typedef struct _CWGLYPH
+{
+   ULONG cp;
+   ULONG width;
+   ULONG offset;
+} CWGLYPH;
+
+// decoded portal line, kept until the line is written again
+
+#define CWLINE_STALE   0
+#define CWLINE_ASCII   1
+#define CWLINE_UTF8    2
+
+typedef struct _CWLINE
+{
+   ULONG state;
+   ULONG count;           // characters in glyph
+   ULONG size;            // glyph entries allocated
+   CWGLYPH *glyph;
+} CWLINE;
+#endif
+
+// portal line storage.  Only the cells written so far are kept, the
+// rest of the line is blank, and attributes are runs of cells which
+// share one attribute.  Cells outside every run use the portal text
+// attribute.
+
+typedef struct _CWRUN
+{
+   WORD start;
+   WORD len;
+   ULONG attr;
+} CWRUN;
+
+typedef struct _CWTEXT
+{
+   BYTE *text;            // len cells and a terminating nul
+   ULONG len;             // cells in use
+   ULONG size;            // bytes allocated for text
+   CWRUN *run;            // attribute runs sorted by start
+   ULONG runs;
+   ULONG run_size;
+} CWTEXT;
+
+// one line of a write_portal_lines() call.  PORTAL_CLEOL ends the
+// line after text as write_portal_cleol() does, PORTAL_RULE ignores
+// text and draws a horizontal line across the row as
+// write_portal_line() does.
+
+#define PORTAL_CLEOL   0x0001
+#define PORTAL_RULE    0x0002
+
+typedef struct _PORTAL_LINE
+{
+   const char *text;
+   ULONG row;
+   ULONG col;
+   ULONG attr;
+   ULONG flags;
+} PORTAL_LINE;
+
+// text builder for the fmt_ functions.  Text is appended in place
+// and kept nul terminated, whatever does not fit in size - 1 bytes is
+// dropped.  num, row and col are set by begin_portal_line when the
+// buffer is a portal line.
+
+typedef struct _CWFMT
+{
+   char *buf;
+   ULONG size;
+   ULONG len;
+   ULONG num;
+   ULONG row;
+   ULONG col;
+} CWFMT;
+
+#define FMT_SI    0x0000     // units in powers of 1000
+#define FMT_IEC   0x0001     // units in powers of 1024
+
 typedef struct _FIELD_LIST
 {
    struct _FIELD_LIST *next;
@@ -337,6 +495,14 @@ typedef struct _CWFRAME
    BYTE **el_attr;
    BYTE *el_attr_storage;
    ULONG *el_values;
+   CWTEXT *el_text;       // portal lines, three buffers per line
+   ULONG *el_state;       // drawn, written and ready buffer of each line
+   ULONG el_seq;          // odd while an update is being published
+   ULONG batch;           // begin_portal_update nesting
+   ULONG batch_first;     // lines written in the open update
+   ULONG batch_last;
+   ULONG *batch_map;      // a bit for each line written in the update
+   ULONG *el_scratch;     // portal line attributes expanded for drawing
    ULONG el_count;
    ULONG el_limit;
    ULONG start_row;
@@ -407,11 +573,80 @@ typedef struct _CWFRAME
    FIELD_LIST *head;
    FIELD_LIST *tail;
    ULONG field_count;
+   FIELD_LIST **field_index;   // fields sorted by row, col
+   ULONG field_index_size;
+   ULONG memory;          // bytes held by this frame's buffers
 #if LINUX_UTIL
    pthread_mutex_t mutex;
+   pthread_mutex_t store_mutex;   // portal line writers
+   ULONG batch_thread;    // thread with an update open
+   CWLINE *el_lines;      // decoded lines in unicode mode
+   ULONG *wide_saved;     // p_wide under the frame
+   ULONG *xattr_saved;    // p_xattr under the frame
 #endif
 } CWFRAME;
 
+#if (LINUX_UTIL)
+// library performance counters.  cells_written counts cells stored
+// into the screen map, cells_emitted counts cells handed to ncurses
+// and tty_bytes counts bytes ncurses actually wrote to the terminal
+// while the overlay, slow link mode or set_stats_tty_bytes() is on.
+// Lock wait times only include acquisitions which had to block.
+
+typedef struct _CWSTATS
+{
+   LONGLONG cells_written;
+   LONGLONG cells_emitted;
+   LONGLONG tty_bytes;
+   LONGLONG refreshes;
+   LONGLONG vidmem_locks;
+   LONGLONG vidmem_contended;
+   LONGLONG vidmem_wait_ns;
+   LONGLONG frame_locks;
+   LONGLONG frame_contended;
+   LONGLONG frame_wait_ns;
+   LONGLONG render_ns;
+   LONGLONG render_max_ns;
+   LONGLONG last_render_ns;
+   LONGLONG color_pairs;      // extended color pairs in use
+   LONGLONG color_misses;     // pair cache misses
+   LONGLONG color_evictions;  // pairs reused for another color
+   LONGLONG frames_dropped;   // refreshes skipped on a slow link
+   LONGLONG portals_deferred; // background portal updates deferred
+   LONGLONG link_rate;        // measured drain rate, bytes/sec
+   LONGLONG link_queued;      // terminal output queue, bytes
+   LONGLONG keys_coalesced;   // repeated navigation keys drawn together
+   LONGLONG notes_posted;     // post_notification calls
+   LONGLONG notes_coalesced;  // notifications folded into a repeat count
+   LONGLONG notes_dropped;    // notifications lost to a full queue
+} CWSTATS;
+
+// key interaction latency, from get_key returning a key until the
+// next get_key call has refreshed the screen.  hist is log linear
+// with CW_LATENCY_SUB buckets per power of two nanoseconds.
+
+#define CW_LATENCY_SUB       8
+#define CW_LATENCY_BUCKETS   512
+
+typedef struct _CWLATENCY
+{
+   LONGLONG count;
+   LONGLONG total_ns;
+   LONGLONG min_ns;
+   LONGLONG max_ns;
+   LONGLONG hist[CW_LATENCY_BUCKETS];
+} CWLATENCY;
+
+// completion of an async dialog, see complete_future()
+typedef struct _CWFUTURE
+{
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   ULONG done;
+   ULONG result;
+} CWFUTURE;
+#endif
+
 extern ULONG bar_attribute;
 extern ULONG field_attribute;
 extern ULONG field_popup_highlight_attribute;
@@ -434,11 +669,52 @@ int install_screensaver(void (*ssfunc)(void));
 int uninstall_screensaver(void (*ssfunc)(void));
 ULONG set_screensaver_interval(ULONG seconds);
 void mvputc(ULONG row, ULONG col, const chtype ch);
+int register_flush_hook(void (*func)(NWSCREEN *, void *), void *context);
+int unregister_flush_hook(void (*func)(NWSCREEN *, void *), void *context);
+CW_INTERNAL ULONG copy_screen_map(NWSCREEN *screen, BYTE *dest);
+ULONG push_key(ULONG key);
+ULONG push_key_delay(ULONG key, ULONG delay_ms);
+ULONG push_key_sequence(const ULONG *keys, ULONG count, ULONG delay_ms);
+int key_queue_pending(void);
+int key_input_idle(void);
+ULONG get_key_latency(CWLATENCY *lat);
+void reset_key_latency(void);
+LONGLONG key_latency_percentile(CWLATENCY *lat, ULONG percent);
+ULONG start_key_script(const char *path);
+ULONG start_key_script_text(const char *text);
+ULONG wait_key_script(void);
+ULONG stop_key_script(void);
+ULONG start_console_server(const char *path, int port);
+ULONG stop_console_server(void);
+ULONG start_session_recording(const char *path);
+ULONG stop_session_recording(void);
+LONGLONG get_ns(void);
+ULONG get_cworthy_stats(CWSTATS *stats);
+void reset_cworthy_stats(void);
+ULONG get_frame_memory(ULONG num);
+void set_stats_overlay(ULONG on);
+ULONG get_stats_overlay(void);
+void set_stats_overlay_key(ULONG key);
+void set_stats_tty_bytes(ULONG on);
+ULONG set_slow_link(ULONG budget_ms);
+ULONG get_slow_link(void);
+CW_INTERNAL int defer_portal_update(ULONG num);
 #endif
 
 void copy_data(ULONG *src, ULONG *dest, ULONG len);
 void set_data(ULONG *dest, ULONG value, ULONG len);
 void set_data_b(BYTE *dest, BYTE value, ULONG len);
+CW_INTERNAL void cell_fill(BYTE *v, ULONG count, BYTE c, BYTE attr);
+CW_INTERNAL void cell_recolor(BYTE *v, ULONG count, BYTE attr);
+CW_INTERNAL void cell_copy(BYTE *dest, const BYTE *src, ULONG count);
+CW_INTERNAL ULONG cell_compare(const BYTE *a, const BYTE *b, ULONG count);
+CW_INTERNAL void cell_fill_rect(BYTE *v, ULONG stride, ULONG rows, ULONG cols,
+				BYTE c, BYTE attr);
+CW_INTERNAL void cell_recolor_rect(BYTE *v, ULONG stride, ULONG rows,
+				   ULONG cols, BYTE attr);
+CW_INTERNAL void cell_copy_rect(BYTE *dest, ULONG dest_stride,
+				const BYTE *src, ULONG src_stride,
+				ULONG rows, ULONG cols);
 void hard_xy(ULONG row, ULONG col);
 ULONG get_key(void);
 void set_xy(NWSCREEN *screen, ULONG row, ULONG col);
@@ -465,6 +741,8 @@ int get_char_attribute(NWSCREEN *screen, ULONG row, ULONG col);
 void put_char_cleol(NWSCREEN *screen, int c, ULONG line, ULONG attr);
 void put_char_length(NWSCREEN *screen, int c, ULONG row, ULONG col, ULONG attr,
 		     ULONG len);
+void put_attr_length(NWSCREEN *screen, ULONG row, ULONG col, ULONG attr,
+		     ULONG len);
 ULONG scroll_display(NWSCREEN *screen, ULONG row, ULONG col,
 		   ULONG cols, ULONG lines, ULONG up);
 void set_color(ULONG attr);
@@ -543,6 +821,11 @@ ULONG write_portal(ULONG num, const char *p, ULONG row, ULONG col, ULONG attr);
 ULONG write_portal_char(ULONG num, BYTE p, ULONG row, ULONG col, ULONG attr);
 ULONG write_portal_cleol(ULONG num, const char *p, ULONG row, ULONG col,
 			 ULONG attr);
+ULONG write_portal_lines(ULONG num, const PORTAL_LINE *lines, ULONG count);
+ULONG begin_portal_update(ULONG num);
+ULONG commit_portal_update(ULONG num);
+ULONG begin_portal_line(CWFMT *f, ULONG num, ULONG row, ULONG col);
+ULONG end_portal_line(CWFMT *f, ULONG attr);
 ULONG write_screen_comment_line(NWSCREEN *screen, const char *p, ULONG attr);
 ULONG disable_portal_input(ULONG num);
 ULONG enable_portal_input(ULONG num);
@@ -550,6 +833,24 @@ ULONG clear_portal(ULONG num);
 ULONG clear_portal_storage(ULONG num);
 ULONG error_portal(const char *p, ULONG row);
 ULONG confirm_menu(const char *confirm, ULONG row, ULONG attr);
+#if (LINUX_UTIL)
+ULONG error_portal_async(const char *p, ULONG row,
+			 void (*complete)(ULONG result, void *context),
+			 void *context);
+ULONG message_portal_async(const char *p, ULONG row, ULONG attr,
+			   void (*complete)(ULONG result, void *context),
+			   void *context);
+ULONG confirm_menu_async(const char *confirm, ULONG row, ULONG attr,
+			 void (*complete)(ULONG result, void *context),
+			 void *context);
+ULONG post_notification(const char *p, ULONG attr);
+ULONG set_notification_time(ULONG ms);
+void init_future(CWFUTURE *f);
+void complete_future(ULONG result, void *context);
+int future_done(CWFUTURE *f);
+ULONG wait_future(CWFUTURE *f);
+void free_future(CWFUTURE *f);
+#endif
 ULONG write_portal_line(ULONG num, ULONG row, ULONG attr);
 
 void enable_portal_focus(ULONG num, ULONG interval);
@@ -560,6 +861,21 @@ int get_sleep_count(ULONG num);
 int get_portal_focus(ULONG num);
 ULONG mask_portal(ULONG num);
 ULONG unmask_portal(ULONG num);
+ULONG portal_visible(ULONG num);
+#if (LINUX_UTIL)
+CW_INTERNAL void visibility_changed(void);
+ULONG wait_portal_visible(ULONG num, ULONG timeout_ms);
+ULONG register_portal_refresh(ULONG portal, ULONG interval_ms,
+			      ULONG (*callback)(ULONG portal, void *context),
+			      void *context);
+ULONG unregister_portal_refresh(ULONG portal);
+void stop_portal_refresh(void);
+CW_INTERNAL void portal_refresh_catch_up(void);
+ULONG attach_portal_stream(ULONG portal, int fd, ULONG attr);
+ULONG detach_portal_stream(ULONG portal);
+ULONG portal_stream_done(ULONG portal);
+void stop_portal_streams(void);
+#endif
 
 ULONG message_portal(const char *p, ULONG row, ULONG attr, ULONG wait);
 ULONG create_message_portal(const char *p, ULONG row, ULONG attr);
@@ -580,8 +896,39 @@ void set_unicode_mode(int mode);
 extern ULONG text_mode;
 extern ULONG mono_mode;
 extern ULONG unicode_mode;
+extern ULONG focus_frame;
 extern int has_color;
 
+#if (LINUX_UTIL)
+ULONG cw_wcwidth(ULONG cp);
+ULONG utf8_decode(const BYTE **s);
+int utf8_ascii(const char *s, ULONG len);
+ULONG utf8_layout(const char *s, CWGLYPH *g, ULONG max_cols, ULONG *cols);
+ULONG utf8_width(const char *s);
+
+ULONG fmt_decimal(char *p, unsigned long long v);
+ULONG fmt_grouped(char *p, unsigned long long v, char sep);
+void fmt_init(CWFMT *f, char *buf, ULONG size);
+ULONG fmt_chars(CWFMT *f, const char *s, ULONG len);
+ULONG fmt_str(CWFMT *f, const char *s);
+ULONG fmt_char(CWFMT *f, char c);
+ULONG fmt_pad(CWFMT *f, ULONG col);
+ULONG fmt_dec(CWFMT *f, unsigned long long v);
+ULONG fmt_group(CWFMT *f, unsigned long long v);
+ULONG fmt_hex(CWFMT *f, unsigned long long v, ULONG width);
+ULONG fmt_unit(CWFMT *f, unsigned long long v, ULONG flags,
+	       const char *unit);
+ULONG fmt_printf(CWFMT *f, const char *format, ...);
+
+extern CW_INTERNAL CWSTATS cw_stats;
+CW_INTERNAL void init_color_cache(void);
+CW_INTERNAL void release_color_cache(void);
+CW_INTERNAL void set_xattr_color(ULONG attr);
+CW_INTERNAL ULONG get_color_pair(ULONG attr);
+CW_INTERNAL BYTE xattr_fallback(ULONG attr);
+CW_INTERNAL BYTE xattr_pc_attr(ULONG attr);
+#endif
+
 #if WINDOWS_NT_UTIL
 int snprintff(char *buf, int size, const char *fmt, ...);
 #endif
@@ -601,5 +948,9 @@ ULONG add_field_to_portal(ULONG num, ULONG row, ULONG col, ULONG attr,
 			ULONG flags, int (*hide)(ULONG num, FIELD_LIST *fl),
                         void *priv);
 ULONG input_portal_fields(ULONG num);
+
+#if (LINUX_UTIL && defined(__GNUC__))
+#pragma GCC visibility pop
+#endif
 #endif
 
@@ -0,0 +1,231 @@
+/***************************************************************************
+*
+*   Copyright(c) Jeff V. Merkey 1997-2022.  All rights reserved.
+*   Open CWorthy Look Alike Terminal Library.
+*
+*   CWREPLAY session player.  Plays back a recording made with
+*   start_session_recording() at real time or at maximum speed.
+*
+*   backends
+*      curses  - redraw through the cworthy library (default)
+*      text    - decode, then print the final screen as plain text
+*      null    - decode only, useful for timing the decoder
+*
+****************************************************************************/
+
+#include "cworthy.h"
+#include "cworthy-record.h"
+
+#define BACKEND_CURSES   0
+#define BACKEND_TEXT     1
+#define BACKEND_NULL     2
+
+ULONG rows, cols;              // the recording's screen
+ULONG view_rows, view_cols;    // the part of it our terminal shows
+BYTE *screen_map;
+int backend = BACKEND_CURSES;
+
+// decode the frame following its time delta into screen_map, and draw
+// the cells which fit on our terminal
+
+int read_frame(FILE *f, ULONG *cells)
+{
+   ULONG crow, ccol, spans, row, col, len, run, i, j;
+   NWSCREEN *screen = get_console_screen();
+   BYTE text[4096], attr[4096];
+   int c;
+
+   if (!cwr_get_varint(f, &crow) || !cwr_get_varint(f, &ccol) ||
+       !cwr_get_varint(f, &spans))
+      return -1;
+
+   for (i=0; i < spans; i++)
+   {
+      if (!cwr_get_varint(f, &row) || !cwr_get_varint(f, &col) ||
+	  !cwr_get_varint(f, &len))
+	 return -1;
+      if (len > sizeof(text) || row >= rows || col + len > cols)
+	 return -1;
+      if (fread(text, 1, len, f) != len)
+	 return -1;
+
+      for (j=0; j < len; j += run)
+      {
+	 if (!cwr_get_varint(f, &run) || !run || j + run > len)
+	    return -1;
+	 c = getc(f);
+	 if (c == EOF)
+	    return -1;
+	 memset(&attr[j], c, run);
+      }
+
+      for (j=0; j < len; j++)
+      {
+	 screen_map[(row * cols + col + j) * 2] = text[j];
+	 screen_map[(row * cols + col + j) * 2 + 1] = attr[j];
+	 if (backend == BACKEND_CURSES && row < view_rows &&
+	     col + j < view_cols)
+	    put_char(screen, text[j], row, col + j, attr[j]);
+      }
+      *cells += len;
+   }
+
+   if (backend == BACKEND_CURSES && crow < view_rows && ccol < view_cols)
+      set_xy(screen, crow, ccol);
+   return 1;
+}
+
+void print_screen(void)
+{
+   ULONG row, col;
+   BYTE c;
+
+   for (row=0; row < rows; row++)
+   {
+      for (col=0; col < cols; col++)
+      {
+	 c = screen_map[(row * cols + col) * 2];
+	 putchar((c >= 0x20 && c < 0x7F) ? c : ' ');
+      }
+      putchar('\n');
+   }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = NULL;
+    int i, ccode = 0, max_speed = 0;
+    ULONG delta, cells = 0, frames = 0;
+    double speed = 1.0, elapsed;
+    struct timespec start, end, ts;
+    char magic[CWR_MAGIC_LEN];
+    FILE *f;
+
+    for (i=1; i < argc; i++)
+    {
+       if (!strcasecmp(argv[i], "-h") || !strcasecmp(argv[i], "-help"))
+       {
+          printf("USAGE:  cwreplay (max|speed=<n>|curses|text|null|"
+		 "mono) <file>\n");
+          printf("        max            - play back at maximum speed\n");
+          printf("        speed=<n>      - play back n times faster\n");
+          printf("        curses         - draw to the terminal (default)\n");
+          printf("        text           - print the final screen\n");
+          printf("        null           - decode only\n");
+          printf("        mono           - disable color mode\n");
+          exit(0);
+       }
+       else if (!strcasecmp(argv[i], "max"))
+          max_speed = 1;
+       else if (!strncasecmp(argv[i], "speed=", 6))
+          speed = atof(&argv[i][6]);
+       else if (!strcasecmp(argv[i], "curses"))
+          backend = BACKEND_CURSES;
+       else if (!strcasecmp(argv[i], "text"))
+          backend = BACKEND_TEXT;
+       else if (!strcasecmp(argv[i], "null"))
+          backend = BACKEND_NULL;
+       else if (!strcasecmp(argv[i], "mono"))
+          set_mono_mode(1);
+       else
+          path = argv[i];
+    }
+
+    if (!path)
+    {
+       printf("cwreplay:  no recording specified\n");
+       return 1;
+    }
+
+    f = fopen(path, "rb");
+    if (!f)
+    {
+       printf("cwreplay:  could not open %s\n", path);
+       return 1;
+    }
+
+    if (fread(magic, 1, CWR_MAGIC_LEN, f) != CWR_MAGIC_LEN ||
+	memcmp(magic, CWR_MAGIC, CWR_MAGIC_LEN) ||
+	!cwr_get_varint(f, &rows) || !cwr_get_varint(f, &cols) ||
+	!rows || !cols || rows > 1024 || cols > 4096)
+    {
+       printf("cwreplay:  %s is not a cworthy recording\n", path);
+       fclose(f);
+       return 1;
+    }
+
+    screen_map = (BYTE *)calloc(rows * cols, 2);
+    if (!screen_map)
+    {
+       fclose(f);
+       return 1;
+    }
+
+    if (backend == BACKEND_CURSES)
+    {
+       if (init_cworthy())
+       {
+	  fclose(f);
+	  return 1;
+       }
+       set_screensaver_interval(0x7FFFFFFF);
+       // a recording from a larger terminal is drawn clipped to ours
+       view_rows = rows;
+       view_cols = cols;
+       if (view_rows > (ULONG)get_screen_lines())
+	  view_rows = get_screen_lines();
+       if (view_cols > (ULONG)get_screen_cols())
+	  view_cols = get_screen_cols();
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (cwr_get_varint(f, &delta))
+    {
+       // each frame is shown delta after the one before it
+       if (backend == BACKEND_CURSES && !max_speed && delta && speed > 0)
+       {
+	  delta = (ULONG)(delta / speed);
+	  ts.tv_sec = delta / 1000000;
+	  ts.tv_nsec = (delta % 1000000) * 1000;
+	  nanosleep(&ts, NULL);
+       }
+
+       ccode = read_frame(f, &cells);
+       if (ccode < 0)
+	  break;
+       frames++;
+       if (backend != BACKEND_CURSES)
+	  continue;
+
+       // every frame goes through the render path, max included
+       refresh_screen();
+
+       // any key stops the playback
+       if (_kbhit())
+	  break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (backend == BACKEND_CURSES)
+    {
+       refresh_screen();
+       if (ccode >= 0 && !_kbhit())
+	  get_key();
+       release_cworthy();
+    }
+
+    if (backend == BACKEND_TEXT)
+       print_screen();
+
+    elapsed = (end.tv_sec - start.tv_sec) +
+	      (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+    printf("cwreplay:  %lu frames  %lu cells  %.3f seconds",
+	   frames, cells, elapsed);
+    if (elapsed > 0)
+       printf("  %.0f frames/sec", frames / elapsed);
+    printf("%s\n", ccode < 0 ? "  (truncated recording)" : "");
+
+    free(screen_map);
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,285 @@
+/***************************************************************************
+*
+*   Copyright(c) Jeff V. Merkey 1997-2022.  All rights reserved.
+*   Open CWorthy Look Alike Terminal Library.
+*
+*   CWVIEW shared console viewer.  Attaches to a cworthy application
+*   running a console server, displays its screen and optionally
+*   takes control of its keyboard.  Ctrl-] detaches the viewer and
+*   leaves the application running for the next viewer.
+*
+****************************************************************************/
+
+#include "cworthy.h"
+#include "cworthy-server.h"
+#include <poll.h>
+#include <sys/un.h>
+
+#define DETACH_KEY   0x1D   // Ctrl-]
+
+int sock = -1;
+int controller = 0;
+BYTE *msg = NULL;
+ULONG msg_size = 0;
+ULONG msg_len = 0;
+
+int connect_unix(const char *path)
+{
+   struct sockaddr_un addr;
+   int fd;
+
+   fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0)
+      return -1;
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+   if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+   {
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+int connect_tcp(int port)
+{
+   struct sockaddr_in addr;
+   int fd;
+
+   fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (fd < 0)
+      return -1;
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+   {
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+int send_message(BYTE type, BYTE *p, ULONG len)
+{
+   BYTE buf[CWS_MAX_CLIENT_MSG];
+
+   if (len > CWS_MAX_CLIENT_MSG - CWS_HDR_LEN)
+      return -1;
+
+   buf[0] = type;
+   cws_put32(&buf[1], len);
+   if (len)
+      memcpy(&buf[CWS_HDR_LEN], p, len);
+   if (send(sock, buf, CWS_HDR_LEN + len, MSG_NOSIGNAL) != (ssize_t)(CWS_HDR_LEN + len))
+      return -1;
+   return 0;
+}
+
+void draw_cells(ULONG row, ULONG col, BYTE *cells, ULONG count)
+{
+   NWSCREEN *screen = get_console_screen();
+   ULONG i;
+
+   if (row >= screen->nlines)
+      return;
+
+   for (i=0; i < count && (col + i) < screen->ncols; i++)
+      put_char(screen, cells[i * 2], row, col + i, cells[i * 2 + 1]);
+}
+
+int process_message(BYTE type, BYTE *p, ULONG len)
+{
+   ULONG rows, cols, row, spans, pos, i, count;
+
+   switch (type)
+   {
+      case CWS_MSG_FRAME:
+	 if (len < CWS_FRAME_HDR_LEN)
+	    return -1;
+	 rows = cws_get16(&p[0]);
+	 cols = cws_get16(&p[2]);
+	 if (len < CWS_FRAME_HDR_LEN + rows * cols * 2)
+	    return -1;
+	 for (row=0; row < rows; row++)
+	    draw_cells(row, 0, &p[CWS_FRAME_HDR_LEN + row * cols * 2], cols);
+	 set_xy(get_console_screen(), cws_get16(&p[4]), cws_get16(&p[6]));
+	 break;
+
+      case CWS_MSG_DIFF:
+	 if (len < CWS_DIFF_HDR_LEN)
+	    return -1;
+	 spans = cws_get32(&p[4]);
+	 pos = CWS_DIFF_HDR_LEN;
+	 for (i=0; i < spans; i++)
+	 {
+	    if (pos + CWS_SPAN_HDR_LEN > len)
+	       return -1;
+	    count = cws_get16(&p[pos + 4]);
+	    if (pos + CWS_SPAN_HDR_LEN + count * 2 > len)
+	       return -1;
+	    draw_cells(cws_get16(&p[pos]), cws_get16(&p[pos + 2]),
+		       &p[pos + CWS_SPAN_HDR_LEN], count);
+	    pos += CWS_SPAN_HDR_LEN + count * 2;
+	 }
+	 set_xy(get_console_screen(), cws_get16(&p[0]), cws_get16(&p[2]));
+	 break;
+
+      case CWS_MSG_CONTROL:
+	 if (len >= 1)
+	    controller = p[0] ? 1 : 0;
+	 break;
+
+      default:
+	 break;
+   }
+   return 0;
+}
+
+int read_server(void)
+{
+   ULONG len, pos;
+   ssize_t n;
+
+   if (msg_size - msg_len < 65536)
+   {
+      BYTE *p = (BYTE *)realloc(msg, msg_size + 65536);
+      if (!p)
+	 return -1;
+      msg = p;
+      msg_size += 65536;
+   }
+
+   n = recv(sock, &msg[msg_len], msg_size - msg_len, 0);
+   if (n <= 0)
+      return (n < 0 && errno == EINTR) ? 0 : -1;
+   msg_len += n;
+
+   pos = 0;
+   while (msg_len - pos >= CWS_HDR_LEN)
+   {
+      len = cws_get32(&msg[pos + 1]);
+      if (msg_len - pos < CWS_HDR_LEN + len)
+	 break;
+      if (process_message(msg[pos], &msg[pos + CWS_HDR_LEN], len))
+	 return -1;
+      pos += CWS_HDR_LEN + len;
+   }
+   if (pos)
+   {
+      memmove(msg, &msg[pos], msg_len - pos);
+      msg_len -= pos;
+   }
+   return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = CWS_DEFAULT_PATH;
+    int i, port = 0, control = 0;
+    struct pollfd pfd[2];
+    BYTE buf[4];
+    BYTE hello;
+    ULONG key;
+
+    for (i=1; i < argc; i++)
+    {
+       if (!strcasecmp(argv[i], "-h") || !strcasecmp(argv[i], "-help"))
+       {
+          printf("USAGE:  cwview [socket=<path>|port=<n>] "
+		 "(control|text|mono)\n");
+          printf("        socket=<path>  - server socket (default %s)\n",
+		 CWS_DEFAULT_PATH);
+          printf("        port=<n>       - attach over loopback TCP\n");
+          printf("        control        - take keyboard control\n");
+          printf("        text           - disable box line drawing\n");
+          printf("        mono           - disable color mode\n");
+          printf("        Ctrl-]         - detach from the server\n");
+          exit(0);
+       }
+
+       if (!strncasecmp(argv[i], "socket=", 7))
+          path = &argv[i][7];
+
+       if (!strncasecmp(argv[i], "port=", 5))
+          port = atoi(&argv[i][5]);
+
+       if (!strcasecmp(argv[i], "control"))
+          control = 1;
+
+       if (!strcasecmp(argv[i], "text"))
+          set_text_mode(1);
+
+       if (!strcasecmp(argv[i], "mono"))
+          set_mono_mode(1);
+    }
+
+    sock = port ? connect_tcp(port) : connect_unix(path);
+    if (sock < 0)
+    {
+       printf("cwview:  could not attach to %s\n", port ? "port" : path);
+       return 1;
+    }
+
+    hello = control ? CWS_HELLO_CONTROL : 0;
+    if (send_message(CWS_MSG_HELLO, &hello, 1))
+    {
+       close(sock);
+       return 1;
+    }
+
+    if (init_cworthy())
+    {
+       close(sock);
+       return 1;
+    }
+
+    // the screensaver runs on the server side
+    set_screensaver_interval(0x7FFFFFFF);
+
+    pfd[0].fd = sock;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = 0;
+    pfd[1].events = POLLIN;
+
+    for (;;)
+    {
+       if (poll(pfd, 2, -1) < 0)
+       {
+	  if (errno == EINTR)
+	     continue;
+	  break;
+       }
+
+       if (pfd[0].revents)
+       {
+	  if (read_server())
+	     break;
+	  refresh_screen();
+       }
+
+       if (pfd[1].revents & POLLIN)
+       {
+	  key = get_key();
+	  if (key == DETACH_KEY)
+	     break;
+	  if (controller && key)
+	  {
+	     cws_put32(buf, key);
+	     send_message(CWS_MSG_KEY, buf, 4);
+	  }
+       }
+    }
+
+    if (controller)
+       send_message(CWS_MSG_RELEASE, NULL, 0);
+    close(sock);
+    if (msg)
+       free(msg);
+    release_cworthy();
+    return 0;
+}
@@ -184,13 +184,7 @@ static int INET6_input(int type, char *bufp, struct sockaddr *sap)
 #define E_NOSUPP	         1
 
 int active = 0;
-int netsumactive = 0;
-int networkactive = 0;
 int menu, mainportal, logportal = -1;
-pthread_t pstat;
-pthread_t netsumstat;
-pthread_t networkstat;
-pthread_t plog;
 
 typedef struct _ARPTYPE
 {
@@ -407,36 +401,6 @@ ULONG warn_func(NWSCREEN *screen, ULONG index)
     return retCode;
 }
 
-char *comma_snprintf(char *buffer, int size, const char *format, ...)
-{
-    unsigned int len, i;
-    char buf[1024], *src, *dest;
-    size_t vsize = size > (1024 - 1)
-	           ? 1024 - 1 : size;
-    va_list ap;
-
-    va_start(ap, format);
-    len = vsnprintf((char *)buf, vsize, format, ap);
-    va_end(ap);
-
-    if (len)
-    {
-       src = buf + strlen((const char *)buf);
-       dest = buffer + vsize;
-       *dest = '\0';
-       for (i=0; (i < strlen((const char *)buf)) &&
-            (dest >= buffer) && (src >= buf); i++)
-       {
-          if (i && !(i % 3))
-             *--dest = ',';
-          *--dest = *--src;
-       }
-       return (char *)dest;
-    }
-    return (char *)"";
-}
-
-
 struct user_net_device_stats {
     unsigned long long rx_packets;	/* total packets received       */
     unsigned long long tx_packets;	/* total packets transmitted    */
@@ -533,6 +497,47 @@ int get_dev_fields(char *bp, struct user_net_device_stats *stats)
     return 0;
 }
 
+// a counter line is formatted straight into the portal line
+
+static void write_counter(int portal, int row, const char *label,
+			  unsigned long long v)
+{
+        CWFMT f;
+
+        if (begin_portal_line(&f, portal, row, 2))
+           return;
+        fmt_str(&f, label);
+        fmt_group(&f, v);
+        end_portal_line(&f, BRITEWHITE | BGBLUE);
+}
+
+static void write_bytes(int portal, int row, const char *label,
+			unsigned long long v)
+{
+        CWFMT f;
+
+        if (begin_portal_line(&f, portal, row, 2))
+           return;
+        fmt_str(&f, label);
+        fmt_group(&f, v);
+        fmt_str(&f, " (");
+        fmt_unit(&f, v, FMT_SI, "b");
+        fmt_str(&f, ") ");
+        end_portal_line(&f, BRITEWHITE | BGBLUE);
+}
+
+static void fmt_inet(CWFMT *f, struct sockaddr *sa)
+{
+        int i;
+
+        for (i = 2; i < 6; i++)
+        {
+           if (i > 2)
+              fmt_char(f, '.');
+           fmt_dec(f, clip(sa->sa_data[i]));
+        }
+}
+
 int if_getconfig(int skfd, int portal, char *ifname, int *pos, char *bp)
 {
 	struct ifreq ifr;
@@ -542,8 +547,8 @@ int if_getconfig(int skfd, int portal, char *ifname, int *pos, char *bp)
         FILE *f;
         char addr6[40], devname[20];
         struct sockaddr_in6 sap;
-        int plen, scope, dad_status, if_idx, fd, stats_valid;
-        char addr6p[8][5], *w;
+        int plen, scope, dad_status, if_idx, fd, stats_valid, i;
+        char addr6p[8][5];
 	int has_econet = 0, has_ddp = 0, has_ipx_bb = 0, has_ipx_sn = 0;
 	int has_ipx_e3 = 0, has_ipx_e2 = 0;
         struct sockaddr ipxaddr_bb;
@@ -555,12 +560,8 @@ int if_getconfig(int skfd, int portal, char *ifname, int *pos, char *bp)
         struct ifmap map;
         unsigned long can_compress = 0, tx_queue_len, keepalive = 0,
 		      outfill = 0;
-        unsigned long long rx, tx, short_rx, short_tx;
-        char rx_increment[5]="b";
-        char tx_increment[5]="b";
         char display_buffer[1024];
-        char format_buffer[1024];
-        char cat_buffer[1024];
+        CWFMT fb;
         struct user_net_device_stats ifstats;
 
         memset(&ifstats, 0, sizeof(struct user_net_device_stats));
@@ -658,18 +659,21 @@ int if_getconfig(int skfd, int portal, char *ifname, int *pos, char *bp)
         else
 	   memcpy(&map, &ifr.ifr_map, sizeof(struct ifmap));
 
-        display_buffer[0] = '\0';
-	snprintf(format_buffer, sizeof(format_buffer), "%s Link encap:%s  ",
-                ifname, get_arp_type(family));
-        strcat(display_buffer, format_buffer);
+        fmt_init(&fb, display_buffer, sizeof(display_buffer));
+        fmt_str(&fb, ifname);
+        fmt_str(&fb, " Link encap:");
+        fmt_str(&fb, get_arp_type(family));
+        fmt_str(&fb, "  ");
 
         if (hwaddr)
         {
-	  snprintf(format_buffer, sizeof(format_buffer),
-                  "HWaddr: %2.2x:%2.2x:%2.2x:%2.2x:%2.2x:%2.2x",
-	          hwaddr[0], hwaddr[1], hwaddr[2], hwaddr[3],
-                  hwaddr[4], hwaddr[5]);
-           strcat(display_buffer, format_buffer);
+           fmt_str(&fb, "HWaddr: ");
+           for (i = 0; i < 6; i++)
+           {
+              if (i)
+                 fmt_char(&fb, ':');
+              fmt_hex(&fb, hwaddr[i], 2);
+           }
         }
 
 	write_portal(portal, (const char *)display_buffer, row++, 2,
@@ -782,84 +786,70 @@ int if_getconfig(int skfd, int portal, char *ifname, int *pos, char *bp)
                         BRITEWHITE | BGBLUE);
         }
 
-        display_buffer[0] = '\0';
+        fmt_init(&fb, display_buffer, sizeof(display_buffer));
         if (flags == 0)
-	  strcat(display_buffer, ("[NO FLAGS] "));
+	  fmt_str(&fb, "[NO FLAGS] ");
         if (flags & IFF_UP)
-	  strcat(display_buffer, ("UP "));
+	  fmt_str(&fb, "UP ");
         if (flags & IFF_BROADCAST)
-	  strcat(display_buffer, ("BROADCAST "));
+	  fmt_str(&fb, "BROADCAST ");
         if (flags & IFF_DEBUG)
-	  strcat(display_buffer, ("DEBUG "));
+	  fmt_str(&fb, "DEBUG ");
         if (flags & IFF_LOOPBACK)
-	  strcat(display_buffer, ("LOOPBACK "));
+	  fmt_str(&fb, "LOOPBACK ");
         if (flags & IFF_POINTOPOINT)
-	  strcat(display_buffer, ("POINTOPOINT "));
+	  fmt_str(&fb, "POINTOPOINT ");
         if (flags & IFF_NOTRAILERS)
-	  strcat(display_buffer, ("NOTRAILERS "));
+	  fmt_str(&fb, "NOTRAILERS ");
         if (flags & IFF_RUNNING)
-	  strcat(display_buffer, ("RUNNING "));
+	  fmt_str(&fb, "RUNNING ");
         if (flags & IFF_NOARP)
-	  strcat(display_buffer, ("NOARP "));
+	  fmt_str(&fb, "NOARP ");
         if (flags & IFF_PROMISC)
-	  strcat(display_buffer, ("PROMISC "));
+	  fmt_str(&fb, "PROMISC ");
         if (flags & IFF_ALLMULTI)
-	  strcat(display_buffer, ("ALLMULTI "));
+	  fmt_str(&fb, "ALLMULTI ");
         if (flags & IFF_SLAVE)
-	  strcat(display_buffer, ("SLAVE "));
+	  fmt_str(&fb, "SLAVE ");
         if (flags & IFF_MASTER)
-	  strcat(display_buffer, ("MASTER "));
+	  fmt_str(&fb, "MASTER ");
         if (flags & IFF_MULTICAST)
-	  strcat(display_buffer, ("MULTICAST "));
+	  fmt_str(&fb, "MULTICAST ");
         if (flags & IFF_DYNAMIC)
-	  strcat(display_buffer, ("DYNAMIC "));
+	  fmt_str(&fb, "DYNAMIC ");
 
-        snprintf(format_buffer, sizeof(format_buffer),
-		 " MTU:%u  Metric:%u",
-		 mtu, metric ? metric : 1);
-	strcat(display_buffer, format_buffer);
+        fmt_str(&fb, " MTU:");
+        fmt_dec(&fb, (unsigned)mtu);
+        fmt_str(&fb, "  Metric:");
+        fmt_dec(&fb, (unsigned)(metric ? metric : 1));
 
         if (outfill || keepalive)
-        {
-           snprintf(format_buffer, sizeof(format_buffer),
-		    "  Outfill:%ld  Keepalive:%ld",
-		    outfill, keepalive);
-	   strcat(display_buffer, format_buffer);
-        }
+	   fmt_printf(&fb, "  Outfill:%ld  Keepalive:%ld", outfill, keepalive);
         write_portal(portal, (const char *)display_buffer, row++, 2,
                     BRITEWHITE | BGBLUE);
 
         if (has_ip)
         {
-           display_buffer[0] = '\0';
-           snprintf(format_buffer, sizeof(format_buffer),
-		    "inet addr:%u.%u.%u.%u  ",
-                  clip(ifaddr.sa_data[2]), clip(ifaddr.sa_data[3]),
-                  clip(ifaddr.sa_data[4]), clip(ifaddr.sa_data[5]));
-	   strcat(display_buffer, format_buffer);
+           fmt_init(&fb, display_buffer, sizeof(display_buffer));
+           fmt_str(&fb, "inet addr:");
+           fmt_inet(&fb, &ifaddr);
+           fmt_str(&fb, "  ");
 
 	   if (flags & IFF_POINTOPOINT)
            {
-              snprintf(format_buffer, sizeof(format_buffer),
-		       "P-t-P:%u.%u.%u.%u  ",
-                  clip(dstaddr.sa_data[2]), clip(dstaddr.sa_data[3]),
-                  clip(dstaddr.sa_data[4]), clip(dstaddr.sa_data[5]));
-	      strcat(display_buffer, format_buffer);
+              fmt_str(&fb, "P-t-P:");
+              fmt_inet(&fb, &dstaddr);
+              fmt_str(&fb, "  ");
 	   }
 
 	   if (flags & IFF_BROADCAST)
            {
-              snprintf(format_buffer, sizeof(format_buffer),
-		       "Bcast:%u.%u.%u.%u  ",
-                  clip(broadaddr.sa_data[2]), clip(broadaddr.sa_data[3]),
-                  clip(broadaddr.sa_data[4]), clip(broadaddr.sa_data[5]));
-	      strcat(display_buffer, format_buffer);
+              fmt_str(&fb, "Bcast:");
+              fmt_inet(&fb, &broadaddr);
+              fmt_str(&fb, "  ");
 	   }
-           snprintf(format_buffer, sizeof(format_buffer),
-		    "Mask:%u.%u.%u.%u",
-                  clip(netmask.sa_data[2]), clip(netmask.sa_data[3]),
-                  clip(netmask.sa_data[4]), clip(netmask.sa_data[5]));
-	   strcat(display_buffer, format_buffer);
+           fmt_str(&fb, "Mask:");
+           fmt_inet(&fb, &netmask);
 
            write_portal(portal, (const char *)display_buffer, row++, 2,
                         BRITEWHITE | BGBLUE);
@@ -875,44 +865,40 @@ int if_getconfig(int skfd, int portal, char *ifname, int *pos, char *bp)
            {
 	      if (!strcmp(devname, ifname))
               {
-                 display_buffer[0] = '\0';
 	         snprintf(addr6, sizeof(addr6), "%s:%s:%s:%s:%s:%s:%s:%s",
 			 addr6p[0], addr6p[1], addr6p[2], addr6p[3],
 			 addr6p[4], addr6p[5], addr6p[6], addr6p[7]);
 
 		 INET6_input(1, addr6, (struct sockaddr *) &sap);
-		 snprintf(format_buffer, sizeof(format_buffer),
-			  ("inet6 addr: %s/%d"),
-		       INET6_sprint((struct sockaddr *) &sap, 1), plen);
-	         strcat(display_buffer, format_buffer);
-
-		 snprintf(format_buffer, sizeof(format_buffer), (" Scope:"));
-	         strcat(display_buffer, format_buffer);
+                 fmt_init(&fb, display_buffer, sizeof(display_buffer));
+		 fmt_printf(&fb, "inet6 addr: %s/%d",
+			    INET6_sprint((struct sockaddr *) &sap, 1), plen);
+		 fmt_str(&fb, " Scope:");
 
 		 switch (scope)
                  {
 		     case 0:
-		        strcat(display_buffer, ("Global"));
+		        fmt_str(&fb, "Global");
 		        break;
 
 		     case IPV6_ADDR_LINKLOCAL:
-		        strcat(display_buffer, ("Link"));
+		        fmt_str(&fb, "Link");
 		        break;
 
 		     case IPV6_ADDR_SITELOCAL:
-		        strcat(display_buffer, ("Site"));
+		        fmt_str(&fb, "Site");
 		        break;
 
 		     case IPV6_ADDR_COMPATv4:
-		        strcat(display_buffer, ("Compat"));
+		        fmt_str(&fb, "Compat");
 		        break;
 
 		     case IPV6_ADDR_LOOPBACK:
-		        strcat(display_buffer, ("Host"));
+		        fmt_str(&fb, "Host");
 		        break;
 
 		     default:
-		        strcat(display_buffer, ("Unknown"));
+		        fmt_str(&fb, "Unknown");
 		  }
                   write_portal(portal, (const char *)display_buffer, row++, 2,
                                BRITEWHITE | BGBLUE);
@@ -923,238 +909,47 @@ int if_getconfig(int skfd, int portal, char *ifname, int *pos, char *bp)
 
         if (stats_valid)
         {
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%llu",
-			      ifstats.rx_packets);
-           snprintf(display_buffer, sizeof(display_buffer), "RX packets  :%s",
-		    w);
-           write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                     BRITEWHITE | BGBLUE);
-
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%lu",
-               ifstats.rx_errors);
-           snprintf(display_buffer, sizeof(display_buffer), "RX errors   :%s",
-		    w);
-           write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                     BRITEWHITE | BGBLUE);
-
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%lu",
-               ifstats.rx_dropped);
-           snprintf(display_buffer, sizeof(display_buffer), "RX dropped  :%s",
-		    w);
-           write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                     BRITEWHITE | BGBLUE);
-
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%lu",
-               ifstats.rx_fifo_errors);
-           snprintf(display_buffer, sizeof(display_buffer), "RX overruns :%s",
-		    w);
-           write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                     BRITEWHITE | BGBLUE);
-
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%lu",
-	       ifstats.rx_frame_errors);
-           snprintf(display_buffer, sizeof(display_buffer), "RX frame    :%s",
-		    w);
-           write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                     BRITEWHITE | BGBLUE);
-
-	   rx = ifstats.rx_bytes;
-	   tx = ifstats.tx_bytes;
-	   short_rx = rx * 10;
-	   short_tx = tx * 10;
-
-	   if (rx > 1000000000000000000)
-           {
-              short_rx /= 1000000000000000000;
-              strcpy(rx_increment, "Eb");
-           }
-	   else
-	   if (rx > 1000000000000000)
-           {
-              short_rx /= 1000000000000000;
-              strcpy(rx_increment, "Pb");
-           }
-	   else
-	   if (rx > 1000000000000)
-           {
-              short_rx /= 1000000000000;
-              strcpy(rx_increment, "Tb");
-           }
-	   else
-	   if (rx > 1000000000)
-           {
-              short_rx /= 1000000000;
-              strcpy(rx_increment, "Gb");
-           }
-	   else
-	   if (rx > 1000000)
-           {
-              short_rx /= 1000000;
-              strcpy(rx_increment, "Mb");
-           }
-	   else
-           if (rx > 1000)
-           {
-              short_rx /= 1000;
-              strcpy(rx_increment, "Kb");
-           }
-
-	   if (tx > 1000000000000000000)
-           {
-              short_tx /= 1000000000000000000;
-              strcpy(tx_increment, "Eb");
-           }
-	   else
-	   if (tx > 1000000000000000)
-           {
-              short_tx /= 1000000000000000;
-              strcpy(tx_increment, "Pb");
-           }
-	   else
-	   if (tx > 1000000000000)
-           {
-              short_tx /= 1000000000000;
-              strcpy(tx_increment, "Tb");
-           }
-	   else
-	   if (tx > 1000000000)
-           {
-              short_tx /= 1000000000;
-              strcpy(tx_increment, "Gb");
-           }
-	   else
-	   if (tx > 1000000)
-           {
-              short_tx /= 1000000;
-              strcpy(tx_increment, "Mb");
-           }
-	   else
-           if (tx > 1000)
-           {
-              short_tx /= 1000;
-              strcpy(tx_increment, "Kb");
-           }
-
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%llu",
-		    ifstats.tx_packets);
-           snprintf(display_buffer, sizeof(display_buffer), "TX packets  :%s",
-		    w);
-           write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                     BRITEWHITE | BGBLUE);
-
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%lu",
-		    ifstats.tx_errors);
-           snprintf(display_buffer, sizeof(display_buffer), "TX errors   :%s",
-		    w);
-           write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                     BRITEWHITE | BGBLUE);
-
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%lu",
-		    ifstats.tx_dropped);
-           snprintf(display_buffer, sizeof(display_buffer), "TX dropped  :%s",
-		    w);
-           write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                     BRITEWHITE | BGBLUE);
-
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%lu",
-		    ifstats.tx_fifo_errors);
-           snprintf(display_buffer, sizeof(display_buffer), "TX overruns :%s",
-		    w);
-           write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                     BRITEWHITE | BGBLUE);
-
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%lu",
-		    ifstats.tx_carrier_errors);
-           snprintf(display_buffer, sizeof(display_buffer), "TX carrier  :%s",
-		    w);
-           write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                     BRITEWHITE | BGBLUE);
-
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%lu",
-		    ifstats.collisions);
-           snprintf(display_buffer, sizeof(display_buffer), "collisions  :%s",
-		    w);
-           write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                        BRITEWHITE | BGBLUE);
+           write_counter(portal, row++, "RX packets  :", ifstats.rx_packets);
+           write_counter(portal, row++, "RX errors   :", ifstats.rx_errors);
+           write_counter(portal, row++, "RX dropped  :", ifstats.rx_dropped);
+           write_counter(portal, row++, "RX overruns :",
+			 ifstats.rx_fifo_errors);
+           write_counter(portal, row++, "RX frame    :",
+			 ifstats.rx_frame_errors);
+           write_counter(portal, row++, "TX packets  :", ifstats.tx_packets);
+           write_counter(portal, row++, "TX errors   :", ifstats.tx_errors);
+           write_counter(portal, row++, "TX dropped  :", ifstats.tx_dropped);
+           write_counter(portal, row++, "TX overruns :",
+			 ifstats.tx_fifo_errors);
+           write_counter(portal, row++, "TX carrier  :",
+			 ifstats.tx_carrier_errors);
+           write_counter(portal, row++, "collisions  :", ifstats.collisions);
 
 	   if (can_compress)
-           {
-	      w = comma_snprintf(format_buffer, sizeof(format_buffer), "%lu",
-		       ifstats.tx_compressed);
-           snprintf(display_buffer, sizeof(display_buffer), "compressed  :%s",
-		    w);
-           write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                           BRITEWHITE | BGBLUE);
-           }
+              write_counter(portal, row++, "compressed  :",
+			    ifstats.tx_compressed);
 
 	   if (tx_queue_len != (unsigned long)-1)
-           {
-	      w = comma_snprintf(format_buffer, sizeof(format_buffer), "%ld",
-		       tx_queue_len);
-              snprintf(display_buffer, sizeof(display_buffer),
-		       "txqueuelen  :%s", w);
-              write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                           BRITEWHITE | BGBLUE);
-           }
-
+              write_counter(portal, row++, "txqueuelen  :", tx_queue_len);
 
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%llu", rx);
-           snprintf(display_buffer, sizeof(display_buffer),
-		    "RX bytes    :%s", w);
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%llu",
-			      (unsigned long long)(short_rx / 10));
-           snprintf(cat_buffer, sizeof(cat_buffer), " (%s.%llu %s) ",
-		    w, (unsigned long long)(short_rx % 10), rx_increment);
-	   strcat(display_buffer, cat_buffer);
-
-	   write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                     BRITEWHITE | BGBLUE);
-
-	   w = comma_snprintf(format_buffer, sizeof(format_buffer), "%llu", tx);
-           snprintf(display_buffer, sizeof(display_buffer),
-		    "TX bytes    :%s", w);
-           w = comma_snprintf(format_buffer, sizeof(format_buffer), "%llu",
-		    (unsigned long long)(short_tx / 10));
-           snprintf(cat_buffer, sizeof(cat_buffer), " (%s.%llu %s) ",
-		     w, (unsigned long long)(short_tx % 10), tx_increment);
-	   strcat(display_buffer, cat_buffer);
-
-	   write_portal_cleol(portal, (const char *)display_buffer, row++, 2,
-                     BRITEWHITE | BGBLUE);
+           write_bytes(portal, row++, "RX bytes    :", ifstats.rx_bytes);
+           write_bytes(portal, row++, "TX bytes    :", ifstats.tx_bytes);
         }
 
         if ((map.irq || map.mem_start || map.dma || map.base_addr))
         {
-           display_buffer[0] = '\0';
+           fmt_init(&fb, display_buffer, sizeof(display_buffer));
 	   if (map.irq)
-           {
-	      snprintf(format_buffer, sizeof(format_buffer),
-		       ("Interrupt:%d "), map.irq);
-	      strcat(display_buffer, format_buffer);
-           }
+	      fmt_printf(&fb, "Interrupt:%d ", map.irq);
 
 	   if (map.base_addr >= 0x100)
-           {
-	      snprintf(format_buffer, sizeof(format_buffer),
-		       ("Base address:0x%x "),
-		       map.base_addr);
-	      strcat(display_buffer, format_buffer);
-           }
+	      fmt_printf(&fb, "Base address:0x%x ", map.base_addr);
 
 	   if (map.mem_start)
-           {
-	      snprintf(format_buffer, sizeof(format_buffer),
-		       ("Memory:%lx-%lx "), map.mem_start,
-		       map.mem_end);
-	      strcat(display_buffer, format_buffer);
-           }
+	      fmt_printf(&fb, "Memory:%lx-%lx ", map.mem_start, map.mem_end);
 
 	   if (map.dma)
-           {
-	      snprintf(format_buffer, sizeof(format_buffer),
-		       ("DMA chan:%x "), map.dma);
-	      strcat(display_buffer, format_buffer);
-           }
+	      fmt_printf(&fb, "DMA chan:%x ", map.dma);
            write_portal(portal, (const char *)display_buffer, row++, 2,
                         BRITEWHITE | BGBLUE);
         }
@@ -1237,16 +1032,14 @@ int display_network_summary(int portal, char *ifname)
 	char name[IFNAMSIZ], *s;
 
 	s = get_name(name, buf);
-        if (!ifname)
-        {
-           if_getconfig(skfd, portal, name, &pos, s);
-           write_portal_line(portal, pos++, BRITEWHITE | BGBLUE);
-        }
-        else
-        if (!strcasecmp(ifname, name))
+        // each interface block is drawn as one update so its
+        // counters never show up half refreshed
+        if (!ifname || !strcasecmp(ifname, name))
         {
+           begin_portal_update(portal);
            if_getconfig(skfd, portal, name, &pos, s);
            write_portal_line(portal, pos++, BRITEWHITE | BGBLUE);
+           commit_portal_update(portal);
         }
     }
     fclose(fp);
@@ -1259,60 +1052,17 @@ typedef struct nparam {
    char ifname[256];
 } NP;
 
-void *network_routine(void *p)
-{
-   NP *np = (NP *)p;
-   int portal = np ? np->portal : 0;
-   char *ifname = np ? np->ifname : NULL;
-   int state;
-
-   while (networkactive && p)
-   {
-       pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
-       display_network_summary(portal, ifname);
-       update_static_portal(portal);
-       pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
-       sleep(1);
-       if (!get_sleep_count(portal))
-          clear_portal_focus(portal);
-   }
-   return NULL;
-}
-
-void *network_summary_routine(void *p)
-{
-   int portal = p ? *(int *)p : 0;
-   int state;
-
-   while (netsumactive && p)
-   {
-       pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
-       display_network_summary(portal, NULL);
-       update_static_portal(portal);
-       pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
-       sleep(1);
-       if (!get_sleep_count(portal))
-          clear_portal_focus(portal);
-   }
-   return NULL;
-}
+// portal data provider run once a second by the library refresh
+// scheduler.  p is the interface to show or NULL for all of them.
 
-void *pstat_routine(void *p)
+ULONG network_refresh(ULONG portal, void *p)
 {
-   int portal = p ? *(int *)p : 0;
-   int state;
+   NP *np = (NP *)p;
 
-   while (active && p)
-   {
-       pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
-       display_network_summary(portal, NULL);
-       update_static_portal(portal);
-       pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
-       sleep(1);
-       if (!get_sleep_count(portal))
-          clear_portal_focus(portal);
-   }
-   return NULL;
+   display_network_summary(portal, np ? np->ifname : NULL);
+   if (!get_sleep_count(portal))
+      clear_portal_focus(portal);
+   return 0;
 }
 
 ULONG netmenuKeyboardHandler(NWSCREEN *screen, ULONG key, ULONG index, ULONG portal)
@@ -1376,17 +1126,14 @@ ULONG netmenuFunction(NWSCREEN *screen, ULONG value, BYTE *option,
           activate_static_portal(portal);
           update_static_portal(portal);
 
-          networkactive = TRUE;
           np.portal = portal;
           strcpy((char *)np.ifname, (const char *)option);
-          pthread_create(&networkstat, NULL, network_routine, &np);
+          register_portal_refresh(portal, 1000, network_refresh, &np);
 
           enable_portal_focus(portal, 5);
           get_portal_resp(portal);
 
-          networkactive = 0;
-          pthread_cancel(networkstat);
-          pthread_join(networkstat, NULL);
+          unregister_portal_refresh(portal);
 
           snprintf((char *)display_buffer, sizeof(display_buffer),
 		   "  F1-Help  F3-Exit  TAB-View Stats  "
@@ -1515,15 +1262,12 @@ ULONG menuFunction(NWSCREEN *screen, ULONG value, BYTE *option,
           activate_static_portal(portal);
           update_static_portal(portal);
 
-          netsumactive = TRUE;
-          pthread_create(&netsumstat, NULL, network_summary_routine, &portal);
+          register_portal_refresh(portal, 1000, network_refresh, NULL);
 
           enable_portal_focus(portal, 5);
           get_portal_resp(portal);
 
-          netsumactive = 0;
-          pthread_cancel(netsumstat);
-          pthread_join(netsumstat, NULL);
+          unregister_portal_refresh(portal);
 
           snprintf((char *)display_buffer, sizeof(display_buffer),
 		   "  F1-Help  F3-Exit  TAB-View Stats  "
@@ -1582,41 +1326,75 @@ ULONG menuFunction(NWSCREEN *screen, ULONG value, BYTE *option,
 }
 
 /*
-    trap stderr messages and dump them into a portal with a circular buffer
+    trap stderr messages and stream them into the message log portal
 */
 
-void *plog_routine(void *p)
+int stderr_backup = -1, logpipe[2] = { -1, -1 };
+
+void close_message_log(void)
 {
-   int stderr_backup, pipefd[2];
-   unsigned char display_buffer[4096];
-   unsigned char buf[4096];
-   unsigned long i = 0;
+   unsigned char display_buffer[256];
+
+   if (logportal != -1)
+   {
+      detach_portal_stream(logportal);
+      deactivate_static_portal(logportal);
+      free_portal(logportal);
+      logportal = -1;
+   }
 
-   if (pipe(pipefd) == -1)
+   // restore stderr and close the pipe, also after a partial open
+   if (stderr_backup != -1)
+   {
+      if (dup2(stderr_backup, STDERR_FILENO) == -1)
+      {
+	 snprintf((char *)display_buffer, sizeof(display_buffer),
+		  "ifcon:  could not restore stderr");
+	 error_portal_async((const char *)display_buffer,
+			    ((get_screen_lines() - 1) / 2), NULL, NULL);
+      }
+      close(stderr_backup);
+      stderr_backup = -1;
+   }
+   if (logpipe[0] != -1)
+      close(logpipe[0]);
+   if (logpipe[1] != -1)
+      close(logpipe[1]);
+   logpipe[0] = logpipe[1] = -1;
+}
+
+int open_message_log(void)
+{
+   unsigned char display_buffer[256];
+
+   if (pipe(logpipe) == -1)
    {
       snprintf((char *)display_buffer, sizeof(display_buffer),
 	       "ifcon:  could not open pipe");
-      error_portal((const char *)display_buffer,
-		     ((get_screen_lines() - 1) / 2));
-      return NULL;
+      error_portal_async((const char *)display_buffer,
+			 ((get_screen_lines() - 1) / 2), NULL, NULL);
+      logpipe[0] = logpipe[1] = -1;
+      return -1;
    }
 
    if ((stderr_backup = dup(STDERR_FILENO)) == -1)
    {
       snprintf((char *)display_buffer, sizeof(display_buffer),
 	       "ifcon:  could not dup stderr");
-      error_portal((const char *)display_buffer,
-		     ((get_screen_lines() - 1) / 2));
-      return NULL;
+      error_portal_async((const char *)display_buffer,
+			 ((get_screen_lines() - 1) / 2), NULL, NULL);
+      close_message_log();
+      return -1;
    }
 
-   if (dup2(pipefd[1], STDERR_FILENO) == -1)
+   if (dup2(logpipe[1], STDERR_FILENO) == -1)
    {
       snprintf((char *)display_buffer, sizeof(display_buffer),
 	       "ifcon:  could not dup2 stderr pipe");
-      error_portal((const char *)display_buffer,
-		     ((get_screen_lines() - 1) / 2));
-      return NULL;
+      error_portal_async((const char *)display_buffer,
+			 ((get_screen_lines() - 1) / 2), NULL, NULL);
+      close_message_log();
+      return -1;
    }
 
    logportal = make_portal(get_console_screen(),
@@ -1637,38 +1415,18 @@ void *plog_routine(void *p)
 		       NULL,
 		       TRUE);
    if (!logportal)
-      return NULL;
-
-   while (active)
    {
-      if (read(pipefd[0], buf, sizeof(buf)) == -1)
-         break;
-
-      buf[sizeof(buf)-1]='\0';
-      snprintf((char *)display_buffer, sizeof(display_buffer), "%s", buf);
-      write_portal_cleol(logportal, (const char *)display_buffer,
-                         (i++ % 1024), 1, BRITEWHITE | BGBLUE);
+      logportal = -1;
+      close_message_log();
+      return -1;
    }
 
-   if (logportal)
+   if (attach_portal_stream(logportal, logpipe[0], BRITEWHITE | BGBLUE))
    {
-      deactivate_static_portal(logportal);
-      free_portal(logportal);
+      close_message_log();
+      return -1;
    }
-
-   // close pipe and restore stderr
-   close(pipefd[0]);
-   close(pipefd[1]);
-
-   if (dup2(stderr_backup, STDERR_FILENO) == -1)
-   {
-      snprintf((char *)display_buffer, sizeof(display_buffer),
-	       "ifcon:  could not restore stderr");
-      error_portal((const char *)display_buffer,
-		     ((get_screen_lines() - 1) / 2));
-      return NULL;
-   }
-   return NULL;
+   return 0;
 }
 
 ULONG menuKeyboardHandler(NWSCREEN *screen, ULONG key, ULONG index, ULONG portal)
@@ -1722,15 +1480,23 @@ int main(int argc, char *argv[])
     BYTE display_buffer[1024];
     int plines, mlines, mlen = 0;
     struct utsname utsbuf;
+    const char *share_path = NULL, *record_path = NULL, *script_path = NULL;
+    int share_port = 0, sharing = 0, recording = 0, scripting = 0;
 
     for (i=0; i < argc; i++)
     {
        if (!strcasecmp(argv[i], "-h"))
        {
-          printf("USAGE:  ifcon (text|mono|unicode)\n");
+          printf("USAGE:  ifcon (text|mono|unicode|share=<path>|port=<n>|record=<file>|\n"
+		 "               script=<file>|slow[=<ms>])\n");
           printf("        text           - disable box line drawing\n");
           printf("        mono           - disable color mode\n");
           printf("        unicode        - enable unicode support\n");
+          printf("        share=<path>   - serve the screen to cwview\n");
+          printf("        port=<n>       - also serve on loopback TCP\n");
+          printf("        record=<file>  - record the session for cwreplay\n");
+          printf("        script=<file>  - feed keys from a key script\n");
+          printf("        slow[=<ms>]    - slow link mode, lag budget (250ms)\n");
           printf("        ifcon -h       - this help screen\n");
           printf("        ifcon -help    - this help screen\n");
           exit(0);
@@ -1738,10 +1504,16 @@ int main(int argc, char *argv[])
 
        if (!strcasecmp(argv[i], "-help"))
        {
-          printf("USAGE:  ifcon (text|mono|unicode)\n");
+          printf("USAGE:  ifcon (text|mono|unicode|share=<path>|port=<n>|record=<file>|\n"
+		 "               script=<file>|slow[=<ms>])\n");
           printf("        text           - disable box line drawing\n");
           printf("        mono           - disable color mode\n");
           printf("        unicode        - enable unicode support\n");
+          printf("        share=<path>   - serve the screen to cwview\n");
+          printf("        port=<n>       - also serve on loopback TCP\n");
+          printf("        record=<file>  - record the session for cwreplay\n");
+          printf("        script=<file>  - feed keys from a key script\n");
+          printf("        slow[=<ms>]    - slow link mode, lag budget (250ms)\n");
           printf("        ifcon -h       - this help screen\n");
           printf("        ifcon -help    - this help screen\n");
           exit(0);
@@ -1755,11 +1527,39 @@ int main(int argc, char *argv[])
 
        if (!strcasecmp(argv[i], "unicode"))
           set_unicode_mode(1);
+
+       if (!strncasecmp(argv[i], "share=", 6))
+          share_path = &argv[i][6];
+
+       if (!strncasecmp(argv[i], "port=", 5))
+          share_port = atoi(&argv[i][5]);
+
+       if (!strncasecmp(argv[i], "record=", 7))
+          record_path = &argv[i][7];
+
+       if (!strncasecmp(argv[i], "script=", 7))
+          script_path = &argv[i][7];
+
+       if (!strcasecmp(argv[i], "slow"))
+          set_slow_link(250);
+
+       if (!strncasecmp(argv[i], "slow=", 5))
+          set_slow_link(atoi(&argv[i][5]));
     }
 
     if (init_cworthy())
        return 0;
 
+    if ((share_path || share_port) &&
+        !start_console_server(share_path, share_port))
+       sharing = 1;
+
+    if (record_path && !start_session_recording(record_path))
+       recording = 1;
+
+    if (script_path && !start_key_script(script_path))
+       scripting = 1;
+
     // set ssi in seconds
     ssi = set_screensaver_interval(3 * 60);
 
@@ -1856,17 +1656,15 @@ int main(int argc, char *argv[])
     add_item_to_menu(menu, "Message Log", 3);
 
     active = TRUE;
-    pthread_create(&pstat, NULL, pstat_routine, &mainportal);
-    pthread_create(&plog, NULL, plog_routine, NULL);
+    register_portal_refresh(mainportal, 1000, network_refresh, NULL);
+    open_message_log();
 
     retCode = activate_menu(menu);
 
     active = 0;
 
-    pthread_cancel(pstat);
-    pthread_cancel(plog);
-    pthread_join(pstat, NULL);
-    pthread_join(plog, NULL);
+    unregister_portal_refresh(mainportal);
+    close_message_log();
 
 ErrorExit:;
     snprintf((char *)display_buffer, sizeof(display_buffer), " Exiting ... ");
@@ -1883,6 +1681,15 @@ ErrorExit:;
     if (menu)
        free_menu(menu);
 
+    if (scripting)
+       stop_key_script();
+
+    if (sharing)
+       stop_console_server();
+
+    if (recording)
+       stop_session_recording();
+
     set_screensaver_interval(ssi);
     release_cworthy();
     return retCode;
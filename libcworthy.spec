@@ -48,6 +48,8 @@ The %{name} package contains the Netware CWorthy libraries for Linux.
 %files
 %defattr(-,root,root)
 %{_bindir}/ifcon
+%{_bindir}/cwview
+%{_bindir}/cwreplay
 %{_includedir}/cworthy.h
 %{_libdir}/libcworthy.a
 %{_libdir}/libcworthy.so
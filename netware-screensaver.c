@@ -152,6 +152,10 @@ static int worm_kbhit(void)
    ioctl(STDIN, FIONREAD, &bytes);
    // set the terminal to default
    tcsetattr(STDIN, TCSANOW, &init);
+   // keys pushed from a console server controller also
+   // wake up the screen
+   if (!bytes)
+      bytes = key_queue_pending();
    return bytes;
 }
 